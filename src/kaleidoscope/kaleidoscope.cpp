@@ -17,7 +17,6 @@
 #include <map>
 #include <vector>
 #include "kscope.h"
-#include <deque>
 
 using namespace llvm;
 using namespace std;
@@ -318,21 +317,10 @@ static int getNextToken() {
   return CurTok = gettok();
 }
 
-/// BinopPrecedence - This holds the precedence for each binary operator that is
-/// defined.
+/// BinopPrecedence - This holds the precedence for each binary operator.  The
+/// grammar has a rule for each level, so a definition cannot change it.
 static std::map<char, int> BinopPrecedence;
 
-/// GetTokPrecedence - Get the precedence of the pending binary operator token.
-static int GetTokPrecedence(int ct) {
-  if (!isascii(ct))
-    return -1;
-  
-  // Make sure it's a declared binop.
-  int TokPrec = BinopPrecedence[ct];
-  if (TokPrec <= 0) return -1;
-  return TokPrec;
-}
-
 /// Error* - These are little helper functions for error handling.
 ExprAST *Error(const char *Str) { fprintf(stderr, "Error: %s\n", Str);return 0;}
 PrototypeAST *ErrorP(const char *Str) { Error(Str); return 0; }
@@ -500,102 +488,28 @@ static ExprAST *ParseUnary(kscope_syntax_node_t *root,void* data) {
   return 0;
 }
 
-/// binoprhs
-///   ::= ('+' unary)*
-static ExprAST *ParseBinOpRHS(int ExprPrec, ExprAST *LHS,kscope_syntax_node_t *root,void* data) {
-  // If this is a binop, find its precedence.
- // if (root->children == 0)
-//	  return LHS;
- // if (root->children < idx+2)
-//	  return 0;
-
-  if (root->children == 0) return LHS;
-
-  deque<int> Ops;
-  int Op;
-  int ct;
-  deque<ExprAST*> Unis;
-  ExprAST *Right,*Left;
-
-  Unis.push_back(LHS);
-  Right = ParseUnary(root->child[1],data);
-  Unis.push_back(Right);
-  
-
-  ct = kscope_get_str(root->child[0]->child[0])[0];
-
-  Ops.push_back(ct);
-
-  int idx = 2;
-  int ThisPrec,NextPrec;
-
-  ThisPrec = GetTokPrecedence(ct);
-  if (ThisPrec < 1) fprintf(stderr,"Operator precedence unexpectedly low!!!\n");
-
-  //Move forward through expression, consolidating terms when we can.
-  while (idx < root->children){
-    
-      ct = kscope_get_str(root->child[idx]->child[0])[0];
-      NextPrec = GetTokPrecedence(ct);
-        
-	  if (ThisPrec >= NextPrec){
-         int ThisOp = Ops.back();Ops.pop_back();
-		 while (Ops.size() && GetTokPrecedence(ThisOp) > GetTokPrecedence(Ops.back())) {
-    		 Right = Unis.back();Unis.pop_back();
-	    	 Left = Unis.back();Unis.pop_back();
-    		 Op = ThisOp;
-    		Left = new BinaryExprAST(Op,Left,Right);
-    	    Unis.push_back(Left);	
-			ThisOp = Ops.back();Ops.pop_back();
-		}
-		 Ops.push_back(ThisOp);
-	  }
-
-	  Ops.push_back(ct);
-	  Right = ParseUnary(root->child[idx+1],data);
-      Unis.push_back(Right);
-
-
-	  ThisPrec = NextPrec;
-      idx+=2;
-
-
-  }
-  //Consolidate the last term if necessary 
-  int ThisOp = Ops.back();Ops.pop_back();
-  while (Ops.size() && GetTokPrecedence(ThisOp) > GetTokPrecedence(Ops.back())) {
- 	 Right = Unis.back();Unis.pop_back();
-   	 Left = Unis.back();Unis.pop_back();
-	 Op = ThisOp;
-     Left = new BinaryExprAST(Op,Left,Right);
-     Unis.push_back(Left);	
-     ThisOp = Ops.back();Ops.pop_back();
-  }
-  Ops.push_back(ThisOp);
-  //There should only be top level terms left. Do them left to right.
-  while (Ops.size()){
-
-    Left = Unis.front();Unis.pop_front();
-    Right = Unis.front();Unis.pop_front();
-    Op = Ops.front();Ops.pop_front();
-    Left =  new BinaryExprAST(Op,Left,Right);
-    Unis.push_front(Left);
-  }
-  Right = Unis.front();
-  return Right;
-}
-
 /// expression
-///   ::= unary binoprhs
-///
+///   ::= expression ':' assignexpr
+///   ::= assignexpr
+/// and likewise down through '=', '<' '>', '+' '-' and '*' '/' to unary.  Each
+/// level is a left-recursive rule, so the tree already has the precedence.
 static ExprAST *ParseExpression(kscope_syntax_node_t *root,void* data) {
-  ExprAST *LHS = ParseUnary(root->child[0],data);
+  if (root->type == KSCOPE_UNARY_NODE)
+    return ParseUnary(root,data);
+
+  if (root->children == 1)
+    return ParseExpression(root->child[0],data);
+
+  ExprAST *LHS = ParseExpression(root->child[0],data);
   if (!LHS) {
 	  fprintf(stderr,"Error: ParseExpression LHS\n");
 	  return 0;
   }
-  
-  return ParseBinOpRHS(0, LHS,root->child[1],data);
+
+  ExprAST *RHS = ParseExpression(root->child[2],data);
+  if (!RHS) return 0;
+
+  return new BinaryExprAST(kscope_get_str(root->child[1])[0], LHS, RHS);
 }
 
 /// prototype
@@ -626,9 +540,10 @@ static PrototypeAST *ParsePrototype(kscope_syntax_node_t *root,void* data) {
     FnName += kscope_get_str(node->child[1]->child[0]);
     Kind = 2;
     
-    if (node->child[2]->type == KSCOPE_NUMBER_NODE){
-      BinaryPrecedence = (unsigned)strtod(kscope_get_str(node->child[2]->child[0]),NULL);
-    }
+    BinaryPrecedence = BinopPrecedence[FnName[6]];
+    if (node->child[2]->type == KSCOPE_NUMBER_NODE &&
+        (unsigned)strtod(kscope_get_str(node->child[2]->child[0]),NULL) != BinaryPrecedence)
+      return ErrorP("Binary operator precedence differs from the grammar's");
     break;
   }
   
@@ -1052,15 +967,6 @@ Function *FunctionAST::Codegen() {
     return 0;
   
    
-  // If this is an operator, install it.
-  if (Proto->isBinaryOp()){
-    BinopPrecedence[Proto->getOperatorName()] = Proto->getBinaryPrecedence();
-   /* std::map<char,int>::iterator it;
-    fprintf(stderr,"BinopPrecedence----\n");
-    for (it = BinopPrecedence.begin(); it != BinopPrecedence.end(); it++){
-	fprintf(stderr,"[%c]%d\n",(*it).first,(*it).second);    
-    }*/
-  }
   // Create a new basic block to start insertion into.
   BasicBlock *BB = BasicBlock::Create(getGlobalContext(), "entry", TheFunction);
   Builder.SetInsertPoint(BB);
@@ -1083,9 +989,6 @@ Function *FunctionAST::Codegen() {
   
   // Error reading body, remove function.
   TheFunction->eraseFromParent();
-
-  if (Proto->isBinaryOp())
-    BinopPrecedence.erase(Proto->getOperatorName());
   return 0;
 }
 
@@ -1136,17 +1039,22 @@ static void HandleTopLevelExpression(kscope_syntax_node_t *root,void* data) {
   }
 }
 
-/// top ::= definition | external | expression | ';'
-static void MainLoop(kscope_syntax_node_t *root,void* data) {
-  int cnt;
+void kscope_print_traverse(const kscope_flat_tree_t *tree, void *data);
 
-  kscope_syntax_node_t *node;
+/// Flat copy of the statement being handled; its storage is reused for every statement.
+static kscope_flat_tree_t *TopLevelTree;
 
-  for (cnt = 0; cnt < root->children;cnt++){
-	  node = root->child[cnt];
-	  if (node->children){
-	  //fprintf(stderr,"Node: %s!\n",kscope_node_names[node->child[0]->type]);
-      switch (node->child[0]->type) {
+/// top ::= definition | external | expression | ';'
+/// Called by the parser with each top-level node as soon as it is complete, so the
+/// first statement is compiled before the rest of the file is read. The node is
+/// freed when this returns.
+static int HandleTopLevel(kscope_syntax_node_t *node,void* data) {
+	  kscope_flatten(TopLevelTree,node);
+	  kscope_print_traverse(TopLevelTree,data);
+	  int first = TopLevelTree->nodes[0].first_child;
+	  if (first >= 0){
+	  //fprintf(stderr,"Node: %s!\n",kscope_node_names[TopLevelTree->nodes[first].type]);
+      switch (TopLevelTree->nodes[first].type) {
         case KSCOPE_DEFN_NODE:  HandleDefinition(node->child[0],data); break;
         case KSCOPE_EXTERN_NODE: HandleExtern(node->child[0],data); break;
         case KSCOPE_EXPR_NODE:   HandleTopLevelExpression(node->child[0],data); break;
@@ -1154,8 +1062,7 @@ static void MainLoop(kscope_syntax_node_t *root,void* data) {
 		default:; //fprintf(stderr,"Error: Unexpected top level node");
 	  }
 	  }
-  }
-  fprintf(stderr,"Done building!!!!!\n");
+  return 0;
 }
 
 int dump_node(kscope_syntax_node_t *node, void* data)
@@ -1171,29 +1078,37 @@ int dump_node(kscope_syntax_node_t *node, void* data)
 
 void* ib;
 int depth = 0;
-void kscope_print_traverse(kscope_syntax_node_t *root, void *data)
+static int print_flat_node(const kscope_flat_tree_t *tree, int idx, void *data)
 {
 	int cnt;
-    if (root)
-    {
-        kscope_syntax_node_t **cur;
-	
-	if (root->type < 1000){// KSCOPE_LEX_NODE){
+	const kscope_flat_node_t *node = tree->nodes + idx;
+
+	if (node->type < 1000){// KSCOPE_LEX_NODE){
         for (cnt = 0;cnt < depth; cnt++)
 			printf(".");
 
-        printf("%s #%d %d:%d",kscope_node_names[root->type],root->children,root->begin,root->end);
-	if (root->end - root->begin < 8) printf(" [%s]",kscope_get_str(root));
+        printf("%s #%d %d:%d",kscope_node_names[node->type],kscope_flat_children(tree,idx),node->begin,node->end);
+	if (node->end - node->begin < 8){
+		char *str = kscope_flat_get_str(tree,idx);
+		printf(" [%s]",str);
+		free(str);
+	}
 	printf("\n");}
-        if (root->child){
-			depth++;
-            for (cur = root->child; *cur; ++cur){
-                kscope_print_traverse(*cur, data);
-			}
-			depth--;
-		}
-    }
-} /* syntax_node_traverse_inorder() */
+	depth++;
+	return 0;
+}
+
+static int end_flat_node(const kscope_flat_tree_t *tree, int idx, void *data)
+{
+	depth--;
+	return 0;
+}
+
+/// Prints the statement by walking its flat copy, which is laid out in the order it is printed.
+void kscope_print_traverse(const kscope_flat_tree_t *tree, void *data)
+{
+	kscope_flat_traverse_preorder(tree,0,data,print_flat_node,end_flat_node);
+} /* print_traverse() */
 //===----------------------------------------------------------------------===//
 // "Library" functions that can be "extern'd" from user code.
 //===----------------------------------------------------------------------===//
@@ -1265,16 +1180,18 @@ int main(int argc, char** argv) {
   }
   else exit(1);
 	
-  kscope_syntax_node_t *root;
   void* error_list;  
 
-  // Install standard binary operators.
+  // The precedences of the expression rules in kscope.peg.
   // 1 is lowest precedence.
+  BinopPrecedence[':'] = 1;
   BinopPrecedence['='] = 2;
   BinopPrecedence['<'] = 10;
+  BinopPrecedence['>'] = 10;
   BinopPrecedence['+'] = 20;
   BinopPrecedence['-'] = 20;
   BinopPrecedence['*'] = 40;  // highest.
+  BinopPrecedence['/'] = 40;
 
  
   // Prime the first token.
@@ -1316,18 +1233,17 @@ int main(int argc, char** argv) {
   TheFPM = &OurFPM;
 
     // Run the main "interpreter loop" now.
-    // Parse file 
-	if (kscope_parse(input_file,&root,&ib,&error_list)){
-          kscope_print_traverse(root,ib);
+    // Stream the file so each statement is compiled and freed as soon as it is parsed
+	TopLevelTree = kscope_flat_tree_create();
+	if (kscope_parse_stream(input_file,HandleTopLevel,NULL,&ib,&error_list)){
 		printf("\n");
 	}
 	else{
 	        print_errors(error_list);
 	}
-
-  MainLoop(root,ib);
+  fprintf(stderr,"Done building!!!!!\n");
 	
-  kscope_syntax_node_destroy(root);
+  kscope_flat_tree_destroy(TopLevelTree);
   kscope_destroy_error_list(error_list);
   kscope_destroy_input_buffer(ib);
 
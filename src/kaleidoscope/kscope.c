@@ -1,10 +1,11 @@
 /*
- * generated Mon Mar 30 21:04:44 2009
+ * generated Sat Oct 17 22:44:50 2026
  */
 
 #include "kscope.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -12,7 +13,17 @@
 #include <string.h>
 #include <wchar.h>
 
-const char *kscope_node_names[49] = {
+#ifndef WIN32
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <windows.h>
+#endif
+
+const char *kscope_node_names[57] = {
 "KSCOPE_NULL_NODE",
 "KSCOPE_FILE_NODE",
 "KSCOPE_STATEMENT_NODE",
@@ -20,7 +31,10 @@ const char *kscope_node_names[49] = {
 "KSCOPE_EXTERN_NODE",
 "KSCOPE_PROTO_NODE",
 "KSCOPE_EXPR_NODE",
-"KSCOPE_BINOPRHS_NODE",
+"KSCOPE_ASSIGNEXPR_NODE",
+"KSCOPE_CMPEXPR_NODE",
+"KSCOPE_ADDEXPR_NODE",
+"KSCOPE_MULEXPR_NODE",
 "KSCOPE_UNARY_NODE",
 "KSCOPE_PRIMARY_NODE",
 "KSCOPE_VAREXPR_NODE",
@@ -36,6 +50,11 @@ const char *kscope_node_names[49] = {
 "KSCOPE_EQEXPR_NODE",
 "KSCOPE_OPERATOR_NODE",
 "KSCOPE_OPERATOR_STR_NODE",
+"KSCOPE_SEQOP_NODE",
+"KSCOPE_ASSIGNOP_NODE",
+"KSCOPE_CMPOP_NODE",
+"KSCOPE_ADDOP_NODE",
+"KSCOPE_MULOP_NODE",
 "KSCOPE_UNKNOWN_NODE",
 "KSCOPE_IDENTIFIER_NODE",
 "KSCOPE_IDENTIFIER_STR_NODE",
@@ -64,7 +83,15 @@ const char *kscope_node_names[49] = {
 "KSCOPE_EOF_NODE",
 };
 
-kscope_syntax_node_process_ft kscope_dispatch[49] = {
+kscope_syntax_node_process_ft kscope_dispatch[57] = {
+NULL,
+NULL,
+NULL,
+NULL,
+NULL,
+NULL,
+NULL,
+NULL,
 NULL,
 NULL,
 NULL,
@@ -116,7 +143,7 @@ NULL,
 NULL,
 };
 
-wchar_t *wcs_dup(wchar_t *str)
+static wchar_t *wcs_dup(wchar_t *str)
 {
     wchar_t *res;
     int len = (int) wcslen(str) + 1;
@@ -126,7 +153,7 @@ wchar_t *wcs_dup(wchar_t *str)
 
     return res;
 } /* wcs_dup() */
-char *str_dup(char *str)
+static char *str_dup(char *str)
 {
     char *res;
     int len = (int) strlen(str) + 1;
@@ -253,83 +280,389 @@ kscope_syntax_node_t *kscope_syntax_node_create(int type, int begin, int end,voi
     res->last_line  = -1;
     res->child = 0;
     res->children = 0;
+    res->refs = 1;
     res->ib = ib;
     return res;
 } /* syntax_node_create() */
 
+static kscope_syntax_node_t *syntax_node_copy_one(kscope_syntax_node_t *node)
+{
+    kscope_syntax_node_t *copy = kscope_syntax_node_create(node->type, node->begin, node->end, node->ib);
+
+    copy->first_line = node->first_line;
+    copy->last_line = node->last_line;
+    return copy;
+} /* syntax_node_copy_one() */
+
+/* the walks keep the path to the node they are at on a stack of frames, which starts out */
+/* on the C stack and only moves to the heap for trees deeper than that */
+#define WALK_LOCAL_FRAMES 64
+
+static void *walk_stack_grow(void *stack, void *local, int *cap, size_t frame_size)
+{
+    void *res;
+
+    if (stack == local)
+    {
+        res = malloc(*cap * 2 * frame_size);
+        memcpy(res, stack, *cap * frame_size);
+    }
+    else
+    {
+        res = realloc(stack, *cap * 2 * frame_size);
+    }
+
+    *cap *= 2;
+    return res;
+} /* walk_stack_grow() */
+
+typedef struct _copy_frame_t
+{
+    kscope_syntax_node_t *src, *dest;
+    int next;                   /* index of the next child to copy */
+}
+copy_frame_t;
+
+/* gives DEST room for as many children as SRC has */
+static void syntax_node_copy_children(kscope_syntax_node_t *dest, kscope_syntax_node_t *src)
+{
+    dest->child = (kscope_syntax_node_t **) calloc(src->children + 1, sizeof(kscope_syntax_node_t *));
+    dest->children = src->children;
+} /* syntax_node_copy_children() */
+
 kscope_syntax_node_t *kscope_syntax_node_copy(kscope_syntax_node_t *node)
 {
-    kscope_syntax_node_t *copy = 0, **cur;
-    int i, len;
+    copy_frame_t local[WALK_LOCAL_FRAMES], *stack = local;
+    kscope_syntax_node_t *copy, *src, *dest, *child;
+    int i = 0, num = 0, cap = WALK_LOCAL_FRAMES;
 
-    if (node)
+    if (!node)
+        return 0;
+
+    copy = syntax_node_copy_one(node);
+    if (!node->children)
+        return copy;
+
+    /* SRC and DEST are the node being copied and its copy, and the stack holds their ancestors; */
+    /* copies are allocated in pre-order, as the recursive copy allocated them */
+    syntax_node_copy_children(copy, node);
+    src = node;
+    dest = copy;
+
+    for (;;)
     {
-        copy = kscope_syntax_node_create(node->type, node->begin, node->end, node->ib);
-        copy->first_line = node->first_line;
-        copy->last_line = node->last_line;
+        if (i < src->children)
+        {
+            child = src->child[i];
+            dest->child[i++] = syntax_node_copy_one(child);
+            if (!child->children)
+                continue;
+
+            /* nothing is left to copy after a last child, so a chain nested in last children needs no frames */
+            if (i < src->children)
+            {
+                if (num == cap)
+                    stack = (copy_frame_t *) walk_stack_grow(stack, local, &cap, sizeof(copy_frame_t));
+                stack[num].src = src;
+                stack[num].dest = dest;
+                stack[num++].next = i;
+            }
 
-        len = node->children;
-        copy->children = node->children;
-        if (len)
+            dest = dest->child[i - 1];
+            src = child;
+            syntax_node_copy_children(dest, src);
+            i = 0;
+        }
+        else if (num)
+        {
+            --num;
+            src = stack[num].src;
+            dest = stack[num].dest;
+            i = stack[num].next;
+        }
+        else
         {
-            copy->child = (kscope_syntax_node_t **) calloc(len+1, sizeof(kscope_syntax_node_t *));
-            for (i = 0; i < len; ++i)
-                copy->child[i] = kscope_syntax_node_copy(node->child[i]);
+            break;
         }
     }
 
+    if (stack != local)
+        free(stack);
     return copy;
 } /* syntax_node_copy() */
 
 void kscope_syntax_node_destroy(kscope_syntax_node_t *node)
 {
-    kscope_syntax_node_t **cur;
+    kscope_syntax_node_t **cur, **work;
+    int num = 0, cap = 64;
 
     assert(node);
 
-    if (node->child)
-        for (cur = node->child; *cur; ++cur)
-            kscope_syntax_node_destroy(*cur);
+    /* nodes owned by an arena are released with the arena */
+    if (!node->refs || --node->refs > 0)
+        return;
+
+    /* nodes whose last reference has gone, but whose children have not been released yet */
+    work = (kscope_syntax_node_t **) malloc(cap * sizeof(kscope_syntax_node_t *));
+    work[num++] = node;
+
+    while (num)
+    {
+        node = work[--num];
+
+        if (node->child)
+        {
+            if (num + node->children > cap)
+            {
+                while (num + node->children > cap)
+                    cap *= 2;
+                work = (kscope_syntax_node_t **) realloc(work, cap * sizeof(kscope_syntax_node_t *));
+            }
+
+            /* pushed last to first, so nodes are freed in the order they were allocated */
+            for (cur = node->child + node->children - 1; cur >= node->child; --cur)
+                if ((*cur)->refs && --(*cur)->refs == 0)
+                    work[num++] = *cur;
+
+            free(node->child);
+        }
+
+        free(node);
+    }
 
-    free(node);
+    free(work);
 } /* syntax_node_destroy() */
 
+typedef struct _traverse_frame_t
+{
+    kscope_syntax_node_t *node;
+    int next, children;         /* index of the next child to visit, and the number there are */
+}
+traverse_frame_t;
+
+/* walks the subtrees of a tree deeper than WALK_LOCAL_FRAMES, where recursion would risk */
+/* overflowing the C stack */
+static void syntax_node_traverse_deep(kscope_syntax_node_t *root, void *data, kscope_syntax_node_process_ft entry_func, kscope_syntax_node_process_ft exit_func)
+{
+    traverse_frame_t local[WALK_LOCAL_FRAMES], *stack = local;
+    kscope_syntax_node_t *node = root, *child;
+    int i = 0, len, num = 0, cap = WALK_LOCAL_FRAMES;
+
+    if (!root)
+        return;
+    if (entry_func != NULL && entry_func(root, data))
+        return;
+    len = root->children;
+
+    /* NODE is the node being visited, and the stack holds its ancestors; leaves are left as */
+    /* soon as they are entered */
+    for (;;)
+    {
+        if (i < len)
+        {
+            child = node->child[i++];
+            if (entry_func != NULL && entry_func(child, data))
+                continue;
+
+            if (!child->children)
+            {
+                if (exit_func != NULL)
+                    exit_func(child, data);
+                continue;
+            }
+
+            if (num == cap)
+                stack = (traverse_frame_t *) walk_stack_grow(stack, local, &cap, sizeof(traverse_frame_t));
+            stack[num].node = node;
+            stack[num].next = i;
+            stack[num++].children = len;
+            node = child;
+            len = child->children;
+            i = 0;
+        }
+        else
+        {
+            if (exit_func != NULL)
+                exit_func(node, data);
+            if (!num)
+                break;
+
+            --num;
+            node = stack[num].node;
+            i = stack[num].next;
+            len = stack[num].children;
+        }
+    }
+
+    if (stack != local)
+        free(stack);
+} /* syntax_node_traverse_deep() */
+
+/* recursion is cheaper than the frames of syntax_node_traverse_deep() while the tree is */
+/* shallow, so the walk only changes over to those below WALK_LOCAL_FRAMES levels */
+static void syntax_node_traverse_shallow(kscope_syntax_node_t *node, void *data, kscope_syntax_node_process_ft entry_func, kscope_syntax_node_process_ft exit_func, int depth)
+{
+    int i;
+
+    if (entry_func != NULL && entry_func(node, data))
+        return;
+
+    for (i = 0; i < node->children; ++i)
+    {
+        if (depth < WALK_LOCAL_FRAMES)
+            syntax_node_traverse_shallow(node->child[i], data, entry_func, exit_func, depth + 1);
+        else
+            syntax_node_traverse_deep(node->child[i], data, entry_func, exit_func);
+    }
+
+    if (exit_func != NULL)
+        exit_func(node, data);
+} /* syntax_node_traverse_shallow() */
+
 void kscope_syntax_node_traverse_preorder(kscope_syntax_node_t *root, void *data, kscope_syntax_node_process_ft entry_func, kscope_syntax_node_process_ft exit_func)
 {
     if (root)
+        syntax_node_traverse_shallow(root, data, entry_func, exit_func, 0);
+} /* syntax_node_traverse_preorder() */
+
+/* arena allocation */
+
+#define ARENA_MIN_CHUNK_SIZE 65536
+#define ARENA_MAX_CHUNK_SIZE 4194304
+#define ARENA_ALIGN(n) (((n) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+typedef struct _arena_chunk_t
+{
+    struct _arena_chunk_t *next;
+}
+arena_chunk_t;
+
+struct _kscope_arena_t
+{
+    arena_chunk_t *chunks;     /* all chunks, newest first */
+    char *cur, *end;           /* free space in the newest chunk */
+    size_t chunk_size;         /* size of the next chunk to allocate */
+};
+
+kscope_arena_t *kscope_arena_create(void)
+{
+    kscope_arena_t *arena = (kscope_arena_t *) calloc(1, sizeof(kscope_arena_t));
+    arena->chunk_size = ARENA_MIN_CHUNK_SIZE;
+    return arena;
+} /* arena_create() */
+
+void kscope_arena_destroy(kscope_arena_t *arena)
+{
+    arena_chunk_t *chunk, *next;
+
+    if (!arena)
+        return;
+
+    for (chunk = arena->chunks; chunk; chunk = next)
+    {
+        next = chunk->next;
+        free(chunk);
+    }
+
+    free(arena);
+} /* arena_destroy() */
+
+static void *arena_alloc(kscope_arena_t *arena, size_t size)
+{
+    void *res;
+
+    size = ARENA_ALIGN(size);
+
+    if ((size_t) (arena->end - arena->cur) < size)
     {
-        kscope_syntax_node_t **cur;
-        if (entry_func != NULL)
-          if (entry_func(root, data))
-            return;
+        size_t header = ARENA_ALIGN(sizeof(arena_chunk_t));
+        size_t chunk_size = arena->chunk_size;
+        arena_chunk_t *chunk;
 
-        if (root->child)
-            for (cur = root->child; *cur; ++cur)
-                kscope_syntax_node_traverse_preorder(*cur, data, entry_func, exit_func);
-        if (exit_func != NULL)
-          exit_func(root,data);
+        while (chunk_size < size + header)
+            chunk_size *= 2;
+
+        chunk = (arena_chunk_t *) malloc(chunk_size);
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->cur = (char *) chunk + header;
+        arena->end = (char *) chunk + chunk_size;
+
+        if (arena->chunk_size < ARENA_MAX_CHUNK_SIZE)
+            arena->chunk_size *= 2;
     }
-} /* syntax_node_traverse_inorder() */
+
+    res = arena->cur;
+    arena->cur += size;
+    memset(res, 0, size);
+
+    return res;
+} /* arena_alloc() */
+
+static kscope_syntax_node_t *arena_node_create(kscope_arena_t *arena, int type, int begin, int end, void *ib)
+{
+    kscope_syntax_node_t *res;
+
+    if (!arena)
+        return kscope_syntax_node_create(type, begin, end, ib);
+
+    res = (kscope_syntax_node_t *) arena_alloc(arena, sizeof(kscope_syntax_node_t));
+    res->type  = type;
+    res->begin = begin;
+    res->end   = end;
+    res->first_line = -1;
+    res->last_line  = -1;
+    res->refs = 0;
+    res->ib = ib;
+    return res;
+} /* arena_node_create() */
+
+static kscope_syntax_node_t **arena_child_array(kscope_arena_t *arena, int len)
+{
+    if (!arena)
+        return (kscope_syntax_node_t **) calloc(len+1, sizeof(kscope_syntax_node_t *));
+
+    return (kscope_syntax_node_t **) arena_alloc(arena, (len+1) * sizeof(kscope_syntax_node_t *));
+} /* arena_child_array() */
 
 /* error handling functions */
 
+/* a parse only tracks its farthest failure; the message is formatted when it is asked for */
+typedef struct _error_list_t
+{
+    int fail_pos;              /* farthest offset at which a rule failed; -1 if none has */
+    int lookaheads;            /* negative lookaheads being parsed, whose failures are expected */
+    unsigned char expected[(KSCOPE_NUM_NODE_TYPES + 7) / 8]; /* the rules that failed at fail_pos */
+    int formatted;             /* set once the failure has been added to errors */
+    array_t errors;            /* records added by the caller, then the formatted failure */
+#ifdef KSCOPE_STATS
+    kscope_parse_stats_t stats;   /* copied from the memo map when the parse ends */
+#endif
+#ifdef KSCOPE_PROFILE
+    kscope_rule_profile_t profile[KSCOPE_NUM_NODE_TYPES]; /* likewise */
+#endif
+}
+error_list_t;
+
 void *kscope_create_error_list()
 {
-    array_t *ptr = (array_t *) calloc(1, sizeof(array_t));
-    array_init(ptr, sizeof(kscope_error_rec_t), 0);
-    return ptr;
+    error_list_t *errs = (error_list_t *) calloc(1, sizeof(error_list_t));
+    errs->fail_pos = -1;
+    array_init(&errs->errors, sizeof(kscope_error_rec_t), 0);
+    return errs;
 }
 
 void kscope_destroy_error_list(void *error_list)
 {
-    int i, len = array_size((array_t *) error_list);
+    error_list_t *errs = (error_list_t *) error_list;
+    int i, len = array_size(&errs->errors);
     for (i = 0; i < len; ++i)
     {
-        kscope_error_rec_t *er = (kscope_error_rec_t *) array_item((array_t *) error_list, i);
+        kscope_error_rec_t *er = (kscope_error_rec_t *) array_item(&errs->errors, i);
         free(er->str);
     }
-    array_deinit((array_t *) error_list);
-    free((array_t *) error_list);
+    array_deinit(&errs->errors);
+    free(errs);
 }
 
 void kscope_add_error(void *error_list, int pos, wchar_t *str)
@@ -337,55 +670,39 @@ void kscope_add_error(void *error_list, int pos, wchar_t *str)
     kscope_error_rec_t er;
     er.pos = pos;
     er.str = wcs_dup(str);
-    array_add((array_t *) error_list, &er);
-}
-
-int kscope_num_errors(void *error_list)
-{
-    return array_size((array_t *) error_list);
+    array_add(&((error_list_t *) error_list)->errors, &er);
 }
 
-kscope_error_rec_t *kscope_get_error(void *error_list, int index)
+/* notes that rule TYPE failed at POS; failures short of the farthest one are forgotten */
+static void record_failure(error_list_t *errs, int type, int pos)
 {
-    return (kscope_error_rec_t *) array_item((array_t *) error_list, index);
-}
+    if (pos < errs->fail_pos || errs->lookaheads)
+        return;
 
-static void delete_errors(array_t *errors, int start_index)
-{
-    int i, len = array_size(errors);
-    for (i = start_index; i < len; ++i)
+    if (pos > errs->fail_pos)
     {
-        kscope_error_rec_t *rec = (kscope_error_rec_t *) array_item(errors, i);
-        free(rec->str);
+        errs->fail_pos = pos;
+        memset(errs->expected, 0, sizeof(errs->expected));
     }
-    errors->num = start_index;
-}
-
-static void add_error(array_t *errs, int pos, wchar_t *str)
-{
-    kscope_error_rec_t rec;
-    rec.pos = pos;
-    rec.str = wcs_dup(str);
 
-    array_add(errs, &rec);
-} /* add_error() */
+    errs->expected[type >> 3] |= (unsigned char) (1 << (type & 7));
+} /* record_failure() */
 
-static void dump_errors(array_t *errs){
-int cnt,max;
-kscope_error_rec_t *this_error;
+static void clear_failure(error_list_t *errs)
+{
+    errs->fail_pos = -1;
+    memset(errs->expected, 0, sizeof(errs->expected));
+} /* clear_failure() */
 
-for (cnt = kscope_num_errors(errs)-1;cnt >= 0; cnt--){
-  this_error = kscope_get_error(errs,cnt);
-  printf("Error %d:%d %ls\n",cnt,this_error->pos,this_error->str);
-}
-}
-/*Debug dump of errors to stdout*/
 /* input buffers */
 
 enum input_buffer_flags_et
     {
         INPUT_BUFFER_NULL_FLAGS       = 0,
-        INPUT_BUFFER_UNICODE_BOM_READ = 1
+        INPUT_BUFFER_UNICODE_BOM_READ = 1,
+        INPUT_BUFFER_COMPLETE         = 2, /* the whole input is in buf; never read from f */
+        INPUT_BUFFER_MAPPED           = 4, /* buf is a read-only mapping of the file */
+        INPUT_BUFFER_BORROWED         = 8  /* buf belongs to the caller */
     };
 
     enum input_buffer_unicode_mode_et
@@ -406,6 +723,10 @@ enum input_buffer_flags_et
         int buf_size;
         int bytes_read;
         int current_pos;
+        int base;                  /* input offset of buf[0]; streaming discards the bytes before it */
+        array_t line_ends;         /* offsets just past each line ending indexed so far */
+        int lines_dropped;         /* line endings discarded from the front of line_ends */
+        int line_scan_pos;         /* the input before this offset has been indexed */
 
         unsigned int flags;
         int unicode_mode;
@@ -429,19 +750,119 @@ static input_buffer_t *input_buffer_create(char *name, FILE *f)
     ib = (input_buffer_t *) calloc(1, sizeof(input_buffer_t));
     ib->name = str_dup(name);
     ib->f = f;
+    array_init(&ib->line_ends, sizeof(int), 0);
 
     input_buffer_get_unicode_mode(ib);
 
     return ib;
 } /* input_buffer_create() */
 
+static input_buffer_t *input_buffer_create_mem(char *name, const char *data, size_t len)
+{
+    input_buffer_t *ib;
+
+    assert(data || !len);
+
+    if (len > INT_MAX)
+        return 0;
+
+    ib = (input_buffer_t *) calloc(1, sizeof(input_buffer_t));
+    ib->name = str_dup(name);
+    ib->buf = (char *) data;
+    ib->buf_size = ib->bytes_read = (int) len;
+    ib->flags = INPUT_BUFFER_COMPLETE | INPUT_BUFFER_BORROWED;
+    array_init(&ib->line_ends, sizeof(int), 0);
+
+    input_buffer_get_unicode_mode(ib);
+
+    return ib;
+} /* input_buffer_create_mem() */
+
+static input_buffer_t *input_buffer_create_mapped(char *name)
+{
+    input_buffer_t *ib;
+    size_t len;
+    char *data = 0;
+
+#ifdef WIN32
+    FILE *f;
+    long size;
+
+    /* no mmap; read the whole file with a single allocation instead */
+    if (!(f = fopen(name, "rb")))
+        return 0;
+
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    len = size > 0 ? (size_t) size : 0;
+    if (len > INT_MAX || !(data = (char *) malloc(len + 1)) || fread(data, 1, len, f) != len)
+    {
+        free(data);
+        fclose(f);
+        return 0;
+    }
+    fclose(f);
+
+    ib = input_buffer_create_mem(name, data, len);
+    ib->flags &= ~INPUT_BUFFER_BORROWED;
+#else
+    struct stat st;
+    int fd;
+
+    if ((fd = open(name, O_RDONLY)) < 0)
+        return 0;
+
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size > INT_MAX)
+    {
+        close(fd);
+        return 0;
+    }
+
+    len = (size_t) st.st_size;
+
+    /* empty files cannot be mapped, but parse just like an empty buffer */
+    if (len)
+    {
+        data = (char *) mmap(0, len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data == (char *) MAP_FAILED)
+        {
+            close(fd);
+            return 0;
+        }
+
+        madvise(data, len, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    ib = input_buffer_create_mem(name, data, len);
+    ib->flags &= ~INPUT_BUFFER_BORROWED;
+    if (len)
+        ib->flags |= INPUT_BUFFER_MAPPED;
+#endif
+
+    return ib;
+} /* input_buffer_create_mapped() */
+
 static void input_buffer_destroy(input_buffer_t *ib)
 {
     assert(ib);
 
-    fclose(ib->f);
+    if (ib->f)
+        fclose(ib->f);
+
+#ifndef WIN32
+    if (ib->flags & INPUT_BUFFER_MAPPED)
+        munmap(ib->buf, ib->buf_size);
+    else
+#endif
+    if (!(ib->flags & INPUT_BUFFER_BORROWED))
+        free(ib->buf);
+
+    array_deinit(&ib->line_ends);
     free(ib->name);
-    free(ib->buf);
     free(ib);
 } /* input_buffer_destroy() */
 
@@ -462,46 +883,92 @@ static int input_buffer_getpos(input_buffer_t *ib)
 
 #define INPUT_BUFFER_SIZE_INCREMENT 4096
 
-static wchar_t input_buffer_read_char(input_buffer_t *ib)
+/* address of the byte at input offset POS, which must still be in the buffer */
+#define input_buffer_at(ib, pos) ((ib)->buf + ((pos) - (ib)->base))
+
+typedef struct _char_class_t
 {
-    wchar_t ch;
-    int prev_pos, new_pos;
+    unsigned char bits[32];     /* membership of byte values 0..255 */
+    int num_ranges;             /* sorted [lo, hi] pairs for members above 255 */
+    const wchar_t *ranges;
+}
+char_class_t;
 
-    assert(ib);
-    
-    /* resize buffer if necessary, and read */
-    while (ib->current_pos >= ib->bytes_read)
+#define CHAR_CLASS_HAS_BYTE(cls, byte) (((cls)->bits[(unsigned char) (byte) >> 3] >> ((unsigned char) (byte) & 7)) & 1)
+
+static int input_buffer_fill(input_buffer_t *ib)
+{
+    size_t num_bytes_read;
+
+    if ((ib->flags & INPUT_BUFFER_COMPLETE) || !ib->f)
+        return 0;
+
+    /* grow geometrically so that reading a large file copies it a bounded number of times */
+    if (ib->bytes_read - ib->base == ib->buf_size)
     {
-        size_t num_bytes_read;
+        int new_size = ib->buf_size ? ib->buf_size * 2 : INPUT_BUFFER_SIZE_INCREMENT;
+        char *new_buf = (char *) realloc(ib->buf, new_size);
 
-        ib->buf = (char *) realloc(ib->buf, ib->buf_size += INPUT_BUFFER_SIZE_INCREMENT);
+        if (!new_buf)
+            return 0;
 
-        if (!ib->buf)
-        {
-            return WEOF;
-            ib->buf_size -= INPUT_BUFFER_SIZE_INCREMENT;
-        }
+        ib->buf = new_buf;
+        ib->buf_size = new_size;
+    }
 
-        num_bytes_read = fread(ib->buf + ib->bytes_read, 1, INPUT_BUFFER_SIZE_INCREMENT, ib->f);
+    num_bytes_read = fread(input_buffer_at(ib, ib->bytes_read), 1, ib->buf_size - (ib->bytes_read - ib->base), ib->f);
 
-        if (num_bytes_read)
-        {
-            ib->bytes_read += (int) num_bytes_read;
-        }
-        else
-        {
-            return WEOF;
-        }
+    if (!num_bytes_read)
+    {
+        ib->flags |= INPUT_BUFFER_COMPLETE;
+        return 0;
+    }
+
+    ib->bytes_read += (int) num_bytes_read;
+    return 1;
+} /* input_buffer_fill() */
+
+static int input_buffer_fill_to(input_buffer_t *ib, int end)
+{
+    while (ib->bytes_read < end)
+    {
+        if (!input_buffer_fill(ib))
+            return 0;
     }
 
-    /* get next code point and check for eol */
-    prev_pos = ib->current_pos;
+    return 1;
+} /* input_buffer_fill_to() */
+
+/* true if the bytes before END are in the buffer; only calls out when a read is needed */
+#define input_buffer_has(ib, end) ((end) <= (ib)->bytes_read || input_buffer_fill_to(ib, end))
+
+/* drops the bytes before POS from a buffer read from a file; the copy is only made once */
+/* it frees at least half the buffer, so each byte is moved a bounded number of times */
+static void input_buffer_drop_lines(input_buffer_t *ib, int pos);
+
+static void input_buffer_discard(input_buffer_t *ib, int pos)
+{
+    if (!ib->f || pos - ib->base < ib->buf_size / 2)
+        return;
 
-    ch = (wchar_t) ib->buf[ib->current_pos++]; /* just for now */
+    input_buffer_drop_lines(ib, pos);
+    memmove(ib->buf, input_buffer_at(ib, pos), ib->bytes_read - pos);
+    ib->base = pos;
+} /* input_buffer_discard() */
 
-    new_pos = ib->current_pos;
+static wchar_t input_buffer_read_char(input_buffer_t *ib)
+{
+    assert(ib);
+    
+    /* read more of the file if necessary */
+    while (ib->current_pos >= ib->bytes_read)
+    {
+        if (!input_buffer_fill(ib))
+            return WEOF;
+    }
 
-    return ch;
+    assert(ib->current_pos >= ib->base);
+    return (wchar_t) *input_buffer_at(ib, ib->current_pos++); /* just for now */
 } /* input_buffer_read_char() */
 
 static void input_buffer_read_wstring(input_buffer_t *ib, int begin, int end, array_t *str)
@@ -582,236 +1049,451 @@ void kscope_destroy_input_buffer(void *ib)
 
 typedef struct _memo_rec_t
 {
+    int type;                  /* node type of the record; zero marks an empty slot */
     int start_offset, end_offset;
+    int pass;                  /* for a seed: -1 while it grows, else the pass it is good for, or 0 for any */
     kscope_syntax_node_t *parse_tree;
 }
 memo_rec_t;
 
-typedef struct _memo_map_t
+/* a left-recursive rule growing its seed, on the stack of the call doing it */
+typedef struct _grow_frame_t
 {
-    array_t records[KSCOPE_NUM_NODE_TYPES]; /* a array_t of memo_rec_t structures */
+    int type, start_offset;
+    int pass;                  /* numbers the current pass among all those of the parse */
+    struct _grow_frame_t *outer;
 }
-memo_map_t;
+grow_frame_t;
 
-static memo_map_t *memo_map_create()
+/* parallel parsing: workers parse the start rule's top-level repetition from speculative boundaries */
+
+typedef struct _parallel_item_t
 {
-    int i;
-    memo_map_t *map;
-    
-    map = (memo_map_t *) calloc(1, sizeof(memo_map_t));
+    int begin, end;            /* one iteration of the repetition */
+    int first_child, num_children; /* its subtrees, in the chunk's children */
+}
+parallel_item_t;
 
-    for (i = 0; i < KSCOPE_NUM_NODE_TYPES; ++i)
-    {
-        array_init(&map->records[i], sizeof(memo_rec_t), 0);
-    }
+typedef struct _parallel_chunk_t
+{
+    int begin, end;            /* a worker parses items from begin until one reaches end */
+    array_t items;
+    array_t children;          /* the items' subtrees; those taken by the parse are set to null */
+    int next_item;             /* the first item not yet taken or passed over */
+    const kscope_parser_t *parser;
+    input_buffer_t *ib;        /* the buffer being parsed, which taken nodes are pointed back to */
+    input_buffer_t *worker_ib; /* the worker's reader of the same bytes, which its nodes point to */
+    int started;               /* set while a worker thread owns the chunk */
+#ifdef WIN32
+    HANDLE thread;
+#else
+    pthread_t thread;
+#endif
+}
+parallel_chunk_t;
 
-    return map;
-} /* memo_map_create() */
+typedef struct _parallel_parse_t
+{
+    parallel_chunk_t *chunks;  /* in input order */
+    int num_chunks;
+    int joined;                /* the chunks before this one are finished */
+    int cur;                   /* the chunk holding the next item to take */
+}
+parallel_parse_t;
 
-static void memo_map_destroy(memo_map_t *map)
+typedef struct _memo_map_t
 {
-    int i;
+    unsigned int num, cap;     /* cap is always a power of two */
+    memo_rec_t *records;       /* open-addressed table keyed by (type, start_offset) */
+    kscope_arena_t *arena;        /* allocator for the nodes of this parse; null for the heap */
+    int open_choices;          /* choice points that can still backtrack */
+    int commit_pos;            /* nothing before this offset will be parsed again */
+    int evict_pos;             /* records before this offset have been evicted */
+    grow_frame_t *growing;     /* the seeds being grown, innermost first */
+    int passes;                /* seed-growing passes begun so far */
+    unsigned char *scanned;    /* a bit per offset from scanned_base, set where the scanner has run */
+    int scanned_base, scanned_len; /* scanned_base is a multiple of 8, scanned_len counts bytes */
+    kscope_syntax_node_process_ft stream; /* receives the top-level subtrees when streaming */
+    void *stream_data;
+    const kscope_parser_t *parser; /* dispatch table and options */
+    input_buffer_t *node_ib;   /* the buffer nodes point to; a parallel worker's own until its nodes are taken */
+    parallel_parse_t *parallel; /* items parsed ahead by workers, when parsing in parallel */
+#ifdef KSCOPE_STATS
+    kscope_parse_stats_t stats;
+#endif
+#ifdef KSCOPE_PROFILE
+    kscope_rule_profile_t profile[KSCOPE_NUM_NODE_TYPES];
+    unsigned long long profile_children; /* cycles the current rule call has spent in the rules it called */
+    int profile_reach;         /* farthest end of a successful call inside the current one */
+#endif
+}
+memo_map_t;
 
-    assert(map);
+#ifdef KSCOPE_STATS
+#define PARSE_STAT(MAP, FIELD) ((MAP)->stats.FIELD++)
+#else
+#define PARSE_STAT(MAP, FIELD)
+#endif
 
-    for (i = 0; i < KSCOPE_NUM_NODE_TYPES; ++i)
-    {
-        int j, count = array_size(&map->records[i]);
-        for (j = 0; j < count; ++j)
-        {
-            memo_rec_t *mr = (memo_rec_t *) array_item(&map->records[i], j);
-            if (mr->parse_tree)
-                kscope_syntax_node_destroy(mr->parse_tree);
-        }
-        array_deinit(&map->records[i]);
-    }
+#ifdef KSCOPE_PROFILE
 
-    free(map);
-} /* memo_map_destroy() */
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
-static int is_memoized(memo_map_t *map, int type, int start_offset, kscope_syntax_node_t **res, int *end_offset)
+/* what a rule call saves of the call that made it */
+typedef struct _profile_frame_t
 {
-    int i, len;
-    array_t *da;
+    unsigned long long start;  /* clock when the call began */
+    unsigned long long children; /* the caller's cycles in the rules it called so far */
+    int reach;                 /* the caller's farthest end of a successful call */
+    int start_offset;
+}
+profile_frame_t;
 
-    assert(map);
-    assert(type < KSCOPE_NUM_NODE_TYPES);
+static unsigned long long profile_clock(void)
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    return __rdtsc();
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    unsigned int lo, hi;
+
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((unsigned long long) hi << 32) | lo;
+#elif defined(WIN32)
+    LARGE_INTEGER count, freq;
+
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (unsigned long long) (count.QuadPart * (1e9 / freq.QuadPart));
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+} /* profile_clock() */
+
+static void profile_enter(memo_map_t *map, profile_frame_t *frame, int start_offset)
+{
+    frame->children = map->profile_children;
+    frame->reach = map->profile_reach;
+    frame->start_offset = start_offset;
+    map->profile_children = 0;
+    map->profile_reach = start_offset;
+    frame->start = profile_clock();
+} /* profile_enter() */
+
+/* adds a call of rule TYPE to its counters and returns RES, what the call returned */
+static int profile_leave(memo_map_t *map, profile_frame_t *frame, int type, int res, int *end_offset)
+{
+    unsigned long long cycles = profile_clock() - frame->start;
+    kscope_rule_profile_t *rule = &map->profile[type];
 
-    da = &map->records[type];
-    len = array_size(da);
+    rule->calls++;
+    rule->cycles += cycles;
+    rule->self_cycles += cycles - map->profile_children;
+    map->profile_children = frame->children + cycles;
 
-    for (i = 0; i < len; ++i)
+    if (res)
     {
-        memo_rec_t *rec = (memo_rec_t *) array_item(da, i);
-
-        if (rec->start_offset == start_offset)
-        {
-            *res = kscope_syntax_node_copy(rec->parse_tree);
-            *end_offset = rec->end_offset;
-            return 1;
-        }
+        rule->successes++;
+        rule->consumed += *end_offset - frame->start_offset;
+        map->profile_reach = *end_offset > frame->reach ? *end_offset : frame->reach;
+    }
+    else
+    {
+        /* what the rules it called matched is thrown away with it */
+        rule->failures++;
+        rule->backtracked += map->profile_reach - frame->start_offset;
+        map->profile_reach = frame->reach;
     }
 
-    return 0;
-} /* is_memoized() */
+    return res;
+} /* profile_leave() */
 
-static void memoize(memo_map_t *map, int type, int start_offset, int end_offset, kscope_syntax_node_t *node)
-{
-    memo_rec_t rec;
+#endif
 
-    assert(map);
-    assert(type < KSCOPE_NUM_NODE_TYPES);
+#define MEMO_MAP_INITIAL_SIZE 1024
 
-    rec.start_offset = start_offset;
-    rec.end_offset = end_offset;
-    rec.parse_tree = kscope_syntax_node_copy(node);
+static unsigned int memo_hash(int type, int start_offset)
+{
+    unsigned int h = (unsigned int) start_offset * KSCOPE_NUM_NODE_TYPES + (unsigned int) type;
 
-    array_add(&map->records[type], &rec);
-} /* memoize() */
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
 
-static void delete_children(array_t *children, int start_index)
+    return h;
+} /* memo_hash() */
+
+static memo_map_t *memo_map_create(kscope_arena_t *arena)
 {
-    int i, len;
-    
-    assert(children);
+    memo_map_t *map;
     
-    len = array_size(children);
+    map = (memo_map_t *) calloc(1, sizeof(memo_map_t));
+    map->cap = MEMO_MAP_INITIAL_SIZE;
+    map->records = (memo_rec_t *) calloc(map->cap, sizeof(memo_rec_t));
+    map->arena = arena;
 
-    for (i = start_index; i < len; ++i)
+    return map;
+} /* memo_map_create() */
+
+static void memo_map_destroy(memo_map_t *map)
+{
+    unsigned int i;
+
+    assert(map);
+
+    for (i = 0; i < map->cap; ++i)
     {
-        kscope_syntax_node_t *child = *(kscope_syntax_node_t **) array_item(children, i);
-        kscope_syntax_node_destroy(child);
+        memo_rec_t *mr = &map->records[i];
+        if (mr->type && mr->parse_tree)
+            kscope_syntax_node_destroy(mr->parse_tree);
     }
 
-    children->num = start_index;
-} /* delete_children() */
+    free(map->records);
+    free(map->scanned);
+    free(map);
+} /* memo_map_destroy() */
+
+static memo_rec_t *memo_map_find_slot(memo_rec_t *records, unsigned int cap, int type, int start_offset)
+{
+    unsigned int mask = cap - 1;
+    unsigned int i = memo_hash(type, start_offset) & mask;
 
-static void find_line_endings(array_t *end_offsets, input_buffer_t *ib, int start_pos)
+    /* linear probing; stops at the matching record or the first empty slot */
+    while (records[i].type && (records[i].type != type || records[i].start_offset != start_offset))
+        i = (i + 1) & mask;
+
+    return &records[i];
+} /* memo_map_find_slot() */
+
+/* moves the records into a table of NEW_CAP slots, dropping those behind the commit point */
+static void memo_map_rehash(memo_map_t *map, unsigned int new_cap)
 {
-    wchar_t ch, eol_pos = 0;
-    int pos;
+    unsigned int i, old_cap = map->cap;
+    int drop;
+    memo_rec_t *old_records = map->records;
 
-    input_buffer_setpos(ib, start_pos);
+    map->cap = new_cap;
+    map->records = (memo_rec_t *) calloc(map->cap, sizeof(memo_rec_t));
 
-    do
+    for (i = 0; i < old_cap; ++i)
     {
-        ch = input_buffer_read_char(ib);
+        if (!old_records[i].type)
+            continue;
 
-        if (ch == L'\n')
-        {
-            pos = input_buffer_getpos(ib);
-            array_add(end_offsets, &pos);
-            eol_pos = 0;
-        }
-        else if (ch == L'\r')
+        if (old_records[i].start_offset < map->commit_pos)
         {
-            eol_pos = input_buffer_getpos(ib);
+            if (old_records[i].parse_tree)
+                kscope_syntax_node_destroy(old_records[i].parse_tree);
+            map->num--;
         }
         else
         {
-            if (eol_pos > 0)
-            {
-                pos = eol_pos;
-                array_add(end_offsets, &pos);
-            }
+            *memo_map_find_slot(map->records, map->cap, old_records[i].type, old_records[i].start_offset) = old_records[i];
+        }
+    }
+
+    map->evict_pos = map->commit_pos;
+    free(old_records);
 
-            eol_pos = 0;
+    /* the scanner will not run behind the commit point either */
+    if ((drop = (map->commit_pos - map->scanned_base) >> 3) > 0)
+    {
+        if (drop < map->scanned_len)
+        {
+            memmove(map->scanned, map->scanned + drop, map->scanned_len - drop);
+            memset(map->scanned + map->scanned_len - drop, 0, drop);
         }
+        else if (map->scanned)
+        {
+            memset(map->scanned, 0, map->scanned_len);
+        }
+        map->scanned_base += drop * 8;
     }
-    while (ch != WEOF);
+} /* memo_map_rehash() */
 
-    pos = input_buffer_getpos(ib);
-    array_add(end_offsets, &pos);
-} /* find_line_lengths() */
+/* called by CUT when no choice point is left open: the parse can no longer backtrack before POS */
+static void memo_map_commit(memo_map_t *map, int pos)
+{
+    if (pos > map->commit_pos)
+        map->commit_pos = pos;
+} /* memo_map_commit() */
 
-static int find_line(int pos, array_t *line_endings)
+static kscope_syntax_node_t *syntax_node_retain(kscope_syntax_node_t *node)
 {
-    int n, i, len = array_size(line_endings);
-    for (i = 0; i < len; ++i)
+    if (node && node->refs)
+        node->refs++;
+
+    return node;
+} /* syntax_node_retain() */
+
+static int is_memoized(memo_map_t *map, int type, int start_offset, kscope_syntax_node_t **res, int *end_offset)
+{
+    memo_rec_t *rec;
+
+    assert(map);
+    assert(type > 0 && type < KSCOPE_NUM_NODE_TYPES);
+
+    PARSE_STAT(map, memo_lookups);
+    rec = memo_map_find_slot(map->records, map->cap, type, start_offset);
+
+#ifdef KSCOPE_PROFILE
+    if (rec->type)
+        map->profile[type].memo_hits++;
+    else
+        map->profile[type].memo_misses++;
+#endif
+
+    if (rec->type)
     {
-        n = * (int *) array_item(line_endings, i);
-        if (pos < n)
-            return i+1;
+        PARSE_STAT(map, memo_hits);
+        *res = syntax_node_retain(rec->parse_tree);
+        *end_offset = rec->end_offset;
+        return 1;
     }
 
-    if (pos == n)
-        return len;
-    else
-        return -1;
-} /* find_line() */
+    return 0;
+} /* is_memoized() */
 
-static int assign_line_number(kscope_syntax_node_t *node, void *data)
+static void memoize(memo_map_t *map, int type, int start_offset, int end_offset, kscope_syntax_node_t *node)
 {
-    array_t *line_endings = (array_t *) data;
+    memo_rec_t *rec;
+
+    assert(map);
+    assert(type > 0 && type < KSCOPE_NUM_NODE_TYPES);
+
+    /* keep the load factor at or below one half, evicting committed records before growing */
+    if ((map->num + 1) * 2 > map->cap)
+    {
+        if (map->commit_pos > map->evict_pos)
+            memo_map_rehash(map, map->cap);
+        if (map->num * 4 > map->cap)
+            memo_map_rehash(map, map->cap * 2);
+    }
+
+    rec = memo_map_find_slot(map->records, map->cap, type, start_offset);
 
-    if (node->begin >= node->end)
+    if (rec->type)
     {
-        node->first_line = node->last_line = find_line(node->begin, line_endings);
+        if (rec->parse_tree)
+            kscope_syntax_node_destroy(rec->parse_tree);
     }
     else
     {
-        node->first_line = find_line(node->begin, line_endings);
-        node->last_line = find_line(node->end-1, line_endings);
+        map->num++;
+#ifdef KSCOPE_STATS
+        map->stats.memo_records++;
+        if (map->num > map->stats.memo_peak)
+            map->stats.memo_peak = map->num;
+#endif
     }
 
-    return 0;
-} /* assign_line_number() */
+    rec->type = type;
+    rec->start_offset = start_offset;
+    rec->end_offset = end_offset;
+    rec->pass = 0;
+    rec->parse_tree = syntax_node_retain(node);
+} /* memoize() */
+
+static void delete_children(array_t *children, int start_index)
+{
+    int i, len;
+    
+    assert(children);
+    
+    len = array_size(children);
+
+    for (i = start_index; i < len; ++i)
+    {
+        kscope_syntax_node_t *child = *(kscope_syntax_node_t **) array_item(children, i);
+        kscope_syntax_node_destroy(child);
+    }
 
-static void assign_line_numbers(input_buffer_t *ib, kscope_syntax_node_t *node, array_t *line_endings)
+    children->num = start_index;
+} /* delete_children() */
+
+/* hands the subtrees of one iteration of the streamed repetition to the callback, then releases */
+/* them along with the memo records and input behind POS; returns 0 if the callback stops the parse */
+static int stream_children(input_buffer_t *ib, memo_map_t *map, array_t *child_stack, int start_index, int pos)
 {
-    /* assign line numbers to the nodes */
-    kscope_syntax_node_traverse_preorder(node, line_endings, assign_line_number,NULL);
-} /* assign_line_numbers() */
+    int i, stop = 0;
+
+    for (i = start_index; i < array_size(child_stack) && !stop; ++i)
+    {
+        kscope_syntax_node_t *node = *(kscope_syntax_node_t **) array_item(child_stack, i);
+        stop = map->stream(node, map->stream_data);
+    }
+
+    delete_children(child_stack, start_index);
+    memo_map_commit(map, pos);
+    input_buffer_discard(ib, pos);
+
+    return !stop;
+} /* stream_children() */
+
 /* function prototypes */
 
-static int parse_kscope_file(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_statement(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_defn(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_extern(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_proto(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_expr(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_binoprhs(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_unary(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_primary(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_varexpr(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_forexpr(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_ifexpr(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_paren(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_idexpr(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_idproto(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_binproto(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_uniproto(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_protoarg(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_call(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_eqexpr(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_operator(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_operator_str(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_unknown(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_identifier(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_identifier_str(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_number(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_number_str(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_letter(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_lex(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_sep(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_opeql(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_op(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_cp(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_def_kw(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_extern_kw(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_if(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_then(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_else(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_for(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_in(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_binary_kw(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_unary_kw(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_var(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope__(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_ws(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_comment(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_whitespace(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
-static int parse_kscope_eof(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack);
+static int parse_kscope_file(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_statement(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_defn(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_extern(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_proto(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_expr(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_assignexpr(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_cmpexpr(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_addexpr(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_mulexpr(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_unary(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_primary(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_varexpr(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_forexpr(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_ifexpr(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_paren(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_idexpr(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_idproto(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_binproto(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_uniproto(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_protoarg(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_call(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_eqexpr(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_operator(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_operator_str(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_seqop(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_assignop(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_cmpop(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_addop(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_mulop(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_unknown(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_identifier(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_identifier_str(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_number(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_number_str(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_letter(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_lex(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_sep(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_opeql(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_op(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_cp(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_def_kw(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_extern_kw(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_if(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_then(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_else(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_for(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_in(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_binary_kw(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_unary_kw(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_var(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope__(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_ws(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_comment(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_whitespace(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
+static int parse_kscope_eof(input_buffer_t *ib, int start_offset, int *end_ofset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs);
 
 /* parsing macros */
 
@@ -833,17 +1515,22 @@ static int parse_kscope_eof(input_buffer_t *ib, int start_offset, int *end_ofset
                                             \
 }
 
+/* choice points count themselves open in the memo map until they are left or cut */
 #define DISJ(A, B)                          \
 {                                           \
     int orig_stack_size = child_stack.num;  \
     int orig_start_pos = cur_start_pos;     \
+    int cut = 0;                            \
                                             \
+    map->open_choices++;                    \
     A;                                      \
+    if (!cut)                               \
+        map->open_choices--;                \
                                             \
-    if (!res)                               \
+    if (!res && !cut)                       \
     {                                       \
-        delete_errors(error_stack, 0);      \
         cur_start_pos = orig_start_pos;     \
+        cut = 1;                            \
                                             \
         B;                                  \
     }                                       \
@@ -854,31 +1541,122 @@ static int parse_kscope_eof(input_buffer_t *ib, int start_offset, int *end_ofset
         delete_children(&child_stack, orig_stack_size);   \
 }
 
+/* an alternative that cannot start with the next byte fails without being called, recording */
+/* the rule failures the call would have */
+#define PREDICT(first, fails, A)            \
+{                                           \
+    if (input_buffer_has(ib, cur_start_pos + 1) \
+        && CHAR_CLASS_HAS_BYTE(&first, *input_buffer_at(ib, cur_start_pos))) \
+    {                                       \
+        A;                                  \
+    }                                       \
+    else                                    \
+    {                                       \
+        int wish = map->parser->wish_node;  \
+                                            \
+        record_failures(errs, fails, cur_start_pos); \
+        if (wish > 0 && wish < KSCOPE_NUM_NODE_TYPES && ((fails)[wish >> 3] >> (wish & 7)) & 1) \
+            dump_errors(errs);              \
+        res = 0;                            \
+    }                                       \
+}
+
+/* an iteration that fails part of the way through gives back what it consumed */
 #define STAR(A)                             \
 {                                           \
+    int cut, iter_start_pos;                \
                                             \
     do                                      \
     {                                       \
+        cut = 0;                            \
+        iter_start_pos = cur_start_pos;     \
+        map->open_choices++;                \
         A;                                  \
+        if (!cut)                           \
+            map->open_choices--;            \
                                             \
         if (res)                            \
             cur_start_pos = cur_end_pos;    \
     }                                       \
     while(res);                             \
-    res = 1;                                \
+    cur_start_pos = cur_end_pos = iter_start_pos; \
+    res = !cut;                             \
+}
+
+/* the top-level repetition of the start rule; when streaming, each iteration that leaves no */
+/* choice open can never be undone, so its subtrees are handed over and released at once; */
+/* when parsing in parallel, an iteration a worker has already parsed is taken as it is */
+#define STREAM_STAR(A)                      \
+{                                           \
+    int cut, iter_start_pos;                \
+                                            \
+    do                                      \
+    {                                       \
+        int orig_stack_size = child_stack.num; \
+                                            \
+        cut = 0;                            \
+        iter_start_pos = cur_start_pos;     \
+        if (map->parallel && parallel_take(map->parallel, cur_start_pos, &child_stack, &cur_end_pos)) \
+            res = 1;                        \
+        else                                \
+        {                                   \
+            map->open_choices++;            \
+            A;                              \
+            if (!cut)                       \
+                map->open_choices--;        \
+        }                                   \
+                                            \
+        if (res)                            \
+        {                                   \
+            cur_start_pos = cur_end_pos;    \
+            if (map->stream && !map->open_choices \
+                && !stream_children(ib, map, &child_stack, orig_stack_size, cur_start_pos)) \
+                res = 0, cut = 1;           \
+        }                                   \
+    }                                       \
+    while(res);                             \
+    cur_start_pos = cur_end_pos = iter_start_pos; \
+    res = !cut;                             \
+}
+
+/* one iteration of the streamed repetition on its own, for the parallel workers; */
+/* its subtrees go onto CHILDREN */
+#define PEG_ITEM(FUNCTION, EXP)             \
+static int FUNCTION(input_buffer_t *ib, int start_offset, int *end_offset, array_t *children, memo_map_t *map, error_list_t *errs) \
+{                                           \
+    int res = 0;                            \
+    int cur_start_pos = start_offset, cur_end_pos = start_offset; \
+    int cut = 0;                            \
+    array_t child_stack = *children;        \
+    int orig_stack_size = child_stack.num;  \
+                                            \
+    map->open_choices++;                    \
+    EXP;                                    \
+    if (!cut)                               \
+        map->open_choices--;                \
+                                            \
+    if (res)                                \
+        *end_offset = cur_end_pos;          \
+    else                                    \
+        delete_children(&child_stack, orig_stack_size); \
                                             \
-    delete_errors(error_stack, 0);          \
+    *children = child_stack;                \
+    return res;                             \
 }
 
 #define PLUS(A)                             \
 {                                           \
     int orig_stack_size = child_stack.num;  \
-    int count = 0;                          \
-    int error_stack_size = error_stack->num; \
+    int count = 0, cut, iter_start_pos;     \
                                             \
     do                                      \
     {                                       \
+        cut = 0;                            \
+        iter_start_pos = cur_start_pos;     \
+        map->open_choices++;                \
         A;                                  \
+        if (!cut)                           \
+            map->open_choices--;            \
                                             \
         if (res)                            \
         {                                   \
@@ -887,25 +1665,29 @@ static int parse_kscope_eof(input_buffer_t *ib, int start_offset, int *end_ofset
         }                                   \
     }                                       \
     while (res);                            \
-    res = count > 0;                        \
+    cur_start_pos = cur_end_pos = iter_start_pos; \
+    res = count > 0 && !cut;                \
                                             \
-    if (res)                                \
-        delete_errors(error_stack, error_stack_size); \
-    else                                    \
+    if (!res)                               \
         delete_children(&child_stack, orig_stack_size); \
 }
 
 #define QUES(A)                             \
 {                                           \
-    int error_stack_size = error_stack->num; \
+    int cut = 0;                            \
+    int orig_start_pos = cur_start_pos;     \
                                             \
+    map->open_choices++;                    \
     A;                                      \
+    if (!cut)                               \
+        map->open_choices--;                \
                                             \
     if (res)                                \
         cur_start_pos = cur_end_pos;        \
+    else                                    \
+        cur_start_pos = cur_end_pos = orig_start_pos; \
                                             \
-    res = 1;                                \
-    delete_errors(error_stack, error_stack_size); \
+    res = res || !cut;                      \
 }
 
 #define HIDE(A)                                     \
@@ -918,37 +1700,61 @@ static int parse_kscope_eof(input_buffer_t *ib, int start_offset, int *end_ofset
     cur_start_pos = cur_end_pos;                    \
 }
 
+/* lookaheads always backtrack, so a cut inside one never commits; */
+/* what fails inside a negative one was hoped to fail, and is not a syntax error */
 #define BANG(A)                             \
 {                                           \
     int orig_start_pos = cur_start_pos;     \
     int orig_stack_size = child_stack.num;  \
-    int orig_error_size = error_stack->num; \
+    int cut = 1;                            \
+    (void) cut;                             \
                                             \
+    map->open_choices++;                    \
+    errs->lookaheads++;                     \
     A;                                      \
+    errs->lookaheads--;                     \
+    map->open_choices--;                    \
                                             \
     res = !res;                             \
                                             \
     cur_start_pos = cur_end_pos = orig_start_pos;         \
                                             \
     delete_children(&child_stack, orig_stack_size); \
-    delete_errors(error_stack, orig_error_size); \
 }
 
 #define AMP(A)                              \
 {                                           \
     int orig_start_pos = cur_start_pos;     \
+    int cut = 1;                            \
+    (void) cut;                             \
                                             \
-                                            \
+    map->open_choices++;                    \
     A;                                      \
+    map->open_choices--;                    \
                                             \
     cur_start_pos = cur_end_pos = orig_start_pos;         \
                                             \
 }
 
+/* commits to the innermost choice of the rule; with no choice left open anywhere, */
+/* memo records behind the current offset can be evicted */
+#define CUT                                 \
+{                                           \
+    if (!cut)                               \
+    {                                       \
+        cut = 1;                            \
+        map->open_choices--;                \
+    }                                       \
+    if (!map->open_choices)                 \
+        memo_map_commit(map, cur_start_pos); \
+    cur_end_pos = cur_start_pos;            \
+    res = 1;                                \
+}
+
 #define T(func)                                                     \
 {                                                                   \
     kscope_syntax_node_t *child = 0;                                         \
-    if ((res = func(ib, cur_start_pos, &cur_end_pos, &child, map, error_stack))) \
+    if ((res = func(ib, cur_start_pos, &cur_end_pos, &child, map, errs))) \
     {                                                               \
         if (child)                                                  \
             array_add(&child_stack, &child);                        \
@@ -956,34 +1762,53 @@ static int parse_kscope_eof(input_buffer_t *ib, int start_offset, int *end_ofset
     }                                                               \
 }
 
-#define S(str)                                  \
-{                                               \
-    wchar_t ch, *ptr = str;                     \
-                                                \
-    input_buffer_setpos(ib, cur_start_pos);     \
-                                                \
-    for (res = 1; *ptr; ++ptr)                  \
-    {                                           \
-        ch = input_buffer_read_char(ib);        \
-        if (!(res = (ch == *ptr)))              \
-            break;                              \
-    }                                           \
-                                                \
-    if (res)                                    \
-        cur_start_pos = cur_end_pos = input_buffer_getpos(ib);  \
+/* repetitions of a single byte set are consumed in one call to a span kernel */
+#define SPAN_STAR(span)                                         \
+{                                                               \
+    cur_start_pos = cur_end_pos = input_buffer_span(ib, cur_start_pos, &span); \
+    res = 1;                                                    \
 }
 
-#define C(str)                                  \
-{                                               \
-    wchar_t ch, *ptr = str;                     \
-    input_buffer_setpos(ib, cur_start_pos);     \
-    ch = input_buffer_read_char(ib);            \
-    for (res = 0; *ptr; ++ptr)                  \
-    {                                           \
-        if ((res = (ch == *ptr)))               \
-            break;                              \
-    }                                           \
-    if (res)                                    \
+#define SPAN_PLUS(span)                                         \
+{                                                               \
+    int span_end = input_buffer_span(ib, cur_start_pos, &span); \
+    if ((res = span_end > cur_start_pos))                       \
+        cur_start_pos = cur_end_pos = span_end;                 \
+}
+
+/* literals are compared in place against the raw buffer, LEN bytes at once */
+#define S(str, len)                                             \
+{                                                               \
+    res = input_buffer_has(ib, cur_start_pos + (len))           \
+        && memcmp(input_buffer_at(ib, cur_start_pos), str, len) == 0; \
+    if (res)                                                    \
+        cur_start_pos = cur_end_pos = cur_start_pos + (len);    \
+}
+
+#define S1(c)                                                   \
+{                                                               \
+    res = input_buffer_has(ib, cur_start_pos + 1)               \
+        && (unsigned char) *input_buffer_at(ib, cur_start_pos) == (unsigned char) (c); \
+    if (res)                                                    \
+        cur_start_pos = cur_end_pos = cur_start_pos + 1;        \
+}
+
+/* character classes test one bit of their membership table per input byte */
+#define C(cls)                                                  \
+{                                                               \
+    res = input_buffer_has(ib, cur_start_pos + 1)               \
+        && CHAR_CLASS_HAS_BYTE(&cls, *input_buffer_at(ib, cur_start_pos)); \
+    if (res)                                                    \
+        cur_start_pos = cur_end_pos = cur_start_pos + 1;        \
+}
+
+/* classes with members above 255 also search their range list */
+#define CW(cls)                                                 \
+{                                                               \
+    wchar_t ch;                                                 \
+    input_buffer_setpos(ib, cur_start_pos);                     \
+    ch = input_buffer_read_char(ib);                            \
+    if ((res = char_class_match(&cls, ch)))                     \
         cur_start_pos = cur_end_pos = input_buffer_getpos(ib);  \
 }
 
@@ -996,17 +1821,38 @@ static int parse_kscope_eof(input_buffer_t *ib, int start_offset, int *end_ofset
         cur_start_pos = cur_end_pos = input_buffer_getpos(ib);  \
 }
 
-#define PEG_PARSE(FUNCTION, NODE_TYPE, NODE_NAME, EXP)                                                                 \
-static int FUNCTION(input_buffer_t *ib, int start_offset, int *end_offset, kscope_syntax_node_t **node, memo_map_t *map, array_t *error_stack) \
+#ifdef KSCOPE_PROFILE
+#define RULE_FUNCTION(FUNCTION, NODE_TYPE)                                                                   \
+static int FUNCTION##_body(input_buffer_t *ib, int start_offset, int *end_offset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs); \
+static int FUNCTION(input_buffer_t *ib, int start_offset, int *end_offset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs) \
+{                                                                                                           \
+    profile_frame_t frame;                                                                                  \
+    profile_enter(map, &frame, start_offset);                                                               \
+    return profile_leave(map, &frame, NODE_TYPE, FUNCTION##_body(ib, start_offset, end_offset, node, map, errs), end_offset); \
+}                                                                                                           \
+static int FUNCTION##_body(input_buffer_t *ib, int start_offset, int *end_offset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs)
+#else
+#define RULE_FUNCTION(FUNCTION, NODE_TYPE)                                                                   \
+static int FUNCTION(input_buffer_t *ib, int start_offset, int *end_offset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs)
+#endif
+
+#define PEG_PARSE(FUNCTION, NODE_TYPE, EXP)                                                                           \
+RULE_FUNCTION(FUNCTION, NODE_TYPE)                                                                          \
 {                                                                                                           \
     int res = 0;                                                                                            \
     int cur_start_pos = start_offset, cur_end_pos = start_offset;                                           \
+    int cut = 1; /* a cut outside any choice of this rule has nothing to commit to */                       \
+    (void) cut;                                                                                             \
                                                                                                             \
     array_t child_stack;                                                                                    \
     array_init(&child_stack, sizeof(kscope_syntax_node_t *), 0);                                               \
                                                                                                             \
-    if (is_memoized(map, NODE_TYPE, start_offset, node, end_offset))                                        \
+    if (memo_rule[NODE_TYPE] && is_memoized(map, NODE_TYPE, start_offset, node, end_offset))                \
+    {                                                                                                       \
+        if (!*node)                                                                                         \
+            record_failure(errs, NODE_TYPE, start_offset);                                                  \
         return *node != 0;                                                                                  \
+    }                                                                                                       \
                                                                                                             \
     EXP;                                                                                                    \
                                                                                                             \
@@ -1014,9 +1860,10 @@ static int FUNCTION(input_buffer_t *ib, int start_offset, int *end_offset, kscop
     {                                                                                                       \
         int i, len;                                                                                         \
         *end_offset = cur_end_pos;                                                                          \
-        *node = kscope_syntax_node_create(NODE_TYPE, start_offset, cur_end_pos, ib);                           \
+        *node = arena_node_create(map->arena, NODE_TYPE, start_offset, cur_end_pos, map->node_ib);         \
+        PARSE_STAT(map, nodes);                                                                             \
         len = array_size(&child_stack);                                                                     \
-        (*node)->child = (kscope_syntax_node_t **) calloc(len+1, sizeof(kscope_syntax_node_t *));                 \
+        (*node)->child = arena_child_array(map->arena, len);                                                \
                                                                                                             \
         for (i = 0; i < len; ++i)                                                                           \
         {                                                                                                   \
@@ -1025,162 +1872,1745 @@ static int FUNCTION(input_buffer_t *ib, int start_offset, int *end_offset, kscop
         (*node)->children = len;                                                                            \
         delete_children(&child_stack, len);                                                                 \
         array_deinit(&child_stack);                                                                         \
-        if (kscope_dispatch[NODE_TYPE] != NULL) (kscope_dispatch[NODE_TYPE])(*node,NULL);                         \
+        if (map->parser->dispatch[NODE_TYPE] != NULL) map->parser->dispatch[NODE_TYPE](*node, map->parser->data); \
         res = 1;                                                                                            \
     }                                                                                                       \
     else                                                                                                    \
     {                                                                                                       \
-        int len = (int) wcslen(NODE_NAME) + 64;                                                             \
-        wchar_t *buf = (wchar_t *) calloc(len, sizeof(wchar_t));                                            \
-        swprintf(buf, len, L"syntax error: expected %ls", NODE_NAME);                                    \
-        add_error(error_stack, start_offset, buf);                                                          \
-        if(kscope_wish_node == NODE_TYPE) dump_errors(error_stack);					     \
-        free(buf);                                                                                          \
+        record_failure(errs, NODE_TYPE, start_offset);                                                      \
+        PARSE_STAT(map, failures);                                                                          \
+        if (map->parser->wish_node == NODE_TYPE) dump_errors(errs);                                         \
         *node = 0;                                                                                          \
+        delete_children(&child_stack, 0);                                                                   \
+        array_deinit(&child_stack);                                                                         \
     }                                                                                                       \
                                                                                                             \
-    memoize(map, NODE_TYPE, start_offset, res ? *end_offset : start_offset, *node);                         \
+    if (memo_rule[NODE_TYPE])                                                                               \
+        memoize(map, NODE_TYPE, start_offset, res ? *end_offset : start_offset, *node);                     \
                                                                                                             \
     return res;                                                                                             \
 }
 
-/* parsing functions */
+/* a left-recursive rule: FUNCTION##_seed parses it once, and this grows the seed in its memo record */
+#define PEG_GROW(FUNCTION, NODE_TYPE)                                                                        \
+static int FUNCTION(input_buffer_t *ib, int start_offset, int *end_offset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs) \
+{                                                                                                           \
+    int res, end = start_offset;                                                                            \
+    kscope_syntax_node_t *seed;                                                                                \
+    grow_frame_t frame;                                                                                     \
+                                                                                                            \
+    if (seed_memoized(map, NODE_TYPE, start_offset, node, end_offset))                                      \
+    {                                                                                                       \
+        if (!*node)                                                                                         \
+            record_failure(errs, NODE_TYPE, start_offset);                                                  \
+        return *node != 0;                                                                                  \
+    }                                                                                                       \
+                                                                                                            \
+    grow_begin(map, &frame, NODE_TYPE, start_offset);                                                       \
+    do                                                                                                      \
+        res = FUNCTION##_seed(ib, start_offset, &end, &seed, map, errs);                                    \
+    while (grow_step(map, &frame, res, end, seed));                                                         \
+    return grow_end(map, &frame, end_offset, node);                                                         \
+}
+
+/* character classes */
+
+static const char_class_t char_class_0 = { { 0x00,0x00,0x00,0x00,0x00,0xac,0x00,0x74,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+static const char_class_t char_class_1 = { { 0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x04,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+static const char_class_t char_class_2 = { { 0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x20,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+static const char_class_t char_class_3 = { { 0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x50,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+static const char_class_t char_class_4 = { { 0x00,0x00,0x00,0x00,0x00,0x28,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+static const char_class_t char_class_5 = { { 0x00,0x00,0x00,0x00,0x00,0x84,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+static const char_class_t char_class_6 = { { 0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xfe,0xff,0xff,0x07,0xfe,0xff,0xff,0x07,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+static const char_class_t char_class_7 = { { 0x00,0x06,0x00,0x00,0x01,0x43,0xff,0x03,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+static const char_class_t char_class_8 = { { 0x00,0x06,0x00,0x00,0x01,0x00,0x00,0x08,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+
+/* the bytes predicted alternatives can start with, and the rule failures skipping them records */
+
+static const char_class_t first_set_0 = { { 0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x10,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+static const char_class_t first_set_1 = { { 0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x20,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+static const char_class_t first_set_2 = { { 0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xfe,0xff,0xff,0x07,0xfe,0xff,0xff,0x07,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+static const char_class_t first_set_3 = { { 0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x04,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+static const char_class_t first_set_4 = { { 0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x20,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+static const char_class_t first_set_5 = { { 0x00,0x00,0x00,0x00,0x00,0xed,0xff,0x77,0xfe,0xff,0xff,0x07,0xfe,0xff,0xff,0x07,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+static const char_class_t first_set_6 = { { 0x00,0x00,0x00,0x00,0x00,0x41,0xff,0x03,0xfe,0xff,0xff,0x07,0xfe,0xff,0xff,0x07,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+static const char_class_t first_set_7 = { { 0x00,0x00,0x00,0x00,0x00,0xac,0x00,0x74,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+static const char_class_t first_set_8 = { { 0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x40,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+static const char_class_t first_set_9 = { { 0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x40,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+static const char_class_t first_set_10 = { { 0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x02,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+static const char_class_t first_set_11 = { { 0x00,0x00,0x00,0x00,0x00,0x01,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+static const char_class_t first_set_12 = { { 0x00,0x00,0x00,0x00,0x00,0x40,0xff,0x03,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+static const char_class_t first_set_13 = { { 0x00,0x06,0x00,0x00,0x01,0x00,0x00,0x08,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+static const char_class_t first_set_14 = { { 0x00,0x00,0x00,0x00,0x08,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 0, NULL };
+
+static const unsigned char fail_set_0[] = { 0x08,0x00,0x00,0x00,0x00,0x04,0x00,0x00 };
+static const unsigned char fail_set_1[] = { 0x10,0x00,0x00,0x00,0x00,0x08,0x00,0x00 };
+static const unsigned char fail_set_2[] = { 0x00,0x00,0x04,0x00,0x03,0x00,0x00,0x00 };
+static const unsigned char fail_set_3[] = { 0x00,0x00,0x08,0x00,0x00,0x00,0x02,0x00 };
+static const unsigned char fail_set_4[] = { 0x00,0x00,0x10,0x00,0x00,0x00,0x04,0x00 };
+static const unsigned char fail_set_5[] = { 0x00,0xf8,0x03,0x03,0x0f,0x91,0x08,0x00 };
+static const unsigned char fail_set_6[] = { 0x00,0xf0,0x03,0x00,0x0f,0x91,0x08,0x00 };
+static const unsigned char fail_set_7[] = { 0x00,0x00,0x00,0x03,0x00,0x00,0x00,0x00 };
+static const unsigned char fail_set_8[] = { 0x00,0x20,0x00,0x00,0x00,0x00,0x08,0x00 };
+static const unsigned char fail_set_9[] = { 0x00,0x40,0x00,0x00,0x00,0x80,0x00,0x00 };
+static const unsigned char fail_set_10[] = { 0x00,0x80,0x00,0x00,0x00,0x10,0x00,0x00 };
+static const unsigned char fail_set_11[] = { 0x00,0x00,0x01,0x00,0x00,0x01,0x00,0x00 };
+static const unsigned char fail_set_12[] = { 0x00,0x00,0x02,0x00,0x03,0x00,0x00,0x00 };
+static const unsigned char fail_set_13[] = { 0x00,0x00,0x00,0x00,0x0c,0x00,0x00,0x00 };
+static const unsigned char fail_set_14[] = { 0x00,0x00,0x00,0x00,0x00,0x00,0x80,0x00 };
+static const unsigned char fail_set_15[] = { 0x00,0x00,0x00,0x00,0x00,0x00,0x40,0x00 };
+
+/* notes that every rule in the set TYPES failed at POS */
+static void record_failures(error_list_t *errs, const unsigned char *types, int pos)
+{
+    int i;
 
-PEG_PARSE(parse_kscope_file, KSCOPE_FILE_NODE, L"parse_kscope_file", SEQ(T(parse_kscope__), SEQ(STAR(SEQ(T(parse_kscope_statement), T(parse_kscope__))), T(parse_kscope_unknown))))
+    if (pos < errs->fail_pos || errs->lookaheads)
+        return;
 
-PEG_PARSE(parse_kscope_statement, KSCOPE_STATEMENT_NODE, L"parse_kscope_statement", DISJ(T(parse_kscope_defn), DISJ(T(parse_kscope_extern), T(parse_kscope_expr))))
+    if (pos > errs->fail_pos)
+    {
+        errs->fail_pos = pos;
+        memset(errs->expected, 0, sizeof(errs->expected));
+    }
+
+    for (i = 0; i < (int) sizeof(errs->expected); ++i)
+        errs->expected[i] |= types[i];
+} /* record_failures() */
+
+/* span kernels */
 
-PEG_PARSE(parse_kscope_defn, KSCOPE_DEFN_NODE, L"parse_kscope_defn", SEQ(T(parse_kscope_def_kw), SEQ(T(parse_kscope_proto), T(parse_kscope_expr))))
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SPAN_AVX2
+#define SPAN_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SPAN_SSE2
+#endif
 
-PEG_PARSE(parse_kscope_extern, KSCOPE_EXTERN_NODE, L"parse_kscope_extern", SEQ(T(parse_kscope_extern_kw), T(parse_kscope_proto)))
+#if defined(_MSC_VER)
+#include <intrin.h>
+static int span_ctz(unsigned int mask)
+{
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int) index;
+} /* span_ctz() */
+#else
+#define span_ctz(mask) __builtin_ctz(mask)
+#endif
 
-PEG_PARSE(parse_kscope_proto, KSCOPE_PROTO_NODE, L"parse_kscope_proto", DISJ(T(parse_kscope_idproto), DISJ(T(parse_kscope_binproto), T(parse_kscope_uniproto))))
+#define SPAN_MAX_RANGES 8
 
-PEG_PARSE(parse_kscope_expr, KSCOPE_EXPR_NODE, L"parse_kscope_expr", SEQ(T(parse_kscope_unary), T(parse_kscope_binoprhs)))
+typedef struct _char_span_t
+{
+    unsigned char bits[32];     /* bytes that continue the span */
+    int num_ranges;             /* the same set as byte ranges, or 0 to scan bytewise */
+    unsigned char lo[SPAN_MAX_RANGES], hi[SPAN_MAX_RANGES];
+}
+char_span_t;
 
-PEG_PARSE(parse_kscope_binoprhs, KSCOPE_BINOPRHS_NODE, L"parse_kscope_binoprhs", STAR(SEQ(T(parse_kscope_operator), T(parse_kscope_unary))))
+static const char_span_t char_span_0 = { { 0x00,0x00,0x00,0x00,0x00,0x00,0xff,0x03,0xfe,0xff,0xff,0x07,0xfe,0xff,0xff,0x07,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 3, { 0x30, 0x41, 0x61 }, { 0x39, 0x5a, 0x7a } };
+static const char_span_t char_span_1 = { { 0x00,0x00,0x00,0x00,0x00,0x00,0xff,0x03,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 }, 1, { 0x30 }, { 0x39 } };
+static const char_span_t char_span_2 = { { 0xff,0xfb,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff }, 2, { 0x00, 0x0b }, { 0x09, 0xff } };
+static const char_span_t char_span_3 = { { 0xff,0xdb,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff }, 3, { 0x00, 0x0b, 0x0e }, { 0x09, 0x0c, 0xff } };
 
-PEG_PARSE(parse_kscope_unary, KSCOPE_UNARY_NODE, L"parse_kscope_unary", DISJ(T(parse_kscope_primary), SEQ(T(parse_kscope_operator), T(parse_kscope_unary))))
+static const char *span_scan(const char_span_t *span, const char *p, const char *end)
+{
+#if defined(SPAN_SSE2)
+    int i, n = span->num_ranges;
 
-PEG_PARSE(parse_kscope_primary, KSCOPE_PRIMARY_NODE, L"parse_kscope_primary", DISJ(T(parse_kscope_varexpr), DISJ(T(parse_kscope_forexpr), DISJ(T(parse_kscope_ifexpr), DISJ(T(parse_kscope_paren), DISJ(T(parse_kscope_idexpr), T(parse_kscope_number)))))))
+#if defined(SPAN_AVX2)
+    if (n && end - p >= 32)
+    {
+        __m256i lo[SPAN_MAX_RANGES], width[SPAN_MAX_RANGES];
 
-PEG_PARSE(parse_kscope_varexpr, KSCOPE_VAREXPR_NODE, L"parse_kscope_varexpr", SEQ(T(parse_kscope_var), SEQ(T(parse_kscope_identifier), SEQ(QUES(T(parse_kscope_eqexpr)), SEQ(STAR(SEQ(T(parse_kscope_sep), SEQ(T(parse_kscope_identifier), QUES(T(parse_kscope_eqexpr))))), SEQ(T(parse_kscope_in), T(parse_kscope_expr)))))))
+        for (i = 0; i < n; ++i)
+        {
+            lo[i] = _mm256_set1_epi8((char) span->lo[i]);
+            width[i] = _mm256_set1_epi8((char) (span->hi[i] - span->lo[i]));
+        }
 
-PEG_PARSE(parse_kscope_forexpr, KSCOPE_FOREXPR_NODE, L"parse_kscope_forexpr", SEQ(T(parse_kscope_for), SEQ(T(parse_kscope_identifier), SEQ(T(parse_kscope_eqexpr), SEQ(T(parse_kscope_sep), SEQ(T(parse_kscope_expr), SEQ(QUES(SEQ(T(parse_kscope_sep), T(parse_kscope_expr))), SEQ(T(parse_kscope_in), T(parse_kscope_expr)))))))))
+        for (; end - p >= 32; p += 32)
+        {
+            __m256i x = _mm256_loadu_si256((const __m256i *) p);
+            __m256i in = _mm256_setzero_si256();
+            unsigned int stop;
 
-PEG_PARSE(parse_kscope_ifexpr, KSCOPE_IFEXPR_NODE, L"parse_kscope_ifexpr", SEQ(T(parse_kscope_if), SEQ(T(parse_kscope_expr), SEQ(T(parse_kscope_then), SEQ(T(parse_kscope_expr), SEQ(T(parse_kscope_else), T(parse_kscope_expr)))))))
+            for (i = 0; i < n; ++i)
+            {
+                __m256i d = _mm256_sub_epi8(x, lo[i]);
+                in = _mm256_or_si256(in, _mm256_cmpeq_epi8(_mm256_min_epu8(d, width[i]), d));
+            }
 
-PEG_PARSE(parse_kscope_paren, KSCOPE_PAREN_NODE, L"parse_kscope_paren", SEQ(T(parse_kscope_op), SEQ(T(parse_kscope_expr), T(parse_kscope_cp))))
+            if ((stop = ~(unsigned int) _mm256_movemask_epi8(in)) != 0)
+                return p + span_ctz(stop);
+        }
+    }
+#endif
 
-PEG_PARSE(parse_kscope_idexpr, KSCOPE_IDEXPR_NODE, L"parse_kscope_idexpr", DISJ(SEQ(T(parse_kscope_identifier), T(parse_kscope_call)), T(parse_kscope_identifier)))
+    if (n && end - p >= 16)
+    {
+        __m128i lo[SPAN_MAX_RANGES], width[SPAN_MAX_RANGES];
 
-PEG_PARSE(parse_kscope_idproto, KSCOPE_IDPROTO_NODE, L"parse_kscope_idproto", SEQ(T(parse_kscope_identifier), SEQ(T(parse_kscope_op), SEQ(T(parse_kscope_protoarg), SEQ(STAR(T(parse_kscope_protoarg)), T(parse_kscope_cp))))))
+        for (i = 0; i < n; ++i)
+        {
+            lo[i] = _mm_set1_epi8((char) span->lo[i]);
+            width[i] = _mm_set1_epi8((char) (span->hi[i] - span->lo[i]));
+        }
 
-PEG_PARSE(parse_kscope_binproto, KSCOPE_BINPROTO_NODE, L"parse_kscope_binproto", SEQ(T(parse_kscope_binary_kw), SEQ(T(parse_kscope_operator), SEQ(QUES(T(parse_kscope_number)), SEQ(T(parse_kscope_op), SEQ(T(parse_kscope_protoarg), SEQ(T(parse_kscope_protoarg), T(parse_kscope_cp))))))))
+        for (; end - p >= 16; p += 16)
+        {
+            __m128i x = _mm_loadu_si128((const __m128i *) p);
+            __m128i in = _mm_setzero_si128();
+            unsigned int stop;
 
-PEG_PARSE(parse_kscope_uniproto, KSCOPE_UNIPROTO_NODE, L"parse_kscope_uniproto", SEQ(T(parse_kscope_unary_kw), SEQ(T(parse_kscope_operator), SEQ(T(parse_kscope_op), SEQ(T(parse_kscope_protoarg), T(parse_kscope_cp))))))
+            for (i = 0; i < n; ++i)
+            {
+                __m128i d = _mm_sub_epi8(x, lo[i]);
+                in = _mm_or_si128(in, _mm_cmpeq_epi8(_mm_min_epu8(d, width[i]), d));
+            }
 
-PEG_PARSE(parse_kscope_protoarg, KSCOPE_PROTOARG_NODE, L"parse_kscope_protoarg", T(parse_kscope_identifier))
+            if ((stop = ~(unsigned int) _mm_movemask_epi8(in) & 0xffff) != 0)
+                return p + span_ctz(stop);
+        }
+    }
+#endif
 
-PEG_PARSE(parse_kscope_call, KSCOPE_CALL_NODE, L"parse_kscope_call", SEQ(T(parse_kscope_op), SEQ(T(parse_kscope_expr), SEQ(STAR(SEQ(T(parse_kscope_sep), T(parse_kscope_expr))), T(parse_kscope_cp)))))
+    while (p < end && CHAR_CLASS_HAS_BYTE(span, *p))
+        ++p;
 
-PEG_PARSE(parse_kscope_eqexpr, KSCOPE_EQEXPR_NODE, L"parse_kscope_eqexpr", SEQ(T(parse_kscope_opeql), T(parse_kscope_expr)))
+    return p;
+} /* span_scan() */
 
-PEG_PARSE(parse_kscope_operator, KSCOPE_OPERATOR_NODE, L"parse_kscope_operator", SEQ(T(parse_kscope_operator_str), T(parse_kscope__)))
+/* returns the end of the span starting at POS, reading more input as long as the span reaches the end of the buffer */
+static int input_buffer_span(input_buffer_t *ib, int pos, const char_span_t *span)
+{
+    for (;;)
+    {
+        const char *p = input_buffer_at(ib, pos);
 
-PEG_PARSE(parse_kscope_operator_str, KSCOPE_OPERATOR_STR_NODE, L"parse_kscope_operator_str", C(L"-+=*/:<>"))
+        pos += (int) (span_scan(span, p, input_buffer_at(ib, ib->bytes_read)) - p);
 
-PEG_PARSE(parse_kscope_unknown, KSCOPE_UNKNOWN_NODE, L"parse_kscope_unknown", SEQ(STAR(DOT), T(parse_kscope_eof)))
+        if (pos < ib->bytes_read || !input_buffer_fill(ib))
+            return pos;
+    }
+} /* input_buffer_span() */
 
-PEG_PARSE(parse_kscope_identifier, KSCOPE_IDENTIFIER_NODE, L"parse_kscope_identifier", SEQ(T(parse_kscope_identifier_str), HIDE(T(parse_kscope__))))
+/* line numbers */
 
-PEG_PARSE(parse_kscope_identifier_str, KSCOPE_IDENTIFIER_STR_NODE, L"parse_kscope_identifier_str", SEQ(C(L"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"), STAR(C(L"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"))))
+/* indexes the line endings that start before END; a carriage return ends a line unless a newline follows */
+static void input_buffer_index_lines(input_buffer_t *ib, int end)
+{
+    int pos = ib->line_scan_pos;
 
-PEG_PARSE(parse_kscope_number, KSCOPE_NUMBER_NODE, L"parse_kscope_number", SEQ(T(parse_kscope_number_str), T(parse_kscope__)))
+    if (end > ib->bytes_read)
+        end = ib->bytes_read;
 
-PEG_PARSE(parse_kscope_number_str, KSCOPE_NUMBER_STR_NODE, L"parse_kscope_number_str", DISJ(SEQ(PLUS(C(L"0123456789")), QUES(SEQ(S(L"."), STAR(C(L"0123456789"))))), SEQ(S(L"."), PLUS(C(L"0123456789")))))
+    while (pos < end)
+    {
+        const char *p = input_buffer_at(ib, pos);
 
-PEG_PARSE(parse_kscope_letter, KSCOPE_LETTER_NODE, L"parse_kscope_letter", SEQ(BANG(C(L"0123456789. ()\t\n")), DOT))
+        pos += (int) (span_scan(&char_span_3, p, input_buffer_at(ib, end)) - p);
+        if (pos == end)
+            break;
 
-PEG_PARSE(parse_kscope_lex, KSCOPE_LEX_NODE, L"parse_kscope_lex", S(L"Lexer stuff below"))
+        if (*input_buffer_at(ib, pos) == '\r' && input_buffer_has(ib, pos + 2) && *input_buffer_at(ib, pos + 1) == '\n')
+            ++pos;
+        ++pos;
+        array_add(&ib->line_ends, &pos);
+    }
 
-PEG_PARSE(parse_kscope_sep, KSCOPE_SEP_NODE, L"parse_kscope_sep", SEQ(S(L","), T(parse_kscope__)))
+    if (pos > ib->line_scan_pos)
+        ib->line_scan_pos = pos;
+} /* input_buffer_index_lines() */
 
-PEG_PARSE(parse_kscope_opeql, KSCOPE_OPEQL_NODE, L"parse_kscope_opeql", SEQ(S(L"="), T(parse_kscope__)))
+/* the line holding POS is one more than the number of line endings at or before it */
+static int input_buffer_line(input_buffer_t *ib, int pos)
+{
+    const int *ends;
+    int lo = 0, hi;
 
-PEG_PARSE(parse_kscope_op, KSCOPE_OP_NODE, L"parse_kscope_op", SEQ(S(L"("), T(parse_kscope__)))
+    input_buffer_index_lines(ib, pos);
+    ends = (const int *) ib->line_ends.data;
+    hi = array_size(&ib->line_ends);
 
-PEG_PARSE(parse_kscope_cp, KSCOPE_CP_NODE, L"parse_kscope_cp", SEQ(S(L")"), T(parse_kscope__)))
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
 
-PEG_PARSE(parse_kscope_def_kw, KSCOPE_DEF_KW_NODE, L"parse_kscope_def_kw", SEQ(S(L"def"), T(parse_kscope__)))
+        if (ends[mid] <= pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
 
-PEG_PARSE(parse_kscope_extern_kw, KSCOPE_EXTERN_KW_NODE, L"parse_kscope_extern_kw", SEQ(S(L"extern"), T(parse_kscope__)))
+    return ib->lines_dropped + lo + 1;
+} /* input_buffer_line() */
 
-PEG_PARSE(parse_kscope_if, KSCOPE_IF_NODE, L"parse_kscope_if", SEQ(S(L"if"), T(parse_kscope__)))
+/* forgets the line endings at or before POS, which the stream is discarding, but keeps their count */
+static void input_buffer_drop_lines(input_buffer_t *ib, int pos)
+{
+    int *ends;
+    int n = 0, len;
 
-PEG_PARSE(parse_kscope_then, KSCOPE_THEN_NODE, L"parse_kscope_then", SEQ(S(L"then"), T(parse_kscope__)))
+    input_buffer_index_lines(ib, pos);
+    ends = (int *) ib->line_ends.data;
+    len = array_size(&ib->line_ends);
 
-PEG_PARSE(parse_kscope_else, KSCOPE_ELSE_NODE, L"parse_kscope_else", SEQ(S(L"else"), T(parse_kscope__)))
+    while (n < len && ends[n] <= pos)
+        ++n;
 
-PEG_PARSE(parse_kscope_for, KSCOPE_FOR_NODE, L"parse_kscope_for", SEQ(S(L"for"), T(parse_kscope__)))
+    memmove(ends, ends + n, (len - n) * sizeof(int));
+    ib->line_ends.num = len - n;
+    ib->lines_dropped += n;
+} /* input_buffer_drop_lines() */
 
-PEG_PARSE(parse_kscope_in, KSCOPE_IN_NODE, L"parse_kscope_in", SEQ(S(L"in"), T(parse_kscope__)))
+int kscope_syntax_node_first_line(kscope_syntax_node_t *node)
+{
+    if (node->first_line < 0)
+        node->first_line = input_buffer_line((input_buffer_t *) node->ib, node->begin);
 
-PEG_PARSE(parse_kscope_binary_kw, KSCOPE_BINARY_KW_NODE, L"parse_kscope_binary_kw", SEQ(S(L"binary"), T(parse_kscope__)))
+    return node->first_line;
+}
 
-PEG_PARSE(parse_kscope_unary_kw, KSCOPE_UNARY_KW_NODE, L"parse_kscope_unary_kw", SEQ(S(L"unary"), T(parse_kscope__)))
+int kscope_syntax_node_last_line(kscope_syntax_node_t *node)
+{
+    if (node->last_line < 0)
+        node->last_line = input_buffer_line((input_buffer_t *) node->ib, node->begin < node->end ? node->end - 1 : node->begin);
 
-PEG_PARSE(parse_kscope_var, KSCOPE_VAR_NODE, L"parse_kscope_var", SEQ(S(L"var"), T(parse_kscope__)))
+    return node->last_line;
+}
 
-PEG_PARSE(parse_kscope__, KSCOPE___NODE, L"parse_kscope__", STAR(T(parse_kscope_ws)))
+/* rules whose results are memoized; the others are parsed again if re-invoked at the same offset */
 
-PEG_PARSE(parse_kscope_ws, KSCOPE_WS_NODE, L"parse_kscope_ws", DISJ(T(parse_kscope_whitespace), T(parse_kscope_comment)))
+static const char memo_rule[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 0 };
 
-PEG_PARSE(parse_kscope_comment, KSCOPE_COMMENT_NODE, L"parse_kscope_comment", SEQ(S(L"#"), SEQ(STAR(SEQ(BANG(S(L"\n")), DOT)), S(L"\n"))))
+/* left recursion: the memo record of a left-recursive rule holds its seed, the longest match */
+/* found so far.  The seed starts as a failure, so the call back into the rule fails and only */
+/* the alternatives without one can match.  The rule is then parsed again on each new seed, */
+/* until a pass matches no further than the one before.  A cycle can hold more than one such */
+/* rule, as in L <- P '.x' / 'x' with P <- P '(n)' / L.  The first of them is the head, and a */
+/* seed the others grow inside one of its passes holds for that pass only */
 
-PEG_PARSE(parse_kscope_whitespace, KSCOPE_WHITESPACE_NODE, L"parse_kscope_whitespace", C(L" ;\t\n"))
+/* per node type: for a left-recursive rule, the node type of the head of its cycle */
+static const int grow_head[] = { 0, 0, 0, 0, 0, 0, 6, 7, 8, 9, 10, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
 
-PEG_PARSE(parse_kscope_eof, KSCOPE_EOF_NODE, L"parse_kscope_eof", BANG(DOT))
+/* the pass that a seed of TYPE grown at START_OFFSET now holds for: the current one of the */
+/* innermost rule of its cycle growing there, or 0 for any */
+static int grow_pass(const memo_map_t *map, int type, int start_offset)
+{
+    const grow_frame_t *frame;
 
-/* _wish_node is a useful last-ditch grammar debugging tool. 
-Set it to the node you expected to be recognized but wasn't. Dumps error list to stdout. */
-int kscope_wish_node = 32000;
+    for (frame = map->growing; frame; frame = frame->outer)
+    {
+        if (frame->start_offset == start_offset && grow_head[frame->type] == grow_head[type])
+            return frame->pass;
+    }
 
-/* main function */
+    return 0;
+} /* grow_pass() */
 
-int kscope_parse(char *fname, kscope_syntax_node_t **parse_tree, void **input_buf, void **error_list)
+/* is_memoized() for a left-recursive rule, passing over a seed grown for an earlier pass */
+static int seed_memoized(memo_map_t *map, int type, int start_offset, kscope_syntax_node_t **res, int *end_offset)
 {
-    FILE *f;
-    input_buffer_t *ib;
-    int start_offset, end_offset;
-    array_t line_endings;
-    memo_map_t *map;
-    kscope_syntax_node_t *root = 0;
+    memo_rec_t *rec = memo_map_find_slot(map->records, map->cap, type, start_offset);
 
-    f = fopen(fname, "r");
-    if (!f) return 0;
+    if (rec->type && rec->pass > 0 && rec->pass != grow_pass(map, type, start_offset))
+        return 0;
 
-    ib = input_buffer_create(fname, f);
-    assert(ib);
-    *input_buf = ib;
+    return is_memoized(map, type, start_offset, res, end_offset);
+} /* seed_memoized() */
 
-    map = memo_map_create();
-    *error_list = (array_t *) calloc(sizeof(array_t), 1);
-    array_init(*error_list, sizeof(kscope_error_rec_t), 0);
+static void grow_begin(memo_map_t *map, grow_frame_t *frame, int type, int start_offset)
+{
+    memoize(map, type, start_offset, start_offset, 0);
+    memo_map_find_slot(map->records, map->cap, type, start_offset)->pass = -1;
 
-    start_offset = input_buffer_getpos(ib);
-    parse_kscope_file(ib, start_offset, &end_offset, &root, map, *error_list);
-    memo_map_destroy(map);
+    frame->type = type;
+    frame->start_offset = start_offset;
+    frame->pass = ++map->passes;
+    frame->outer = map->growing;
+    map->growing = frame;
 
-    if (root)
+    /* every pass starts at START_OFFSET, so no cut may commit beyond it until the last */
+    map->open_choices++;
+} /* grow_begin() */
+
+/* takes the result of a pass; returns whether it grew the seed, so that another pass is due */
+static int grow_step(memo_map_t *map, grow_frame_t *frame, int res, int end_offset, kscope_syntax_node_t *node)
+{
+    memo_rec_t *rec = memo_map_find_slot(map->records, map->cap, frame->type, frame->start_offset);
+    int grown = res && (!rec->parse_tree || end_offset > rec->end_offset);
+
+    if (grown)
     {
-        array_init(&line_endings, sizeof(int), 0);
-        find_line_endings(&line_endings, ib, root->begin);
-        assign_line_numbers(ib, root, &line_endings);
-        array_deinit(&line_endings);
+        memoize(map, frame->type, frame->start_offset, end_offset, node);
+        memo_map_find_slot(map->records, map->cap, frame->type, frame->start_offset)->pass = -1;
+        frame->pass = ++map->passes;
     }
 
-    *parse_tree = root;
-    return root != 0;
+    /* the record holds the new seed, and a pass that did not grow it is thrown away */
+    if (node)
+        kscope_syntax_node_destroy(node);
+
+    return grown;
+} /* grow_step() */
+
+static int grow_end(memo_map_t *map, grow_frame_t *frame, int *end_offset, kscope_syntax_node_t **node)
+{
+    memo_rec_t *rec;
+
+    map->growing = frame->outer;
+    map->open_choices--;
+
+    rec = memo_map_find_slot(map->records, map->cap, frame->type, frame->start_offset);
+    rec->pass = grow_pass(map, frame->type, frame->start_offset);
+
+    *node = syntax_node_retain(rec->parse_tree);
+    *end_offset = rec->end_offset;
+    return *node != 0;
+} /* grow_end() */
+
+/* what each rule is called in syntax errors */
+
+static const wchar_t *const rule_names[] = { 0,
+    L"parse_kscope_file",
+    L"parse_kscope_statement",
+    L"parse_kscope_defn",
+    L"parse_kscope_extern",
+    L"parse_kscope_proto",
+    L"parse_kscope_expr",
+    L"parse_kscope_assignexpr",
+    L"parse_kscope_cmpexpr",
+    L"parse_kscope_addexpr",
+    L"parse_kscope_mulexpr",
+    L"parse_kscope_unary",
+    L"parse_kscope_primary",
+    L"parse_kscope_varexpr",
+    L"parse_kscope_forexpr",
+    L"parse_kscope_ifexpr",
+    L"parse_kscope_paren",
+    L"parse_kscope_idexpr",
+    L"parse_kscope_idproto",
+    L"parse_kscope_binproto",
+    L"parse_kscope_uniproto",
+    L"parse_kscope_protoarg",
+    L"parse_kscope_call",
+    L"parse_kscope_eqexpr",
+    L"parse_kscope_operator",
+    L"parse_kscope_operator_str",
+    L"parse_kscope_seqop",
+    L"parse_kscope_assignop",
+    L"parse_kscope_cmpop",
+    L"parse_kscope_addop",
+    L"parse_kscope_mulop",
+    L"parse_kscope_unknown",
+    L"parse_kscope_identifier",
+    L"parse_kscope_identifier_str",
+    L"parse_kscope_number",
+    L"parse_kscope_number_str",
+    L"parse_kscope_letter",
+    L"parse_kscope_lex",
+    L"parse_kscope_sep",
+    L"parse_kscope_opeql",
+    L"parse_kscope_op",
+    L"parse_kscope_cp",
+    L"parse_kscope_def_kw",
+    L"parse_kscope_extern_kw",
+    L"parse_kscope_if",
+    L"parse_kscope_then",
+    L"parse_kscope_else",
+    L"parse_kscope_for",
+    L"parse_kscope_in",
+    L"parse_kscope_binary_kw",
+    L"parse_kscope_unary_kw",
+    L"parse_kscope_var",
+    L"parse_kscope__",
+    L"parse_kscope_ws",
+    L"parse_kscope_comment",
+    L"parse_kscope_whitespace",
+    L"parse_kscope_eof"
+};
+
+/* builds "syntax error: expected A, B or C" from the rules that failed at the farthest offset */
+static wchar_t *format_failure(const error_list_t *errs)
+{
+    const wchar_t *names[KSCOPE_NUM_NODE_TYPES];
+    wchar_t *str;
+    size_t len = 32;
+    int type, i, num = 0;
+
+    for (type = 1; type < KSCOPE_NUM_NODE_TYPES; ++type)
+    {
+        if (!((errs->expected[type >> 3] >> (type & 7)) & 1))
+            continue;
+
+        /* rules can share a description; name each one once */
+        for (i = 0; i < num && wcscmp(names[i], rule_names[type]); ++i)
+            ;
+        if (i == num)
+        {
+            names[num++] = rule_names[type];
+            len += wcslen(rule_names[type]) + 4;
+        }
+    }
+
+    str = (wchar_t *) calloc(len, sizeof(wchar_t));
+    wcscpy(str, L"syntax error: expected ");
+    for (i = 0; i < num; ++i)
+    {
+        if (i)
+            wcscat(str, i == num - 1 ? L" or " : L", ");
+        wcscat(str, names[i]);
+    }
+
+    return str;
+} /* format_failure() */
+
+static void format_errors(error_list_t *errs)
+{
+    kscope_error_rec_t er;
+
+    if (errs->formatted || errs->fail_pos < 0)
+        return;
+
+    er.pos = errs->fail_pos;
+    er.str = format_failure(errs);
+    array_add(&errs->errors, &er);
+    errs->formatted = 1;
+} /* format_errors() */
+
+int kscope_num_errors(void *error_list)
+{
+    format_errors((error_list_t *) error_list);
+    return array_size(&((error_list_t *) error_list)->errors);
+}
+
+kscope_error_rec_t *kscope_get_error(void *error_list, int index)
+{
+    format_errors((error_list_t *) error_list);
+    return (kscope_error_rec_t *) array_item(&((error_list_t *) error_list)->errors, index);
+}
+
+int kscope_parse_stats(void *error_list, kscope_parse_stats_t *stats)
+{
+#ifdef KSCOPE_STATS
+    *stats = ((error_list_t *) error_list)->stats;
+    return 1;
+#else
+    (void) error_list;
+    memset(stats, 0, sizeof(kscope_parse_stats_t));
+    return 0;
+#endif
+}
+
+int kscope_profile(void *error_list, kscope_rule_profile_t *rules)
+{
+#ifdef KSCOPE_PROFILE
+    memcpy(rules, ((error_list_t *) error_list)->profile, sizeof(((error_list_t *) error_list)->profile));
+    return 1;
+#else
+    (void) error_list;
+    memset(rules, 0, KSCOPE_NUM_NODE_TYPES * sizeof(kscope_rule_profile_t));
+    return 0;
+#endif
+}
+
+static int compare_self_cycles(const void *a, const void *b)
+{
+    long long diff = (*(const kscope_rule_profile_t **) b)->self_cycles - (*(const kscope_rule_profile_t **) a)->self_cycles;
+    return diff > 0 ? 1 : diff < 0 ? -1 : 0;
+} /* compare_self_cycles() */
+
+void kscope_profile_report(void *error_list, FILE *out)
+{
+    kscope_rule_profile_t rules[KSCOPE_NUM_NODE_TYPES], *order[KSCOPE_NUM_NODE_TYPES];
+    long long total = 0;
+    int i, num = 0;
+
+    if (!kscope_profile(error_list, rules))
+    {
+        fprintf(out, "no profile; compile the parser with KSCOPE_PROFILE defined\n");
+        return;
+    }
+
+    for (i = 1; i < KSCOPE_NUM_NODE_TYPES; ++i)
+    {
+        total += rules[i].self_cycles;
+        if (rules[i].calls)
+            order[num++] = &rules[i];
+    }
+    qsort(order, num, sizeof(order[0]), compare_self_cycles);
+
+    fprintf(out, "%-28s %6s %14s %12s %12s %12s %12s %12s %12s %14s %14s\n", "rule", "self", "self cycles",
+        "calls", "memo hits", "memo misses", "successes", "failures", "consumed", "backtracked", "cycles");
+    for (i = 0; i < num; ++i)
+    {
+        const kscope_rule_profile_t *r = order[i];
+
+        fprintf(out, "%-28s %5.1f%% %14lld %12lld %12lld %12lld %12lld %12lld %12lld %14lld %14lld\n", kscope_node_names[r - rules],
+            total ? 100.0 * r->self_cycles / total : 0.0, r->self_cycles, r->calls, r->memo_hits, r->memo_misses,
+            r->successes, r->failures, r->consumed, r->backtracked, r->cycles);
+    }
+} /* profile_report() */
+
+/*Debug dump of errors to stdout*/
+static void dump_errors(error_list_t *errs){
+wchar_t *str;
+
+if (errs->fail_pos < 0) return;
+str = format_failure(errs);
+printf("WishError %d %ls\n",errs->fail_pos,str);
+free(str);
+}
+
+/* the scanner: a DFA over classes of bytes that matches every token rule at once */
+
+#define SCAN_NUM_TOKENS 14
+#define SCAN_NUM_CLASSES 25
+
+static const unsigned char scan_token_type[] =
+{
+    38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51
+};
+
+static const unsigned char scan_byte_class[] =
+{
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 0, 0, 3, 0, 0, 0, 0, 4, 5, 0, 0, 6, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 7, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 8, 9, 0, 10, 11, 12, 0, 13, 14, 0, 0, 15, 0, 16, 17,
+    0, 0, 18, 19, 20, 21, 22, 0, 23, 24, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+/* a line per state; state 0 is dead, state 1 the start */
+static const unsigned char scan_next[] =
+{
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 2, 3, 4, 5, 0, 6, 7, 8, 9, 0, 10, 0, 0, 0, 0, 0, 11, 12, 13, 0, 0,
+    0, 14, 14, 15, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 16, 16, 17, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 18, 18, 19, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 20, 20, 21, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 22, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 23, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 24, 0, 0, 0, 0, 0, 0, 0, 25, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 26, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 27, 0, 0, 0, 28, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 29, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 30, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 31, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 14, 14, 15, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    32, 32, 33, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32,
+    0, 16, 16, 17, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    34, 34, 35, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34,
+    0, 18, 18, 19, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    36, 36, 37, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36,
+    0, 20, 20, 21, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    38, 38, 39, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 40, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 41, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 42, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 43, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 44, 0, 0, 0, 0, 0, 0,
+    0, 45, 45, 46, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 47, 47, 48, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 49, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 50, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 51, 0, 0, 0, 0, 0, 0,
+    32, 32, 33, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32,
+    0, 14, 14, 15, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    34, 34, 35, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34, 34,
+    0, 16, 16, 17, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    36, 36, 37, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36,
+    0, 18, 18, 19, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    38, 38, 39, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38,
+    0, 20, 20, 21, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 52, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 53, 53, 54, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 55, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 56, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 57, 57, 58, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 45, 45, 46, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    59, 59, 60, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59,
+    0, 47, 47, 48, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    61, 61, 62, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 63, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 64, 0, 0, 0, 0, 0, 0,
+    0, 65, 65, 66, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 67, 0, 0, 0, 0, 0, 0,
+    0, 53, 53, 54, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    68, 68, 69, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68,
+    0, 70, 70, 71, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 72, 0, 0, 0, 0, 0, 0,
+    0, 57, 57, 58, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    73, 73, 74, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73,
+    59, 59, 60, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59, 59,
+    0, 45, 45, 46, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    61, 61, 62, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61, 61,
+    0, 47, 47, 48, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 75, 75, 76, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 77,
+    0, 65, 65, 66, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    78, 78, 79, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 80,
+    68, 68, 69, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68,
+    0, 53, 53, 54, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 70, 70, 71, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    81, 81, 82, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 83, 0, 0, 0, 0, 0, 0, 0, 0,
+    73, 73, 74, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73, 73,
+    0, 57, 57, 58, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 75, 75, 76, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    84, 84, 85, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84,
+    0, 86, 86, 87, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    78, 78, 79, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78, 78,
+    0, 65, 65, 66, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 88, 88, 89, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    81, 81, 82, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81, 81,
+    0, 70, 70, 71, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 90, 90, 91, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    84, 84, 85, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84, 84,
+    0, 75, 75, 76, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 86, 86, 87, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    92, 92, 93, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92,
+    0, 88, 88, 89, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    94, 94, 95, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94,
+    0, 90, 90, 91, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    96, 96, 97, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96,
+    92, 92, 93, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92, 92,
+    0, 86, 86, 87, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    94, 94, 95, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94, 94,
+    0, 88, 88, 89, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    96, 96, 97, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96, 96,
+    0, 90, 90, 91, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+/* the tokens, as indices into scan_token_type, that reaching each state matches */
+static const unsigned char scan_accept_begin[] =
+{
+    0, 0, 0, 1, 2, 3, 4, 4, 4, 4, 4, 4, 4, 4, 4, 5,
+    5, 6, 6, 7, 7, 8, 8, 8, 8, 8, 8, 8, 9, 10, 10, 10,
+    10, 10, 11, 11, 12, 12, 13, 13, 14, 14, 15, 15, 15, 16, 17, 17,
+    18, 18, 18, 18, 19, 19, 20, 20, 21, 21, 22, 22, 22, 23, 23, 24,
+    25, 25, 26, 26, 26, 26, 27, 28, 28, 28, 28, 29, 30, 30, 31, 31,
+    32, 33, 33, 34, 35, 35, 36, 37, 37, 38, 38, 39, 39, 39, 40, 40,
+    41, 41, 42
+};
+
+static const unsigned char scan_accepts[] =
+{
+    2, 3, 0, 1, 2, 3, 0, 1, 6, 10, 2, 3, 0, 1, 4, 9,
+    6, 10, 13, 4, 8, 9, 6, 10, 7, 13, 4, 8, 9, 7, 12, 13,
+    11, 8, 5, 7, 12, 11, 5, 12, 11, 5
+};
+
+static int memo_map_scanned(memo_map_t *map, int pos)
+{
+    int bit = pos - map->scanned_base;
+
+    return bit >= 0 && bit < map->scanned_len * 8 && (map->scanned[bit >> 3] >> (bit & 7)) & 1;
+} /* memo_map_scanned() */
+
+static void memo_map_set_scanned(memo_map_t *map, int pos)
+{
+    int bit = pos - map->scanned_base, len;
+
+    assert(bit >= 0);
+
+    if (bit >= map->scanned_len * 8)
+    {
+        for (len = map->scanned_len ? map->scanned_len * 2 : 256; bit >= len * 8; len *= 2)
+            ;
+        map->scanned = (unsigned char *) realloc(map->scanned, len);
+        memset(map->scanned + map->scanned_len, 0, len - map->scanned_len);
+        map->scanned_len = len;
+    }
+
+    map->scanned[bit >> 3] |= (unsigned char) (1 << (bit & 7));
+} /* memo_map_set_scanned() */
+
+/* runs the scanner from START_OFFSET as far as any token can match, and memoizes the longest */
+/* match of each token there, without its node, and notes that it has run there */
+static void scan(input_buffer_t *ib, int start_offset, memo_map_t *map)
+{
+    int end[SCAN_NUM_TOKENS];
+    int i, state = 1, pos = start_offset;
+
+    for (i = 0; i < SCAN_NUM_TOKENS; ++i)
+        end[i] = -1;
+
+    while (input_buffer_has(ib, pos + 1)
+        && (state = scan_next[state * SCAN_NUM_CLASSES + scan_byte_class[(unsigned char) *input_buffer_at(ib, pos)]]))
+    {
+        ++pos;
+        for (i = scan_accept_begin[state]; i < scan_accept_begin[state + 1]; ++i)
+            end[scan_accepts[i]] = pos;
+    }
+
+    for (i = 0; i < SCAN_NUM_TOKENS; ++i)
+    {
+        if (end[i] >= 0)
+            memoize(map, scan_token_type[i], start_offset, end[i], NULL);
+    }
+
+    memo_map_set_scanned(map, start_offset);
+} /* scan() */
+
+/* matches the token rule for node type TYPE, like a function PEG_PARSE would make; the first token */
+/* asked for at an offset scans there, the rest find their matches memoized, and a token's leaf */
+/* node is built when it is first asked for */
+static int scan_token(input_buffer_t *ib, int type, int start_offset, int *end_offset, kscope_syntax_node_t **node, memo_map_t *map, error_list_t *errs)
+{
+    memo_rec_t *rec = memo_map_find_slot(map->records, map->cap, type, start_offset);
+
+    if (!rec->type && !memo_map_scanned(map, start_offset))
+    {
+        scan(ib, start_offset, map);
+        rec = memo_map_find_slot(map->records, map->cap, type, start_offset);
+    }
+
+    if (!rec->type)
+    {
+        record_failure(errs, type, start_offset);
+        PARSE_STAT(map, failures);
+        if (map->parser->wish_node == type)
+            dump_errors(errs);
+        *node = 0;
+        return 0;
+    }
+
+    if (!rec->parse_tree)
+    {
+        rec->parse_tree = arena_node_create(map->arena, type, start_offset, rec->end_offset, map->node_ib);
+        PARSE_STAT(map, nodes);
+        rec->parse_tree->child = arena_child_array(map->arena, 0);
+        if (map->parser->dispatch[type] != NULL)
+            map->parser->dispatch[type](rec->parse_tree, map->parser->data);
+    }
+
+    *node = syntax_node_retain(rec->parse_tree);
+    *end_offset = rec->end_offset;
+    return 1;
+} /* scan_token() */
+
+#define PEG_TOKEN(FUNCTION, NODE_TYPE)                                                                        \
+RULE_FUNCTION(FUNCTION, NODE_TYPE)                                                                          \
+{                                                                                                           \
+    return scan_token(ib, NODE_TYPE, start_offset, end_offset, node, map, errs);                            \
+}
+
+/* set if the start rule has a top-level repetition whose subtrees can be streamed */
+
+static const int stream_top_level = 1;
+
+/* parallel parsing: each worker parses iterations of the streamed repetition from a */
+/* speculative boundary, and the sequential parse takes an item wherever it reaches the item's start */
+
+static int parse_stream_item(input_buffer_t *ib, int start_offset, int *end_offset, array_t *children, memo_map_t *map, error_list_t *errs);
+
+/* the start of the next line after POS that does not begin with a blank, or LIMIT; */
+/* top-level items tend to start there, and indented lines tend to continue one */
+static int parallel_next_line(input_buffer_t *ib, int pos, int limit)
+{
+    const char *nl;
+    char ch;
+
+    while (pos < limit && (nl = (const char *) memchr(input_buffer_at(ib, pos), '\n', limit - pos)))
+    {
+        pos = ib->base + (int) (nl - ib->buf) + 1;
+        if (pos < limit && (ch = *input_buffer_at(ib, pos)) != ' ' && ch != '\t' && ch != '\r' && ch != '\n')
+            return pos;
+    }
+
+    return limit;
+} /* parallel_next_line() */
+
+/* parses items from the chunk's start until one reaches its end; where none parses, */
+/* the worker moves on to the next line that could start one */
+static void parallel_chunk_run(parallel_chunk_t *chunk)
+{
+    input_buffer_t *ib;
+    memo_map_t *map;
+    void *errs;
+    parallel_item_t item;
+    int pos = chunk->begin, end;
+
+    /* reading moves a buffer's position, so the worker reads the same bytes through one of its own, */
+    /* and its nodes point there until parallel_take() hands them to the calling thread */
+    chunk->worker_ib = ib = input_buffer_create_mem(chunk->ib->name, chunk->ib->buf, chunk->ib->bytes_read);
+    map = memo_map_create(0);
+    map->parser = chunk->parser;
+    map->node_ib = ib;
+    errs = kscope_create_error_list();
+
+    while (pos < chunk->end)
+    {
+        item.first_child = array_size(&chunk->children);
+
+        if (parse_stream_item(ib, pos, &end, &chunk->children, map, (error_list_t *) errs) && end > pos)
+        {
+            item.begin = pos;
+            item.end = pos = end;
+            item.num_children = array_size(&chunk->children) - item.first_child;
+            array_add(&chunk->items, &item);
+        }
+        else
+        {
+            delete_children(&chunk->children, item.first_child);
+            pos = parallel_next_line(ib, pos, chunk->end);
+        }
+    }
+
+    kscope_destroy_error_list(errs);
+    memo_map_destroy(map);
+} /* parallel_chunk_run() */
+
+#ifdef WIN32
+static DWORD WINAPI parallel_thread(LPVOID chunk)
+{
+    parallel_chunk_run((parallel_chunk_t *) chunk);
+    return 0;
+} /* parallel_thread() */
+#else
+static void *parallel_thread(void *chunk)
+{
+    parallel_chunk_run((parallel_chunk_t *) chunk);
+    return 0;
+} /* parallel_thread() */
+#endif
+
+/* a chunk that gets no thread stays empty, and is parsed sequentially */
+static void parallel_start(parallel_chunk_t *chunk)
+{
+#ifdef WIN32
+    chunk->started = (chunk->thread = CreateThread(0, 0, parallel_thread, chunk, 0, 0)) != 0;
+#else
+    chunk->started = pthread_create(&chunk->thread, 0, parallel_thread, chunk) == 0;
+#endif
+} /* parallel_start() */
+
+static void parallel_join(parallel_chunk_t *chunk)
+{
+    if (!chunk->started)
+        return;
+
+#ifdef WIN32
+    WaitForSingleObject(chunk->thread, INFINITE);
+    CloseHandle(chunk->thread);
+#else
+    pthread_join(chunk->thread, 0);
+#endif
+    chunk->started = 0;
+} /* parallel_join() */
+
+static int parallel_adopt_node(kscope_syntax_node_t *node, void *ib)
+{
+    node->ib = ib;
+    return 0;
+} /* parallel_adopt_node() */
+
+/* takes the item the workers parsed at POS, if any, moving its subtrees onto CHILD_STACK */
+static int parallel_take(parallel_parse_t *par, int pos, array_t *child_stack, int *end_offset)
+{
+    parallel_chunk_t *chunk;
+    parallel_item_t *item;
+    kscope_syntax_node_t **slot;
+    int i;
+
+    /* a chunk is waited for once the parse has reached it */
+    while (par->joined < par->num_chunks && par->chunks[par->joined].begin <= pos)
+        parallel_join(&par->chunks[par->joined++]);
+
+    for (; par->cur < par->joined; ++par->cur)
+    {
+        chunk = par->chunks + par->cur;
+
+        /* items behind POS were speculation the parse did not follow; parallel_finish() frees them */
+        while (chunk->next_item < array_size(&chunk->items))
+        {
+            item = (parallel_item_t *) array_item(&chunk->items, chunk->next_item);
+            if (item->begin > pos)
+                return 0;
+
+            chunk->next_item++;
+            if (item->begin < pos)
+                continue;
+
+            for (i = 0; i < item->num_children; ++i)
+            {
+                slot = (kscope_syntax_node_t **) array_item(&chunk->children, item->first_child + i);
+                kscope_syntax_node_traverse_preorder(*slot, chunk->ib, parallel_adopt_node, 0);
+                array_add(child_stack, slot);
+                *slot = 0;
+            }
+
+            *end_offset = item->end;
+            return 1;
+        }
+    }
+
+    return 0;
+} /* parallel_take() */
+
+/* waits for every worker and frees the items the parse did not take */
+static void parallel_finish(parallel_parse_t *par)
+{
+    parallel_chunk_t *chunk;
+    kscope_syntax_node_t *node;
+    int i, j;
+
+    for (i = 0; i < par->num_chunks; ++i)
+    {
+        chunk = par->chunks + i;
+        parallel_join(chunk);
+
+        for (j = 0; j < array_size(&chunk->children); ++j)
+        {
+            if ((node = *(kscope_syntax_node_t **) array_item(&chunk->children, j)))
+                kscope_syntax_node_destroy(node);
+        }
+
+        array_deinit(&chunk->items);
+        array_deinit(&chunk->children);
+        if (chunk->worker_ib)
+            input_buffer_destroy(chunk->worker_ib);
+    }
+
+    free(par->chunks);
+} /* parallel_finish() */
+
+/* parsing functions */
+
+PEG_PARSE(parse_kscope_file, KSCOPE_FILE_NODE, SEQ(T(parse_kscope__), SEQ(STREAM_STAR(SEQ(T(parse_kscope_statement), SEQ(T(parse_kscope__), CUT))), T(parse_kscope_unknown))))
+
+PEG_PARSE(parse_kscope_statement, KSCOPE_STATEMENT_NODE, DISJ(PREDICT(first_set_0, fail_set_0, T(parse_kscope_defn)), DISJ(PREDICT(first_set_1, fail_set_1, T(parse_kscope_extern)), T(parse_kscope_expr))))
+
+PEG_PARSE(parse_kscope_defn, KSCOPE_DEFN_NODE, SEQ(T(parse_kscope_def_kw), SEQ(T(parse_kscope_proto), T(parse_kscope_expr))))
+
+PEG_PARSE(parse_kscope_extern, KSCOPE_EXTERN_NODE, SEQ(T(parse_kscope_extern_kw), T(parse_kscope_proto)))
+
+PEG_PARSE(parse_kscope_proto, KSCOPE_PROTO_NODE, DISJ(PREDICT(first_set_2, fail_set_2, T(parse_kscope_idproto)), DISJ(PREDICT(first_set_3, fail_set_3, T(parse_kscope_binproto)), PREDICT(first_set_4, fail_set_4, T(parse_kscope_uniproto)))))
+
+PEG_PARSE(parse_kscope_expr_seed, KSCOPE_EXPR_NODE, DISJ(SEQ(T(parse_kscope_expr), SEQ(T(parse_kscope_seqop), T(parse_kscope_assignexpr))), T(parse_kscope_assignexpr)))
+
+PEG_GROW(parse_kscope_expr, KSCOPE_EXPR_NODE)
+
+PEG_PARSE(parse_kscope_assignexpr_seed, KSCOPE_ASSIGNEXPR_NODE, DISJ(SEQ(T(parse_kscope_assignexpr), SEQ(T(parse_kscope_assignop), T(parse_kscope_cmpexpr))), T(parse_kscope_cmpexpr)))
+
+PEG_GROW(parse_kscope_assignexpr, KSCOPE_ASSIGNEXPR_NODE)
+
+PEG_PARSE(parse_kscope_cmpexpr_seed, KSCOPE_CMPEXPR_NODE, DISJ(SEQ(T(parse_kscope_cmpexpr), SEQ(T(parse_kscope_cmpop), T(parse_kscope_addexpr))), T(parse_kscope_addexpr)))
+
+PEG_GROW(parse_kscope_cmpexpr, KSCOPE_CMPEXPR_NODE)
+
+PEG_PARSE(parse_kscope_addexpr_seed, KSCOPE_ADDEXPR_NODE, DISJ(SEQ(T(parse_kscope_addexpr), SEQ(T(parse_kscope_addop), T(parse_kscope_mulexpr))), T(parse_kscope_mulexpr)))
+
+PEG_GROW(parse_kscope_addexpr, KSCOPE_ADDEXPR_NODE)
+
+PEG_PARSE(parse_kscope_mulexpr_seed, KSCOPE_MULEXPR_NODE, DISJ(SEQ(T(parse_kscope_mulexpr), SEQ(T(parse_kscope_mulop), T(parse_kscope_unary))), PREDICT(first_set_5, fail_set_5, T(parse_kscope_unary))))
+
+PEG_GROW(parse_kscope_mulexpr, KSCOPE_MULEXPR_NODE)
+
+PEG_PARSE(parse_kscope_unary, KSCOPE_UNARY_NODE, DISJ(PREDICT(first_set_6, fail_set_6, T(parse_kscope_primary)), PREDICT(first_set_7, fail_set_7, SEQ(T(parse_kscope_operator), T(parse_kscope_unary)))))
+
+PEG_PARSE(parse_kscope_primary, KSCOPE_PRIMARY_NODE, DISJ(PREDICT(first_set_8, fail_set_8, T(parse_kscope_varexpr)), DISJ(PREDICT(first_set_9, fail_set_9, T(parse_kscope_forexpr)), DISJ(PREDICT(first_set_10, fail_set_10, T(parse_kscope_ifexpr)), DISJ(PREDICT(first_set_11, fail_set_11, T(parse_kscope_paren)), DISJ(PREDICT(first_set_2, fail_set_12, T(parse_kscope_idexpr)), PREDICT(first_set_12, fail_set_13, T(parse_kscope_number))))))))
+
+PEG_PARSE(parse_kscope_varexpr, KSCOPE_VAREXPR_NODE, SEQ(T(parse_kscope_var), SEQ(T(parse_kscope_identifier), SEQ(QUES(T(parse_kscope_eqexpr)), SEQ(STAR(SEQ(T(parse_kscope_sep), SEQ(T(parse_kscope_identifier), QUES(T(parse_kscope_eqexpr))))), SEQ(T(parse_kscope_in), T(parse_kscope_expr)))))))
+
+PEG_PARSE(parse_kscope_forexpr, KSCOPE_FOREXPR_NODE, SEQ(T(parse_kscope_for), SEQ(T(parse_kscope_identifier), SEQ(T(parse_kscope_eqexpr), SEQ(T(parse_kscope_sep), SEQ(T(parse_kscope_expr), SEQ(QUES(SEQ(T(parse_kscope_sep), T(parse_kscope_expr))), SEQ(T(parse_kscope_in), T(parse_kscope_expr)))))))))
+
+PEG_PARSE(parse_kscope_ifexpr, KSCOPE_IFEXPR_NODE, SEQ(T(parse_kscope_if), SEQ(T(parse_kscope_expr), SEQ(T(parse_kscope_then), SEQ(T(parse_kscope_expr), SEQ(T(parse_kscope_else), T(parse_kscope_expr)))))))
+
+PEG_PARSE(parse_kscope_paren, KSCOPE_PAREN_NODE, SEQ(T(parse_kscope_op), SEQ(T(parse_kscope_expr), T(parse_kscope_cp))))
+
+PEG_PARSE(parse_kscope_idexpr, KSCOPE_IDEXPR_NODE, SEQ(T(parse_kscope_identifier), QUES(T(parse_kscope_call))))
+
+PEG_PARSE(parse_kscope_idproto, KSCOPE_IDPROTO_NODE, SEQ(T(parse_kscope_identifier), SEQ(T(parse_kscope_op), SEQ(T(parse_kscope_protoarg), SEQ(STAR(T(parse_kscope_protoarg)), T(parse_kscope_cp))))))
+
+PEG_PARSE(parse_kscope_binproto, KSCOPE_BINPROTO_NODE, SEQ(T(parse_kscope_binary_kw), SEQ(T(parse_kscope_operator), SEQ(QUES(T(parse_kscope_number)), SEQ(T(parse_kscope_op), SEQ(T(parse_kscope_protoarg), SEQ(T(parse_kscope_protoarg), T(parse_kscope_cp))))))))
+
+PEG_PARSE(parse_kscope_uniproto, KSCOPE_UNIPROTO_NODE, SEQ(T(parse_kscope_unary_kw), SEQ(T(parse_kscope_operator), SEQ(T(parse_kscope_op), SEQ(T(parse_kscope_protoarg), T(parse_kscope_cp))))))
+
+PEG_PARSE(parse_kscope_protoarg, KSCOPE_PROTOARG_NODE, T(parse_kscope_identifier))
+
+PEG_PARSE(parse_kscope_call, KSCOPE_CALL_NODE, SEQ(T(parse_kscope_op), SEQ(T(parse_kscope_expr), SEQ(STAR(SEQ(T(parse_kscope_sep), T(parse_kscope_expr))), T(parse_kscope_cp)))))
+
+PEG_PARSE(parse_kscope_eqexpr, KSCOPE_EQEXPR_NODE, SEQ(T(parse_kscope_opeql), T(parse_kscope_expr)))
+
+PEG_PARSE(parse_kscope_operator, KSCOPE_OPERATOR_NODE, SEQ(T(parse_kscope_operator_str), T(parse_kscope__)))
+
+PEG_PARSE(parse_kscope_operator_str, KSCOPE_OPERATOR_STR_NODE, C(char_class_0))
+
+PEG_PARSE(parse_kscope_seqop, KSCOPE_SEQOP_NODE, SEQ(C(char_class_1), T(parse_kscope__)))
+
+PEG_PARSE(parse_kscope_assignop, KSCOPE_ASSIGNOP_NODE, SEQ(C(char_class_2), T(parse_kscope__)))
+
+PEG_PARSE(parse_kscope_cmpop, KSCOPE_CMPOP_NODE, SEQ(C(char_class_3), T(parse_kscope__)))
+
+PEG_PARSE(parse_kscope_addop, KSCOPE_ADDOP_NODE, SEQ(C(char_class_4), T(parse_kscope__)))
+
+PEG_PARSE(parse_kscope_mulop, KSCOPE_MULOP_NODE, SEQ(C(char_class_5), T(parse_kscope__)))
+
+PEG_PARSE(parse_kscope_unknown, KSCOPE_UNKNOWN_NODE, SEQ(STAR(DOT), T(parse_kscope_eof)))
+
+PEG_PARSE(parse_kscope_identifier, KSCOPE_IDENTIFIER_NODE, SEQ(T(parse_kscope_identifier_str), HIDE(STAR(T(parse_kscope_ws)))))
+
+PEG_PARSE(parse_kscope_identifier_str, KSCOPE_IDENTIFIER_STR_NODE, SEQ(C(char_class_6), SPAN_STAR(char_span_0)))
+
+PEG_PARSE(parse_kscope_number, KSCOPE_NUMBER_NODE, SEQ(T(parse_kscope_number_str), T(parse_kscope__)))
+
+PEG_PARSE(parse_kscope_number_str, KSCOPE_NUMBER_STR_NODE, DISJ(SEQ(SPAN_PLUS(char_span_1), QUES(SEQ(S1('.'), SPAN_STAR(char_span_1)))), SEQ(S1('.'), SPAN_PLUS(char_span_1))))
+
+PEG_PARSE(parse_kscope_letter, KSCOPE_LETTER_NODE, SEQ(BANG(C(char_class_7)), DOT))
+
+PEG_PARSE(parse_kscope_lex, KSCOPE_LEX_NODE, S("Lexer stuff below", 17))
+
+PEG_TOKEN(parse_kscope_sep, KSCOPE_SEP_NODE)
+
+PEG_TOKEN(parse_kscope_opeql, KSCOPE_OPEQL_NODE)
+
+PEG_TOKEN(parse_kscope_op, KSCOPE_OP_NODE)
+
+PEG_TOKEN(parse_kscope_cp, KSCOPE_CP_NODE)
+
+PEG_TOKEN(parse_kscope_def_kw, KSCOPE_DEF_KW_NODE)
+
+PEG_TOKEN(parse_kscope_extern_kw, KSCOPE_EXTERN_KW_NODE)
+
+PEG_TOKEN(parse_kscope_if, KSCOPE_IF_NODE)
+
+PEG_TOKEN(parse_kscope_then, KSCOPE_THEN_NODE)
+
+PEG_TOKEN(parse_kscope_else, KSCOPE_ELSE_NODE)
+
+PEG_TOKEN(parse_kscope_for, KSCOPE_FOR_NODE)
+
+PEG_TOKEN(parse_kscope_in, KSCOPE_IN_NODE)
+
+PEG_TOKEN(parse_kscope_binary_kw, KSCOPE_BINARY_KW_NODE)
+
+PEG_TOKEN(parse_kscope_unary_kw, KSCOPE_UNARY_KW_NODE)
+
+PEG_TOKEN(parse_kscope_var, KSCOPE_VAR_NODE)
+
+PEG_PARSE(parse_kscope__, KSCOPE___NODE, STAR(T(parse_kscope_ws)))
+
+PEG_PARSE(parse_kscope_ws, KSCOPE_WS_NODE, DISJ(PREDICT(first_set_13, fail_set_14, T(parse_kscope_whitespace)), PREDICT(first_set_14, fail_set_15, T(parse_kscope_comment))))
+
+PEG_PARSE(parse_kscope_comment, KSCOPE_COMMENT_NODE, SEQ(S1('#'), SEQ(SPAN_STAR(char_span_2), S1('\n'))))
+
+PEG_PARSE(parse_kscope_whitespace, KSCOPE_WHITESPACE_NODE, C(char_class_8))
+
+PEG_PARSE(parse_kscope_eof, KSCOPE_EOF_NODE, BANG(DOT))
+
+PEG_ITEM(parse_stream_item, SEQ(T(parse_kscope_statement), SEQ(T(parse_kscope__), CUT)))
+
+/* _wish_node is a useful last-ditch grammar debugging tool. 
+Set it to the node you expected to be recognized but wasn't. Dumps error list to stdout. */
+int kscope_wish_node = 32000;
+
+/* a context for the _parse functions that don't take one */
+static void parser_init(kscope_parser_t *parser)
+{
+    memset(parser, 0, sizeof(kscope_parser_t));
+    memcpy(parser->dispatch, kscope_dispatch, sizeof(parser->dispatch));
+    parser->wish_node = kscope_wish_node;
+} /* parser_init() */
+
+/* main function */
+
+static int parse_input_buffer(const kscope_parser_t *parser, input_buffer_t *ib, kscope_arena_t *arena, kscope_syntax_node_t **parse_tree, void **error_list, kscope_syntax_node_process_ft stream, void *stream_data, parallel_parse_t *parallel)
+{
+    int start_offset, end_offset;
+    memo_map_t *map;
+    kscope_syntax_node_t *root = 0;
+
+    map = memo_map_create(arena);
+    *error_list = kscope_create_error_list();
+
+    start_offset = input_buffer_getpos(ib);
+    map->stream = stream;
+    map->stream_data = stream_data;
+    map->parser = parser;
+    map->node_ib = ib;
+    map->parallel = parallel;
+
+    parse_kscope_file(ib, start_offset, &end_offset, &root, map, *error_list);
+#ifdef KSCOPE_STATS
+    ((error_list_t *) *error_list)->stats = map->stats;
+#endif
+#ifdef KSCOPE_PROFILE
+    memcpy(((error_list_t *) *error_list)->profile, map->profile, sizeof(map->profile));
+#endif
+    memo_map_destroy(map);
+
+    /* how far a successful parse looked ahead is not an error */
+    if (root)
+        clear_failure((error_list_t *) *error_list);
+
+    /* a streamed parse has already handed over everything but the start node */
+    if (root && stream && !stream_top_level && stream(root, stream_data))
+    {
+        kscope_syntax_node_destroy(root);
+        root = 0;
+    }
+
+    *parse_tree = root;
+    return root != 0;
+} /* parse_input_buffer() */
+
+static int parse_file(const kscope_parser_t *parser, char *fname, kscope_arena_t *arena, kscope_syntax_node_t **parse_tree, void **input_buf, void **error_list)
+{
+    FILE *f;
+    input_buffer_t *ib;
+
+    f = fopen(fname, "r");
+    if (!f) return 0;
+
+    ib = input_buffer_create(fname, f);
+    assert(ib);
+    *input_buf = ib;
+
+    return parse_input_buffer(parser, ib, arena, parse_tree, error_list, 0, 0, 0);
+} /* parse_file() */
+
+static int parse_mapped(const kscope_parser_t *parser, char *fname, kscope_arena_t *arena, kscope_syntax_node_t **parse_tree, void **input_buf, void **error_list)
+{
+    input_buffer_t *ib;
+
+    if (!(ib = input_buffer_create_mapped(fname)))
+        return 0;
+
+    *input_buf = ib;
+    return parse_input_buffer(parser, ib, arena, parse_tree, error_list, 0, 0, 0);
+} /* parse_mapped() */
+
+static int parse_mem(const kscope_parser_t *parser, const char *data, size_t len, kscope_arena_t *arena, kscope_syntax_node_t **parse_tree, void **input_buf, void **error_list)
+{
+    input_buffer_t *ib;
+
+    if (!(ib = input_buffer_create_mem("<memory>", data, len)))
+        return 0;
+
+    *input_buf = ib;
+    return parse_input_buffer(parser, ib, arena, parse_tree, error_list, 0, 0, 0);
+} /* parse_mem() */
+
+int kscope_parse(char *fname, kscope_syntax_node_t **parse_tree, void **input_buf, void **error_list)
+{
+    kscope_parser_t parser;
+
+    parser_init(&parser);
+    return parse_file(&parser, fname, 0, parse_tree, input_buf, error_list);
+}
+
+int kscope_parse_arena(char *fname, kscope_arena_t *arena, kscope_syntax_node_t **parse_tree, void **input_buf, void **error_list)
+{
+    kscope_parser_t parser;
+
+    assert(arena);
+    parser_init(&parser);
+    return parse_file(&parser, fname, arena, parse_tree, input_buf, error_list);
+}
+
+int kscope_parse_mmap(char *fname, kscope_arena_t *arena, kscope_syntax_node_t **parse_tree, void **input_buf, void **error_list)
+{
+    kscope_parser_t parser;
+
+    parser_init(&parser);
+    return parse_mapped(&parser, fname, arena, parse_tree, input_buf, error_list);
+}
+
+int kscope_parse_mem(const char *data, size_t len, kscope_arena_t *arena, kscope_syntax_node_t **parse_tree, void **input_buf, void **error_list)
+{
+    kscope_parser_t parser;
+
+    parser_init(&parser);
+    return parse_mem(&parser, data, len, arena, parse_tree, input_buf, error_list);
+}
+
+int kscope_parse_stream(char *fname, kscope_syntax_node_process_ft callback, void *data, void **input_buf, void **error_list)
+{
+    FILE *f;
+    input_buffer_t *ib;
+    kscope_syntax_node_t *root;
+    kscope_parser_t parser;
+    int res;
+
+    assert(callback);
+
+    f = fopen(fname, "r");
+    if (!f) return 0;
+
+    ib = input_buffer_create(fname, f);
+    assert(ib);
+    *input_buf = ib;
+
+    /* heap nodes, so that each subtree is freed as soon as the callback returns */
+    parser_init(&parser);
+    res = parse_input_buffer(&parser, ib, 0, &root, error_list, callback, data, 0);
+    if (root)
+        kscope_syntax_node_destroy(root);
+
+    return res;
+}
+
+/* parser contexts */
+
+kscope_parser_t *kscope_parser_create(void)
+{
+    kscope_parser_t *parser = (kscope_parser_t *) malloc(sizeof(kscope_parser_t));
+    parser_init(parser);
+    return parser;
+} /* parser_create() */
+
+void kscope_parser_destroy(kscope_parser_t *parser)
+{
+    free(parser);
+} /* parser_destroy() */
+
+int kscope_parser_parse(kscope_parser_t *parser, char *fname, kscope_syntax_node_t **parse_tree, void **input_buf, void **error_list)
+{
+    assert(parser);
+
+    if (parser->use_mmap)
+        return parse_mapped(parser, fname, parser->arena, parse_tree, input_buf, error_list);
+    else
+        return parse_file(parser, fname, parser->arena, parse_tree, input_buf, error_list);
+}
+
+int kscope_parser_parse_mem(kscope_parser_t *parser, const char *data, size_t len, kscope_syntax_node_t **parse_tree, void **input_buf, void **error_list)
+{
+    assert(parser);
+    return parse_mem(parser, data, len, parser->arena, parse_tree, input_buf, error_list);
+}
+
+/* worker pool for _parse_many() */
+
+typedef struct _parse_pool_t
+{
+    const kscope_parser_t *parser;  /* copied by each worker */
+    kscope_parse_job_t *jobs;
+    int num_jobs;
+    volatile long next;        /* the next job to hand out */
+    volatile long parsed;      /* jobs that parsed */
+}
+parse_pool_t;
+
+static long parse_pool_add(volatile long *value, long n)
+{
+#ifdef WIN32
+    return InterlockedExchangeAdd(value, n);
+#else
+    return __sync_fetch_and_add(value, n);
+#endif
+} /* parse_pool_add() */
+
+static void parse_pool_work(parse_pool_t *pool)
+{
+    kscope_parser_t parser = *pool->parser;
+    kscope_parse_job_t *job;
+    long i, parsed = 0;
+
+    /* an arena cannot be shared between threads, and each tree must be freeable on its own */
+    parser.arena = 0;
+
+    while ((i = parse_pool_add(&pool->next, 1)) < pool->num_jobs)
+    {
+        job = pool->jobs + i;
+        job->parse_tree = 0;
+        job->input_buffer = 0;
+        job->error_list = 0;
+
+        if (!job->fname)
+            job->res = parse_mem(&parser, job->data, job->len, 0, &job->parse_tree, &job->input_buffer, &job->error_list);
+        else if (parser.use_mmap)
+            job->res = parse_mapped(&parser, job->fname, 0, &job->parse_tree, &job->input_buffer, &job->error_list);
+        else
+            job->res = parse_file(&parser, job->fname, 0, &job->parse_tree, &job->input_buffer, &job->error_list);
+
+        parsed += job->res;
+    }
+
+    parse_pool_add(&pool->parsed, parsed);
+} /* parse_pool_work() */
+
+#ifdef WIN32
+static DWORD WINAPI parse_pool_thread(LPVOID pool)
+{
+    parse_pool_work((parse_pool_t *) pool);
+    return 0;
+} /* parse_pool_thread() */
+#else
+static void *parse_pool_thread(void *pool)
+{
+    parse_pool_work((parse_pool_t *) pool);
+    return 0;
+} /* parse_pool_thread() */
+#endif
+
+static int parse_pool_processors(void)
+{
+#ifdef WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int) info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int) n : 1;
+#endif
+} /* parse_pool_processors() */
+
+int kscope_parse_many(const kscope_parser_t *parser, kscope_parse_job_t *jobs, int num_jobs, int num_threads)
+{
+    parse_pool_t pool;
+    kscope_parser_t defaults;
+    int i, started = 0;
+#ifdef WIN32
+    HANDLE *threads;
+#else
+    pthread_t *threads;
+#endif
+
+    if (!parser)
+    {
+        parser_init(&defaults);
+        parser = &defaults;
+    }
+
+    if (num_threads <= 0)
+        num_threads = parse_pool_processors();
+    if (num_threads > num_jobs)
+        num_threads = num_jobs;
+
+    pool.parser = parser;
+    pool.jobs = jobs;
+    pool.num_jobs = num_jobs;
+    pool.next = 0;
+    pool.parsed = 0;
+
+    /* the calling thread is one of the workers, and does everything if no thread can be started */
+    threads = num_threads > 1 ? malloc((num_threads - 1) * sizeof(*threads)) : 0;
+
+    for (i = 1; i < num_threads; ++i)
+    {
+#ifdef WIN32
+        if ((threads[started] = CreateThread(0, 0, parse_pool_thread, &pool, 0, 0)) != 0)
+            ++started;
+#else
+        if (pthread_create(&threads[started], 0, parse_pool_thread, &pool) == 0)
+            ++started;
+#endif
+    }
+
+    parse_pool_work(&pool);
+
+    for (i = 0; i < started; ++i)
+    {
+#ifdef WIN32
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], 0);
+#endif
+    }
+
+    free(threads);
+    return (int) pool.parsed;
+} /* parse_many() */
+
+/* parallel parse */
+
+/* smaller inputs are not worth a thread */
+#define PARALLEL_MIN_CHUNK 65536
+
+int kscope_parser_parse_parallel(const kscope_parser_t *parser, char *fname, int num_threads, kscope_syntax_node_t **parse_tree, void **input_buf, void **error_list)
+{
+    kscope_parser_t defaults;
+    input_buffer_t *ib;
+    parallel_parse_t par;
+    parallel_chunk_t *chunk;
+    int i, len, begin, res;
+
+    if (!parser)
+    {
+        parser_init(&defaults);
+        parser = &defaults;
+    }
+
+    if (!(ib = input_buffer_create_mapped(fname)))
+        return 0;
+    *input_buf = ib;
+
+    len = ib->bytes_read;
+    if (num_threads <= 0)
+        num_threads = parse_pool_processors();
+    if (num_threads > len / PARALLEL_MIN_CHUNK)
+        num_threads = len / PARALLEL_MIN_CHUNK;
+    if (num_threads < 2)
+        return parse_input_buffer(parser, ib, 0, parse_tree, error_list, 0, 0, 0);
+
+    /* the calling thread parses from the start; each worker starts at the first unindented line */
+    /* past an even split, and parses until it has passed the next worker's start */
+    par.chunks = (parallel_chunk_t *) calloc(num_threads - 1, sizeof(parallel_chunk_t));
+    par.num_chunks = par.joined = par.cur = 0;
+
+    for (i = 1, begin = 0; i < num_threads; ++i)
+    {
+        int pos = parallel_next_line(ib, (int) ((double) len * i / num_threads), len);
+
+        if (pos <= begin || pos >= len)
+            continue;
+
+        chunk = par.chunks + par.num_chunks++;
+        chunk->begin = begin = pos;
+        chunk->end = len;
+        if (par.num_chunks > 1)
+            chunk[-1].end = pos;
+
+        array_init(&chunk->items, sizeof(parallel_item_t), 0);
+        array_init(&chunk->children, sizeof(kscope_syntax_node_t *), 0);
+        chunk->parser = parser;
+        chunk->ib = ib;
+    }
+
+    for (i = 0; i < par.num_chunks; ++i)
+        parallel_start(par.chunks + i);
+
+    res = parse_input_buffer(parser, ib, 0, parse_tree, error_list, 0, 0, &par);
+    parallel_finish(&par);
+
+    /* the errors of a failed parse are the ones the sequential parse reports */
+    if (!res)
+    {
+        kscope_destroy_error_list(*error_list);
+        res = parse_input_buffer(parser, ib, 0, parse_tree, error_list, 0, 0, 0);
+    }
+
+    return res;
+} /* parser_parse_parallel() */
+
+/* flat syntax trees */
+
+kscope_flat_tree_t *kscope_flat_tree_create(void)
+{
+    return (kscope_flat_tree_t *) calloc(1, sizeof(kscope_flat_tree_t));
+} /* flat_tree_create() */
+
+void kscope_flat_tree_destroy(kscope_flat_tree_t *tree)
+{
+    if (!tree)
+        return;
+
+    free(tree->nodes);
+    free(tree);
+} /* flat_tree_destroy() */
+
+static int flat_tree_add(kscope_flat_tree_t *tree, kscope_syntax_node_t *node)
+{
+    kscope_flat_node_t *flat;
+
+    if (tree->num_nodes == tree->cap)
+    {
+        tree->cap = tree->cap ? tree->cap * 2 : 256;
+        tree->nodes = (kscope_flat_node_t *) realloc(tree->nodes, tree->cap * sizeof(kscope_flat_node_t));
+    }
+
+    flat = tree->nodes + tree->num_nodes;
+    flat->type = node->type;
+    flat->begin = node->begin;
+    flat->end = node->end;
+    flat->first_child = -1;
+    flat->next_sibling = -1;
+
+    return tree->num_nodes++;
+} /* flat_tree_add() */
+
+typedef struct _flatten_frame_t
+{
+    kscope_syntax_node_t *node;
+    int index;                 /* where node went in the flat tree */
+    int next;                  /* next child of node to copy */
+    int last;                  /* flat index of the last child copied, or -1 */
+}
+flatten_frame_t;
+
+void kscope_flatten(kscope_flat_tree_t *tree, kscope_syntax_node_t *root)
+{
+    array_t stack;
+    flatten_frame_t frame, *top;
+
+    assert(tree);
+
+    tree->num_nodes = 0;
+    tree->ib = root ? root->ib : 0;
+
+    if (!root)
+        return;
+
+    /* the stack holds the path from the root, so nodes are copied in pre-order without recursing */
+    array_init(&stack, sizeof(flatten_frame_t), 0);
+    frame.node = root;
+    frame.index = flat_tree_add(tree, root);
+    frame.next = 0;
+    frame.last = -1;
+    array_add(&stack, &frame);
+
+    while (array_size(&stack))
+    {
+        top = (flatten_frame_t *) array_item(&stack, array_size(&stack) - 1);
+
+        if (top->next < top->node->children)
+        {
+            frame.node = top->node->child[top->next++];
+            frame.index = flat_tree_add(tree, frame.node);
+            frame.next = 0;
+            frame.last = -1;
+
+            if (top->last < 0)
+                tree->nodes[top->index].first_child = frame.index;
+            else
+                tree->nodes[top->last].next_sibling = frame.index;
+
+            top->last = frame.index;
+            array_add(&stack, &frame);
+        }
+        else
+        {
+            stack.num--;
+        }
+    }
+
+    array_deinit(&stack);
+} /* flatten() */
+
+int kscope_flat_children(const kscope_flat_tree_t *tree, int node)
+{
+    int n = 0, cur;
+
+    for (cur = tree->nodes[node].first_child; cur >= 0; cur = tree->nodes[cur].next_sibling)
+        ++n;
+
+    return n;
+} /* flat_children() */
+
+int kscope_flat_child(const kscope_flat_tree_t *tree, int node, int idx)
+{
+    int cur;
+
+    for (cur = tree->nodes[node].first_child; cur >= 0 && idx > 0; cur = tree->nodes[cur].next_sibling)
+        --idx;
+
+    return idx < 0 ? -1 : cur;
+} /* flat_child() */
+
+int kscope_flat_first_line(const kscope_flat_tree_t *tree, int node)
+{
+    return input_buffer_line((input_buffer_t *) tree->ib, tree->nodes[node].begin);
+}
+
+int kscope_flat_last_line(const kscope_flat_tree_t *tree, int node)
+{
+    const kscope_flat_node_t *flat = tree->nodes + node;
+    return input_buffer_line((input_buffer_t *) tree->ib, flat->begin < flat->end ? flat->end - 1 : flat->begin);
+}
+
+wchar_t *kscope_flat_get_wstr(const kscope_flat_tree_t *tree, int node)
+{
+    array_t str;
+    wchar_t *res;
+
+    array_init(&str, sizeof(wchar_t), 0);
+    input_buffer_read_wstring((input_buffer_t *) tree->ib, tree->nodes[node].begin, tree->nodes[node].end, &str);
+    res = wcs_dup(str.data);
+    array_deinit(&str);
+    return res;
+}
+
+char *kscope_flat_get_str(const kscope_flat_tree_t *tree, int node)
+{
+    array_t str;
+    char *res;
+
+    array_init(&str, sizeof(char), 0);
+    input_buffer_read_string((input_buffer_t *) tree->ib, tree->nodes[node].begin, tree->nodes[node].end, &str);
+    res = str_dup(str.data);
+    array_deinit(&str);
+    return res;
+}
+
+void kscope_flat_traverse_preorder(const kscope_flat_tree_t *tree, int root, void *data, kscope_flat_process_ft entry_func, kscope_flat_process_ft exit_func)
+{
+    array_t stack;
+    int node = root;
+
+    if (root < 0 || root >= tree->num_nodes)
+        return;
+
+    /* nodes are visited in array order; the stack only remembers which parents still need exit_func */
+    array_init(&stack, sizeof(int), 0);
+
+    for (;;)
+    {
+        if (entry_func == NULL || !entry_func(tree, node, data))
+        {
+            if (tree->nodes[node].first_child >= 0)
+            {
+                array_add(&stack, &node);
+                node = tree->nodes[node].first_child;
+                continue;
+            }
+
+            if (exit_func != NULL)
+                exit_func(tree, node, data);
+        }
+
+        while (node != root && tree->nodes[node].next_sibling < 0)
+        {
+            node = *(int *) array_item(&stack, array_size(&stack) - 1);
+            stack.num--;
+            if (exit_func != NULL)
+                exit_func(tree, node, data);
+        }
+
+        if (node == root)
+            break;
+
+        node = tree->nodes[node].next_sibling;
+    }
+
+    array_deinit(&stack);
+} /* flat_traverse_preorder() */
+
+int kscope_parse_flat(char *fname, kscope_flat_tree_t *tree, void **input_buf, void **error_list)
+{
+    kscope_arena_t *arena = kscope_arena_create();
+    kscope_syntax_node_t *root = 0;
+    kscope_parser_t parser;
+    int res;
+
+    assert(tree);
+
+    /* the pointer tree only lives until it has been copied, so it comes from an arena */
+    parser_init(&parser);
+    res = parse_file(&parser, fname, arena, &root, input_buf, error_list);
+    kscope_flatten(tree, root);
+    kscope_arena_destroy(arena);
+
+    return res;
 }
 
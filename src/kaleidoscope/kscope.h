@@ -2,7 +2,7 @@
 #define KSCOPE_KSCOPE_H
 
 /*
- * generated Mon Mar 30 21:04:44 2009
+ * generated Sat Oct 17 22:39:06 2026
  */
 
 #ifdef WIN32
@@ -11,6 +11,8 @@
 #define snprintf _snprintf
 #endif
 
+#include <stddef.h>
+#include <stdio.h>
 #include <wchar.h>
 
 #ifdef __cplusplus
@@ -28,52 +30,60 @@ enum kscope_node_type
 	KSCOPE_EXTERN_NODE = 4,
 	KSCOPE_PROTO_NODE = 5,
 	KSCOPE_EXPR_NODE = 6,
-	KSCOPE_BINOPRHS_NODE = 7,
-	KSCOPE_UNARY_NODE = 8,
-	KSCOPE_PRIMARY_NODE = 9,
-	KSCOPE_VAREXPR_NODE = 10,
-	KSCOPE_FOREXPR_NODE = 11,
-	KSCOPE_IFEXPR_NODE = 12,
-	KSCOPE_PAREN_NODE = 13,
-	KSCOPE_IDEXPR_NODE = 14,
-	KSCOPE_IDPROTO_NODE = 15,
-	KSCOPE_BINPROTO_NODE = 16,
-	KSCOPE_UNIPROTO_NODE = 17,
-	KSCOPE_PROTOARG_NODE = 18,
-	KSCOPE_CALL_NODE = 19,
-	KSCOPE_EQEXPR_NODE = 20,
-	KSCOPE_OPERATOR_NODE = 21,
-	KSCOPE_OPERATOR_STR_NODE = 22,
-	KSCOPE_UNKNOWN_NODE = 23,
-	KSCOPE_IDENTIFIER_NODE = 24,
-	KSCOPE_IDENTIFIER_STR_NODE = 25,
-	KSCOPE_NUMBER_NODE = 26,
-	KSCOPE_NUMBER_STR_NODE = 27,
-	KSCOPE_LETTER_NODE = 28,
-	KSCOPE_LEX_NODE = 29,
-	KSCOPE_SEP_NODE = 30,
-	KSCOPE_OPEQL_NODE = 31,
-	KSCOPE_OP_NODE = 32,
-	KSCOPE_CP_NODE = 33,
-	KSCOPE_DEF_KW_NODE = 34,
-	KSCOPE_EXTERN_KW_NODE = 35,
-	KSCOPE_IF_NODE = 36,
-	KSCOPE_THEN_NODE = 37,
-	KSCOPE_ELSE_NODE = 38,
-	KSCOPE_FOR_NODE = 39,
-	KSCOPE_IN_NODE = 40,
-	KSCOPE_BINARY_KW_NODE = 41,
-	KSCOPE_UNARY_KW_NODE = 42,
-	KSCOPE_VAR_NODE = 43,
-	KSCOPE___NODE = 44,
-	KSCOPE_WS_NODE = 45,
-	KSCOPE_COMMENT_NODE = 46,
-	KSCOPE_WHITESPACE_NODE = 47,
-	KSCOPE_EOF_NODE = 48,
-	KSCOPE_NUM_NODE_TYPES = 49
+	KSCOPE_ASSIGNEXPR_NODE = 7,
+	KSCOPE_CMPEXPR_NODE = 8,
+	KSCOPE_ADDEXPR_NODE = 9,
+	KSCOPE_MULEXPR_NODE = 10,
+	KSCOPE_UNARY_NODE = 11,
+	KSCOPE_PRIMARY_NODE = 12,
+	KSCOPE_VAREXPR_NODE = 13,
+	KSCOPE_FOREXPR_NODE = 14,
+	KSCOPE_IFEXPR_NODE = 15,
+	KSCOPE_PAREN_NODE = 16,
+	KSCOPE_IDEXPR_NODE = 17,
+	KSCOPE_IDPROTO_NODE = 18,
+	KSCOPE_BINPROTO_NODE = 19,
+	KSCOPE_UNIPROTO_NODE = 20,
+	KSCOPE_PROTOARG_NODE = 21,
+	KSCOPE_CALL_NODE = 22,
+	KSCOPE_EQEXPR_NODE = 23,
+	KSCOPE_OPERATOR_NODE = 24,
+	KSCOPE_OPERATOR_STR_NODE = 25,
+	KSCOPE_SEQOP_NODE = 26,
+	KSCOPE_ASSIGNOP_NODE = 27,
+	KSCOPE_CMPOP_NODE = 28,
+	KSCOPE_ADDOP_NODE = 29,
+	KSCOPE_MULOP_NODE = 30,
+	KSCOPE_UNKNOWN_NODE = 31,
+	KSCOPE_IDENTIFIER_NODE = 32,
+	KSCOPE_IDENTIFIER_STR_NODE = 33,
+	KSCOPE_NUMBER_NODE = 34,
+	KSCOPE_NUMBER_STR_NODE = 35,
+	KSCOPE_LETTER_NODE = 36,
+	KSCOPE_LEX_NODE = 37,
+	KSCOPE_SEP_NODE = 38,
+	KSCOPE_OPEQL_NODE = 39,
+	KSCOPE_OP_NODE = 40,
+	KSCOPE_CP_NODE = 41,
+	KSCOPE_DEF_KW_NODE = 42,
+	KSCOPE_EXTERN_KW_NODE = 43,
+	KSCOPE_IF_NODE = 44,
+	KSCOPE_THEN_NODE = 45,
+	KSCOPE_ELSE_NODE = 46,
+	KSCOPE_FOR_NODE = 47,
+	KSCOPE_IN_NODE = 48,
+	KSCOPE_BINARY_KW_NODE = 49,
+	KSCOPE_UNARY_KW_NODE = 50,
+	KSCOPE_VAR_NODE = 51,
+	KSCOPE___NODE = 52,
+	KSCOPE_WS_NODE = 53,
+	KSCOPE_COMMENT_NODE = 54,
+	KSCOPE_WHITESPACE_NODE = 55,
+	KSCOPE_EOF_NODE = 56,
+	KSCOPE_NUM_NODE_TYPES = 57
 };
 
-extern const char *kscope_node_names[49];
+extern const char *kscope_node_names[57];
 /* nodes in the abstract syntax tree */
 
 typedef struct _kscope_syntax_node_t
@@ -81,9 +91,10 @@ typedef struct _kscope_syntax_node_t
     int type;                  /* type of node; this is defined above.                    */
     int begin;                 /* input position before the first character of the match  */
     int end;                   /* input position after the last character of the match    */
-    int first_line;            /* line on which the match begins                          */
-    int last_line;             /* line on which the match ends                            */
+    int first_line;            /* line on which the match begins; -1 until asked for      */
+    int last_line;             /* line on which the match ends; -1 until asked for        */
     int children;            /* number of children*/                                      
+    int refs;                  /* reference count; memoized subtrees are shared, not copied. zero for arena nodes */
     struct _kscope_syntax_node_t **child; /* null-terminated array of child nodes                    */
     void *data;
     void *ib; /*Pointer to text buffer*/
@@ -92,12 +103,78 @@ kscope_syntax_node_t;
 
 extern kscope_syntax_node_t *kscope_syntax_node_create(int type, int begin, int end, void* ib);
 extern kscope_syntax_node_t *kscope_syntax_node_copy(kscope_syntax_node_t *node);
-extern void kscope_syntax_node_destroy(kscope_syntax_node_t *node);
+extern void kscope_syntax_node_destroy(kscope_syntax_node_t *node); /* releases one reference; frees the tree when none remain */
 extern int kscope_syntax_node_children(kscope_syntax_node_t *node); /*Returns number of children this node has*/
+extern int kscope_syntax_node_first_line(kscope_syntax_node_t *node); /* looks up and caches first_line; the input must not have been destroyed */
+extern int kscope_syntax_node_last_line(kscope_syntax_node_t *node); /* looks up and caches last_line */
 extern kscope_syntax_node_t *kscope_syntax_node_child(kscope_syntax_node_t *node,int idx);/*Returns child indicated by idx*/
 typedef int (*kscope_syntax_node_process_ft)(kscope_syntax_node_t *node, void *data);
-extern void kscope_syntax_node_traverse_preorder(kscope_syntax_node_t *root, void *data, kscope_syntax_node_process_ft entry_func,kscope_syntax_node_process_ft exit_func);
-extern  kscope_syntax_node_process_ft kscope_dispatch[49];
+#define KSCOPE_SKIP_SUBTREE 1 /* returned by an entry_func to skip the node's children and its exit_func */
+extern void kscope_syntax_node_traverse_preorder(kscope_syntax_node_t *root, void *data, kscope_syntax_node_process_ft entry_func,kscope_syntax_node_process_ft exit_func); /* walks with an explicit stack, so any depth of tree is safe */
+extern  kscope_syntax_node_process_ft kscope_dispatch[57];
+
+/* arena allocation */
+
+typedef struct _kscope_arena_t kscope_arena_t;
+extern kscope_arena_t *kscope_arena_create(void);
+extern void kscope_arena_destroy(kscope_arena_t *arena); /* frees every node allocated from the arena in one call */
+
+/* flat syntax trees: every node in one array, in pre-order, linked by index */
+
+typedef struct _kscope_flat_node_t
+{
+    int type;                  /* type of node; this is defined above.                    */
+    int begin;                 /* input position before the first character of the match  */
+    int end;                   /* input position after the last character of the match    */
+    int first_child;           /* index of the first child, or -1                          */
+    int next_sibling;          /* index of the next child of the same parent, or -1        */
+}
+kscope_flat_node_t;
+
+typedef struct _kscope_flat_tree_t
+{
+    kscope_flat_node_t *nodes;    /* nodes[0] is the root; a loop over the array visits the tree in pre-order */
+    int num_nodes;
+    int cap;
+    void *ib; /*Pointer to text buffer*/
+}
+kscope_flat_tree_t;
+
+extern kscope_flat_tree_t *kscope_flat_tree_create(void);
+extern void kscope_flat_tree_destroy(kscope_flat_tree_t *tree); /* does not destroy the input buffer */
+extern void kscope_flatten(kscope_flat_tree_t *tree, kscope_syntax_node_t *root); /* replaces the contents of tree with a copy of root, reusing its storage */
+extern int kscope_flat_children(const kscope_flat_tree_t *tree, int node); /*Returns number of children this node has*/
+extern int kscope_flat_child(const kscope_flat_tree_t *tree, int node, int idx); /* returns the index of child idx, or -1 */
+extern int kscope_flat_first_line(const kscope_flat_tree_t *tree, int node);
+extern int kscope_flat_last_line(const kscope_flat_tree_t *tree, int node);
+extern wchar_t *kscope_flat_get_wstr(const kscope_flat_tree_t *tree, int node);
+extern char *kscope_flat_get_str(const kscope_flat_tree_t *tree, int node);
+typedef int (*kscope_flat_process_ft)(const kscope_flat_tree_t *tree, int node, void *data);
+extern void kscope_flat_traverse_preorder(const kscope_flat_tree_t *tree, int root, void *data, kscope_flat_process_ft entry_func, kscope_flat_process_ft exit_func); /* a nonzero return from entry_func skips the node's children and exit_func */
+
+/* parser contexts: everything a parse reads besides its input, so that threads can parse independently */
+
+typedef struct _kscope_parser_t
+{
+    kscope_syntax_node_process_ft dispatch[57]; /* called with each node of that type as it is built */
+    void *data;                /* passed to the dispatch functions */
+    int wish_node;             /* a failure to match this node type dumps the error list */
+    kscope_arena_t *arena;        /* builds trees in this arena when set; null for the heap */
+    int use_mmap;              /* maps files whole instead of reading them */
+}
+kscope_parser_t;
+
+typedef struct _kscope_parse_job_t
+{
+    char *fname;               /* file to parse, or null to parse data */
+    const char *data;          /* buffer to parse when fname is null; it must outlive the input buffer */
+    size_t len;
+    int res;                   /* the rest are filled in as by _parse() */
+    kscope_syntax_node_t *parse_tree;
+    void *input_buffer;
+    void *error_list;
+}
+kscope_parse_job_t;
 
 /* error handling */
 
@@ -114,6 +191,41 @@ extern void kscope_add_error(void *error_list, int pos, wchar_t *str); /* add an
 extern int kscope_num_errors(void *error_list); /* returns the number of errors in the list */
 extern kscope_error_rec_t *kscope_get_error(void *error_list, int index);
 
+/* counters kept by a parser compiled with KSCOPE_STATS defined */
+
+typedef struct _kscope_parse_stats_t
+{
+    long long memo_lookups;    /* rule calls that looked for a memoized result */
+    long long memo_hits;       /* lookups that found one */
+    long long memo_records;    /* records added to the memo map */
+    long long memo_peak;       /* most records held at once */
+    long long nodes;           /* nodes built, including those backtracking dropped */
+    long long failures;        /* rule calls that failed; the farthest make the syntax error */
+}
+kscope_parse_stats_t;
+
+extern int kscope_parse_stats(void *error_list, kscope_parse_stats_t *stats); /* the counters of the parse that made error_list; returns 0, with them zeroed, unless the parser was compiled with KSCOPE_STATS */
+
+/* counters kept for each rule by a parser compiled with KSCOPE_PROFILE defined; cycles are */
+/* nanoseconds where there is no cycle counter */
+
+typedef struct _kscope_rule_profile_t
+{
+    long long calls;
+    long long memo_hits;       /* calls that found the result memoized */
+    long long memo_misses;     /* calls of a memoized rule that did not */
+    long long successes;
+    long long failures;
+    long long consumed;        /* bytes matched by the calls that succeeded */
+    long long backtracked;     /* bytes matched inside the calls that failed, then given up */
+    long long cycles;          /* spent in the calls, including the rules they called */
+    long long self_cycles;     /* spent in the calls but not in the rules they called */
+}
+kscope_rule_profile_t;
+
+extern int kscope_profile(void *error_list, kscope_rule_profile_t *rules); /* copies the counters of the parse that made error_list into rules[KSCOPE_NUM_NODE_TYPES], by node type; returns 0, with them zeroed, unless the parser was compiled with KSCOPE_PROFILE */
+extern void kscope_profile_report(void *error_list, FILE *out); /* prints the counters by rule, the most self cycles first */
+
 /* input buffers */
 
 extern wchar_t *kscope_get_wstr(kscope_syntax_node_t *node);
@@ -123,6 +235,21 @@ extern void kscope_destroy_input_buffer(void *ib);
 /* main parse function */
 
 extern int kscope_parse(char *fname, kscope_syntax_node_t **parse_tree, void **input_buffer, void **error_list);
+extern int kscope_parse_arena(char *fname, kscope_arena_t *arena, kscope_syntax_node_t **parse_tree, void **input_buffer, void **error_list); /* the tree is owned by the arena */
+
+/* The following take an optional arena; pass null to build the tree on the heap. */
+extern int kscope_parse_mmap(char *fname, kscope_arena_t *arena, kscope_syntax_node_t **parse_tree, void **input_buffer, void **error_list); /* maps the whole file instead of reading it */
+extern int kscope_parse_mem(const char *data, size_t len, kscope_arena_t *arena, kscope_syntax_node_t **parse_tree, void **input_buffer, void **error_list); /* parses the caller's buffer in place; it must outlive the input buffer */
+extern int kscope_parse_stream(char *fname, kscope_syntax_node_process_ft callback, void *data, void **input_buffer, void **error_list); /* hands each subtree of the start rule's top-level repetition to callback, then frees it; a nonzero return stops the parse */
+extern int kscope_parse_flat(char *fname, kscope_flat_tree_t *tree, void **input_buffer, void **error_list); /* leaves the parse tree in tree instead of on the heap */
+
+/* The _parse functions above use _dispatch and _wish_node; the following use a parser context. */
+extern kscope_parser_t *kscope_parser_create(void); /* starts from the current _dispatch and _wish_node */
+extern void kscope_parser_destroy(kscope_parser_t *parser); /* does not destroy the arena */
+extern int kscope_parser_parse(kscope_parser_t *parser, char *fname, kscope_syntax_node_t **parse_tree, void **input_buffer, void **error_list);
+extern int kscope_parser_parse_mem(kscope_parser_t *parser, const char *data, size_t len, kscope_syntax_node_t **parse_tree, void **input_buffer, void **error_list);
+extern int kscope_parse_many(const kscope_parser_t *parser, kscope_parse_job_t *jobs, int num_jobs, int num_threads); /* parses the jobs on num_threads workers (0 for one per processor), each with its own copy of parser; trees are on the heap; returns the number that parsed */
+extern int kscope_parser_parse_parallel(const kscope_parser_t *parser, char *fname, int num_threads, kscope_syntax_node_t **parse_tree, void **input_buffer, void **error_list); /* splits the start rule's top-level repetition between num_threads workers (0 for one per processor); dispatch functions run on the workers, also for subtrees that are then dropped; trees are on the heap */
 
 #ifdef __cplusplus
 }
@@ -38,6 +38,23 @@
 #include <string.h>
 #include <wchar.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NU_SSE2
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+static int nu_ctz(unsigned int mask)
+{
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int) index;
+} /* nu_ctz() */
+#else
+#define nu_ctz(mask) __builtin_ctz(mask)
+#endif
+
 #define INPUT_BUFFER_SIZE_INCREMENT 8192
 
 input_buffer_t *input_buffer_create(const char *name, FILE *f)
@@ -155,64 +172,91 @@ void input_buffer_read_string(input_buffer_t *ib, const int begin, const int end
 
 
 
+/** Returns the first carriage return or line feed in [p, end), or end if there is none. */
+static const char *find_eol(const char *p, const char *end)
+{
+#if defined(NU_SSE2)
+    const __m128i lf = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+
+    while (end - p >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) p);
+        unsigned int mask = (unsigned int) _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)));
+
+        if (mask)
+            return p + nu_ctz(mask);
+
+        p += 16;
+    }
+#endif
+
+    while (p < end && *p != '\n' && *p != '\r')
+        ++p;
+
+    return p;
+} /* find_eol() */
+
 /** 
  * Goes through and finds the lengths of all the line endings in the input buffer (in bytes). 
+ * A line ends after a line feed, a carriage return / line feed pair, or a lone carriage return.
+ * The last entry is always the end of the input.
  * \param end_offsets A pre-initialized array of int to store line offsets.
  * \param ib The input buffer to search.
  * \param start_pos The position in the input buffer in which to start.
  */
 void input_buffer_find_line_endings(array_t *end_offsets, input_buffer_t *ib, int start_pos)
 {
-    wchar_t ch, eol_pos = 0;
+    const char *p, *end;
     int pos;
 
-    input_buffer_setpos(ib, start_pos);
+    /* pull the rest of the file into the buffer so it can be scanned in one pass */
+    input_buffer_setpos(ib, ib->bytes_read);
+    while (input_buffer_read_char(ib) != WEOF)
+        input_buffer_setpos(ib, ib->bytes_read);
 
-    do
+    if (start_pos < ib->bytes_read)
     {
-        ch = input_buffer_read_char(ib);
+        p = ib->buf + start_pos;
+        end = ib->buf + ib->bytes_read;
 
-        if (ch == L'\n')
+        while ((p = find_eol(p, end)) < end)
         {
-            pos = input_buffer_getpos(ib);
-            array_add(end_offsets, &pos);
-            eol_pos = 0;
-        }
-        else if (ch == L'\r')
-        {
-            eol_pos = input_buffer_getpos(ib);
-        }
-        else
-        {
-            if (eol_pos > 0)
-            {
-                pos = eol_pos;
-                array_add(end_offsets, &pos);
-            }
+            if (*p == '\r' && p + 1 < end && p[1] == '\n')
+                ++p;
 
-            eol_pos = 0;
+            pos = (int) (++p - ib->buf);
+            array_add(end_offsets, &pos);
         }
     }
-    while (ch != WEOF);
 
-    pos = input_buffer_getpos(ib);
+    pos = ib->bytes_read;
     array_add(end_offsets, &pos);
-} /* find_line_lengths() */
+} /* input_buffer_find_line_endings() */
 
 /** Given a particular character offset, figures out which lines it's on. */
 int input_buffer_find_line(int pos, array_t *end_offsets)
 {
-    int n, i, len = array_size(end_offsets);
-    for (i = 0; i < len; ++i)
+    int lo = 0, hi = array_size(end_offsets), mid;
+
+    if (!hi)
+        return -1;
+
+    /* find the first line that ends after pos */
+    while (lo < hi)
     {
-        n = * (int *) array_item(end_offsets, i);
-        if (pos < n)
-            return i+1;
+        mid = lo + (hi - lo) / 2;
+
+        if (* (int *) array_item(end_offsets, mid) > pos)
+            hi = mid;
+        else
+            lo = mid + 1;
     }
 
-    if (pos == n)
-        return len;
+    if (lo < array_size(end_offsets))
+        return lo + 1;
+    else if (pos == * (int *) array_item(end_offsets, lo - 1))
+        return lo;
     else
         return -1;
-} /* find_line() */
+} /* input_buffer_find_line() */
 
@@ -0,0 +1,954 @@
+/*
+ * Copyright (c) 2006, The Narwhal Project 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    * Neither the name of the Narwhal Project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */ 
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <assert.h>
+#include "internal.h"
+
+/*************************************************/
+
+/**
+ * Stores the sets computed while deciding which rules to memoize.
+ * Sets of rules are byte arrays indexed like the rule records.
+ */
+typedef struct _memo_context
+{
+    array_t *rule_records;  /* array of rule_rec_t * */
+    int num_rules;
+
+    char *nullable;         /* the rule can succeed without consuming input */
+    char **start;           /* rules invoked, directly or not, at the offset the rule starts at */
+    char **end;             /* rules that may be invoked at the offset the rule ends at */
+    char *candidate;        /* rules that may be re-invoked at the same offset after backtracking */
+
+    int direct;             /* exp_start() leaves out the rules the rules it adds invoke */
+    int changed;
+}
+memo_context;
+
+/*************************************************/
+
+static int rule_index(memo_context *context, const wchar_t *name)
+{
+    int i;
+
+    for (i = 0; i < context->num_rules; ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(context->rule_records, i);
+        if (wcscmp(rec->rule_name, name) == 0)
+            return i;
+    }
+
+    return -1;
+} /* rule_index() */
+
+
+static char *set_create(memo_context *context)
+{
+    return (char *) calloc(context->num_rules + 1, 1);
+} /* set_create() */
+
+
+static int set_union(memo_context *context, char *dest, const char *src)
+{
+    int i, changed = 0;
+
+    for (i = 0; i < context->num_rules; ++i)
+    {
+        if (src[i] && !dest[i])
+            changed = dest[i] = 1;
+    }
+
+    return changed;
+} /* set_union() */
+
+/*************************************************/
+
+static int exp_nullable(memo_context *context, const rule_exp_t *exp)
+{
+    int i;
+
+    switch (exp->type)
+    {
+    case RULE_EXP_SEQ:
+        return exp_nullable(context, exp->left) && exp_nullable(context, exp->right);
+    case RULE_EXP_DISJ:
+        return exp_nullable(context, exp->left) || exp_nullable(context, exp->right);
+    case RULE_EXP_STAR:
+    case RULE_EXP_QUES:
+    case RULE_EXP_BANG:
+    case RULE_EXP_AMP:
+    case RULE_EXP_CUT:
+        return 1;
+    case RULE_EXP_PLUS:
+    case RULE_EXP_HIDE:
+        return exp_nullable(context, exp->left);
+    case RULE_EXP_CALL:
+        i = rule_index(context, exp->data.str);
+        return i >= 0 && context->nullable[i];
+    case RULE_EXP_STR:
+        return exp->data.str[0] == 0;
+    }
+
+    return 0;
+} /* exp_nullable() */
+
+
+/**
+ * Adds the rules EXP invokes at its own start offset to SET, along with the rules those invoke there.
+ */
+static void exp_start(memo_context *context, const rule_exp_t *exp, char *set)
+{
+    int i;
+
+    switch (exp->type)
+    {
+    case RULE_EXP_SEQ:
+        exp_start(context, exp->left, set);
+        if (exp_nullable(context, exp->left))
+            exp_start(context, exp->right, set);
+        break;
+    case RULE_EXP_DISJ:
+        exp_start(context, exp->left, set);
+        exp_start(context, exp->right, set);
+        break;
+    case RULE_EXP_STAR:
+    case RULE_EXP_PLUS:
+    case RULE_EXP_QUES:
+    case RULE_EXP_BANG:
+    case RULE_EXP_AMP:
+    case RULE_EXP_HIDE:
+        exp_start(context, exp->left, set);
+        break;
+    case RULE_EXP_CALL:
+        if ((i = rule_index(context, exp->data.str)) >= 0)
+        {
+            set[i] = 1;
+            if (!context->direct)
+                set_union(context, set, context->start[i]);
+        }
+        break;
+    }
+} /* exp_start() */
+
+
+/**
+ * Adds the rules EXP may invoke at the offset where it ends to SET: the attempts
+ * that end a repetition, and rules that succeed there without consuming input.
+ */
+static void exp_end(memo_context *context, const rule_exp_t *exp, char *set)
+{
+    int i;
+
+    switch (exp->type)
+    {
+    case RULE_EXP_SEQ:
+        exp_end(context, exp->right, set);
+        if (exp_nullable(context, exp->right))
+        {
+            exp_end(context, exp->left, set);
+            exp_start(context, exp->right, set);
+        }
+        break;
+    case RULE_EXP_DISJ:
+        exp_end(context, exp->left, set);
+        exp_end(context, exp->right, set);
+        if (exp_nullable(context, exp->right))
+            exp_start(context, exp->left, set);
+        break;
+    case RULE_EXP_STAR:
+    case RULE_EXP_PLUS:
+    case RULE_EXP_QUES:
+        exp_start(context, exp->left, set);
+        exp_end(context, exp->left, set);
+        break;
+    case RULE_EXP_BANG:
+    case RULE_EXP_AMP:
+        exp_start(context, exp->left, set);
+        break;
+    case RULE_EXP_HIDE:
+        exp_end(context, exp->left, set);
+        break;
+    case RULE_EXP_CALL:
+        if ((i = rule_index(context, exp->data.str)) >= 0)
+        {
+            if (context->nullable[i])
+                set[i] = 1;
+            set_union(context, set, context->end[i]);
+        }
+        break;
+    }
+} /* exp_end() */
+
+/*************************************************/
+
+/**
+ * Marks the rules invoked at the same offset by both A and B. If both sets start at
+ * that offset (OUTER_ONLY), a rule only reached through another marked one is
+ * skipped, since memoizing the outer rule is enough.
+ */
+static void mark_overlap(memo_context *context, const char *a, const char *b, int outer_only)
+{
+    int i, j;
+
+    for (i = 0; i < context->num_rules; ++i)
+    {
+        int outer = 1;
+
+        if (!a[i] || !b[i])
+            continue;
+
+        for (j = 0; j < context->num_rules && outer && outer_only; ++j)
+        {
+            if (j != i && a[j] && b[j] && context->start[j][i] && !context->start[i][j])
+                outer = 0;
+        }
+
+        if (outer)
+            context->candidate[i] = 1;
+    }
+} /* mark_overlap() */
+
+
+/* whether A and B are the same call, string, class or dot */
+static int same_element(const rule_exp_t *a, const rule_exp_t *b)
+{
+    if (a->type != b->type)
+        return 0;
+
+    switch (a->type)
+    {
+    case RULE_EXP_CALL:
+    case RULE_EXP_STR:
+    case RULE_EXP_CLASS:
+        return wcscmp(a->data.str, b->data.str) == 0;
+    case RULE_EXP_DOT:
+        return 1;
+    }
+
+    return 0;
+} /* same_element() */
+
+
+/**
+ * Marks the rules two alternatives both invoke at their start, and after any
+ * prefix of elements they share, since those run again at the same offsets.
+ */
+static void mark_shared(memo_context *context, const rule_exp_t *a, const rule_exp_t *b)
+{
+    while (a && b)
+    {
+        const rule_exp_t *head_a = a->type == RULE_EXP_SEQ ? a->left : a;
+        const rule_exp_t *head_b = b->type == RULE_EXP_SEQ ? b->left : b;
+        char *set_a = set_create(context), *set_b = set_create(context);
+
+        exp_start(context, a, set_a);
+        exp_start(context, b, set_b);
+        mark_overlap(context, set_a, set_b, 1);
+
+        free(set_a);
+        free(set_b);
+
+        if (!same_element(head_a, head_b))
+            break;
+
+        a = a->type == RULE_EXP_SEQ ? a->right : 0;
+        b = b->type == RULE_EXP_SEQ ? b->right : 0;
+    }
+} /* mark_shared() */
+
+
+static void exp_candidates(memo_context *context, const rule_exp_t *exp)
+{
+    const rule_exp_t *alt;
+    char *set_a, *set_b;
+
+    switch (exp->type)
+    {
+    case RULE_EXP_SEQ:
+        /* the right side starts where the left side ended, possibly after invoking rules there */
+        set_a = set_create(context);
+        set_b = set_create(context);
+        exp_end(context, exp->left, set_a);
+        if (exp_nullable(context, exp->left))
+            exp_start(context, exp->left, set_a);
+        exp_start(context, exp->right, set_b);
+        mark_overlap(context, set_a, set_b, 0);
+        free(set_a);
+        free(set_b);
+
+        exp_candidates(context, exp->left);
+        exp_candidates(context, exp->right);
+        break;
+    case RULE_EXP_DISJ:
+        /* the first alternative against each of the others */
+        for (alt = exp->right; alt; alt = alt->type == RULE_EXP_DISJ ? alt->right : 0)
+            mark_shared(context, exp->left, alt->type == RULE_EXP_DISJ ? alt->left : alt);
+
+        exp_candidates(context, exp->left);
+        exp_candidates(context, exp->right);
+        break;
+    case RULE_EXP_STAR:
+    case RULE_EXP_PLUS:
+        /* each iteration starts where the previous one ended */
+        set_a = set_create(context);
+        set_b = set_create(context);
+        exp_end(context, exp->left, set_a);
+        exp_start(context, exp->left, set_b);
+        mark_overlap(context, set_a, set_b, 0);
+        free(set_a);
+        free(set_b);
+
+        exp_candidates(context, exp->left);
+        break;
+    case RULE_EXP_QUES:
+    case RULE_EXP_BANG:
+    case RULE_EXP_AMP:
+    case RULE_EXP_HIDE:
+        exp_candidates(context, exp->left);
+        break;
+    }
+} /* exp_candidates() */
+
+/*************************************************/
+
+static void memo_context_init(memo_context *context, array_t *rule_records)
+{
+    char *set;
+    int i;
+
+    context->rule_records = rule_records;
+    context->num_rules = array_size(rule_records);
+    context->nullable = set_create(context);
+    context->candidate = set_create(context);
+    context->start = (char **) calloc(context->num_rules + 1, sizeof(char *));
+    context->end = (char **) calloc(context->num_rules + 1, sizeof(char *));
+    context->direct = 0;
+
+    for (i = 0; i < context->num_rules; ++i)
+    {
+        context->start[i] = set_create(context);
+        context->end[i] = set_create(context);
+    }
+
+    /* nullable rules, start and end sets, to a fixed point */
+    do
+    {
+        context->changed = 0;
+
+        for (i = 0; i < context->num_rules; ++i)
+        {
+            rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+
+            /* the scanner matches token rules without invoking the rules in them */
+            if (!rec->rule_spec || rec->token)
+                continue;
+
+            if (!context->nullable[i] && exp_nullable(context, rec->rule_spec))
+                context->changed = context->nullable[i] = 1;
+
+            set = set_create(context);
+            exp_start(context, rec->rule_spec, set);
+            context->changed |= set_union(context, context->start[i], set);
+            free(set);
+
+            set = set_create(context);
+            exp_end(context, rec->rule_spec, set);
+            context->changed |= set_union(context, context->end[i], set);
+            free(set);
+        }
+    }
+    while (context->changed);
+} /* memo_context_init() */
+
+
+static void memo_context_deinit(memo_context *context)
+{
+    int i;
+
+    for (i = 0; i < context->num_rules; ++i)
+    {
+        free(context->start[i]);
+        free(context->end[i]);
+    }
+
+    free(context->start);
+    free(context->end);
+    free(context->nullable);
+    free(context->candidate);
+} /* memo_context_deinit() */
+
+/*************************************************/
+
+/* whether the rule at INDEX is memoized, once the candidates are marked and check_grammar() has found the left recursion */
+static int memo_decision(const memo_context *context, const rule_rec_t *rec, int index)
+{
+    /* the scanner remembers token matches itself */
+    if (rec->token)
+        return 0;
+    if (rec->left_recursion == RULE_LR_LEADER)
+        return 1;
+    if (rec->left_recursion == RULE_LR_INVOLVED)
+        return 0;
+    if (rec->memo == RULE_MEMO_ON)
+        return 1;
+    if (rec->memo == RULE_MEMO_OFF)
+        return 0;
+
+    return context->candidate[index];
+} /* memo_decision() */
+
+
+void analyse_memoization(array_t *rule_records)
+{
+    memo_context context;
+    int i;
+
+    memo_context_init(&context, rule_records);
+
+    /* rules that backtracking can re-invoke at the same offset */
+    for (i = 0; i < context.num_rules; ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+
+        if (rec->rule_spec && !rec->token)
+            exp_candidates(&context, rec->rule_spec);
+    }
+
+    for (i = 0; i < context.num_rules; ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+        rec->memoized = memo_decision(&context, rec, i);
+    }
+
+    memo_context_deinit(&context);
+} /* analyse_memoization() */
+
+/*************************************************/
+
+/**
+ * Stores what check_grammar() needs besides the sets the memoization analysis computes.
+ */
+typedef struct _check_context
+{
+    memo_context memo;
+
+    char *infallible;       /* the rule succeeds on any input */
+    char **direct;          /* rules invoked directly at the offset the rule starts at */
+
+    rule_rec_t *rec;        /* the rule being checked */
+    array_t *errors, *warnings;
+}
+check_context;
+
+/*************************************************/
+
+static void report(array_t *list, int pos, const wchar_t *msg, const wchar_t *name, const wchar_t *detail)
+{
+    int len;
+    wchar_t *buf;
+
+    if (!list)
+        return;
+
+    len = (int) (wcslen(msg) + wcslen(name) + (detail ? wcslen(detail) : 0) + 32);
+    buf = (wchar_t *) calloc(len + 1, sizeof(wchar_t));
+    swprintf(buf, len, msg, name, detail);
+    add_error(list, pos, buf);
+    free(buf);
+} /* report() */
+
+
+/* whether EXP has a cut outside the rules it calls, which can make a choice around it fail */
+static int exp_has_cut(const rule_exp_t *exp)
+{
+    if (!exp)
+        return 0;
+
+    if (exp->type == RULE_EXP_CUT)
+        return 1;
+
+    if (exp->type == RULE_EXP_CALL || exp->type == RULE_EXP_STR || exp->type == RULE_EXP_CLASS)
+        return 0;
+
+    return exp_has_cut(exp->left) || exp_has_cut(exp->right);
+} /* exp_has_cut() */
+
+
+static int exp_infallible(check_context *context, const rule_exp_t *exp)
+{
+    int i;
+
+    switch (exp->type)
+    {
+    case RULE_EXP_SEQ:
+        return exp_infallible(context, exp->left) && exp_infallible(context, exp->right);
+    case RULE_EXP_DISJ:
+        /* a cut in the first alternative can fail the choice before the second is tried */
+        return exp_infallible(context, exp->left) || (!exp_has_cut(exp->left) && exp_infallible(context, exp->right));
+    case RULE_EXP_STAR:
+    case RULE_EXP_QUES:
+        return !exp_has_cut(exp->left);
+    case RULE_EXP_CUT:
+        return 1;
+    case RULE_EXP_PLUS:
+    case RULE_EXP_AMP:
+    case RULE_EXP_HIDE:
+        return exp_infallible(context, exp->left);
+    case RULE_EXP_CALL:
+        i = rule_index(&context->memo, exp->data.str);
+        return i >= 0 && context->infallible[i];
+    case RULE_EXP_STR:
+        return exp->data.str[0] == 0;
+    }
+
+    return 0;
+} /* exp_infallible() */
+
+
+/* adds every rule EXP invokes to SET */
+static void exp_calls(check_context *context, const rule_exp_t *exp, char *set)
+{
+    int i;
+
+    if (!exp)
+        return;
+
+    if (exp->type == RULE_EXP_CALL)
+    {
+        if ((i = rule_index(&context->memo, exp->data.str)) >= 0)
+            set[i] = 1;
+        return;
+    }
+
+    if (exp->type == RULE_EXP_STR || exp->type == RULE_EXP_CLASS)
+        return;
+
+    exp_calls(context, exp->left, set);
+    exp_calls(context, exp->right, set);
+} /* exp_calls() */
+
+/*************************************************/
+
+/**
+ * Whether every match of B starts with a match of A, where A is a single string, class
+ * or dot; an ordered choice then takes A wherever B could match.
+ */
+static int exp_covers(const rule_exp_t *a, const rule_exp_t *b)
+{
+    const wchar_t *ch;
+
+    while (a->type == RULE_EXP_HIDE)
+        a = a->left;
+
+    while (b->type == RULE_EXP_HIDE || b->type == RULE_EXP_SEQ)
+        b = b->left;
+
+    switch (a->type)
+    {
+    case RULE_EXP_STR:
+        return a->data.str[0] && b->type == RULE_EXP_STR && wcsncmp(a->data.str, b->data.str, wcslen(a->data.str)) == 0;
+    case RULE_EXP_DOT:
+        return b->type == RULE_EXP_DOT || ((b->type == RULE_EXP_STR || b->type == RULE_EXP_CLASS) && b->data.str[0]);
+    case RULE_EXP_CLASS:
+        if (b->type == RULE_EXP_STR)
+            return b->data.str[0] && wcschr(a->data.str, b->data.str[0]);
+        if (b->type != RULE_EXP_CLASS || !b->data.str[0])
+            return 0;
+        for (ch = b->data.str; *ch; ++ch)
+        {
+            if (!wcschr(a->data.str, *ch))
+                return 0;
+        }
+        return 1;
+    }
+
+    return 0;
+} /* exp_covers() */
+
+
+/* reports alternatives of the choice EXP that the ones before them keep from ever matching */
+static void check_choice(check_context *context, const rule_exp_t *exp)
+{
+    const rule_exp_t *alt, *earlier, *b;
+
+    for (alt = exp->right; alt; alt = alt->type == RULE_EXP_DISJ ? alt->right : 0)
+    {
+        b = alt->type == RULE_EXP_DISJ ? alt->left : alt;
+
+        for (earlier = exp; earlier != alt; earlier = earlier->right)
+        {
+            if (exp_infallible(context, earlier->left))
+            {
+                report(context->warnings, b->pos, L"alternative in rule '%ls' is never tried, since one before it always succeeds", context->rec->rule_name, 0);
+                return;
+            }
+
+            if (exp_covers(earlier->left, b))
+            {
+                report(context->warnings, b->pos, L"alternative in rule '%ls' never matches, since one before it matches first wherever it could", context->rec->rule_name, 0);
+                break;
+            }
+        }
+    }
+} /* check_choice() */
+
+
+static void check_exp(check_context *context, const rule_exp_t *exp)
+{
+    const rule_exp_t *alt;
+
+    switch (exp->type)
+    {
+    case RULE_EXP_SEQ:
+        check_exp(context, exp->left);
+        check_exp(context, exp->right);
+        break;
+    case RULE_EXP_DISJ:
+        check_choice(context, exp);
+        for (alt = exp; alt->type == RULE_EXP_DISJ; alt = alt->right)
+            check_exp(context, alt->left);
+        check_exp(context, alt);
+        break;
+    case RULE_EXP_STAR:
+    case RULE_EXP_PLUS:
+        /* an iteration that consumes nothing leaves the repetition where it was */
+        if (exp_nullable(&context->memo, exp->left))
+            report(context->errors, exp->pos, L"repetition in rule '%ls' can match the empty string, so it would repeat forever", context->rec->rule_name, 0);
+        check_exp(context, exp->left);
+        break;
+    case RULE_EXP_QUES:
+    case RULE_EXP_BANG:
+    case RULE_EXP_AMP:
+    case RULE_EXP_HIDE:
+        check_exp(context, exp->left);
+        break;
+    }
+} /* check_exp() */
+
+
+/* whether calls at the start offset lead from the rule at INDEX back to it without passing a leader */
+static int leads_back(check_context *context, int index)
+{
+    int num = context->memo.num_rules, *stack, top = 0, i, j, found = 0;
+    char *seen = set_create(&context->memo);
+
+    stack = (int *) malloc((num + 1) * sizeof(int));
+    stack[top++] = index;
+    seen[index] = 1;
+
+    while (top && !found)
+    {
+        i = stack[--top];
+
+        for (j = 0; j < num && !found; ++j)
+        {
+            rule_rec_t *rec = *(rule_rec_t **) array_item(context->memo.rule_records, j);
+
+            if (!context->direct[i][j])
+                continue;
+
+            if (j == index)
+                found = 1;
+            else if (!seen[j] && rec->left_recursion != RULE_LR_LEADER)
+            {
+                seen[j] = 1;
+                stack[top++] = j;
+            }
+        }
+    }
+
+    free(stack);
+    free(seen);
+
+    return found;
+} /* leads_back() */
+
+/*************************************************/
+
+void check_grammar(array_t *rule_records, array_t *errors, array_t *warnings)
+{
+    check_context context;
+    char *kept_out, **kept_reach;
+    int i, j, num, changed;
+
+    memo_context_init(&context.memo, rule_records);
+    num = context.memo.num_rules;
+
+    context.infallible = set_create(&context.memo);
+    context.direct = (char **) calloc(num + 1, sizeof(char *));
+    context.errors = errors;
+    context.warnings = warnings;
+
+    for (i = 0; i < num; ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+
+        context.direct[i] = set_create(&context.memo);
+
+        /* check_token_rules() has checked the token rules */
+        if (!rec->rule_spec || rec->token)
+            continue;
+
+        context.memo.direct = 1;
+        exp_start(&context.memo, rec->rule_spec, context.direct[i]);
+        context.memo.direct = 0;
+    }
+
+    /* rules that cannot fail, to a fixed point */
+    do
+    {
+        changed = 0;
+
+        for (i = 0; i < num; ++i)
+        {
+            rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+
+            if (!rec->rule_spec || rec->token)
+                continue;
+
+            if (!context.infallible[i] && exp_infallible(&context, rec->rule_spec))
+                changed = context.infallible[i] = 1;
+        }
+    }
+    while (changed);
+
+    for (i = 0; i < num; ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+
+        if (!rec->rule_spec || rec->token)
+            continue;
+
+        context.rec = rec;
+        check_exp(&context, rec->rule_spec);
+    }
+
+    /* left recursion: in each cycle of calls at the start offset, the first rule to come back */
+    /* to itself grows a seed, and so does each rule that comes back to itself without passing */
+    /* one of those, as P does in L <- P '.x' / 'x' with P <- P '(n)' / L.  The first of them is */
+    /* the head, whose every pass grows the others again.  The remaining rules parse again on */
+    /* each pass */
+    for (i = 0; i < num; ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+
+        rec->left_recursion = RULE_LR_NONE;
+        rec->lr_head = i;
+        if (rec->rule_spec && !rec->token && context.memo.start[i][i] && leads_back(&context, i))
+            rec->left_recursion = RULE_LR_LEADER;
+    }
+
+    for (i = 0; i < num; ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+
+        if (rec->left_recursion != RULE_LR_LEADER)
+            continue;
+
+        context.rec = rec;
+
+        if (rec->memo == RULE_MEMO_OFF)
+            report(errors, rec->node->begin, L"rule '%ls' is left-recursive, so it cannot be @nomemo: its memo record holds the seed it grows", rec->rule_name, 0);
+
+        for (j = 0; j < num; ++j)
+        {
+            rule_rec_t *other = *(rule_rec_t **) array_item(rule_records, j);
+
+            if (j == i || !context.memo.start[i][j] || !context.memo.start[j][i])
+                continue;
+
+            /* the rules of a cycle are the same from each of its leaders */
+            if (other->left_recursion == RULE_LR_LEADER)
+            {
+                if (j < i)
+                {
+                    rec->lr_head = other->lr_head;
+                    break;
+                }
+                continue;
+            }
+
+            other->left_recursion = RULE_LR_INVOLVED;
+            if (other->memo == RULE_MEMO_ON)
+                report(errors, other->node->begin, L"rule '%ls' cannot be @memo, since it is in the left recursion of '%ls', and a memo record would stop the seed growing", other->rule_name, rec->rule_name);
+        }
+    }
+
+    /* a rule kept out of the memo that backtracking inside its own recursion tries again at */
+    /* the same offset is parsed twice or more at every level, so the time doubles with each; */
+    /* which rules are kept out is decided as analyse_memoization() will decide it */
+    kept_out = set_create(&context.memo);
+    memset(context.memo.candidate, 0, num + 1);
+    for (i = 0; i < num; ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+
+        if (rec->rule_spec && !rec->token)
+            exp_candidates(&context.memo, rec->rule_spec);
+    }
+
+    for (i = 0; i < num; ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+        kept_out[i] = rec->rule_spec && !rec->token && !memo_decision(&context.memo, rec, i);
+    }
+
+    /* a memoized rule in the recursion is parsed once per offset, which bounds the work, */
+    /* so the recursion must go through kept out rules only */
+    kept_reach = (char **) calloc(num + 1, sizeof(char *));
+    for (i = 0; i < num; ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+
+        kept_reach[i] = set_create(&context.memo);
+        if (!kept_out[i])
+            continue;
+
+        exp_calls(&context, rec->rule_spec, kept_reach[i]);
+        for (j = 0; j < num; ++j)
+            kept_reach[i][j] &= kept_out[j];
+    }
+
+    do
+    {
+        changed = 0;
+
+        for (i = 0; i < num; ++i)
+        {
+            for (j = 0; j < num; ++j)
+            {
+                if (kept_reach[i][j])
+                    changed |= set_union(&context.memo, kept_reach[i], kept_reach[j]);
+            }
+        }
+    }
+    while (changed);
+
+    for (i = 0; i < num; ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+
+        if (!kept_reach[i][i])
+            continue;
+
+        for (j = 0; j < num; ++j)
+        {
+            rule_rec_t *caller = *(rule_rec_t **) array_item(rule_records, j);
+
+            if (!kept_reach[i][j] || !kept_reach[j][i])
+                continue;
+
+            /* only a call the backtracking makes itself repeats the work, since one through */
+            /* a memoized rule is looked up the second time */
+            memset(context.memo.candidate, 0, num + 1);
+            context.memo.direct = 1;
+            exp_candidates(&context.memo, caller->rule_spec);
+            context.memo.direct = 0;
+
+            if (!context.memo.candidate[i])
+                continue;
+
+            if (rec->memo == RULE_MEMO_OFF)
+                report(errors, rec->node->begin, L"rule '%ls' is @nomemo, but backtracking in '%ls' tries it again at the same offset at every level of its recursion, which takes exponential time", rec->rule_name, caller->rule_name);
+            else if (rec->left_recursion == RULE_LR_INVOLVED)
+                report(errors, rec->node->begin, L"rule '%ls' cannot be memoized inside a left recursion, but backtracking in '%ls' tries it again at the same offset at every level of its recursion, which takes exponential time", rec->rule_name, caller->rule_name);
+            else
+                report(errors, rec->node->begin, L"rule '%ls' is not memoized, but backtracking in '%ls' tries it again at the same offset at every level of its recursion, which takes exponential time", rec->rule_name, caller->rule_name);
+            break;
+        }
+    }
+
+    /* clean up */
+    for (i = 0; i < num; ++i)
+    {
+        free(context.direct[i]);
+        free(kept_reach[i]);
+    }
+
+    free(context.direct);
+    free(kept_reach);
+    free(kept_out);
+    free(context.infallible);
+    memo_context_deinit(&context.memo);
+} /* check_grammar() */
+
+/*************************************************/
+
+void print_memo_report(array_t *rule_records)
+{
+    int i, len = array_size(rule_records), num = 0;
+
+    for (i = 0; i < len; ++i)
+        num += (*(rule_rec_t **) array_item(rule_records, i))->memoized;
+
+    fprintf(stdout, "memoized rules (%d of %d):", num, len);
+
+    for (i = 0; i < len; ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+
+        if (rec->memoized)
+            fprintf(stdout, " '%ls'%s", rec->rule_name, rec->memo == RULE_MEMO_ON ? " (@memo)"
+                : rec->left_recursion == RULE_LR_LEADER ? " (left-recursive)" : "");
+    }
+
+    fprintf(stdout, "\n");
+
+    for (i = 0; i < len; ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+
+        if (rec->memo == RULE_MEMO_OFF)
+            fprintf(stdout, "rule '%ls' is not memoized (@nomemo)\n", rec->rule_name);
+    }
+
+    for (i = 0, num = 0; i < len; ++i)
+        num += (*(rule_rec_t **) array_item(rule_records, i))->token;
+
+    if (!num)
+        return;
+
+    fprintf(stdout, "token rules, matched by the scanner (%d):", num);
+
+    for (i = 0; i < len; ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+
+        if (rec->token)
+            fprintf(stdout, " '%ls'", rec->rule_name);
+    }
+
+    fprintf(stdout, "\n");
+} /* print_memo_report() */
@@ -36,6 +36,7 @@
 #include "narwhal_utils.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <wchar.h>
 #include <wctype.h>
@@ -43,6 +44,7 @@
 /*************************************************/
 
 #define BUF_LEN 1024
+#define SPAN_MAX_RANGES 8
 
 static void to_upper(wchar_t *s)
 {
@@ -118,7 +120,7 @@ static void get_node_function_names(const wchar_t *prefix, const array_t *rule_r
 
 static void generate_header(const wchar_t *prefix, const char *header_fname, FILE *header_file, const array_t *node_type_labels)
 {
-    wchar_t buf[BUF_LEN];
+    wchar_t buf[BUF_LEN], ubuf[BUF_LEN];
     time_t cur_time;
     int i, len;
 
@@ -138,7 +140,7 @@ static void generate_header(const wchar_t *prefix, const char *header_fname, FIL
     fprintf(header_file, "#ifdef WIN32\n#pragma warning(disable : 4996)\n#define _CRT_SECURE_NO_DEPRECATE\n#define snprintf _snprintf\n#endif\n\n");
 
 
-    fprintf(header_file, "#include <wchar.h>\n\n");
+    fprintf(header_file, "#include <stddef.h>\n#include <stdio.h>\n#include <wchar.h>\n\n");
 
     fprintf(header_file, "#ifdef __cplusplus\nextern \"C\" {\n#endif\n\n");
 
@@ -170,6 +172,8 @@ static void generate_header(const wchar_t *prefix, const char *header_fname, FIL
     /* syntax tree types */
     wcscpy(buf, prefix);
     to_lower(buf);
+    wcscpy(ubuf, prefix);
+    to_upper(ubuf);
 
     fprintf(header_file, "/* nodes in the abstract syntax tree */\n\n");
     fprintf(header_file, "typedef struct _%ls_syntax_node_t\n"
@@ -177,9 +181,10 @@ static void generate_header(const wchar_t *prefix, const char *header_fname, FIL
         "    int type;                  /* type of node; this is defined above.                    */\n"
         "    int begin;                 /* input position before the first character of the match  */\n"
         "    int end;                   /* input position after the last character of the match    */\n"
-        "    int first_line;            /* line on which the match begins                          */\n"
-        "    int last_line;             /* line on which the match ends                            */\n"
+        "    int first_line;            /* line on which the match begins; -1 until asked for      */\n"
+        "    int last_line;             /* line on which the match ends; -1 until asked for        */\n"
 	"    int children;            /* number of children*/                                      \n"
+        "    int refs;                  /* reference count; memoized subtrees are shared, not copied. zero for arena nodes */\n"
         "    struct _%ls_syntax_node_t **child; /* null-terminated array of child nodes                    */\n"
         "    void *data;\n"
 		"    void *ib; /*Pointer to text buffer*/\n"
@@ -188,13 +193,76 @@ static void generate_header(const wchar_t *prefix, const char *header_fname, FIL
 
     fprintf(header_file, "extern %ls_syntax_node_t *%ls_syntax_node_create(int type, int begin, int end, void* ib);\n", buf, buf);
     fprintf(header_file, "extern %ls_syntax_node_t *%ls_syntax_node_copy(%ls_syntax_node_t *node);\n", buf, buf, buf);
-    fprintf(header_file, "extern void %ls_syntax_node_destroy(%ls_syntax_node_t *node);\n", buf, buf);
+    fprintf(header_file, "extern void %ls_syntax_node_destroy(%ls_syntax_node_t *node); /* releases one reference; frees the tree when none remain */\n", buf, buf);
     fprintf(header_file, "extern int %ls_syntax_node_children(%ls_syntax_node_t *node); /*Returns number of children this node has*/\n", buf, buf);
+    fprintf(header_file, "extern int %ls_syntax_node_first_line(%ls_syntax_node_t *node); /* looks up and caches first_line; the input must not have been destroyed */\n", buf, buf);
+    fprintf(header_file, "extern int %ls_syntax_node_last_line(%ls_syntax_node_t *node); /* looks up and caches last_line */\n", buf, buf);
     fprintf(header_file, "extern %ls_syntax_node_t *%ls_syntax_node_child(%ls_syntax_node_t *node,int idx);/*Returns child indicated by idx*/\n", buf, buf, buf);
     fprintf(header_file, "typedef int (*%ls_syntax_node_process_ft)(%ls_syntax_node_t *node, void *data);\n", buf, buf);
-    fprintf(header_file, "extern void %ls_syntax_node_traverse_preorder(%ls_syntax_node_t *root, void *data, %ls_syntax_node_process_ft entry_func,%ls_syntax_node_process_ft exit_func);\n", buf, buf, buf, buf);
+    fprintf(header_file, "#define %ls_SKIP_SUBTREE 1 /* returned by an entry_func to skip the node's children and its exit_func */\n", ubuf);
+    fprintf(header_file, "extern void %ls_syntax_node_traverse_preorder(%ls_syntax_node_t *root, void *data, %ls_syntax_node_process_ft entry_func,%ls_syntax_node_process_ft exit_func); /* walks with an explicit stack, so any depth of tree is safe */\n", buf, buf, buf, buf);
    fprintf(header_file, "extern  %ls_syntax_node_process_ft %ls_dispatch[%d];\n\n", buf, buf, len);
 
+    /* arena allocation */
+    fprintf(header_file, "/* arena allocation */\n\n");
+    fprintf(header_file, "typedef struct _%ls_arena_t %ls_arena_t;\n", buf, buf);
+    fprintf(header_file, "extern %ls_arena_t *%ls_arena_create(void);\n", buf, buf);
+    fprintf(header_file, "extern void %ls_arena_destroy(%ls_arena_t *arena); /* frees every node allocated from the arena in one call */\n\n", buf, buf);
+
+    /* flat trees */
+    fprintf(header_file, "/* flat syntax trees: every node in one array, in pre-order, linked by index */\n\n");
+    fprintf(header_file, "typedef struct _%ls_flat_node_t\n"
+        "{\n"
+        "    int type;                  /* type of node; this is defined above.                    */\n"
+        "    int begin;                 /* input position before the first character of the match  */\n"
+        "    int end;                   /* input position after the last character of the match    */\n"
+        "    int first_child;           /* index of the first child, or -1                          */\n"
+        "    int next_sibling;          /* index of the next child of the same parent, or -1        */\n"
+        "}\n"
+        "%ls_flat_node_t;\n\n", buf, buf);
+    fprintf(header_file, "typedef struct _%ls_flat_tree_t\n"
+        "{\n"
+        "    %ls_flat_node_t *nodes;    /* nodes[0] is the root; a loop over the array visits the tree in pre-order */\n"
+        "    int num_nodes;\n"
+        "    int cap;\n"
+        "    void *ib; /*Pointer to text buffer*/\n"
+        "}\n"
+        "%ls_flat_tree_t;\n\n", buf, buf, buf);
+    fprintf(header_file, "extern %ls_flat_tree_t *%ls_flat_tree_create(void);\n", buf, buf);
+    fprintf(header_file, "extern void %ls_flat_tree_destroy(%ls_flat_tree_t *tree); /* does not destroy the input buffer */\n", buf, buf);
+    fprintf(header_file, "extern void %ls_flatten(%ls_flat_tree_t *tree, %ls_syntax_node_t *root); /* replaces the contents of tree with a copy of root, reusing its storage */\n", buf, buf, buf);
+    fprintf(header_file, "extern int %ls_flat_children(const %ls_flat_tree_t *tree, int node); /*Returns number of children this node has*/\n", buf, buf);
+    fprintf(header_file, "extern int %ls_flat_child(const %ls_flat_tree_t *tree, int node, int idx); /* returns the index of child idx, or -1 */\n", buf, buf);
+    fprintf(header_file, "extern int %ls_flat_first_line(const %ls_flat_tree_t *tree, int node);\n", buf, buf);
+    fprintf(header_file, "extern int %ls_flat_last_line(const %ls_flat_tree_t *tree, int node);\n", buf, buf);
+    fprintf(header_file, "extern wchar_t *%ls_flat_get_wstr(const %ls_flat_tree_t *tree, int node);\n", buf, buf);
+    fprintf(header_file, "extern char *%ls_flat_get_str(const %ls_flat_tree_t *tree, int node);\n", buf, buf);
+    fprintf(header_file, "typedef int (*%ls_flat_process_ft)(const %ls_flat_tree_t *tree, int node, void *data);\n", buf, buf);
+    fprintf(header_file, "extern void %ls_flat_traverse_preorder(const %ls_flat_tree_t *tree, int root, void *data, %ls_flat_process_ft entry_func, %ls_flat_process_ft exit_func); /* a nonzero return from entry_func skips the node's children and exit_func */\n\n", buf, buf, buf, buf);
+
+    /* parser contexts */
+    fprintf(header_file, "/* parser contexts: everything a parse reads besides its input, so that threads can parse independently */\n\n");
+    fprintf(header_file, "typedef struct _%ls_parser_t\n"
+        "{\n"
+        "    %ls_syntax_node_process_ft dispatch[%d]; /* called with each node of that type as it is built */\n"
+        "    void *data;                /* passed to the dispatch functions */\n"
+        "    int wish_node;             /* a failure to match this node type dumps the error list */\n"
+        "    %ls_arena_t *arena;        /* builds trees in this arena when set; null for the heap */\n"
+        "    int use_mmap;              /* maps files whole instead of reading them */\n"
+        "}\n"
+        "%ls_parser_t;\n\n", buf, buf, len, buf, buf);
+    fprintf(header_file, "typedef struct _%ls_parse_job_t\n"
+        "{\n"
+        "    char *fname;               /* file to parse, or null to parse data */\n"
+        "    const char *data;          /* buffer to parse when fname is null; it must outlive the input buffer */\n"
+        "    size_t len;\n"
+        "    int res;                   /* the rest are filled in as by _parse() */\n"
+        "    %ls_syntax_node_t *parse_tree;\n"
+        "    void *input_buffer;\n"
+        "    void *error_list;\n"
+        "}\n"
+        "%ls_parse_job_t;\n\n", buf, buf, buf);
+
     /* error handling */
     fprintf(header_file, "/* error handling */\n\n");
     fprintf(header_file, "typedef struct _%ls_error_rec_t\n"
@@ -210,6 +278,39 @@ static void generate_header(const wchar_t *prefix, const char *header_fname, FIL
     fprintf(header_file, "extern int %ls_num_errors(void *error_list); /* returns the number of errors in the list */\n", buf);
     fprintf(header_file, "extern %ls_error_rec_t *%ls_get_error(void *error_list, int index);\n\n", buf, buf);
 
+    /* parse counters */
+    fprintf(header_file, "/* counters kept by a parser compiled with %ls_STATS defined */\n\n", ubuf);
+    fprintf(header_file, "typedef struct _%ls_parse_stats_t\n"
+        "{\n"
+        "    long long memo_lookups;    /* rule calls that looked for a memoized result */\n"
+        "    long long memo_hits;       /* lookups that found one */\n"
+        "    long long memo_records;    /* records added to the memo map */\n"
+        "    long long memo_peak;       /* most records held at once */\n"
+        "    long long nodes;           /* nodes built, including those backtracking dropped */\n"
+        "    long long failures;        /* rule calls that failed; the farthest make the syntax error */\n"
+        "}\n"
+        "%ls_parse_stats_t;\n\n", buf, buf);
+    fprintf(header_file, "extern int %ls_parse_stats(void *error_list, %ls_parse_stats_t *stats); /* the counters of the parse that made error_list; returns 0, with them zeroed, unless the parser was compiled with %ls_STATS */\n\n", buf, buf, ubuf);
+
+    /* rule profiles */
+    fprintf(header_file, "/* counters kept for each rule by a parser compiled with %ls_PROFILE defined; cycles are */\n"
+        "/* nanoseconds where there is no cycle counter */\n\n", ubuf);
+    fprintf(header_file, "typedef struct _%ls_rule_profile_t\n"
+        "{\n"
+        "    long long calls;\n"
+        "    long long memo_hits;       /* calls that found the result memoized */\n"
+        "    long long memo_misses;     /* calls of a memoized rule that did not */\n"
+        "    long long successes;\n"
+        "    long long failures;\n"
+        "    long long consumed;        /* bytes matched by the calls that succeeded */\n"
+        "    long long backtracked;     /* bytes matched inside the calls that failed, then given up */\n"
+        "    long long cycles;          /* spent in the calls, including the rules they called */\n"
+        "    long long self_cycles;     /* spent in the calls but not in the rules they called */\n"
+        "}\n"
+        "%ls_rule_profile_t;\n\n", buf, buf);
+    fprintf(header_file, "extern int %ls_profile(void *error_list, %ls_rule_profile_t *rules); /* copies the counters of the parse that made error_list into rules[%ls_NUM_NODE_TYPES], by node type; returns 0, with them zeroed, unless the parser was compiled with %ls_PROFILE */\n", buf, buf, ubuf, ubuf);
+    fprintf(header_file, "extern void %ls_profile_report(void *error_list, FILE *out); /* prints the counters by rule, the most self cycles first */\n\n", buf);
+
     /* main function */
     fprintf(header_file, "/* input buffers */\n\n");
     fprintf(header_file, "extern wchar_t *%ls_get_wstr(%ls_syntax_node_t *node);\n", buf, buf);
@@ -217,7 +318,20 @@ static void generate_header(const wchar_t *prefix, const char *header_fname, FIL
     fprintf(header_file, "extern void %ls_destroy_input_buffer(void *ib);\n\n", buf);
 
     fprintf(header_file, "/* main parse function */\n\n");
-    fprintf(header_file, "extern int %ls_parse(char *fname, %ls_syntax_node_t **parse_tree, void **input_buffer, void **error_list);\n\n", buf, buf);
+    fprintf(header_file, "extern int %ls_parse(char *fname, %ls_syntax_node_t **parse_tree, void **input_buffer, void **error_list);\n", buf, buf);
+    fprintf(header_file, "extern int %ls_parse_arena(char *fname, %ls_arena_t *arena, %ls_syntax_node_t **parse_tree, void **input_buffer, void **error_list); /* the tree is owned by the arena */\n", buf, buf, buf);
+    fprintf(header_file, "\n/* The following take an optional arena; pass null to build the tree on the heap. */\n");
+    fprintf(header_file, "extern int %ls_parse_mmap(char *fname, %ls_arena_t *arena, %ls_syntax_node_t **parse_tree, void **input_buffer, void **error_list); /* maps the whole file instead of reading it */\n", buf, buf, buf);
+    fprintf(header_file, "extern int %ls_parse_mem(const char *data, size_t len, %ls_arena_t *arena, %ls_syntax_node_t **parse_tree, void **input_buffer, void **error_list); /* parses the caller's buffer in place; it must outlive the input buffer */\n", buf, buf, buf);
+    fprintf(header_file, "extern int %ls_parse_stream(char *fname, %ls_syntax_node_process_ft callback, void *data, void **input_buffer, void **error_list); /* hands each subtree of the start rule's top-level repetition to callback, then frees it; a nonzero return stops the parse */\n", buf, buf);
+    fprintf(header_file, "extern int %ls_parse_flat(char *fname, %ls_flat_tree_t *tree, void **input_buffer, void **error_list); /* leaves the parse tree in tree instead of on the heap */\n\n", buf, buf);
+    fprintf(header_file, "/* The _parse functions above use _dispatch and _wish_node; the following use a parser context. */\n");
+    fprintf(header_file, "extern %ls_parser_t *%ls_parser_create(void); /* starts from the current _dispatch and _wish_node */\n", buf, buf);
+    fprintf(header_file, "extern void %ls_parser_destroy(%ls_parser_t *parser); /* does not destroy the arena */\n", buf, buf);
+    fprintf(header_file, "extern int %ls_parser_parse(%ls_parser_t *parser, char *fname, %ls_syntax_node_t **parse_tree, void **input_buffer, void **error_list);\n", buf, buf, buf);
+    fprintf(header_file, "extern int %ls_parser_parse_mem(%ls_parser_t *parser, const char *data, size_t len, %ls_syntax_node_t **parse_tree, void **input_buffer, void **error_list);\n", buf, buf, buf);
+    fprintf(header_file, "extern int %ls_parse_many(const %ls_parser_t *parser, %ls_parse_job_t *jobs, int num_jobs, int num_threads); /* parses the jobs on num_threads workers (0 for one per processor), each with its own copy of parser; trees are on the heap; returns the number that parsed */\n", buf, buf, buf);
+    fprintf(header_file, "extern int %ls_parser_parse_parallel(const %ls_parser_t *parser, char *fname, int num_threads, %ls_syntax_node_t **parse_tree, void **input_buffer, void **error_list); /* splits the start rule's top-level repetition between num_threads workers (0 for one per processor); dispatch functions run on the workers, also for subtrees that are then dropped; trees are on the heap */\n\n", buf, buf, buf);
 
     /* end guard */
     fprintf(header_file, "#ifdef __cplusplus\n}\n#endif\n\n");
@@ -253,7 +367,8 @@ int len,i;
     }
     fprintf(src_file, "};\n\n");
 
-    fprintf(src_file, "wchar_t *wcs_dup(wchar_t *str)\n"
+    /* static, so that several generated parsers can be linked into one program */
+    fprintf(src_file, "static wchar_t *wcs_dup(wchar_t *str)\n"
 	"{\n"
 	"    wchar_t *res;\n"
 	"    int len = (int) wcslen(str) + 1;\n"
@@ -264,7 +379,7 @@ int len,i;
 	"    return res;\n"
         "} /* wcs_dup() */\n");
 
-    fprintf(src_file, "char *str_dup(char *str)\n"
+    fprintf(src_file, "static char *str_dup(char *str)\n"
 	"{\n"
 	"    char *res;\n"
 	"    int len = (int) strlen(str) + 1;\n"
@@ -398,86 +513,388 @@ int len,i;
         "    res->last_line  = -1;\n"
         "    res->child = 0;\n"
 	"    res->children = 0;\n"
+	"    res->refs = 1;\n"
 	"    res->ib = ib;\n"
         "    return res;\n"
         "} /* syntax_node_create() */\n\n", buf, buf, buf, buf, buf);
 
-    fprintf(src_file, "%ls_syntax_node_t *%ls_syntax_node_copy(%ls_syntax_node_t *node)\n"
+    fprintf(src_file, "static %ls_syntax_node_t *syntax_node_copy_one(%ls_syntax_node_t *node)\n"
         "{\n"
-        "    %ls_syntax_node_t *copy = 0, **cur;\n"
-        "    int i, len;\n"
+        "    %ls_syntax_node_t *copy = %ls_syntax_node_create(node->type, node->begin, node->end, node->ib);\n"
         "\n"
-        "    if (node)\n"
+        "    copy->first_line = node->first_line;\n"
+        "    copy->last_line = node->last_line;\n"
+        "    return copy;\n"
+        "} /* syntax_node_copy_one() */\n\n", buf, buf, buf, buf);
+
+    fprintf(src_file, "/* the walks keep the path to the node they are at on a stack of frames, which starts out */\n"
+        "/* on the C stack and only moves to the heap for trees deeper than that */\n"
+        "#define WALK_LOCAL_FRAMES 64\n\n"
+        "static void *walk_stack_grow(void *stack, void *local, int *cap, size_t frame_size)\n"
+        "{\n"
+        "    void *res;\n"
+        "\n"
+        "    if (stack == local)\n"
         "    {\n"
-        "        copy = %ls_syntax_node_create(node->type, node->begin, node->end, node->ib);\n"
-        "        copy->first_line = node->first_line;\n"
-        "        copy->last_line = node->last_line;\n"
-        "\n", buf, buf, buf, buf, buf);
+        "        res = malloc(*cap * 2 * frame_size);\n"
+        "        memcpy(res, stack, *cap * frame_size);\n"
+        "    }\n"
+        "    else\n"
+        "    {\n"
+        "        res = realloc(stack, *cap * 2 * frame_size);\n"
+        "    }\n"
+        "\n"
+        "    *cap *= 2;\n"
+        "    return res;\n"
+        "} /* walk_stack_grow() */\n\n");
+
+    fprintf(src_file, "typedef struct _copy_frame_t\n"
+        "{\n"
+        "    %ls_syntax_node_t *src, *dest;\n"
+        "    int next;                   /* index of the next child to copy */\n"
+        "}\n"
+        "copy_frame_t;\n\n"
+        "/* gives DEST room for as many children as SRC has */\n"
+        "static void syntax_node_copy_children(%ls_syntax_node_t *dest, %ls_syntax_node_t *src)\n"
+        "{\n"
+        "    dest->child = (%ls_syntax_node_t **) calloc(src->children + 1, sizeof(%ls_syntax_node_t *));\n"
+        "    dest->children = src->children;\n"
+        "} /* syntax_node_copy_children() */\n\n", buf, buf, buf, buf, buf);
 
-    fprintf(src_file, 
-        "        len = node->children;\n"
-        "        copy->children = node->children;\n"  
-        "        if (len)\n"
+    fprintf(src_file, "%ls_syntax_node_t *%ls_syntax_node_copy(%ls_syntax_node_t *node)\n"
+        "{\n"
+        "    copy_frame_t local[WALK_LOCAL_FRAMES], *stack = local;\n"
+        "    %ls_syntax_node_t *copy, *src, *dest, *child;\n"
+        "    int i = 0, num = 0, cap = WALK_LOCAL_FRAMES;\n"
+        "\n"
+        "    if (!node)\n"
+        "        return 0;\n"
+        "\n"
+        "    copy = syntax_node_copy_one(node);\n"
+        "    if (!node->children)\n"
+        "        return copy;\n"
+        "\n"
+        "    /* SRC and DEST are the node being copied and its copy, and the stack holds their ancestors; */\n"
+        "    /* copies are allocated in pre-order, as the recursive copy allocated them */\n"
+        "    syntax_node_copy_children(copy, node);\n"
+        "    src = node;\n"
+        "    dest = copy;\n"
+        "\n"
+        "    for (;;)\n"
+        "    {\n"
+        "        if (i < src->children)\n"
+        "        {\n"
+        "            child = src->child[i];\n"
+        "            dest->child[i++] = syntax_node_copy_one(child);\n"
+        "            if (!child->children)\n"
+        "                continue;\n"
+        "\n"
+        "            /* nothing is left to copy after a last child, so a chain nested in last children needs no frames */\n"
+        "            if (i < src->children)\n"
+        "            {\n"
+        "                if (num == cap)\n"
+        "                    stack = (copy_frame_t *) walk_stack_grow(stack, local, &cap, sizeof(copy_frame_t));\n"
+        "                stack[num].src = src;\n"
+        "                stack[num].dest = dest;\n"
+        "                stack[num++].next = i;\n"
+        "            }\n"
+        "\n"
+        "            dest = dest->child[i - 1];\n"
+        "            src = child;\n"
+        "            syntax_node_copy_children(dest, src);\n"
+        "            i = 0;\n"
+        "        }\n"
+        "        else if (num)\n"
+        "        {\n"
+        "            --num;\n"
+        "            src = stack[num].src;\n"
+        "            dest = stack[num].dest;\n"
+        "            i = stack[num].next;\n"
+        "        }\n"
+        "        else\n"
         "        {\n"
-        "            copy->child = (%ls_syntax_node_t **) calloc(len+1, sizeof(%ls_syntax_node_t *));\n"
-        "            for (i = 0; i < len; ++i)\n"
-        "                copy->child[i] = %ls_syntax_node_copy(node->child[i]);\n"
+        "            break;\n"
         "        }\n"
         "    }\n"
         "\n"
+        "    if (stack != local)\n"
+        "        free(stack);\n"
         "    return copy;\n"
-        "} /* syntax_node_copy() */\n\n", buf, buf, buf);
+        "} /* syntax_node_copy() */\n\n", buf, buf, buf, buf);
 
     fprintf(src_file, "void %ls_syntax_node_destroy(%ls_syntax_node_t *node)\n"
         "{\n"
-        "    %ls_syntax_node_t **cur;\n"
+        "    %ls_syntax_node_t **cur, **work;\n"
+        "    int num = 0, cap = 64;\n"
         "\n"
         "    assert(node);\n"
         "\n"
-        "    if (node->child)\n"
-        "        for (cur = node->child; *cur; ++cur)\n"
-        "            %ls_syntax_node_destroy(*cur);\n"
+        "    /* nodes owned by an arena are released with the arena */\n"
+        "    if (!node->refs || --node->refs > 0)\n"
+        "        return;\n"
+        "\n"
+        "    /* nodes whose last reference has gone, but whose children have not been released yet */\n"
+        "    work = (%ls_syntax_node_t **) malloc(cap * sizeof(%ls_syntax_node_t *));\n"
+        "    work[num++] = node;\n"
+        "\n"
+        "    while (num)\n"
+        "    {\n"
+        "        node = work[--num];\n"
+        "\n"
+        "        if (node->child)\n"
+        "        {\n"
+        "            if (num + node->children > cap)\n"
+        "            {\n"
+        "                while (num + node->children > cap)\n"
+        "                    cap *= 2;\n"
+        "                work = (%ls_syntax_node_t **) realloc(work, cap * sizeof(%ls_syntax_node_t *));\n"
+        "            }\n"
+        "\n"
+        "            /* pushed last to first, so nodes are freed in the order they were allocated */\n"
+        "            for (cur = node->child + node->children - 1; cur >= node->child; --cur)\n"
+        "                if ((*cur)->refs && --(*cur)->refs == 0)\n"
+        "                    work[num++] = *cur;\n"
+        "\n"
+        "            free(node->child);\n"
+        "        }\n"
+        "\n"
+        "        free(node);\n"
+        "    }\n"
+        "\n"
+        "    free(work);\n"
+        "} /* syntax_node_destroy() */\n\n", buf, buf, buf, buf, buf, buf, buf);
+
+
+    fprintf(src_file, "typedef struct _traverse_frame_t\n"
+        "{\n"
+        "    %ls_syntax_node_t *node;\n"
+        "    int next, children;         /* index of the next child to visit, and the number there are */\n"
+        "}\n"
+        "traverse_frame_t;\n\n", buf);
+
+    fprintf(src_file, "/* walks the subtrees of a tree deeper than WALK_LOCAL_FRAMES, where recursion would risk */\n"
+        "/* overflowing the C stack */\n"
+        "static void syntax_node_traverse_deep(%ls_syntax_node_t *root, void *data, %ls_syntax_node_process_ft entry_func, %ls_syntax_node_process_ft exit_func)\n"
+        "{\n"
+        "    traverse_frame_t local[WALK_LOCAL_FRAMES], *stack = local;\n"
+        "    %ls_syntax_node_t *node = root, *child;\n"
+        "    int i = 0, len, num = 0, cap = WALK_LOCAL_FRAMES;\n"
+        "\n"
+        "    if (!root)\n"
+        "        return;\n"
+        "    if (entry_func != NULL && entry_func(root, data))\n"
+        "        return;\n"
+        "    len = root->children;\n"
+        "\n"
+        "    /* NODE is the node being visited, and the stack holds its ancestors; leaves are left as */\n"
+        "    /* soon as they are entered */\n"
+        "    for (;;)\n"
+        "    {\n"
+        "        if (i < len)\n"
+        "        {\n"
+        "            child = node->child[i++];\n"
+        "            if (entry_func != NULL && entry_func(child, data))\n"
+        "                continue;\n"
+        "\n"
+        "            if (!child->children)\n"
+        "            {\n"
+        "                if (exit_func != NULL)\n"
+        "                    exit_func(child, data);\n"
+        "                continue;\n"
+        "            }\n"
+        "\n"
+        "            if (num == cap)\n"
+        "                stack = (traverse_frame_t *) walk_stack_grow(stack, local, &cap, sizeof(traverse_frame_t));\n"
+        "            stack[num].node = node;\n"
+        "            stack[num].next = i;\n"
+        "            stack[num++].children = len;\n"
+        "            node = child;\n"
+        "            len = child->children;\n"
+        "            i = 0;\n"
+        "        }\n"
+        "        else\n"
+        "        {\n"
+        "            if (exit_func != NULL)\n"
+        "                exit_func(node, data);\n"
+        "            if (!num)\n"
+        "                break;\n"
+        "\n"
+        "            --num;\n"
+        "            node = stack[num].node;\n"
+        "            i = stack[num].next;\n"
+        "            len = stack[num].children;\n"
+        "        }\n"
+        "    }\n"
         "\n"
-        "    free(node);\n"
-        "} /* syntax_node_destroy() */\n\n", buf, buf, buf, buf);
+        "    if (stack != local)\n"
+        "        free(stack);\n"
+        "} /* syntax_node_traverse_deep() */\n\n", buf, buf, buf, buf);
 
+    fprintf(src_file, "/* recursion is cheaper than the frames of syntax_node_traverse_deep() while the tree is */\n"
+        "/* shallow, so the walk only changes over to those below WALK_LOCAL_FRAMES levels */\n"
+        "static void syntax_node_traverse_shallow(%ls_syntax_node_t *node, void *data, %ls_syntax_node_process_ft entry_func, %ls_syntax_node_process_ft exit_func, int depth)\n"
+        "{\n"
+        "    int i;\n"
+        "\n"
+        "    if (entry_func != NULL && entry_func(node, data))\n"
+        "        return;\n"
+        "\n"
+        "    for (i = 0; i < node->children; ++i)\n"
+        "    {\n"
+        "        if (depth < WALK_LOCAL_FRAMES)\n"
+        "            syntax_node_traverse_shallow(node->child[i], data, entry_func, exit_func, depth + 1);\n"
+        "        else\n"
+        "            syntax_node_traverse_deep(node->child[i], data, entry_func, exit_func);\n"
+        "    }\n"
+        "\n"
+        "    if (exit_func != NULL)\n"
+        "        exit_func(node, data);\n"
+        "} /* syntax_node_traverse_shallow() */\n\n", buf, buf, buf);
 
     fprintf(src_file, "void %ls_syntax_node_traverse_preorder(%ls_syntax_node_t *root, void *data, %ls_syntax_node_process_ft entry_func, %ls_syntax_node_process_ft exit_func)\n"
         "{\n"
         "    if (root)\n"
+        "        syntax_node_traverse_shallow(root, data, entry_func, exit_func, 0);\n"
+        "} /* syntax_node_traverse_preorder() */\n\n", buf, buf, buf, buf);
+
+    /* arena functions */
+    fprintf(src_file, "/* arena allocation */\n\n");
+    fprintf(src_file, "#define ARENA_MIN_CHUNK_SIZE 65536\n"
+        "#define ARENA_MAX_CHUNK_SIZE 4194304\n"
+        "#define ARENA_ALIGN(n) (((n) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))\n\n");
+
+    fprintf(src_file, "typedef struct _arena_chunk_t\n"
+        "{\n"
+        "    struct _arena_chunk_t *next;\n"
+        "}\n"
+        "arena_chunk_t;\n\n");
+
+    fprintf(src_file, "struct _%ls_arena_t\n"
+        "{\n"
+        "    arena_chunk_t *chunks;     /* all chunks, newest first */\n"
+        "    char *cur, *end;           /* free space in the newest chunk */\n"
+        "    size_t chunk_size;         /* size of the next chunk to allocate */\n"
+        "};\n\n", buf);
+
+    fprintf(src_file, "%ls_arena_t *%ls_arena_create(void)\n"
+        "{\n"
+        "    %ls_arena_t *arena = (%ls_arena_t *) calloc(1, sizeof(%ls_arena_t));\n"
+        "    arena->chunk_size = ARENA_MIN_CHUNK_SIZE;\n"
+        "    return arena;\n"
+        "} /* arena_create() */\n\n", buf, buf, buf, buf, buf);
+
+    fprintf(src_file, "void %ls_arena_destroy(%ls_arena_t *arena)\n"
+        "{\n"
+        "    arena_chunk_t *chunk, *next;\n"
+        "\n"
+        "    if (!arena)\n"
+        "        return;\n"
+        "\n"
+        "    for (chunk = arena->chunks; chunk; chunk = next)\n"
+        "    {\n"
+        "        next = chunk->next;\n"
+        "        free(chunk);\n"
+        "    }\n"
+        "\n"
+        "    free(arena);\n"
+        "} /* arena_destroy() */\n\n", buf, buf);
+
+    fprintf(src_file, "static void *arena_alloc(%ls_arena_t *arena, size_t size)\n"
+        "{\n"
+        "    void *res;\n"
+        "\n"
+        "    size = ARENA_ALIGN(size);\n"
+        "\n"
+        "    if ((size_t) (arena->end - arena->cur) < size)\n"
         "    {\n"
-        "        %ls_syntax_node_t **cur;\n"
-        "        if (entry_func != NULL)\n"
-        "          if (entry_func(root, data))\n"
-        "            return;\n"
+        "        size_t header = ARENA_ALIGN(sizeof(arena_chunk_t));\n"
+        "        size_t chunk_size = arena->chunk_size;\n"
+        "        arena_chunk_t *chunk;\n"
         "\n"
-        "        if (root->child)\n"
-        "            for (cur = root->child; *cur; ++cur)\n"
-        "                %ls_syntax_node_traverse_preorder(*cur, data, entry_func, exit_func);\n"
-		"        if (exit_func != NULL)\n"
-		"          exit_func(root,data);\n"
+        "        while (chunk_size < size + header)\n"
+        "            chunk_size *= 2;\n"
+        "\n"
+        "        chunk = (arena_chunk_t *) malloc(chunk_size);\n"
+        "        chunk->next = arena->chunks;\n"
+        "        arena->chunks = chunk;\n"
+        "        arena->cur = (char *) chunk + header;\n"
+        "        arena->end = (char *) chunk + chunk_size;\n"
+        "\n"
+        "        if (arena->chunk_size < ARENA_MAX_CHUNK_SIZE)\n"
+        "            arena->chunk_size *= 2;\n"
         "    }\n"
-        "} /* syntax_node_traverse_inorder() */\n\n", buf, buf, buf, buf, buf, buf);
+        "\n"
+        "    res = arena->cur;\n"
+        "    arena->cur += size;\n"
+        "    memset(res, 0, size);\n"
+        "\n"
+        "    return res;\n"
+        "} /* arena_alloc() */\n\n", buf);
+
+    fprintf(src_file, "static %ls_syntax_node_t *arena_node_create(%ls_arena_t *arena, int type, int begin, int end, void *ib)\n"
+        "{\n"
+        "    %ls_syntax_node_t *res;\n"
+        "\n"
+        "    if (!arena)\n"
+        "        return %ls_syntax_node_create(type, begin, end, ib);\n"
+        "\n"
+        "    res = (%ls_syntax_node_t *) arena_alloc(arena, sizeof(%ls_syntax_node_t));\n"
+        "    res->type  = type;\n"
+        "    res->begin = begin;\n"
+        "    res->end   = end;\n"
+        "    res->first_line = -1;\n"
+        "    res->last_line  = -1;\n"
+        "    res->refs = 0;\n"
+        "    res->ib = ib;\n"
+        "    return res;\n"
+        "} /* arena_node_create() */\n\n", buf, buf, buf, buf, buf, buf);
+
+    fprintf(src_file, "static %ls_syntax_node_t **arena_child_array(%ls_arena_t *arena, int len)\n"
+        "{\n"
+        "    if (!arena)\n"
+        "        return (%ls_syntax_node_t **) calloc(len+1, sizeof(%ls_syntax_node_t *));\n"
+        "\n"
+        "    return (%ls_syntax_node_t **) arena_alloc(arena, (len+1) * sizeof(%ls_syntax_node_t *));\n"
+        "} /* arena_child_array() */\n\n", buf, buf, buf, buf, buf, buf);
 
     /* error handling functions */
     fprintf(src_file, "/* error handling functions */\n\n");
+    fprintf(src_file, "/* a parse only tracks its farthest failure; the message is formatted when it is asked for */\n"
+        "typedef struct _error_list_t\n"
+        "{\n"
+        "    int fail_pos;              /* farthest offset at which a rule failed; -1 if none has */\n"
+        "    int lookaheads;            /* negative lookaheads being parsed, whose failures are expected */\n"
+        "    unsigned char expected[(%ls_NUM_NODE_TYPES + 7) / 8]; /* the rules that failed at fail_pos */\n"
+        "    int formatted;             /* set once the failure has been added to errors */\n"
+        "    array_t errors;            /* records added by the caller, then the formatted failure */\n"
+        "#ifdef %ls_STATS\n"
+        "    %ls_parse_stats_t stats;   /* copied from the memo map when the parse ends */\n"
+        "#endif\n"
+        "#ifdef %ls_PROFILE\n"
+        "    %ls_rule_profile_t profile[%ls_NUM_NODE_TYPES]; /* likewise */\n"
+        "#endif\n"
+        "}\n"
+        "error_list_t;\n\n", cbuf, cbuf, buf, cbuf, buf, cbuf);
+
     fprintf(src_file, "void *%ls_create_error_list()\n"
         "{\n"
-        "    array_t *ptr = (array_t *) calloc(1, sizeof(array_t));\n"
-        "    array_init(ptr, sizeof(%ls_error_rec_t), 0);\n"
-        "    return ptr;\n"
+        "    error_list_t *errs = (error_list_t *) calloc(1, sizeof(error_list_t));\n"
+        "    errs->fail_pos = -1;\n"
+        "    array_init(&errs->errors, sizeof(%ls_error_rec_t), 0);\n"
+        "    return errs;\n"
         "}\n\n", buf, buf);
 
     fprintf(src_file, "void %ls_destroy_error_list(void *error_list)\n"
         "{\n"
-        "    int i, len = array_size((array_t *) error_list);\n"
+        "    error_list_t *errs = (error_list_t *) error_list;\n"
+        "    int i, len = array_size(&errs->errors);\n"
         "    for (i = 0; i < len; ++i)\n"
         "    {\n"
-        "        %ls_error_rec_t *er = (%ls_error_rec_t *) array_item((array_t *) error_list, i);\n"
+        "        %ls_error_rec_t *er = (%ls_error_rec_t *) array_item(&errs->errors, i);\n"
         "        free(er->str);\n"
         "    }\n"
-        "    array_deinit((array_t *) error_list);\n"
-        "    free((array_t *) error_list);\n"
+        "    array_deinit(&errs->errors);\n"
+        "    free(errs);\n"
         "}\n\n", buf, buf, buf);
 
     fprintf(src_file, "void %ls_add_error(void *error_list, int pos, wchar_t *str)\n"
@@ -485,49 +902,29 @@ int len,i;
         "    %ls_error_rec_t er;\n"
         "    er.pos = pos;\n"
         "    er.str = wcs_dup(str);\n"
-        "    array_add((array_t *) error_list, &er);\n"
+        "    array_add(&((error_list_t *) error_list)->errors, &er);\n"
         "}\n\n", buf, buf);
 
-    fprintf(src_file, "int %ls_num_errors(void *error_list)\n"
+    fprintf(src_file, "/* notes that rule TYPE failed at POS; failures short of the farthest one are forgotten */\n"
+        "static void record_failure(error_list_t *errs, int type, int pos)\n"
         "{\n"
-        "    return array_size((array_t *) error_list);\n"
-        "}\n\n", buf);
+        "    if (pos < errs->fail_pos || errs->lookaheads)\n"
+        "        return;\n"
+        "\n"
+        "    if (pos > errs->fail_pos)\n"
+        "    {\n"
+        "        errs->fail_pos = pos;\n"
+        "        memset(errs->expected, 0, sizeof(errs->expected));\n"
+        "    }\n"
+        "\n"
+        "    errs->expected[type >> 3] |= (unsigned char) (1 << (type & 7));\n"
+        "} /* record_failure() */\n\n");
 
-    fprintf(src_file, "%ls_error_rec_t *%ls_get_error(void *error_list, int index)\n"
+    fprintf(src_file, "static void clear_failure(error_list_t *errs)\n"
         "{\n"
-        "    return (%ls_error_rec_t *) array_item((array_t *) error_list, index);\n"
-        "}\n\n", buf, buf, buf);
-
-    fprintf(src_file, "static void delete_errors(array_t *errors, int start_index)\n"
-"{\n"
-"    int i, len = array_size(errors);\n"
-"    for (i = start_index; i < len; ++i)\n"
-"    {\n"
-"        %ls_error_rec_t *rec = (%ls_error_rec_t *) array_item(errors, i);\n"
-"        free(rec->str);\n"
-"    }\n"
-"    errors->num = start_index;\n"
-"}\n\n", buf, buf);
-
-    fprintf(src_file, "static void add_error(array_t *errs, int pos, wchar_t *str)\n"
-"{\n"
-"    %ls_error_rec_t rec;\n"
-"    rec.pos = pos;\n"
-"    rec.str = wcs_dup(str);\n"
-"\n"
-"    array_add(errs, &rec);\n"
-"} /* add_error() */\n\n", buf);
-
-    fprintf(src_file, "static void dump_errors(array_t *errs){\n"
-		    "int cnt,max;\n"
-		    "%ls_error_rec_t *this_error;\n"
-		    "\n"
-		    "for (cnt = %ls_num_errors(errs)-1;cnt >= 0; cnt--){\n"
-		    "  this_error = %ls_get_error(errs,cnt);\n"
-		    "  printf(\"WishError %%d:%%d %%ls\\n\",cnt,this_error->pos,this_error->str);\n"
-		    "}\n"
-		    "}\n"
-		    "/*Debug dump of errors to stdout*/\n",buf,buf,buf);
+        "    errs->fail_pos = -1;\n"
+        "    memset(errs->expected, 0, sizeof(errs->expected));\n"
+        "} /* clear_failure() */\n\n");
 
 
 
@@ -536,7 +933,10 @@ int len,i;
     fprintf(src_file, "enum input_buffer_flags_et\n"
         "    {\n"
         "        INPUT_BUFFER_NULL_FLAGS       = 0,\n"
-        "        INPUT_BUFFER_UNICODE_BOM_READ = 1\n"
+        "        INPUT_BUFFER_UNICODE_BOM_READ = 1,\n"
+        "        INPUT_BUFFER_COMPLETE         = 2, /* the whole input is in buf; never read from f */\n"
+        "        INPUT_BUFFER_MAPPED           = 4, /* buf is a read-only mapping of the file */\n"
+        "        INPUT_BUFFER_BORROWED         = 8  /* buf belongs to the caller */\n"
         "    };\n"
         "\n"
         "    enum input_buffer_unicode_mode_et\n"
@@ -557,6 +957,10 @@ int len,i;
         "        int buf_size;\n"
         "        int bytes_read;\n"
         "        int current_pos;\n"
+        "        int base;                  /* input offset of buf[0]; streaming discards the bytes before it */\n"
+        "        array_t line_ends;         /* offsets just past each line ending indexed so far */\n"
+        "        int lines_dropped;         /* line endings discarded from the front of line_ends */\n"
+        "        int line_scan_pos;         /* the input before this offset has been indexed */\n"
         "\n"
         "        unsigned int flags;\n"
         "        int unicode_mode;\n"
@@ -580,19 +984,119 @@ int len,i;
         "    ib = (input_buffer_t *) calloc(1, sizeof(input_buffer_t));\n"
         "    ib->name = str_dup(name);\n"
         "    ib->f = f;\n"
+        "    array_init(&ib->line_ends, sizeof(int), 0);\n"
         "\n"
         "    input_buffer_get_unicode_mode(ib);\n"
         "\n"
         "    return ib;\n"
         "} /* input_buffer_create() */\n\n");
 
+    fprintf(src_file, "static input_buffer_t *input_buffer_create_mem(char *name, const char *data, size_t len)\n"
+        "{\n"
+        "    input_buffer_t *ib;\n"
+        "\n"
+        "    assert(data || !len);\n"
+        "\n"
+        "    if (len > INT_MAX)\n"
+        "        return 0;\n"
+        "\n"
+        "    ib = (input_buffer_t *) calloc(1, sizeof(input_buffer_t));\n"
+        "    ib->name = str_dup(name);\n"
+        "    ib->buf = (char *) data;\n"
+        "    ib->buf_size = ib->bytes_read = (int) len;\n"
+        "    ib->flags = INPUT_BUFFER_COMPLETE | INPUT_BUFFER_BORROWED;\n"
+        "    array_init(&ib->line_ends, sizeof(int), 0);\n"
+        "\n"
+        "    input_buffer_get_unicode_mode(ib);\n"
+        "\n"
+        "    return ib;\n"
+        "} /* input_buffer_create_mem() */\n\n");
+
+    fprintf(src_file, "static input_buffer_t *input_buffer_create_mapped(char *name)\n"
+        "{\n"
+        "    input_buffer_t *ib;\n"
+        "    size_t len;\n"
+        "    char *data = 0;\n"
+        "\n"
+        "#ifdef WIN32\n"
+        "    FILE *f;\n"
+        "    long size;\n"
+        "\n"
+        "    /* no mmap; read the whole file with a single allocation instead */\n"
+        "    if (!(f = fopen(name, \"rb\")))\n"
+        "        return 0;\n"
+        "\n"
+        "    fseek(f, 0, SEEK_END);\n"
+        "    size = ftell(f);\n"
+        "    fseek(f, 0, SEEK_SET);\n"
+        "\n"
+        "    len = size > 0 ? (size_t) size : 0;\n"
+        "    if (len > INT_MAX || !(data = (char *) malloc(len + 1)) || fread(data, 1, len, f) != len)\n"
+        "    {\n"
+        "        free(data);\n"
+        "        fclose(f);\n"
+        "        return 0;\n"
+        "    }\n"
+        "    fclose(f);\n"
+        "\n"
+        "    ib = input_buffer_create_mem(name, data, len);\n"
+        "    ib->flags &= ~INPUT_BUFFER_BORROWED;\n"
+        "#else\n"
+        "    struct stat st;\n"
+        "    int fd;\n"
+        "\n"
+        "    if ((fd = open(name, O_RDONLY)) < 0)\n"
+        "        return 0;\n"
+        "\n"
+        "    if (fstat(fd, &st) < 0 || (size_t) st.st_size > INT_MAX)\n"
+        "    {\n"
+        "        close(fd);\n"
+        "        return 0;\n"
+        "    }\n"
+        "\n"
+        "    len = (size_t) st.st_size;\n"
+        "\n"
+        "    /* empty files cannot be mapped, but parse just like an empty buffer */\n"
+        "    if (len)\n"
+        "    {\n"
+        "        data = (char *) mmap(0, len, PROT_READ, MAP_PRIVATE, fd, 0);\n"
+        "\n"
+        "        if (data == (char *) MAP_FAILED)\n"
+        "        {\n"
+        "            close(fd);\n"
+        "            return 0;\n"
+        "        }\n"
+        "\n"
+        "        madvise(data, len, MADV_SEQUENTIAL);\n"
+        "    }\n"
+        "    close(fd);\n"
+        "\n"
+        "    ib = input_buffer_create_mem(name, data, len);\n"
+        "    ib->flags &= ~INPUT_BUFFER_BORROWED;\n"
+        "    if (len)\n"
+        "        ib->flags |= INPUT_BUFFER_MAPPED;\n"
+        "#endif\n"
+        "\n"
+        "    return ib;\n"
+        "} /* input_buffer_create_mapped() */\n\n");
+
     fprintf(src_file, "static void input_buffer_destroy(input_buffer_t *ib)\n"
         "{\n"
         "    assert(ib);\n"
         "\n"
-        "    fclose(ib->f);\n"
+        "    if (ib->f)\n"
+        "        fclose(ib->f);\n"
+        "\n"
+        "#ifndef WIN32\n"
+        "    if (ib->flags & INPUT_BUFFER_MAPPED)\n"
+        "        munmap(ib->buf, ib->buf_size);\n"
+        "    else\n"
+        "#endif\n"
+        "    if (!(ib->flags & INPUT_BUFFER_BORROWED))\n"
+        "        free(ib->buf);\n"
+        "\n"
+        "    array_deinit(&ib->line_ends);\n"
         "    free(ib->name);\n"
-        "    free(ib->buf);\n"
         "    free(ib);\n"
         "} /* input_buffer_destroy() */\n\n");
 
@@ -613,46 +1117,91 @@ int len,i;
 
     fprintf(src_file, "#define INPUT_BUFFER_SIZE_INCREMENT 4096\n\n");
 
-    fprintf(src_file, "static wchar_t input_buffer_read_char(input_buffer_t *ib)\n"
+    fprintf(src_file, "/* address of the byte at input offset POS, which must still be in the buffer */\n"
+        "#define input_buffer_at(ib, pos) ((ib)->buf + ((pos) - (ib)->base))\n\n");
+
+    fprintf(src_file, "typedef struct _char_class_t\n"
+        "{\n"
+        "    unsigned char bits[32];     /* membership of byte values 0..255 */\n"
+        "    int num_ranges;             /* sorted [lo, hi] pairs for members above 255 */\n"
+        "    const wchar_t *ranges;\n"
+        "}\n"
+        "char_class_t;\n\n");
+
+    fprintf(src_file, "#define CHAR_CLASS_HAS_BYTE(cls, byte) (((cls)->bits[(unsigned char) (byte) >> 3] >> ((unsigned char) (byte) & 7)) & 1)\n\n");
+
+    fprintf(src_file, "static int input_buffer_fill(input_buffer_t *ib)\n"
         "{\n"
-        "    wchar_t ch;\n"
-        "    int prev_pos, new_pos;\n"
+        "    size_t num_bytes_read;\n"
         "\n"
-        "    assert(ib);\n"
-        "    \n"
-        "    /* resize buffer if necessary, and read */\n"
-        "    while (ib->current_pos >= ib->bytes_read)\n"
+        "    if ((ib->flags & INPUT_BUFFER_COMPLETE) || !ib->f)\n"
+        "        return 0;\n"
+        "\n"
+        "    /* grow geometrically so that reading a large file copies it a bounded number of times */\n"
+        "    if (ib->bytes_read - ib->base == ib->buf_size)\n"
         "    {\n"
-        "        size_t num_bytes_read;\n"
+        "        int new_size = ib->buf_size ? ib->buf_size * 2 : INPUT_BUFFER_SIZE_INCREMENT;\n"
+        "        char *new_buf = (char *) realloc(ib->buf, new_size);\n"
         "\n"
-        "        ib->buf = (char *) realloc(ib->buf, ib->buf_size += INPUT_BUFFER_SIZE_INCREMENT);\n"
+        "        if (!new_buf)\n"
+        "            return 0;\n"
         "\n"
-        "        if (!ib->buf)\n"
-        "        {\n"
-        "            return WEOF;\n"
-        "            ib->buf_size -= INPUT_BUFFER_SIZE_INCREMENT;\n"
-        "        }\n"
+        "        ib->buf = new_buf;\n"
+        "        ib->buf_size = new_size;\n"
+        "    }\n"
         "\n"
-        "        num_bytes_read = fread(ib->buf + ib->bytes_read, 1, INPUT_BUFFER_SIZE_INCREMENT, ib->f);\n"
+        "    num_bytes_read = fread(input_buffer_at(ib, ib->bytes_read), 1, ib->buf_size - (ib->bytes_read - ib->base), ib->f);\n"
         "\n"
-        "        if (num_bytes_read)\n"
-        "        {\n"
-        "            ib->bytes_read += (int) num_bytes_read;\n"
-        "        }\n"
-        "        else\n"
-        "        {\n"
-        "            return WEOF;\n"
-        "        }\n"
+        "    if (!num_bytes_read)\n"
+        "    {\n"
+        "        ib->flags |= INPUT_BUFFER_COMPLETE;\n"
+        "        return 0;\n"
         "    }\n"
         "\n"
-        "    /* get next code point and check for eol */\n"
-        "    prev_pos = ib->current_pos;\n"
+        "    ib->bytes_read += (int) num_bytes_read;\n"
+        "    return 1;\n"
+        "} /* input_buffer_fill() */\n\n");
+
+    fprintf(src_file, "static int input_buffer_fill_to(input_buffer_t *ib, int end)\n"
+        "{\n"
+        "    while (ib->bytes_read < end)\n"
+        "    {\n"
+        "        if (!input_buffer_fill(ib))\n"
+        "            return 0;\n"
+        "    }\n"
         "\n"
-        "    ch = (wchar_t) ib->buf[ib->current_pos++]; /* just for now */\n"
+        "    return 1;\n"
+        "} /* input_buffer_fill_to() */\n\n");
+
+    fprintf(src_file, "/* true if the bytes before END are in the buffer; only calls out when a read is needed */\n"
+        "#define input_buffer_has(ib, end) ((end) <= (ib)->bytes_read || input_buffer_fill_to(ib, end))\n\n");
+
+    fprintf(src_file, "/* drops the bytes before POS from a buffer read from a file; the copy is only made once */\n"
+        "/* it frees at least half the buffer, so each byte is moved a bounded number of times */\n"
+        "static void input_buffer_drop_lines(input_buffer_t *ib, int pos);\n\n"
+        "static void input_buffer_discard(input_buffer_t *ib, int pos)\n"
+        "{\n"
+        "    if (!ib->f || pos - ib->base < ib->buf_size / 2)\n"
+        "        return;\n"
         "\n"
-        "    new_pos = ib->current_pos;\n"
+        "    input_buffer_drop_lines(ib, pos);\n"
+        "    memmove(ib->buf, input_buffer_at(ib, pos), ib->bytes_read - pos);\n"
+        "    ib->base = pos;\n"
+        "} /* input_buffer_discard() */\n\n");
+
+    fprintf(src_file, "static wchar_t input_buffer_read_char(input_buffer_t *ib)\n"
+        "{\n"
+        "    assert(ib);\n"
+        "    \n"
+        "    /* read more of the file if necessary */\n"
+        "    while (ib->current_pos >= ib->bytes_read)\n"
+        "    {\n"
+        "        if (!input_buffer_fill(ib))\n"
+        "            return WEOF;\n"
+        "    }\n"
         "\n"
-        "    return ch;\n"
+        "    assert(ib->current_pos >= ib->base);\n"
+        "    return (wchar_t) *input_buffer_at(ib, ib->current_pos++); /* just for now */\n"
         "} /* input_buffer_read_char() */\n\n");
 
     fprintf(src_file, "static void input_buffer_read_wstring(input_buffer_t *ib, int begin, int end, array_t *str)\n"
@@ -736,92 +1285,355 @@ int len,i;
     fprintf(src_file, "/* memo map functions */\n\n");
     fprintf(src_file, "typedef struct _memo_rec_t\n"
         "{\n"
+        "    int type;                  /* node type of the record; zero marks an empty slot */\n"
         "    int start_offset, end_offset;\n"
+        "    int pass;                  /* for a seed: -1 while it grows, else the pass it is good for, or 0 for any */\n"
         "    %ls_syntax_node_t *parse_tree;\n"
         "}\n"
         "memo_rec_t;\n\n", buf);
 
-    fprintf(src_file, "typedef struct _memo_map_t\n"
+    fprintf(src_file, "/* a left-recursive rule growing its seed, on the stack of the call doing it */\n"
+        "typedef struct _grow_frame_t\n"
         "{\n"
-        "    array_t records[%ls_NUM_NODE_TYPES]; /* a array_t of memo_rec_t structures */\n"
+        "    int type, start_offset;\n"
+        "    int pass;                  /* numbers the current pass among all those of the parse */\n"
+        "    struct _grow_frame_t *outer;\n"
         "}\n"
-        "memo_map_t;\n\n", cbuf);
+        "grow_frame_t;\n\n");
 
-    fprintf(src_file, "static memo_map_t *memo_map_create()\n"
+    fprintf(src_file, "/* parallel parsing: workers parse the start rule's top-level repetition from speculative boundaries */\n\n");
+    fprintf(src_file, "typedef struct _parallel_item_t\n"
         "{\n"
-        "    int i;\n"
-        "    memo_map_t *map;\n"
-        "    \n"
-        "    map = (memo_map_t *) calloc(1, sizeof(memo_map_t));\n"
+        "    int begin, end;            /* one iteration of the repetition */\n"
+        "    int first_child, num_children; /* its subtrees, in the chunk's children */\n"
+        "}\n"
+        "parallel_item_t;\n\n");
+
+    fprintf(src_file, "typedef struct _parallel_chunk_t\n"
+        "{\n"
+        "    int begin, end;            /* a worker parses items from begin until one reaches end */\n"
+        "    array_t items;\n"
+        "    array_t children;          /* the items' subtrees; those taken by the parse are set to null */\n"
+        "    int next_item;             /* the first item not yet taken or passed over */\n"
+        "    const %ls_parser_t *parser;\n"
+        "    input_buffer_t *ib;        /* the buffer being parsed, which taken nodes are pointed back to */\n"
+        "    input_buffer_t *worker_ib; /* the worker's reader of the same bytes, which its nodes point to */\n"
+        "    int started;               /* set while a worker thread owns the chunk */\n"
+        "#ifdef WIN32\n"
+        "    HANDLE thread;\n"
+        "#else\n"
+        "    pthread_t thread;\n"
+        "#endif\n"
+        "}\n"
+        "parallel_chunk_t;\n\n", buf);
+
+    fprintf(src_file, "typedef struct _parallel_parse_t\n"
+        "{\n"
+        "    parallel_chunk_t *chunks;  /* in input order */\n"
+        "    int num_chunks;\n"
+        "    int joined;                /* the chunks before this one are finished */\n"
+        "    int cur;                   /* the chunk holding the next item to take */\n"
+        "}\n"
+        "parallel_parse_t;\n\n");
+
+    fprintf(src_file, "typedef struct _memo_map_t\n"
+        "{\n"
+        "    unsigned int num, cap;     /* cap is always a power of two */\n"
+        "    memo_rec_t *records;       /* open-addressed table keyed by (type, start_offset) */\n"
+        "    %ls_arena_t *arena;        /* allocator for the nodes of this parse; null for the heap */\n"
+        "    int open_choices;          /* choice points that can still backtrack */\n"
+        "    int commit_pos;            /* nothing before this offset will be parsed again */\n"
+        "    int evict_pos;             /* records before this offset have been evicted */\n"
+        "    grow_frame_t *growing;     /* the seeds being grown, innermost first */\n"
+        "    int passes;                /* seed-growing passes begun so far */\n"
+        "    unsigned char *scanned;    /* a bit per offset from scanned_base, set where the scanner has run */\n"
+        "    int scanned_base, scanned_len; /* scanned_base is a multiple of 8, scanned_len counts bytes */\n"
+        "    %ls_syntax_node_process_ft stream; /* receives the top-level subtrees when streaming */\n"
+        "    void *stream_data;\n"
+        "    const %ls_parser_t *parser; /* dispatch table and options */\n"
+        "    input_buffer_t *node_ib;   /* the buffer nodes point to; a parallel worker's own until its nodes are taken */\n"
+        "    parallel_parse_t *parallel; /* items parsed ahead by workers, when parsing in parallel */\n"
+        "#ifdef %ls_STATS\n"
+        "    %ls_parse_stats_t stats;\n"
+        "#endif\n"
+        "#ifdef %ls_PROFILE\n"
+        "    %ls_rule_profile_t profile[%ls_NUM_NODE_TYPES];\n"
+        "    unsigned long long profile_children; /* cycles the current rule call has spent in the rules it called */\n"
+        "    int profile_reach;         /* farthest end of a successful call inside the current one */\n"
+        "#endif\n"
+        "}\n"
+        "memo_map_t;\n\n", buf, buf, buf, cbuf, buf, cbuf, buf, cbuf);
+
+    fprintf(src_file, "#ifdef %ls_STATS\n"
+        "#define PARSE_STAT(MAP, FIELD) ((MAP)->stats.FIELD++)\n"
+        "#else\n"
+        "#define PARSE_STAT(MAP, FIELD)\n"
+        "#endif\n\n", cbuf);
+
+    fprintf(src_file, "#ifdef %ls_PROFILE\n"
         "\n"
-        "    for (i = 0; i < %ls_NUM_NODE_TYPES; ++i)\n"
-        "    {\n"
-        "        array_init(&map->records[i], sizeof(memo_rec_t), 0);\n"
-        "    }\n"
+        "#if defined(_MSC_VER)\n"
+        "#include <intrin.h>\n"
+        "#endif\n"
         "\n"
-        "    return map;\n"
-        "} /* memo_map_create() */\n\n", cbuf);
-
-    fprintf(src_file, "static void memo_map_destroy(memo_map_t *map)\n"
+        "/* what a rule call saves of the call that made it */\n"
+        "typedef struct _profile_frame_t\n"
         "{\n"
-        "    int i;\n"
+        "    unsigned long long start;  /* clock when the call began */\n"
+        "    unsigned long long children; /* the caller's cycles in the rules it called so far */\n"
+        "    int reach;                 /* the caller's farthest end of a successful call */\n"
+        "    int start_offset;\n"
+        "}\n"
+        "profile_frame_t;\n"
         "\n"
-        "    assert(map);\n"
+        "static unsigned long long profile_clock(void)\n"
+        "{\n"
+        "#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))\n"
+        "    return __rdtsc();\n"
+        "#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))\n"
+        "    unsigned int lo, hi;\n"
         "\n"
-        "    for (i = 0; i < %ls_NUM_NODE_TYPES; ++i)\n"
-        "    {\n"
-        "        int j, count = array_size(&map->records[i]);\n"
-        "        for (j = 0; j < count; ++j)\n"
-        "        {\n"
-        "            memo_rec_t *mr = (memo_rec_t *) array_item(&map->records[i], j);\n"
-        "            if (mr->parse_tree)\n"
-        "                %ls_syntax_node_destroy(mr->parse_tree);\n"
-        "        }\n"
-        "        array_deinit(&map->records[i]);\n"
-        "    }\n"
+        "    __asm__ __volatile__ (\"rdtsc\" : \"=a\" (lo), \"=d\" (hi));\n"
+        "    return ((unsigned long long) hi << 32) | lo;\n"
+        "#elif defined(WIN32)\n"
+        "    LARGE_INTEGER count, freq;\n"
         "\n"
-        "    free(map);\n"
-        "} /* memo_map_destroy() */\n\n", cbuf, buf);
-
-    fprintf(src_file, "static int is_memoized(memo_map_t *map, int type, int start_offset, %ls_syntax_node_t **res, int *end_offset)\n"
+        "    QueryPerformanceCounter(&count);\n"
+        "    QueryPerformanceFrequency(&freq);\n"
+        "    return (unsigned long long) (count.QuadPart * (1e9 / freq.QuadPart));\n"
+        "#else\n"
+        "    struct timespec ts;\n"
+        "\n"
+        "    clock_gettime(CLOCK_MONOTONIC, &ts);\n"
+        "    return (unsigned long long) ts.tv_sec * 1000000000u + ts.tv_nsec;\n"
+        "#endif\n"
+        "} /* profile_clock() */\n"
+        "\n"
+        "static void profile_enter(memo_map_t *map, profile_frame_t *frame, int start_offset)\n"
         "{\n"
-        "    int i, len;\n"
-        "    array_t *da;\n"
+        "    frame->children = map->profile_children;\n"
+        "    frame->reach = map->profile_reach;\n"
+        "    frame->start_offset = start_offset;\n"
+        "    map->profile_children = 0;\n"
+        "    map->profile_reach = start_offset;\n"
+        "    frame->start = profile_clock();\n"
+        "} /* profile_enter() */\n"
         "\n"
-        "    assert(map);\n"
-        "    assert(type < %ls_NUM_NODE_TYPES);\n"
+        "/* adds a call of rule TYPE to its counters and returns RES, what the call returned */\n"
+        "static int profile_leave(memo_map_t *map, profile_frame_t *frame, int type, int res, int *end_offset)\n"
+        "{\n"
+        "    unsigned long long cycles = profile_clock() - frame->start;\n"
+        "    %ls_rule_profile_t *rule = &map->profile[type];\n"
         "\n"
-        "    da = &map->records[type];\n"
-        "    len = array_size(da);\n"
+        "    rule->calls++;\n"
+        "    rule->cycles += cycles;\n"
+        "    rule->self_cycles += cycles - map->profile_children;\n"
+        "    map->profile_children = frame->children + cycles;\n"
         "\n"
-        "    for (i = 0; i < len; ++i)\n"
+        "    if (res)\n"
         "    {\n"
-        "        memo_rec_t *rec = (memo_rec_t *) array_item(da, i);\n"
+        "        rule->successes++;\n"
+        "        rule->consumed += *end_offset - frame->start_offset;\n"
+        "        map->profile_reach = *end_offset > frame->reach ? *end_offset : frame->reach;\n"
+        "    }\n"
+        "    else\n"
+        "    {\n"
+        "        /* what the rules it called matched is thrown away with it */\n"
+        "        rule->failures++;\n"
+        "        rule->backtracked += map->profile_reach - frame->start_offset;\n"
+        "        map->profile_reach = frame->reach;\n"
+        "    }\n"
+        "\n"
+        "    return res;\n"
+        "} /* profile_leave() */\n"
+        "\n"
+        "#endif\n\n", cbuf, buf);
+
+    fprintf(src_file, "#define MEMO_MAP_INITIAL_SIZE 1024\n\n");
+
+    fprintf(src_file, "static unsigned int memo_hash(int type, int start_offset)\n"
+        "{\n"
+        "    unsigned int h = (unsigned int) start_offset * %ls_NUM_NODE_TYPES + (unsigned int) type;\n"
+        "\n"
+        "    h ^= h >> 16;\n"
+        "    h *= 0x85ebca6bu;\n"
+        "    h ^= h >> 13;\n"
+        "    h *= 0xc2b2ae35u;\n"
+        "    h ^= h >> 16;\n"
+        "\n"
+        "    return h;\n"
+        "} /* memo_hash() */\n\n", cbuf);
+
+    fprintf(src_file, "static memo_map_t *memo_map_create(%ls_arena_t *arena)\n"
+        "{\n"
+        "    memo_map_t *map;\n"
+        "    \n"
+        "    map = (memo_map_t *) calloc(1, sizeof(memo_map_t));\n"
+        "    map->cap = MEMO_MAP_INITIAL_SIZE;\n"
+        "    map->records = (memo_rec_t *) calloc(map->cap, sizeof(memo_rec_t));\n"
+        "    map->arena = arena;\n"
+        "\n"
+        "    return map;\n"
+        "} /* memo_map_create() */\n\n", buf);
+
+    fprintf(src_file, "static void memo_map_destroy(memo_map_t *map)\n"
+        "{\n"
+        "    unsigned int i;\n"
+        "\n"
+        "    assert(map);\n"
+        "\n"
+        "    for (i = 0; i < map->cap; ++i)\n"
+        "    {\n"
+        "        memo_rec_t *mr = &map->records[i];\n"
+        "        if (mr->type && mr->parse_tree)\n"
+        "            %ls_syntax_node_destroy(mr->parse_tree);\n"
+        "    }\n"
+        "\n"
+        "    free(map->records);\n"
+        "    free(map->scanned);\n"
+        "    free(map);\n"
+        "} /* memo_map_destroy() */\n\n", buf);
+
+    fprintf(src_file, "static memo_rec_t *memo_map_find_slot(memo_rec_t *records, unsigned int cap, int type, int start_offset)\n"
+        "{\n"
+        "    unsigned int mask = cap - 1;\n"
+        "    unsigned int i = memo_hash(type, start_offset) & mask;\n"
+        "\n"
+        "    /* linear probing; stops at the matching record or the first empty slot */\n"
+        "    while (records[i].type && (records[i].type != type || records[i].start_offset != start_offset))\n"
+        "        i = (i + 1) & mask;\n"
         "\n"
-        "        if (rec->start_offset == start_offset)\n"
+        "    return &records[i];\n"
+        "} /* memo_map_find_slot() */\n\n");
+
+    fprintf(src_file, "/* moves the records into a table of NEW_CAP slots, dropping those behind the commit point */\n"
+        "static void memo_map_rehash(memo_map_t *map, unsigned int new_cap)\n"
+        "{\n"
+        "    unsigned int i, old_cap = map->cap;\n"
+        "    int drop;\n"
+        "    memo_rec_t *old_records = map->records;\n"
+        "\n"
+        "    map->cap = new_cap;\n"
+        "    map->records = (memo_rec_t *) calloc(map->cap, sizeof(memo_rec_t));\n"
+        "\n"
+        "    for (i = 0; i < old_cap; ++i)\n"
+        "    {\n"
+        "        if (!old_records[i].type)\n"
+        "            continue;\n"
+        "\n"
+        "        if (old_records[i].start_offset < map->commit_pos)\n"
         "        {\n"
-        "            *res = %ls_syntax_node_copy(rec->parse_tree);\n"
-        "            *end_offset = rec->end_offset;\n"
-        "            return 1;\n"
+        "            if (old_records[i].parse_tree)\n"
+        "                %ls_syntax_node_destroy(old_records[i].parse_tree);\n"
+        "            map->num--;\n"
+        "        }\n"
+        "        else\n"
+        "        {\n"
+        "            *memo_map_find_slot(map->records, map->cap, old_records[i].type, old_records[i].start_offset) = old_records[i];\n"
+        "        }\n"
+        "    }\n"
+        "\n"
+        "    map->evict_pos = map->commit_pos;\n"
+        "    free(old_records);\n"
+        "\n"
+        "    /* the scanner will not run behind the commit point either */\n"
+        "    if ((drop = (map->commit_pos - map->scanned_base) >> 3) > 0)\n"
+        "    {\n"
+        "        if (drop < map->scanned_len)\n"
+        "        {\n"
+        "            memmove(map->scanned, map->scanned + drop, map->scanned_len - drop);\n"
+        "            memset(map->scanned + map->scanned_len - drop, 0, drop);\n"
         "        }\n"
+        "        else if (map->scanned)\n"
+        "        {\n"
+        "            memset(map->scanned, 0, map->scanned_len);\n"
+        "        }\n"
+        "        map->scanned_base += drop * 8;\n"
+        "    }\n"
+        "} /* memo_map_rehash() */\n\n", buf);
+
+    fprintf(src_file, "/* called by CUT when no choice point is left open: the parse can no longer backtrack before POS */\n"
+        "static void memo_map_commit(memo_map_t *map, int pos)\n"
+        "{\n"
+        "    if (pos > map->commit_pos)\n"
+        "        map->commit_pos = pos;\n"
+        "} /* memo_map_commit() */\n\n");
+
+    fprintf(src_file, "static %ls_syntax_node_t *syntax_node_retain(%ls_syntax_node_t *node)\n"
+        "{\n"
+        "    if (node && node->refs)\n"
+        "        node->refs++;\n"
+        "\n"
+        "    return node;\n"
+        "} /* syntax_node_retain() */\n\n", buf, buf);
+
+    fprintf(src_file, "static int is_memoized(memo_map_t *map, int type, int start_offset, %ls_syntax_node_t **res, int *end_offset)\n"
+        "{\n"
+        "    memo_rec_t *rec;\n"
+        "\n"
+        "    assert(map);\n"
+        "    assert(type > 0 && type < %ls_NUM_NODE_TYPES);\n"
+        "\n"
+        "    PARSE_STAT(map, memo_lookups);\n"
+        "    rec = memo_map_find_slot(map->records, map->cap, type, start_offset);\n"
+        "\n"
+        "#ifdef %ls_PROFILE\n"
+        "    if (rec->type)\n"
+        "        map->profile[type].memo_hits++;\n"
+        "    else\n"
+        "        map->profile[type].memo_misses++;\n"
+        "#endif\n"
+        "\n"
+        "    if (rec->type)\n"
+        "    {\n"
+        "        PARSE_STAT(map, memo_hits);\n"
+        "        *res = syntax_node_retain(rec->parse_tree);\n"
+        "        *end_offset = rec->end_offset;\n"
+        "        return 1;\n"
         "    }\n"
         "\n"
         "    return 0;\n"
-        "} /* is_memoized() */\n\n", buf, cbuf, buf);
+        "} /* is_memoized() */\n\n", buf, cbuf, cbuf);
 
     fprintf(src_file, "static void memoize(memo_map_t *map, int type, int start_offset, int end_offset, %ls_syntax_node_t *node)\n"
         "{\n"
-        "    memo_rec_t rec;\n"
+        "    memo_rec_t *rec;\n"
         "\n"
         "    assert(map);\n"
-        "    assert(type < %ls_NUM_NODE_TYPES);\n"
+        "    assert(type > 0 && type < %ls_NUM_NODE_TYPES);\n"
+        "\n"
+        "    /* keep the load factor at or below one half, evicting committed records before growing */\n"
+        "    if ((map->num + 1) * 2 > map->cap)\n"
+        "    {\n"
+        "        if (map->commit_pos > map->evict_pos)\n"
+        "            memo_map_rehash(map, map->cap);\n"
+        "        if (map->num * 4 > map->cap)\n"
+        "            memo_map_rehash(map, map->cap * 2);\n"
+        "    }\n"
+        "\n"
+        "    rec = memo_map_find_slot(map->records, map->cap, type, start_offset);\n"
         "\n"
-        "    rec.start_offset = start_offset;\n"
-        "    rec.end_offset = end_offset;\n"
-        "    rec.parse_tree = %ls_syntax_node_copy(node);\n"
+        "    if (rec->type)\n"
+        "    {\n"
+        "        if (rec->parse_tree)\n"
+        "            %ls_syntax_node_destroy(rec->parse_tree);\n"
+        "    }\n"
+        "    else\n"
+        "    {\n"
+        "        map->num++;\n"
+        "#ifdef %ls_STATS\n"
+        "        map->stats.memo_records++;\n"
+        "        if (map->num > map->stats.memo_peak)\n"
+        "            map->stats.memo_peak = map->num;\n"
+        "#endif\n"
+        "    }\n"
         "\n"
-        "    array_add(&map->records[type], &rec);\n"
-        "} /* memoize() */\n\n", buf, cbuf, buf);
+        "    rec->type = type;\n"
+        "    rec->start_offset = start_offset;\n"
+        "    rec->end_offset = end_offset;\n"
+        "    rec->pass = 0;\n"
+        "    rec->parse_tree = syntax_node_retain(node);\n"
+        "} /* memoize() */\n\n", buf, cbuf, buf, cbuf);
 
     fprintf(src_file, "static void delete_children(array_t *children, int start_index)\n"
         "{\n"
@@ -840,87 +1652,29 @@ int len,i;
         "    children->num = start_index;\n"
         "} /* delete_children() */\n\n", buf, buf, buf);
 
-    /* line number utilities */
-    fprintf(src_file, "static void find_line_endings(array_t *end_offsets, input_buffer_t *ib, int start_pos)\n"
-"{\n"
-"    wchar_t ch, eol_pos = 0;\n"
-"    int pos;\n"
-"\n"
-"    input_buffer_setpos(ib, start_pos);\n"
-"\n"
-"    do\n"
-"    {\n"
-"        ch = input_buffer_read_char(ib);\n"
-"\n"
-"        if (ch == L'\\n')\n"
-"        {\n"
-"            pos = input_buffer_getpos(ib);\n"
-"            array_add(end_offsets, &pos);\n"
-"            eol_pos = 0;\n"
-"        }\n"
-"        else if (ch == L'\\r')\n"
-"        {\n"
-"            eol_pos = input_buffer_getpos(ib);\n"
-"        }\n"
-"        else\n"
-"        {\n"
-"            if (eol_pos > 0)\n"
-"            {\n"
-"                pos = eol_pos;\n"
-"                array_add(end_offsets, &pos);\n"
-"            }\n"
-"\n"
-"            eol_pos = 0;\n"
-"        }\n"
-"    }\n"
-"    while (ch != WEOF);\n"
-"\n"
-"    pos = input_buffer_getpos(ib);\n"
-"    array_add(end_offsets, &pos);\n"
-"} /* find_line_lengths() */\n"
-"\n"
-"static int find_line(int pos, array_t *line_endings)\n"
-"{\n"
-"    int n, i, len = array_size(line_endings);\n"
-"    for (i = 0; i < len; ++i)\n"
-"    {\n"
-"        n = * (int *) array_item(line_endings, i);\n"
-"        if (pos < n)\n"
-"            return i+1;\n"
-"    }\n"
-"\n"
-"    if (pos == n)\n"
-"        return len;\n"
-"    else\n"
-"        return -1;\n"
-"} /* find_line() */\n"
-"\n"
-"static int assign_line_number(%ls_syntax_node_t *node, void *data)\n"
-"{\n"
-"    array_t *line_endings = (array_t *) data;\n"
-"\n"
-"    if (node->begin >= node->end)\n"
-"    {\n"
-"        node->first_line = node->last_line = find_line(node->begin, line_endings);\n"
-"    }\n"
-"    else\n"
-"    {\n"
-"        node->first_line = find_line(node->begin, line_endings);\n"
-"        node->last_line = find_line(node->end-1, line_endings);\n"
-"    }\n"
-"\n"
-"    return 0;\n"
-"} /* assign_line_number() */\n"
-"\n"
-"static void assign_line_numbers(input_buffer_t *ib, %ls_syntax_node_t *node, array_t *line_endings)\n"
-"{\n"
-"    /* assign line numbers to the nodes */\n"
-"    %ls_syntax_node_traverse_preorder(node, line_endings, assign_line_number,NULL);\n"
-"} /* assign_line_numbers() */\n", buf, buf, buf);
+    /* streaming */
+    fprintf(src_file, "/* hands the subtrees of one iteration of the streamed repetition to the callback, then releases */\n"
+        "/* them along with the memo records and input behind POS; returns 0 if the callback stops the parse */\n"
+        "static int stream_children(input_buffer_t *ib, memo_map_t *map, array_t *child_stack, int start_index, int pos)\n"
+        "{\n"
+        "    int i, stop = 0;\n"
+        "\n"
+        "    for (i = start_index; i < array_size(child_stack) && !stop; ++i)\n"
+        "    {\n"
+        "        %ls_syntax_node_t *node = *(%ls_syntax_node_t **) array_item(child_stack, i);\n"
+        "        stop = map->stream(node, map->stream_data);\n"
+        "    }\n"
+        "\n"
+        "    delete_children(child_stack, start_index);\n"
+        "    memo_map_commit(map, pos);\n"
+        "    input_buffer_discard(ib, pos);\n"
+        "\n"
+        "    return !stop;\n"
+        "} /* stream_children() */\n\n", buf, buf);
 
 } /* print_utility_source() */
 
-static void print_function_prototypes(const wchar_t *prefix, FILE *src_file, const array_t *node_function_names)
+static void print_function_prototypes(const wchar_t *prefix, FILE *src_file, const array_t *node_function_names, int backend)
 {
     wchar_t pbuf[128];
     int i, len;
@@ -930,10 +1684,11 @@ static void print_function_prototypes(const wchar_t *prefix, FILE *src_file, con
 
     fprintf(src_file, "/* function prototypes */\n\n");
 
-    len = array_size(node_function_names);
+    /* the bytecode backend has a function for the start rule only */
+    len = backend == BACKEND_VM ? 1 : array_size(node_function_names);
     for (i = 0; i < len; ++i)
     {
-        fprintf(src_file, "static int %ls(input_buffer_t *ib, int start_offset, int *end_ofset, %ls_syntax_node_t **node, memo_map_t *map, array_t *error_stack);\n", 
+        fprintf(src_file, "static int %ls(input_buffer_t *ib, int start_offset, int *end_ofset, %ls_syntax_node_t **node, memo_map_t *map, error_list_t *errs);\n", 
             *(wchar_t **) array_item(node_function_names, i), pbuf);
     }
 
@@ -942,10 +1697,12 @@ static void print_function_prototypes(const wchar_t *prefix, FILE *src_file, con
 
 static void print_macros(const wchar_t *prefix, FILE *src_file)
 {
-    wchar_t pbuf[128];
+    wchar_t pbuf[128], ubuf[128];
 
     swprintf(pbuf, 128, L"%ls", prefix);
     to_lower(pbuf);
+    swprintf(ubuf, 128, L"%ls", prefix);
+    to_upper(ubuf);
 
     fprintf(src_file, "/* parsing macros */\n\n");
 
@@ -967,17 +1724,22 @@ static void print_macros(const wchar_t *prefix, FILE *src_file)
         "                                            \\\n"
         "}\n\n");
 
-    fprintf(src_file, "#define DISJ(A, B)                          \\\n"
+    fprintf(src_file, "/* choice points count themselves open in the memo map until they are left or cut */\n"
+        "#define DISJ(A, B)                          \\\n"
         "{                                           \\\n"
         "    int orig_stack_size = child_stack.num;  \\\n"
         "    int orig_start_pos = cur_start_pos;     \\\n"
+        "    int cut = 0;                            \\\n"
         "                                            \\\n"
+        "    map->open_choices++;                    \\\n"
         "    A;                                      \\\n"
+        "    if (!cut)                               \\\n"
+        "        map->open_choices--;                \\\n"
         "                                            \\\n"
-        "    if (!res)                               \\\n"
+        "    if (!res && !cut)                       \\\n"
         "    {                                       \\\n"
-        "        delete_errors(error_stack, 0);      \\\n"
         "        cur_start_pos = orig_start_pos;     \\\n"
+        "        cut = 1;                            \\\n"
         "                                            \\\n"
         "        B;                                  \\\n"
         "    }                                       \\\n"
@@ -988,31 +1750,122 @@ static void print_macros(const wchar_t *prefix, FILE *src_file)
         "        delete_children(&child_stack, orig_stack_size);   \\\n"
         "}\n\n");
 
-    fprintf(src_file, "#define STAR(A)                             \\\n"
+    fprintf(src_file, "/* an alternative that cannot start with the next byte fails without being called, recording */\n"
+        "/* the rule failures the call would have */\n"
+        "#define PREDICT(first, fails, A)            \\\n"
+        "{                                           \\\n"
+        "    if (input_buffer_has(ib, cur_start_pos + 1) \\\n"
+        "        && CHAR_CLASS_HAS_BYTE(&first, *input_buffer_at(ib, cur_start_pos))) \\\n"
+        "    {                                       \\\n"
+        "        A;                                  \\\n"
+        "    }                                       \\\n"
+        "    else                                    \\\n"
+        "    {                                       \\\n"
+        "        int wish = map->parser->wish_node;  \\\n"
+        "                                            \\\n"
+        "        record_failures(errs, fails, cur_start_pos); \\\n"
+        "        if (wish > 0 && wish < %ls_NUM_NODE_TYPES && ((fails)[wish >> 3] >> (wish & 7)) & 1) \\\n"
+        "            dump_errors(errs);              \\\n"
+        "        res = 0;                            \\\n"
+        "    }                                       \\\n"
+        "}\n\n", ubuf);
+
+    fprintf(src_file, "/* an iteration that fails part of the way through gives back what it consumed */\n"
+        "#define STAR(A)                             \\\n"
         "{                                           \\\n"
+        "    int cut, iter_start_pos;                \\\n"
         "                                            \\\n"
         "    do                                      \\\n"
         "    {                                       \\\n"
+        "        cut = 0;                            \\\n"
+        "        iter_start_pos = cur_start_pos;     \\\n"
+        "        map->open_choices++;                \\\n"
         "        A;                                  \\\n"
+        "        if (!cut)                           \\\n"
+        "            map->open_choices--;            \\\n"
         "                                            \\\n"
         "        if (res)                            \\\n"
         "            cur_start_pos = cur_end_pos;    \\\n"
         "    }                                       \\\n"
         "    while(res);                             \\\n"
-        "    res = 1;                                \\\n"
+        "    cur_start_pos = cur_end_pos = iter_start_pos; \\\n"
+        "    res = !cut;                             \\\n"
+        "}\n\n");
+
+    fprintf(src_file, "/* the top-level repetition of the start rule; when streaming, each iteration that leaves no */\n"
+        "/* choice open can never be undone, so its subtrees are handed over and released at once; */\n"
+        "/* when parsing in parallel, an iteration a worker has already parsed is taken as it is */\n"
+        "#define STREAM_STAR(A)                      \\\n"
+        "{                                           \\\n"
+        "    int cut, iter_start_pos;                \\\n"
         "                                            \\\n"
-        "    delete_errors(error_stack, 0);          \\\n"
+        "    do                                      \\\n"
+        "    {                                       \\\n"
+        "        int orig_stack_size = child_stack.num; \\\n"
+        "                                            \\\n"
+        "        cut = 0;                            \\\n"
+        "        iter_start_pos = cur_start_pos;     \\\n"
+        "        if (map->parallel && parallel_take(map->parallel, cur_start_pos, &child_stack, &cur_end_pos)) \\\n"
+        "            res = 1;                        \\\n"
+        "        else                                \\\n"
+        "        {                                   \\\n"
+        "            map->open_choices++;            \\\n"
+        "            A;                              \\\n"
+        "            if (!cut)                       \\\n"
+        "                map->open_choices--;        \\\n"
+        "        }                                   \\\n"
+        "                                            \\\n"
+        "        if (res)                            \\\n"
+        "        {                                   \\\n"
+        "            cur_start_pos = cur_end_pos;    \\\n"
+        "            if (map->stream && !map->open_choices \\\n"
+        "                && !stream_children(ib, map, &child_stack, orig_stack_size, cur_start_pos)) \\\n"
+        "                res = 0, cut = 1;           \\\n"
+        "        }                                   \\\n"
+        "    }                                       \\\n"
+        "    while(res);                             \\\n"
+        "    cur_start_pos = cur_end_pos = iter_start_pos; \\\n"
+        "    res = !cut;                             \\\n"
+        "}\n\n");
+
+    fprintf(src_file, "/* one iteration of the streamed repetition on its own, for the parallel workers; */\n"
+        "/* its subtrees go onto CHILDREN */\n"
+        "#define PEG_ITEM(FUNCTION, EXP)             \\\n"
+        "static int FUNCTION(input_buffer_t *ib, int start_offset, int *end_offset, array_t *children, memo_map_t *map, error_list_t *errs) \\\n"
+        "{                                           \\\n"
+        "    int res = 0;                            \\\n"
+        "    int cur_start_pos = start_offset, cur_end_pos = start_offset; \\\n"
+        "    int cut = 0;                            \\\n"
+        "    array_t child_stack = *children;        \\\n"
+        "    int orig_stack_size = child_stack.num;  \\\n"
+        "                                            \\\n"
+        "    map->open_choices++;                    \\\n"
+        "    EXP;                                    \\\n"
+        "    if (!cut)                               \\\n"
+        "        map->open_choices--;                \\\n"
+        "                                            \\\n"
+        "    if (res)                                \\\n"
+        "        *end_offset = cur_end_pos;          \\\n"
+        "    else                                    \\\n"
+        "        delete_children(&child_stack, orig_stack_size); \\\n"
+        "                                            \\\n"
+        "    *children = child_stack;                \\\n"
+        "    return res;                             \\\n"
         "}\n\n");
 
     fprintf(src_file, "#define PLUS(A)                             \\\n"
         "{                                           \\\n"
         "    int orig_stack_size = child_stack.num;  \\\n"
-        "    int count = 0;                          \\\n"
-        "    int error_stack_size = error_stack->num; \\\n"
+        "    int count = 0, cut, iter_start_pos;     \\\n"
         "                                            \\\n"
         "    do                                      \\\n"
         "    {                                       \\\n"
+        "        cut = 0;                            \\\n"
+        "        iter_start_pos = cur_start_pos;     \\\n"
+        "        map->open_choices++;                \\\n"
         "        A;                                  \\\n"
+        "        if (!cut)                           \\\n"
+        "            map->open_choices--;            \\\n"
         "                                            \\\n"
         "        if (res)                            \\\n"
         "        {                                   \\\n"
@@ -1021,25 +1874,29 @@ static void print_macros(const wchar_t *prefix, FILE *src_file)
         "        }                                   \\\n"
         "    }                                       \\\n"
         "    while (res);                            \\\n"
-        "    res = count > 0;                        \\\n"
+        "    cur_start_pos = cur_end_pos = iter_start_pos; \\\n"
+        "    res = count > 0 && !cut;                \\\n"
         "                                            \\\n"
-        "    if (res)                                \\\n"
-        "        delete_errors(error_stack, error_stack_size); \\\n"
-        "    else                                    \\\n"
+        "    if (!res)                               \\\n"
         "        delete_children(&child_stack, orig_stack_size); \\\n"
         "}\n\n");
 
     fprintf(src_file, "#define QUES(A)                             \\\n"
         "{                                           \\\n"
-        "    int error_stack_size = error_stack->num; \\\n"
+        "    int cut = 0;                            \\\n"
+        "    int orig_start_pos = cur_start_pos;     \\\n"
         "                                            \\\n"
+        "    map->open_choices++;                    \\\n"
         "    A;                                      \\\n"
+        "    if (!cut)                               \\\n"
+        "        map->open_choices--;                \\\n"
         "                                            \\\n"
         "    if (res)                                \\\n"
         "        cur_start_pos = cur_end_pos;        \\\n"
+        "    else                                    \\\n"
+        "        cur_start_pos = cur_end_pos = orig_start_pos; \\\n"
         "                                            \\\n"
-        "    res = 1;                                \\\n"
-        "    delete_errors(error_stack, error_stack_size); \\\n"
+        "    res = res || !cut;                      \\\n"
         "}\n\n");
 
     fprintf(src_file, "#define HIDE(A)                                     \\\n"
@@ -1054,37 +1911,61 @@ static void print_macros(const wchar_t *prefix, FILE *src_file)
 
 
 
-    fprintf(src_file, "#define BANG(A)                             \\\n"
+    fprintf(src_file, "/* lookaheads always backtrack, so a cut inside one never commits; */\n"
+        "/* what fails inside a negative one was hoped to fail, and is not a syntax error */\n"
+        "#define BANG(A)                             \\\n"
         "{                                           \\\n"
         "    int orig_start_pos = cur_start_pos;     \\\n"
         "    int orig_stack_size = child_stack.num;  \\\n"
-        "    int orig_error_size = error_stack->num; \\\n"
+        "    int cut = 1;                            \\\n"
+        "    (void) cut;                             \\\n"
         "                                            \\\n"
+        "    map->open_choices++;                    \\\n"
+        "    errs->lookaheads++;                     \\\n"
         "    A;                                      \\\n"
+        "    errs->lookaheads--;                     \\\n"
+        "    map->open_choices--;                    \\\n"
         "                                            \\\n"
         "    res = !res;                             \\\n"
         "                                            \\\n"
         "    cur_start_pos = cur_end_pos = orig_start_pos;         \\\n"
         "                                            \\\n"
         "    delete_children(&child_stack, orig_stack_size); \\\n"
-        "    delete_errors(error_stack, orig_error_size); \\\n"
         "}\n\n");
 
     fprintf(src_file, "#define AMP(A)                              \\\n"
         "{                                           \\\n"
         "    int orig_start_pos = cur_start_pos;     \\\n"
+        "    int cut = 1;                            \\\n"
+        "    (void) cut;                             \\\n"
         "                                            \\\n"
-        "                                            \\\n"
+        "    map->open_choices++;                    \\\n"
         "    A;                                      \\\n"
+        "    map->open_choices--;                    \\\n"
         "                                            \\\n"
         "    cur_start_pos = cur_end_pos = orig_start_pos;         \\\n"
         "                                            \\\n"
         "}\n\n");
 
+    fprintf(src_file, "/* commits to the innermost choice of the rule; with no choice left open anywhere, */\n"
+        "/* memo records behind the current offset can be evicted */\n"
+        "#define CUT                                 \\\n"
+        "{                                           \\\n"
+        "    if (!cut)                               \\\n"
+        "    {                                       \\\n"
+        "        cut = 1;                            \\\n"
+        "        map->open_choices--;                \\\n"
+        "    }                                       \\\n"
+        "    if (!map->open_choices)                 \\\n"
+        "        memo_map_commit(map, cur_start_pos); \\\n"
+        "    cur_end_pos = cur_start_pos;            \\\n"
+        "    res = 1;                                \\\n"
+        "}\n\n");
+
     fprintf(src_file, "#define T(func)                                                     \\\n"
         "{                                                                   \\\n"
         "    %ls_syntax_node_t *child = 0;                                         \\\n"
-        "    if ((res = func(ib, cur_start_pos, &cur_end_pos, &child, map, error_stack))) \\\n"
+        "    if ((res = func(ib, cur_start_pos, &cur_end_pos, &child, map, errs))) \\\n"
         "    {                                                               \\\n"
         "        if (child)                                                  \\\n"
         "            array_add(&child_stack, &child);                        \\\n"
@@ -1092,34 +1973,53 @@ static void print_macros(const wchar_t *prefix, FILE *src_file)
         "    }                                                               \\\n"
         "}\n\n", pbuf);
 
-    fprintf(src_file, "#define S(str)                                  \\\n"
-        "{                                               \\\n"
-        "    wchar_t ch, *ptr = str;                     \\\n"
-        "                                                \\\n"
-        "    input_buffer_setpos(ib, cur_start_pos);     \\\n"
-        "                                                \\\n"
-        "    for (res = 1; *ptr; ++ptr)                  \\\n"
-        "    {                                           \\\n"
-        "        ch = input_buffer_read_char(ib);        \\\n"
-        "        if (!(res = (ch == *ptr)))              \\\n"
-        "            break;                              \\\n"
-        "    }                                           \\\n"
-        "                                                \\\n"
-        "    if (res)                                    \\\n"
-        "        cur_start_pos = cur_end_pos = input_buffer_getpos(ib);  \\\n"
+    fprintf(src_file, "/* repetitions of a single byte set are consumed in one call to a span kernel */\n"
+        "#define SPAN_STAR(span)                                         \\\n"
+        "{                                                               \\\n"
+        "    cur_start_pos = cur_end_pos = input_buffer_span(ib, cur_start_pos, &span); \\\n"
+        "    res = 1;                                                    \\\n"
         "}\n\n");
 
-    fprintf(src_file, "#define C(str)                                  \\\n"
-        "{                                               \\\n"
-        "    wchar_t ch, *ptr = str;                     \\\n"
-        "    input_buffer_setpos(ib, cur_start_pos);     \\\n"
-        "    ch = input_buffer_read_char(ib);            \\\n"
-        "    for (res = 0; *ptr; ++ptr)                  \\\n"
-        "    {                                           \\\n"
-        "        if ((res = (ch == *ptr)))               \\\n"
-        "            break;                              \\\n"
-        "    }                                           \\\n"
-        "    if (res)                                    \\\n"
+    fprintf(src_file, "#define SPAN_PLUS(span)                                         \\\n"
+        "{                                                               \\\n"
+        "    int span_end = input_buffer_span(ib, cur_start_pos, &span); \\\n"
+        "    if ((res = span_end > cur_start_pos))                       \\\n"
+        "        cur_start_pos = cur_end_pos = span_end;                 \\\n"
+        "}\n\n");
+
+    fprintf(src_file, "/* literals are compared in place against the raw buffer, LEN bytes at once */\n"
+        "#define S(str, len)                                             \\\n"
+        "{                                                               \\\n"
+        "    res = input_buffer_has(ib, cur_start_pos + (len))           \\\n"
+        "        && memcmp(input_buffer_at(ib, cur_start_pos), str, len) == 0; \\\n"
+        "    if (res)                                                    \\\n"
+        "        cur_start_pos = cur_end_pos = cur_start_pos + (len);    \\\n"
+        "}\n\n");
+
+    fprintf(src_file, "#define S1(c)                                                   \\\n"
+        "{                                                               \\\n"
+        "    res = input_buffer_has(ib, cur_start_pos + 1)               \\\n"
+        "        && (unsigned char) *input_buffer_at(ib, cur_start_pos) == (unsigned char) (c); \\\n"
+        "    if (res)                                                    \\\n"
+        "        cur_start_pos = cur_end_pos = cur_start_pos + 1;        \\\n"
+        "}\n\n");
+
+    fprintf(src_file, "/* character classes test one bit of their membership table per input byte */\n"
+        "#define C(cls)                                                  \\\n"
+        "{                                                               \\\n"
+        "    res = input_buffer_has(ib, cur_start_pos + 1)               \\\n"
+        "        && CHAR_CLASS_HAS_BYTE(&cls, *input_buffer_at(ib, cur_start_pos)); \\\n"
+        "    if (res)                                                    \\\n"
+        "        cur_start_pos = cur_end_pos = cur_start_pos + 1;        \\\n"
+        "}\n\n");
+
+    fprintf(src_file, "/* classes with members above 255 also search their range list */\n"
+        "#define CW(cls)                                                 \\\n"
+        "{                                                               \\\n"
+        "    wchar_t ch;                                                 \\\n"
+        "    input_buffer_setpos(ib, cur_start_pos);                     \\\n"
+        "    ch = input_buffer_read_char(ib);                            \\\n"
+        "    if ((res = char_class_match(&cls, ch)))                     \\\n"
         "        cur_start_pos = cur_end_pos = input_buffer_getpos(ib);  \\\n"
         "}\n\n");
 
@@ -1132,17 +2032,39 @@ static void print_macros(const wchar_t *prefix, FILE *src_file)
         "        cur_start_pos = cur_end_pos = input_buffer_getpos(ib);  \\\n"
         "}\n\n");
 
-    fprintf(src_file, "#define PEG_PARSE(FUNCTION, NODE_TYPE, NODE_NAME, EXP)                                                                 \\\n"
-        "static int FUNCTION(input_buffer_t *ib, int start_offset, int *end_offset, %ls_syntax_node_t **node, memo_map_t *map, array_t *error_stack) \\\n"
+    /* the profile wraps each rule function in one that counts and times its calls */
+    fprintf(src_file, "#ifdef %ls_PROFILE\n"
+        "#define RULE_FUNCTION(FUNCTION, NODE_TYPE)                                                                   \\\n"
+        "static int FUNCTION##_body(input_buffer_t *ib, int start_offset, int *end_offset, %ls_syntax_node_t **node, memo_map_t *map, error_list_t *errs); \\\n"
+        "static int FUNCTION(input_buffer_t *ib, int start_offset, int *end_offset, %ls_syntax_node_t **node, memo_map_t *map, error_list_t *errs) \\\n"
+        "{                                                                                                           \\\n"
+        "    profile_frame_t frame;                                                                                  \\\n"
+        "    profile_enter(map, &frame, start_offset);                                                               \\\n"
+        "    return profile_leave(map, &frame, NODE_TYPE, FUNCTION##_body(ib, start_offset, end_offset, node, map, errs), end_offset); \\\n"
+        "}                                                                                                           \\\n"
+        "static int FUNCTION##_body(input_buffer_t *ib, int start_offset, int *end_offset, %ls_syntax_node_t **node, memo_map_t *map, error_list_t *errs)\n"
+        "#else\n"
+        "#define RULE_FUNCTION(FUNCTION, NODE_TYPE)                                                                   \\\n"
+        "static int FUNCTION(input_buffer_t *ib, int start_offset, int *end_offset, %ls_syntax_node_t **node, memo_map_t *map, error_list_t *errs)\n"
+        "#endif\n\n", ubuf, pbuf, pbuf, pbuf, pbuf);
+
+    fprintf(src_file, "#define PEG_PARSE(FUNCTION, NODE_TYPE, EXP)                                                                           \\\n"
+        "RULE_FUNCTION(FUNCTION, NODE_TYPE)                                                                          \\\n"
         "{                                                                                                           \\\n"
         "    int res = 0;                                                                                            \\\n"
         "    int cur_start_pos = start_offset, cur_end_pos = start_offset;                                           \\\n"
+        "    int cut = 1; /* a cut outside any choice of this rule has nothing to commit to */                       \\\n"
+        "    (void) cut;                                                                                             \\\n"
         "                                                                                                            \\\n"
         "    array_t child_stack;                                                                                    \\\n"
         "    array_init(&child_stack, sizeof(%ls_syntax_node_t *), 0);                                               \\\n"
         "                                                                                                            \\\n"
-        "    if (is_memoized(map, NODE_TYPE, start_offset, node, end_offset))                                        \\\n"
+        "    if (memo_rule[NODE_TYPE] && is_memoized(map, NODE_TYPE, start_offset, node, end_offset))                \\\n"
+        "    {                                                                                                       \\\n"
+        "        if (!*node)                                                                                         \\\n"
+        "            record_failure(errs, NODE_TYPE, start_offset);                                                  \\\n"
         "        return *node != 0;                                                                                  \\\n"
+        "    }                                                                                                       \\\n"
         "                                                                                                            \\\n"
         "    EXP;                                                                                                    \\\n"
         "                                                                                                            \\\n"
@@ -1150,9 +2072,10 @@ static void print_macros(const wchar_t *prefix, FILE *src_file)
         "    {                                                                                                       \\\n"
         "        int i, len;                                                                                         \\\n"
         "        *end_offset = cur_end_pos;                                                                          \\\n"
-        "        *node = %ls_syntax_node_create(NODE_TYPE, start_offset, cur_end_pos, ib);                           \\\n"
+        "        *node = arena_node_create(map->arena, NODE_TYPE, start_offset, cur_end_pos, map->node_ib);         \\\n"
+        "        PARSE_STAT(map, nodes);                                                                             \\\n"
         "        len = array_size(&child_stack);                                                                     \\\n"
-        "        (*node)->child = (%ls_syntax_node_t **) calloc(len+1, sizeof(%ls_syntax_node_t *));                 \\\n"
+        "        (*node)->child = arena_child_array(map->arena, len);                                                \\\n"
         "                                                                                                            \\\n"
         "        for (i = 0; i < len; ++i)                                                                           \\\n"
         "        {                                                                                                   \\\n"
@@ -1161,264 +2084,3362 @@ static void print_macros(const wchar_t *prefix, FILE *src_file)
 	"        (*node)->children = len;                                                                            \\\n"
         "        delete_children(&child_stack, len);                                                                 \\\n"
         "        array_deinit(&child_stack);                                                                         \\\n"
-        "        if (%ls_dispatch[NODE_TYPE] != NULL) (%ls_dispatch[NODE_TYPE])(*node,NULL);                         \\\n"
+        "        if (map->parser->dispatch[NODE_TYPE] != NULL) map->parser->dispatch[NODE_TYPE](*node, map->parser->data); \\\n"
         "        res = 1;                                                                                            \\\n"
         "    }                                                                                                       \\\n"
         "    else                                                                                                    \\\n"
         "    {                                                                                                       \\\n"
-        "        int len = (int) wcslen(NODE_NAME) + 64;                                                             \\\n"
-        "        wchar_t *buf = (wchar_t *) calloc(len, sizeof(wchar_t));                                            \\\n"
-        "        swprintf(buf, len, L\"syntax error: expected %%ls\", NODE_NAME);                                    \\\n"
-        "        add_error(error_stack, start_offset, buf);                                                          \\\n"
-	"        if(%ls_wish_node == NODE_TYPE) dump_errors(error_stack);					     \\\n"
-        "        free(buf);                                                                                          \\\n"
+        "        record_failure(errs, NODE_TYPE, start_offset);                                                      \\\n"
+        "        PARSE_STAT(map, failures);                                                                          \\\n"
+	"        if (map->parser->wish_node == NODE_TYPE) dump_errors(errs);                                         \\\n"
         "        *node = 0;                                                                                          \\\n"
+        "        delete_children(&child_stack, 0);                                                                   \\\n"
+        "        array_deinit(&child_stack);                                                                         \\\n"
         "    }                                                                                                       \\\n"
         "                                                                                                            \\\n"
-        "    memoize(map, NODE_TYPE, start_offset, res ? *end_offset : start_offset, *node);                         \\\n"
+        "    if (memo_rule[NODE_TYPE])                                                                               \\\n"
+        "        memoize(map, NODE_TYPE, start_offset, res ? *end_offset : start_offset, *node);                     \\\n"
         "                                                                                                            \\\n"
         "    return res;                                                                                             \\\n"
-        "}\n\n", pbuf, pbuf, pbuf, pbuf, pbuf, pbuf, pbuf, pbuf, pbuf);
+        "}\n\n", pbuf, pbuf);
+
+    fprintf(src_file, "/* a left-recursive rule: FUNCTION##_seed parses it once, and this grows the seed in its memo record */\n"
+        "#define PEG_GROW(FUNCTION, NODE_TYPE)                                                                        \\\n"
+        "static int FUNCTION(input_buffer_t *ib, int start_offset, int *end_offset, %ls_syntax_node_t **node, memo_map_t *map, error_list_t *errs) \\\n"
+        "{                                                                                                           \\\n"
+        "    int res, end = start_offset;                                                                            \\\n"
+        "    %ls_syntax_node_t *seed;                                                                                \\\n"
+        "    grow_frame_t frame;                                                                                     \\\n"
+        "                                                                                                            \\\n"
+        "    if (seed_memoized(map, NODE_TYPE, start_offset, node, end_offset))                                      \\\n"
+        "    {                                                                                                       \\\n"
+        "        if (!*node)                                                                                         \\\n"
+        "            record_failure(errs, NODE_TYPE, start_offset);                                                  \\\n"
+        "        return *node != 0;                                                                                  \\\n"
+        "    }                                                                                                       \\\n"
+        "                                                                                                            \\\n"
+        "    grow_begin(map, &frame, NODE_TYPE, start_offset);                                                       \\\n"
+        "    do                                                                                                      \\\n"
+        "        res = FUNCTION##_seed(ib, start_offset, &end, &seed, map, errs);                                    \\\n"
+        "    while (grow_step(map, &frame, res, end, seed));                                                         \\\n"
+        "    return grow_end(map, &frame, end_offset, node);                                                         \\\n"
+        "}\n\n", pbuf, pbuf);
 } /* print_macros() */
 
 
-static void print_escape(wchar_t *buf, wchar_t *str)
+static void print_byte_escape(wchar_t *buf, wchar_t ch)
 {
-    wchar_t *ch;
-    wchar_t temp[3];
-    temp[1] = 0;
-    temp[2] = 0;
+    wchar_t temp[8];
+    unsigned int byte = (unsigned int) ch & 0xff;
 
-    for (ch = str; *ch; ++ch)
+    switch (byte)
     {
-        temp[0] = '\\';
-
-        switch (*ch)
-        {
-        case L'\'':
-            temp[1] = '\'';
-            break;
-        case L'\"':
-            temp[1] = '\"';
-            break;
-        case L'\?':
-            temp[1] = '?';
-            break;
-        case L'\\':
-            temp[1] = '\\';
-            break;
-        case L'\a':
-            temp[1] = 'a';
-            break;
-        case L'\b':
-            temp[1] = 'b';
-            break;
-        case L'\f':
-            temp[1] = 'f';
-            break;
-        case L'\n':
-            temp[1] = 'n';
-            break;
-        case L'\r':
-            temp[1] = 'r';
-            break;
-        case L'\t':
-            temp[1] = 't';
-            break;
-        case L'\v':
-            temp[1] = 'v';
-            break;
-        default:
-            temp[0] = *ch;
-            temp[1] = 0;
-            break;
-        }
+    case '\'':
+        wcscat(buf, L"\\'");
+        return;
+    case '\"':
+        wcscat(buf, L"\\\"");
+        return;
+    case '?':
+        wcscat(buf, L"\\?");
+        return;
+    case '\\':
+        wcscat(buf, L"\\\\");
+        return;
+    case '\n':
+        wcscat(buf, L"\\n");
+        return;
+    case '\r':
+        wcscat(buf, L"\\r");
+        return;
+    case '\t':
+        wcscat(buf, L"\\t");
+        return;
+    }
 
-        wcscat(buf, temp);
+    /* anything else outside printable ASCII goes out as a fixed-width octal escape */
+    if (byte >= 0x20 && byte < 0x7f)
+    {
+        temp[0] = (wchar_t) byte;
+        temp[1] = 0;
+    }
+    else
+    {
+        swprintf(temp, 8, L"\\%03o", byte);
     }
-} /* print_escape() */
 
+    wcscat(buf, temp);
+} /* print_byte_escape() */
 
-static void print_rule_exp(wchar_t *buf, const rule_exp_t *exp, const array_t *rule_records, const array_t *node_function_names)
+
+static int find_class(const array_t *classes, const wchar_t *str)
 {
-    int i, len;
+    int i, len = array_size(classes);
 
-    switch (exp->type)
+    for (i = 0; i < len; ++i)
     {
-    case RULE_EXP_SEQ:
-        wcsncat(buf, L"SEQ(", BUF_LEN);
-        print_rule_exp(buf, exp->left, rule_records, node_function_names);
-        wcsncat(buf, L", ", BUF_LEN);
-        print_rule_exp(buf, exp->right, rule_records, node_function_names);
-        wcsncat(buf, L")", BUF_LEN);
-        break;
-    case RULE_EXP_DISJ:
-        wcsncat(buf, L"DISJ(", BUF_LEN);
-        print_rule_exp(buf, exp->left, rule_records, node_function_names);
-        wcsncat(buf, L", ", BUF_LEN);
-        print_rule_exp(buf, exp->right, rule_records, node_function_names);
-        wcsncat(buf, L")", BUF_LEN);
-        break;
-    case RULE_EXP_STAR:
-        wcsncat(buf, L"STAR(", BUF_LEN);
-        print_rule_exp(buf, exp->left, rule_records, node_function_names);
-        wcsncat(buf, L")", BUF_LEN);
-        break;
-    case RULE_EXP_PLUS:
-        wcsncat(buf, L"PLUS(", BUF_LEN);
-        print_rule_exp(buf, exp->left, rule_records, node_function_names);
-        wcsncat(buf, L")", BUF_LEN);
-        break;
-    case RULE_EXP_QUES:
-        wcsncat(buf, L"QUES(", BUF_LEN);
-        print_rule_exp(buf, exp->left, rule_records, node_function_names);
-        wcsncat(buf, L")", BUF_LEN);
-        break;
-    case RULE_EXP_BANG:
-        wcsncat(buf, L"BANG(", BUF_LEN);
-        print_rule_exp(buf, exp->left, rule_records, node_function_names);
-        wcsncat(buf, L")", BUF_LEN);
-        break;
-    case RULE_EXP_AMP:
-        wcsncat(buf, L"AMP(", BUF_LEN);
-        print_rule_exp(buf, exp->left, rule_records, node_function_names);
-        wcsncat(buf, L")", BUF_LEN);
-        break;
-    case RULE_EXP_HIDE:
-        wcsncat(buf, L"HIDE(", BUF_LEN);
-        print_rule_exp(buf, exp->left, rule_records, node_function_names);
-        wcsncat(buf, L")", BUF_LEN);
-        break;
-    case RULE_EXP_CALL:
-        wcsncat(buf, L"T(", BUF_LEN);
-        len = array_size(rule_records);
-        for (i = 0; i < len; ++i)
-        {
-            rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
-            if (wcscmp(rec->rule_name, exp->data.str) == 0)
-            {
-                wcsncat(buf, *(wchar_t **) array_item(node_function_names, i), BUF_LEN);
-            }
-        }
-        wcsncat(buf, L")", BUF_LEN);
-        break;
-    case RULE_EXP_STR:
-        wcsncat(buf, L"S(L\"", BUF_LEN);
-        print_escape(buf, exp->data.str);
-        wcsncat(buf, L"\")", BUF_LEN);
-        break;
-    case RULE_EXP_DOT:
-        wcsncat(buf, L"DOT", BUF_LEN);
-        break;
-    case RULE_EXP_CLASS:
-        wcsncat(buf, L"C(L\"", BUF_LEN);
-        print_escape(buf, exp->data.str);
-        wcsncat(buf, L"\")", BUF_LEN);
-        break;
+        if (wcscmp(*(const wchar_t **) array_item(classes, i), str) == 0)
+            return i;
     }
-} /* print_rule_exp() */
-
-static void print_function_bodies(const wchar_t *prefix, FILE *src_file, const array_t *rule_records, const array_t *node_type_labels, const array_t *node_function_names)
-{
-    wchar_t pbuf[128];
-    wchar_t buf[BUF_LEN];
-    int i, len;
 
-    swprintf(pbuf, 128, L"%ls", prefix);
-    to_lower(pbuf);
+    return -1;
+} /* find_class() */
 
-    fprintf(src_file, "/* parsing functions */\n\n");
 
-    len = array_size(rule_records);
-    for (i = 0; i < len; ++i)
+static int class_has_wide(const wchar_t *str)
+{
+    for (; *str; ++str)
     {
-        rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
-
-        buf[0] = 0;
-        print_rule_exp(buf, rec->rule_spec, rule_records, node_function_names);
-        fprintf(src_file, "PEG_PARSE(%ls, %ls, L\"%ls\", %ls)\n\n", 
-            *(wchar_t **) array_item(node_function_names, i),
-            *(wchar_t **) array_item(node_type_labels, i+1),
-            ((rec->rule_desc && rec->rule_desc[0]) ? rec->rule_desc : *(wchar_t **) array_item(node_function_names, i)),
-            buf);
+        if (*str < -128 || *str > 255)
+            return 1;
     }
 
+    return 0;
+} /* class_has_wide() */
 
-} /* print_function_bodies() */
 
-static void generate_source(const wchar_t *prefix, const char *header_fname, const char *src_fname, FILE *src_file, 
-                            const array_t *rule_records, input_buffer_t *ib, const array_t *line_endings, 
-                            const array_t *node_type_labels, const array_t *node_function_names)
+static int compare_wchar(const void *a, const void *b)
 {
-    wchar_t buf[BUF_LEN];
-    time_t cur_time;
+    wchar_t x = *(const wchar_t *) a, y = *(const wchar_t *) b;
+    return x < y ? -1 : x > y;
+} /* compare_wchar() */
 
-    /* timestamp */
-    time(&cur_time);
-    fprintf(src_file, "/*\n * generated %s */\n", ctime(&cur_time));
-    fprintf(src_file, "\n");
+
+/* sets the bits of the byte members of an expanded class string, collecting wide members in WIDE if given */
+static void class_bits(const wchar_t *str, unsigned char bits[32], array_t *wide)
+{
+    memset(bits, 0, 32);
+
+    for (; *str; ++str)
+    {
+        wchar_t ch = *str;
+
+        /* members read from the grammar as sign-extended bytes still denote those bytes */
+        if (ch < 0 && ch >= -128)
+            ch &= 0xff;
+
+        if (ch >= 0 && ch < 256)
+            bits[ch >> 3] |= (unsigned char) (1 << (ch & 7));
+        else if (wide)
+            array_add(wide, &ch);
+    }
+} /* class_bits() */
+
+
+/* the expanded class string becomes a 256-bit table plus a coalesced range list for wide members */
+static int print_class_table(FILE *src_file, int index, const wchar_t *str)
+{
+    unsigned char bits[32];
+    array_t wide;
+    int i, num_ranges = 0;
+
+    array_init(&wide, sizeof(wchar_t), 0);
+    class_bits(str, bits, &wide);
+
+    if (array_size(&wide))
+    {
+        wchar_t *chars = (wchar_t *) array_item(&wide, 0);
+
+        qsort(chars, array_size(&wide), sizeof(wchar_t), compare_wchar);
+
+        fprintf(src_file, "static const wchar_t char_class_%d_ranges[] = { ", index);
+        for (i = 0; i < array_size(&wide); )
+        {
+            wchar_t lo = chars[i], hi = chars[i];
+
+            while (++i < array_size(&wide) && chars[i] <= hi + 1)
+                hi = chars[i];
+
+            fprintf(src_file, "%s%d, %d", num_ranges ? ", " : "", (int) lo, (int) hi);
+            ++num_ranges;
+        }
+        fprintf(src_file, " };\n");
+    }
+
+    fprintf(src_file, "static const char_class_t char_class_%d = { {", index);
+    for (i = 0; i < 32; ++i)
+        fprintf(src_file, "%s0x%02x", i ? "," : " ", bits[i]);
+    if (num_ranges)
+        fprintf(src_file, " }, %d, char_class_%d_ranges };\n", num_ranges, index);
+    else
+        fprintf(src_file, " }, 0, NULL };\n");
+
+    array_deinit(&wide);
+    return num_ranges;
+} /* print_class_table() */
+
+
+static void print_class_tables(FILE *src_file, const array_t *classes)
+{
+    int i, len = array_size(classes), any_wide = 0;
+
+    if (!len)
+        return;
+
+    fprintf(src_file, "/* character classes */\n\n");
+
+    for (i = 0; i < len; ++i)
+        any_wide |= print_class_table(src_file, i, *(const wchar_t **) array_item(classes, i)) > 0;
+
+    fprintf(src_file, "\n");
+
+    if (any_wide)
+    {
+        fprintf(src_file, "static int char_class_match(const char_class_t *cls, wchar_t ch)\n"
+            "{\n"
+            "    int lo = 0, hi;\n"
+            "\n"
+            "    if (ch == WEOF)\n"
+            "        return 0;\n"
+            "\n"
+            "    if (ch < 256)\n"
+            "        return CHAR_CLASS_HAS_BYTE(cls, ch);\n"
+            "\n"
+            "    /* binary search the sorted ranges */\n"
+            "    hi = cls->num_ranges - 1;\n"
+            "    while (lo <= hi)\n"
+            "    {\n"
+            "        int mid = (lo + hi) / 2;\n"
+            "\n"
+            "        if (ch < cls->ranges[mid*2])\n"
+            "            hi = mid - 1;\n"
+            "        else if (ch > cls->ranges[mid*2+1])\n"
+            "            lo = mid + 1;\n"
+            "        else\n"
+            "            return 1;\n"
+            "    }\n"
+            "\n"
+            "    return 0;\n"
+            "} /* char_class_match() */\n\n");
+    }
+} /* print_class_tables() */
+
+
+typedef struct _span_rec_t
+{
+    const wchar_t *set;     /* expanded class string, or a one-character literal */
+    int negate;             /* the span runs over every byte not in SET */
+}
+span_rec_t;
+
+
+/* recognises repetition bodies that consume exactly one byte from a fixed set: [...] and (!X .) */
+static int span_body(const rule_exp_t *exp, span_rec_t *rec)
+{
+    if (exp->type == RULE_EXP_CLASS && !class_has_wide(exp->data.str))
+    {
+        rec->set = exp->data.str;
+        rec->negate = 0;
+        return 1;
+    }
+
+    if (exp->type == RULE_EXP_SEQ && exp->left->type == RULE_EXP_BANG && exp->right->type == RULE_EXP_DOT)
+    {
+        const rule_exp_t *stop = exp->left->left;
+
+        if ((stop->type == RULE_EXP_CLASS && !class_has_wide(stop->data.str)) || 
+            (stop->type == RULE_EXP_STR && wcslen(stop->data.str) == 1 && !class_has_wide(stop->data.str)))
+        {
+            rec->set = stop->data.str;
+            rec->negate = 1;
+            return 1;
+        }
+    }
+
+    return 0;
+} /* span_body() */
+
+
+static int find_span(const array_t *spans, const span_rec_t *rec)
+{
+    int i, len = array_size(spans);
+
+    for (i = 0; i < len; ++i)
+    {
+        const span_rec_t *cur = (const span_rec_t *) array_item(spans, i);
+        if (cur->negate == rec->negate && wcscmp(cur->set, rec->set) == 0)
+            return i;
+    }
+
+    return -1;
+} /* find_span() */
+
+
+static void collect_spans(array_t *spans, const rule_exp_t *exp)
+{
+    span_rec_t rec;
+
+    if (!exp)
+        return;
+
+    if ((exp->type == RULE_EXP_STAR || exp->type == RULE_EXP_PLUS) && span_body(exp->left, &rec))
+    {
+        if (find_span(spans, &rec) < 0)
+            array_add(spans, &rec);
+        return;
+    }
+
+    collect_spans(spans, exp->left);
+    collect_spans(spans, exp->right);
+} /* collect_spans() */
+
+
+/* the classes inside a repetition that becomes a span are read through the span's table instead */
+static void collect_classes(array_t *classes, const rule_exp_t *exp)
+{
+    span_rec_t rec;
+
+    if (!exp)
+        return;
+
+    if (exp->type == RULE_EXP_CLASS)
+    {
+        if (find_class(classes, exp->data.str) < 0)
+            array_add(classes, (void *) &exp->data.str);
+        return;
+    }
+
+    if ((exp->type == RULE_EXP_STAR || exp->type == RULE_EXP_PLUS) && span_body(exp->left, &rec))
+        return;
+
+    collect_classes(classes, exp->left);
+    collect_classes(classes, exp->right);
+} /* collect_classes() */
+
+
+/* a span's byte set is emitted as a table for the scalar loop and, when it is few enough byte ranges, as ranges for the vector loop */
+static void print_span_table(FILE *src_file, int index, const span_rec_t *rec)
+{
+    unsigned char bits[32], lo[SPAN_MAX_RANGES], hi[SPAN_MAX_RANGES];
+    int i, num_ranges = 0;
+
+    class_bits(rec->set, bits, NULL);
+
+    if (rec->negate)
+    {
+        for (i = 0; i < 32; ++i)
+            bits[i] = (unsigned char) ~bits[i];
+    }
+
+    for (i = 0; i < 256; )
+    {
+        int first;
+
+        if (!((bits[i >> 3] >> (i & 7)) & 1))
+        {
+            ++i;
+            continue;
+        }
+
+        for (first = i; i < 256 && ((bits[i >> 3] >> (i & 7)) & 1); ++i)
+            ;
+
+        if (num_ranges == SPAN_MAX_RANGES)
+        {
+            num_ranges = -1;
+            break;
+        }
+
+        lo[num_ranges] = (unsigned char) first;
+        hi[num_ranges] = (unsigned char) (i - 1);
+        ++num_ranges;
+    }
+
+    /* too many ranges to test in parallel: the span is scanned bytewise */
+    if (num_ranges < 0)
+        num_ranges = 0;
+
+    fprintf(src_file, "static const char_span_t char_span_%d = { {", index);
+    for (i = 0; i < 32; ++i)
+        fprintf(src_file, "%s0x%02x", i ? "," : " ", bits[i]);
+    fprintf(src_file, " }, %d, {", num_ranges);
+    for (i = 0; i < num_ranges; ++i)
+        fprintf(src_file, "%s0x%02x", i ? ", " : " ", lo[i]);
+    fprintf(src_file, "%s}, {", num_ranges ? " " : " 0 ");
+    for (i = 0; i < num_ranges; ++i)
+        fprintf(src_file, "%s0x%02x", i ? ", " : " ", hi[i]);
+    fprintf(src_file, "%s} };\n", num_ranges ? " " : " 0 ");
+} /* print_span_table() */
+
+
+static void print_span_tables(FILE *src_file, const array_t *spans)
+{
+    int i, len = array_size(spans);
+
+    fprintf(src_file, "/* span kernels */\n\n");
+
+    fprintf(src_file, "#if defined(__AVX2__)\n"
+        "#include <immintrin.h>\n"
+        "#define SPAN_AVX2\n"
+        "#define SPAN_SSE2\n"
+        "#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)\n"
+        "#include <emmintrin.h>\n"
+        "#define SPAN_SSE2\n"
+        "#endif\n\n");
+
+    fprintf(src_file, "#if defined(_MSC_VER)\n"
+        "#include <intrin.h>\n"
+        "static int span_ctz(unsigned int mask)\n"
+        "{\n"
+        "    unsigned long index;\n"
+        "    _BitScanForward(&index, mask);\n"
+        "    return (int) index;\n"
+        "} /* span_ctz() */\n"
+        "#else\n"
+        "#define span_ctz(mask) __builtin_ctz(mask)\n"
+        "#endif\n\n");
+
+    fprintf(src_file, "#define SPAN_MAX_RANGES %d\n\n", SPAN_MAX_RANGES);
+
+    fprintf(src_file, "typedef struct _char_span_t\n"
+        "{\n"
+        "    unsigned char bits[32];     /* bytes that continue the span */\n"
+        "    int num_ranges;             /* the same set as byte ranges, or 0 to scan bytewise */\n"
+        "    unsigned char lo[SPAN_MAX_RANGES], hi[SPAN_MAX_RANGES];\n"
+        "}\n"
+        "char_span_t;\n\n");
+
+    for (i = 0; i < len; ++i)
+        print_span_table(src_file, i, (const span_rec_t *) array_item(spans, i));
+
+    fprintf(src_file, "\n");
+
+    /* a byte x is in [lo, hi] when min(x - lo, hi - lo) == x - lo in unsigned arithmetic, which needs nothing beyond SSE2 */
+    fprintf(src_file, "static const char *span_scan(const char_span_t *span, const char *p, const char *end)\n"
+        "{\n"
+        "#if defined(SPAN_SSE2)\n"
+        "    int i, n = span->num_ranges;\n"
+        "\n"
+        "#if defined(SPAN_AVX2)\n"
+        "    if (n && end - p >= 32)\n"
+        "    {\n"
+        "        __m256i lo[SPAN_MAX_RANGES], width[SPAN_MAX_RANGES];\n"
+        "\n"
+        "        for (i = 0; i < n; ++i)\n"
+        "        {\n"
+        "            lo[i] = _mm256_set1_epi8((char) span->lo[i]);\n"
+        "            width[i] = _mm256_set1_epi8((char) (span->hi[i] - span->lo[i]));\n"
+        "        }\n"
+        "\n"
+        "        for (; end - p >= 32; p += 32)\n"
+        "        {\n"
+        "            __m256i x = _mm256_loadu_si256((const __m256i *) p);\n"
+        "            __m256i in = _mm256_setzero_si256();\n"
+        "            unsigned int stop;\n"
+        "\n"
+        "            for (i = 0; i < n; ++i)\n"
+        "            {\n"
+        "                __m256i d = _mm256_sub_epi8(x, lo[i]);\n"
+        "                in = _mm256_or_si256(in, _mm256_cmpeq_epi8(_mm256_min_epu8(d, width[i]), d));\n"
+        "            }\n"
+        "\n"
+        "            if ((stop = ~(unsigned int) _mm256_movemask_epi8(in)) != 0)\n"
+        "                return p + span_ctz(stop);\n"
+        "        }\n"
+        "    }\n"
+        "#endif\n"
+        "\n"
+        "    if (n && end - p >= 16)\n"
+        "    {\n"
+        "        __m128i lo[SPAN_MAX_RANGES], width[SPAN_MAX_RANGES];\n"
+        "\n"
+        "        for (i = 0; i < n; ++i)\n"
+        "        {\n"
+        "            lo[i] = _mm_set1_epi8((char) span->lo[i]);\n"
+        "            width[i] = _mm_set1_epi8((char) (span->hi[i] - span->lo[i]));\n"
+        "        }\n"
+        "\n"
+        "        for (; end - p >= 16; p += 16)\n"
+        "        {\n"
+        "            __m128i x = _mm_loadu_si128((const __m128i *) p);\n"
+        "            __m128i in = _mm_setzero_si128();\n"
+        "            unsigned int stop;\n"
+        "\n"
+        "            for (i = 0; i < n; ++i)\n"
+        "            {\n"
+        "                __m128i d = _mm_sub_epi8(x, lo[i]);\n"
+        "                in = _mm_or_si128(in, _mm_cmpeq_epi8(_mm_min_epu8(d, width[i]), d));\n"
+        "            }\n"
+        "\n"
+        "            if ((stop = ~(unsigned int) _mm_movemask_epi8(in) & 0xffff) != 0)\n"
+        "                return p + span_ctz(stop);\n"
+        "        }\n"
+        "    }\n"
+        "#endif\n"
+        "\n"
+        "    while (p < end && CHAR_CLASS_HAS_BYTE(span, *p))\n"
+        "        ++p;\n"
+        "\n"
+        "    return p;\n"
+        "} /* span_scan() */\n\n");
+} /* print_span_tables() */
+
+
+static void print_span_reader(FILE *src_file)
+{
+    fprintf(src_file, "/* returns the end of the span starting at POS, reading more input as long as the span reaches the end of the buffer */\n"
+        "static int input_buffer_span(input_buffer_t *ib, int pos, const char_span_t *span)\n"
+        "{\n"
+        "    for (;;)\n"
+        "    {\n"
+        "        const char *p = input_buffer_at(ib, pos);\n"
+        "\n"
+        "        pos += (int) (span_scan(span, p, input_buffer_at(ib, ib->bytes_read)) - p);\n"
+        "\n"
+        "        if (pos < ib->bytes_read || !input_buffer_fill(ib))\n"
+        "            return pos;\n"
+        "    }\n"
+        "} /* input_buffer_span() */\n\n");
+} /* print_span_reader() */
+
+
+/* the line index is built on demand with the span kernel LINE_SPAN, which stops at '\n' and '\r' */
+static void print_line_index(const wchar_t *prefix, FILE *src_file, int line_span)
+{
+    fprintf(src_file, "/* line numbers */\n\n");
+
+    fprintf(src_file, "/* indexes the line endings that start before END; a carriage return ends a line unless a newline follows */\n"
+        "static void input_buffer_index_lines(input_buffer_t *ib, int end)\n"
+        "{\n"
+        "    int pos = ib->line_scan_pos;\n"
+        "\n"
+        "    if (end > ib->bytes_read)\n"
+        "        end = ib->bytes_read;\n"
+        "\n"
+        "    while (pos < end)\n"
+        "    {\n"
+        "        const char *p = input_buffer_at(ib, pos);\n"
+        "\n"
+        "        pos += (int) (span_scan(&char_span_%d, p, input_buffer_at(ib, end)) - p);\n"
+        "        if (pos == end)\n"
+        "            break;\n"
+        "\n"
+        "        if (*input_buffer_at(ib, pos) == '\\r' && input_buffer_has(ib, pos + 2) && *input_buffer_at(ib, pos + 1) == '\\n')\n"
+        "            ++pos;\n"
+        "        ++pos;\n"
+        "        array_add(&ib->line_ends, &pos);\n"
+        "    }\n"
+        "\n"
+        "    if (pos > ib->line_scan_pos)\n"
+        "        ib->line_scan_pos = pos;\n"
+        "} /* input_buffer_index_lines() */\n\n", line_span);
+
+    fprintf(src_file, "/* the line holding POS is one more than the number of line endings at or before it */\n"
+        "static int input_buffer_line(input_buffer_t *ib, int pos)\n"
+        "{\n"
+        "    const int *ends;\n"
+        "    int lo = 0, hi;\n"
+        "\n"
+        "    input_buffer_index_lines(ib, pos);\n"
+        "    ends = (const int *) ib->line_ends.data;\n"
+        "    hi = array_size(&ib->line_ends);\n"
+        "\n"
+        "    while (lo < hi)\n"
+        "    {\n"
+        "        int mid = lo + (hi - lo) / 2;\n"
+        "\n"
+        "        if (ends[mid] <= pos)\n"
+        "            lo = mid + 1;\n"
+        "        else\n"
+        "            hi = mid;\n"
+        "    }\n"
+        "\n"
+        "    return ib->lines_dropped + lo + 1;\n"
+        "} /* input_buffer_line() */\n\n");
+
+    fprintf(src_file, "/* forgets the line endings at or before POS, which the stream is discarding, but keeps their count */\n"
+        "static void input_buffer_drop_lines(input_buffer_t *ib, int pos)\n"
+        "{\n"
+        "    int *ends;\n"
+        "    int n = 0, len;\n"
+        "\n"
+        "    input_buffer_index_lines(ib, pos);\n"
+        "    ends = (int *) ib->line_ends.data;\n"
+        "    len = array_size(&ib->line_ends);\n"
+        "\n"
+        "    while (n < len && ends[n] <= pos)\n"
+        "        ++n;\n"
+        "\n"
+        "    memmove(ends, ends + n, (len - n) * sizeof(int));\n"
+        "    ib->line_ends.num = len - n;\n"
+        "    ib->lines_dropped += n;\n"
+        "} /* input_buffer_drop_lines() */\n\n");
+
+    fprintf(src_file, "int %ls_syntax_node_first_line(%ls_syntax_node_t *node)\n"
+        "{\n"
+        "    if (node->first_line < 0)\n"
+        "        node->first_line = input_buffer_line((input_buffer_t *) node->ib, node->begin);\n"
+        "\n"
+        "    return node->first_line;\n"
+        "}\n\n", prefix, prefix);
+
+    fprintf(src_file, "int %ls_syntax_node_last_line(%ls_syntax_node_t *node)\n"
+        "{\n"
+        "    if (node->last_line < 0)\n"
+        "        node->last_line = input_buffer_line((input_buffer_t *) node->ib, node->begin < node->end ? node->end - 1 : node->begin);\n"
+        "\n"
+        "    return node->last_line;\n"
+        "}\n\n", prefix, prefix);
+} /* print_line_index() */
+
+
+static int rule_is_called(const rule_exp_t *exp, const wchar_t *rule_name)
+{
+    if (!exp)
+        return 0;
+
+    if (exp->type == RULE_EXP_CALL)
+        return wcscmp(exp->data.str, rule_name) == 0;
+
+    return rule_is_called(exp->left, rule_name) || rule_is_called(exp->right, rule_name);
+} /* rule_is_called() */
+
+
+/* FIRST-set prediction: an alternative of an ordered choice that cannot start with the next input */
+/* byte is failed without being called, recording the same rule failures the call would have */
+
+#define FIRST_EOF 256           /* stands for the end of the input among byte values */
+
+enum eval_result_et
+{
+    EVAL_FAIL    = 0,
+    EVAL_EMPTY   = 1,           /* succeeds without consuming input */
+    EVAL_UNKNOWN = 2            /* depends on more than the next byte */
+};
+
+typedef struct _first_info_t
+{
+    const array_t *rule_records;
+    int num_rules;
+    char *nullable;             /* per rule: can succeed without consuming input */
+    unsigned char *first;       /* per rule: 32 bytes of the byte values a match can start with */
+    char *visiting;             /* rules being evaluated, so that left recursion gives up */
+    int fail_len;               /* bytes in a set of node types */
+}
+first_info_t;
+
+typedef struct _predict_rec_t
+{
+    const rule_exp_t *exp;      /* the alternative */
+    int first_index, fail_index;
+}
+predict_rec_t;
+
+static int find_rule(const array_t *rule_records, const wchar_t *rule_name)
+{
+    int i;
+
+    for (i = 0; i < array_size(rule_records); ++i)
+    {
+        if (wcscmp((*(rule_rec_t **) array_item(rule_records, i))->rule_name, rule_name) == 0)
+            return i;
+    }
+
+    return -1;
+} /* find_rule() */
+
+static int exp_nullable(const first_info_t *info, const rule_exp_t *exp)
+{
+    int i;
+
+    switch (exp->type)
+    {
+    case RULE_EXP_SEQ:
+        return exp_nullable(info, exp->left) && exp_nullable(info, exp->right);
+    case RULE_EXP_DISJ:
+        return exp_nullable(info, exp->left) || exp_nullable(info, exp->right);
+    case RULE_EXP_PLUS:
+    case RULE_EXP_HIDE:
+        return exp_nullable(info, exp->left);
+    case RULE_EXP_CALL:
+        i = find_rule(info->rule_records, exp->data.str);
+        return i < 0 || info->nullable[i];
+    case RULE_EXP_STR:
+        return !exp->data.str[0];
+    case RULE_EXP_DOT:
+    case RULE_EXP_CLASS:
+        return 0;
+    default:
+        /* repetitions, options, lookaheads and cuts */
+        return 1;
+    }
+} /* exp_nullable() */
+
+/* adds the byte values a match of EXP can start with to FIRST */
+static void exp_first(const first_info_t *info, const rule_exp_t *exp, unsigned char first[32])
+{
+    unsigned char bits[32];
+    int i, j;
+
+    switch (exp->type)
+    {
+    case RULE_EXP_SEQ:
+        exp_first(info, exp->left, first);
+        if (exp_nullable(info, exp->left))
+            exp_first(info, exp->right, first);
+        break;
+    case RULE_EXP_DISJ:
+        exp_first(info, exp->left, first);
+        exp_first(info, exp->right, first);
+        break;
+    case RULE_EXP_STAR:
+    case RULE_EXP_PLUS:
+    case RULE_EXP_QUES:
+    case RULE_EXP_HIDE:
+        exp_first(info, exp->left, first);
+        break;
+    case RULE_EXP_CALL:
+        if ((i = find_rule(info->rule_records, exp->data.str)) < 0)
+            memset(first, 0xff, 32);
+        else
+            for (j = 0; j < 32; ++j)
+                first[j] |= info->first[i * 32 + j];
+        break;
+    case RULE_EXP_STR:
+        if (exp->data.str[0])
+            first[(exp->data.str[0] & 0xff) >> 3] |= (unsigned char) (1 << (exp->data.str[0] & 7));
+        break;
+    case RULE_EXP_CLASS:
+        class_bits(exp->data.str, bits, 0);
+        for (i = 0; i < 32; ++i)
+            first[i] |= bits[i];
+        /* members above 255 are read as wide characters, which can start with any high byte */
+        if (class_has_wide(exp->data.str))
+            memset(first + 16, 0xff, 16);
+        break;
+    case RULE_EXP_DOT:
+        memset(first, 0xff, 32);
+        break;
+    default:
+        /* lookaheads and cuts consume nothing */
+        break;
+    }
+} /* exp_first() */
+
+static void first_info_init(first_info_t *info, const array_t *rule_records)
+{
+    unsigned char first[32];
+    const rule_exp_t *spec;
+    int i, j, changed;
+
+    info->rule_records = rule_records;
+    info->num_rules = array_size(rule_records);
+    info->nullable = (char *) calloc(info->num_rules + 1, 1);
+    info->first = (unsigned char *) calloc(info->num_rules + 1, 32);
+    info->visiting = (char *) calloc(info->num_rules + 1, 1);
+    info->fail_len = (info->num_rules + 1 + 7) / 8;
+
+    /* both grow until nothing changes, starting from the least */
+    do
+    {
+        changed = 0;
+
+        for (i = 0; i < info->num_rules; ++i)
+        {
+            if (!(spec = (*(rule_rec_t **) array_item(rule_records, i))->rule_spec))
+                continue;
+
+            if (!info->nullable[i] && exp_nullable(info, spec))
+                info->nullable[i] = changed = 1;
+
+            memset(first, 0, 32);
+            exp_first(info, spec, first);
+            for (j = 0; j < 32; ++j)
+            {
+                if (first[j] & ~info->first[i * 32 + j])
+                {
+                    info->first[i * 32 + j] |= first[j];
+                    changed = 1;
+                }
+            }
+        }
+    }
+    while (changed);
+} /* first_info_init() */
+
+static void first_info_deinit(first_info_t *info)
+{
+    free(info->nullable);
+    free(info->first);
+    free(info->visiting);
+} /* first_info_deinit() */
+
+/* what EXP does at an offset whose byte is BYTE, or FIRST_EOF; rules that fail are added to FAILS */
+static int exp_eval_byte(first_info_t *info, const rule_exp_t *exp, int byte, unsigned char *fails)
+{
+    unsigned char bits[32], *ignored;
+    const rule_exp_t *spec;
+    int i, res;
+
+    switch (exp->type)
+    {
+    case RULE_EXP_SEQ:
+        if ((res = exp_eval_byte(info, exp->left, byte, fails)) != EVAL_EMPTY)
+            return res;
+        return exp_eval_byte(info, exp->right, byte, fails);
+    case RULE_EXP_DISJ:
+        if ((res = exp_eval_byte(info, exp->left, byte, fails)) != EVAL_FAIL)
+            return res;
+        return exp_eval_byte(info, exp->right, byte, fails);
+    case RULE_EXP_STAR:
+    case RULE_EXP_QUES:
+        res = exp_eval_byte(info, exp->left, byte, fails);
+        if (res == EVAL_FAIL)
+            return EVAL_EMPTY;
+        /* a repetition of something that matches empty never ends */
+        return exp->type == RULE_EXP_QUES && res == EVAL_EMPTY ? EVAL_EMPTY : EVAL_UNKNOWN;
+    case RULE_EXP_PLUS:
+        res = exp_eval_byte(info, exp->left, byte, fails);
+        return res == EVAL_FAIL ? EVAL_FAIL : EVAL_UNKNOWN;
+    case RULE_EXP_BANG:
+        /* failures inside a negative lookahead are not recorded */
+        ignored = (unsigned char *) calloc(info->fail_len, 1);
+        res = exp_eval_byte(info, exp->left, byte, ignored);
+        free(ignored);
+        return res == EVAL_FAIL ? EVAL_EMPTY : res == EVAL_EMPTY ? EVAL_FAIL : EVAL_UNKNOWN;
+    case RULE_EXP_AMP:
+    case RULE_EXP_HIDE:
+        return exp_eval_byte(info, exp->left, byte, fails);
+    case RULE_EXP_CALL:
+        i = find_rule(info->rule_records, exp->data.str);
+        if (i < 0 || info->visiting[i] || !(spec = (*(rule_rec_t **) array_item(info->rule_records, i))->rule_spec))
+            return EVAL_UNKNOWN;
+
+        /* the scanner fails a token rule on a byte it cannot start with, recording nothing else */
+        if ((*(rule_rec_t **) array_item(info->rule_records, i))->token)
+        {
+            if (byte != FIRST_EOF && (info->first[i * 32 + (byte >> 3)] >> (byte & 7)) & 1)
+                return EVAL_UNKNOWN;
+            fails[(i + 1) >> 3] |= (unsigned char) (1 << ((i + 1) & 7));
+            return EVAL_FAIL;
+        }
+
+        info->visiting[i] = 1;
+        res = exp_eval_byte(info, spec, byte, fails);
+        info->visiting[i] = 0;
+
+        /* rule i has node type i + 1 */
+        if (res == EVAL_FAIL)
+            fails[(i + 1) >> 3] |= (unsigned char) (1 << ((i + 1) & 7));
+
+        /* a rule that matches empty leaves a node and a memo record, which skipping the */
+        /* alternative would drop, so an alternative reaching one on this byte is not predicted */
+        return res == EVAL_EMPTY ? EVAL_UNKNOWN : res;
+    case RULE_EXP_STR:
+        if (!exp->data.str[0])
+            return EVAL_EMPTY;
+        return byte == (exp->data.str[0] & 0xff) ? EVAL_UNKNOWN : EVAL_FAIL;
+    case RULE_EXP_CLASS:
+    case RULE_EXP_DOT:
+        if (byte == FIRST_EOF)
+            return EVAL_FAIL;
+        memset(bits, 0, 32);
+        exp_first(info, exp, bits);
+        return (bits[byte >> 3] >> (byte & 7)) & 1 ? EVAL_UNKNOWN : EVAL_FAIL;
+    default:
+        /* a cut changes what the enclosing choice does next */
+        return EVAL_UNKNOWN;
+    }
+} /* exp_eval_byte() */
+
+static int exp_has_call(const rule_exp_t *exp)
+{
+    if (!exp)
+        return 0;
+
+    return exp->type == RULE_EXP_CALL || exp_has_call(exp->left) || exp_has_call(exp->right);
+} /* exp_has_call() */
+
+static int find_or_add_set(array_t *sets, const unsigned char *set)
+{
+    int i;
+
+    for (i = 0; i < array_size(sets); ++i)
+    {
+        if (memcmp(array_item(sets, i), set, sets->data_size) == 0)
+            return i;
+    }
+
+    array_add(sets, (void *) set);
+    return i;
+} /* find_or_add_set() */
+
+/* predicts EXP if it must consume input, calls a rule, and fails with the same rule failures, */
+/* at least one, for every byte outside its FIRST set */
+static void predict_alternative(first_info_t *info, const rule_exp_t *exp, array_t *predictions, array_t *first_sets, array_t *fail_sets)
+{
+    unsigned char first[32], *fails, *byte_fails;
+    predict_rec_t rec;
+    int byte, i, found = 0;
+
+    if (!exp_has_call(exp) || exp_nullable(info, exp))
+        return;
+
+    memset(first, 0, 32);
+    exp_first(info, exp, first);
+    for (i = 0; i < 32 && first[i] == 0xff; ++i)
+        ;
+    if (i == 32)
+        return;
+
+    fails = (unsigned char *) calloc(info->fail_len, 1);
+    byte_fails = (unsigned char *) calloc(info->fail_len, 1);
+
+    for (byte = 0; byte <= FIRST_EOF; ++byte)
+    {
+        if (byte < FIRST_EOF && (first[byte >> 3] >> (byte & 7)) & 1)
+            continue;
+
+        memset(byte_fails, 0, info->fail_len);
+        if (exp_eval_byte(info, exp, byte, byte_fails) != EVAL_FAIL || (found && memcmp(fails, byte_fails, info->fail_len)))
+            break;
+
+        memcpy(fails, byte_fails, info->fail_len);
+        found = 1;
+    }
+
+    /* with no rule failure to record, record_failures() would still move the error position */
+    for (i = 0; found && i < info->fail_len && fails[i] == 0; ++i)
+        ;
+
+    if (byte > FIRST_EOF && i < info->fail_len)
+    {
+        rec.exp = exp;
+        rec.first_index = find_or_add_set(first_sets, first);
+        rec.fail_index = find_or_add_set(fail_sets, fails);
+        array_add(predictions, &rec);
+    }
+
+    free(fails);
+    free(byte_fails);
+} /* predict_alternative() */
+
+static void collect_predictions(first_info_t *info, const rule_exp_t *exp, array_t *predictions, array_t *first_sets, array_t *fail_sets)
+{
+    if (!exp)
+        return;
+
+    /* a choice of several alternatives nests to the right */
+    if (exp->type == RULE_EXP_DISJ)
+    {
+        predict_alternative(info, exp->left, predictions, first_sets, fail_sets);
+        if (exp->right->type != RULE_EXP_DISJ)
+            predict_alternative(info, exp->right, predictions, first_sets, fail_sets);
+    }
+
+    collect_predictions(info, exp->left, predictions, first_sets, fail_sets);
+    collect_predictions(info, exp->right, predictions, first_sets, fail_sets);
+} /* collect_predictions() */
+
+static const predict_rec_t *find_prediction(const array_t *predictions, const rule_exp_t *exp)
+{
+    int i;
+
+    for (i = 0; i < array_size(predictions); ++i)
+    {
+        const predict_rec_t *rec = (const predict_rec_t *) array_item(predictions, i);
+        if (rec->exp == exp)
+            return rec;
+    }
+
+    return 0;
+} /* find_prediction() */
+
+/* printed only for the interpreter and for parsers with predicted alternatives, which use it */
+static void print_record_failures(FILE *src_file)
+{
+    fprintf(src_file, "/* notes that every rule in the set TYPES failed at POS */\n"
+        "static void record_failures(error_list_t *errs, const unsigned char *types, int pos)\n"
+        "{\n"
+        "    int i;\n"
+        "\n"
+        "    if (pos < errs->fail_pos || errs->lookaheads)\n"
+        "        return;\n"
+        "\n"
+        "    if (pos > errs->fail_pos)\n"
+        "    {\n"
+        "        errs->fail_pos = pos;\n"
+        "        memset(errs->expected, 0, sizeof(errs->expected));\n"
+        "    }\n"
+        "\n"
+        "    for (i = 0; i < (int) sizeof(errs->expected); ++i)\n"
+        "        errs->expected[i] |= types[i];\n"
+        "} /* record_failures() */\n\n");
+} /* print_record_failures() */
+
+static void print_prediction_tables(FILE *src_file, const array_t *first_sets, const array_t *fail_sets)
+{
+    const unsigned char *set;
+    int i, j;
+
+    if (!array_size(first_sets))
+        return;
+
+    fprintf(src_file, "/* the bytes predicted alternatives can start with, and the rule failures skipping them records */\n\n");
+
+    for (i = 0; i < array_size(first_sets); ++i)
+    {
+        set = (const unsigned char *) array_item(first_sets, i);
+        fprintf(src_file, "static const char_class_t first_set_%d = { {", i);
+        for (j = 0; j < 32; ++j)
+            fprintf(src_file, "%s0x%02x", j ? "," : " ", set[j]);
+        fprintf(src_file, " }, 0, NULL };\n");
+    }
+    fprintf(src_file, "\n");
+
+    for (i = 0; i < array_size(fail_sets); ++i)
+    {
+        set = (const unsigned char *) array_item(fail_sets, i);
+        fprintf(src_file, "static const unsigned char fail_set_%d[] = {", i);
+        for (j = 0; j < fail_sets->data_size; ++j)
+            fprintf(src_file, "%s0x%02x", j ? "," : " ", set[j]);
+        fprintf(src_file, " };\n");
+    }
+    fprintf(src_file, "\n");
+} /* print_prediction_tables() */
+
+
+/* the repetition that streams: a STAR in the top-level sequence of the start rule, which nothing else calls */
+static const rule_exp_t *find_stream_star(const array_t *rule_records)
+{
+    const rule_rec_t *start = *(rule_rec_t **) array_item(rule_records, 0);
+    const rule_exp_t *exp = start->rule_spec;
+    span_rec_t span;
+    int i;
+
+    if (start->token)
+        return 0;
+
+    for (i = 0; i < array_size(rule_records); ++i)
+    {
+        if (rule_is_called((*(rule_rec_t **) array_item(rule_records, i))->rule_spec, start->rule_name))
+            return 0;
+    }
+
+    while (exp && exp->type == RULE_EXP_SEQ)
+    {
+        if (exp->left->type == RULE_EXP_STAR && !span_body(exp->left->left, &span))
+            return exp->left;
+        exp = exp->right;
+    }
+
+    return exp && exp->type == RULE_EXP_STAR && !span_body(exp->left, &span) ? exp : 0;
+} /* find_stream_star() */
+
+
+/** Prints the worker side of the parallel parse, which the streamed repetition calls into. */
+static void print_parallel_workers(const wchar_t *pbuf, FILE *src_file)
+{
+    fprintf(src_file, "/* parallel parsing: each worker parses iterations of the streamed repetition from a */\n"
+        "/* speculative boundary, and the sequential parse takes an item wherever it reaches the item's start */\n\n");
+
+    fprintf(src_file, "static int parse_stream_item(input_buffer_t *ib, int start_offset, int *end_offset, array_t *children, memo_map_t *map, error_list_t *errs);\n\n");
+
+    fprintf(src_file, "/* the start of the next line after POS that does not begin with a blank, or LIMIT; */\n"
+        "/* top-level items tend to start there, and indented lines tend to continue one */\n"
+        "static int parallel_next_line(input_buffer_t *ib, int pos, int limit)\n"
+        "{\n"
+        "    const char *nl;\n"
+        "    char ch;\n"
+        "\n"
+        "    while (pos < limit && (nl = (const char *) memchr(input_buffer_at(ib, pos), '\\n', limit - pos)))\n"
+        "    {\n"
+        "        pos = ib->base + (int) (nl - ib->buf) + 1;\n"
+        "        if (pos < limit && (ch = *input_buffer_at(ib, pos)) != ' ' && ch != '\\t' && ch != '\\r' && ch != '\\n')\n"
+        "            return pos;\n"
+        "    }\n"
+        "\n"
+        "    return limit;\n"
+        "} /* parallel_next_line() */\n\n");
+
+    fprintf(src_file, "/* parses items from the chunk's start until one reaches its end; where none parses, */\n"
+        "/* the worker moves on to the next line that could start one */\n"
+        "static void parallel_chunk_run(parallel_chunk_t *chunk)\n"
+        "{\n"
+        "    input_buffer_t *ib;\n"
+        "    memo_map_t *map;\n"
+        "    void *errs;\n"
+        "    parallel_item_t item;\n"
+        "    int pos = chunk->begin, end;\n"
+        "\n"
+        "    /* reading moves a buffer's position, so the worker reads the same bytes through one of its own, */\n"
+        "    /* and its nodes point there until parallel_take() hands them to the calling thread */\n"
+        "    chunk->worker_ib = ib = input_buffer_create_mem(chunk->ib->name, chunk->ib->buf, chunk->ib->bytes_read);\n"
+        "    map = memo_map_create(0);\n"
+        "    map->parser = chunk->parser;\n"
+        "    map->node_ib = ib;\n"
+        "    errs = %ls_create_error_list();\n"
+        "\n"
+        "    while (pos < chunk->end)\n"
+        "    {\n"
+        "        item.first_child = array_size(&chunk->children);\n"
+        "\n"
+        "        if (parse_stream_item(ib, pos, &end, &chunk->children, map, (error_list_t *) errs) && end > pos)\n"
+        "        {\n"
+        "            item.begin = pos;\n"
+        "            item.end = pos = end;\n"
+        "            item.num_children = array_size(&chunk->children) - item.first_child;\n"
+        "            array_add(&chunk->items, &item);\n"
+        "        }\n"
+        "        else\n"
+        "        {\n"
+        "            delete_children(&chunk->children, item.first_child);\n"
+        "            pos = parallel_next_line(ib, pos, chunk->end);\n"
+        "        }\n"
+        "    }\n"
+        "\n"
+        "    %ls_destroy_error_list(errs);\n"
+        "    memo_map_destroy(map);\n"
+        "} /* parallel_chunk_run() */\n\n", pbuf, pbuf);
+
+    fprintf(src_file, "#ifdef WIN32\n"
+        "static DWORD WINAPI parallel_thread(LPVOID chunk)\n"
+        "{\n"
+        "    parallel_chunk_run((parallel_chunk_t *) chunk);\n"
+        "    return 0;\n"
+        "} /* parallel_thread() */\n"
+        "#else\n"
+        "static void *parallel_thread(void *chunk)\n"
+        "{\n"
+        "    parallel_chunk_run((parallel_chunk_t *) chunk);\n"
+        "    return 0;\n"
+        "} /* parallel_thread() */\n"
+        "#endif\n\n");
+
+    fprintf(src_file, "/* a chunk that gets no thread stays empty, and is parsed sequentially */\n"
+        "static void parallel_start(parallel_chunk_t *chunk)\n"
+        "{\n"
+        "#ifdef WIN32\n"
+        "    chunk->started = (chunk->thread = CreateThread(0, 0, parallel_thread, chunk, 0, 0)) != 0;\n"
+        "#else\n"
+        "    chunk->started = pthread_create(&chunk->thread, 0, parallel_thread, chunk) == 0;\n"
+        "#endif\n"
+        "} /* parallel_start() */\n\n");
+
+    fprintf(src_file, "static void parallel_join(parallel_chunk_t *chunk)\n"
+        "{\n"
+        "    if (!chunk->started)\n"
+        "        return;\n"
+        "\n"
+        "#ifdef WIN32\n"
+        "    WaitForSingleObject(chunk->thread, INFINITE);\n"
+        "    CloseHandle(chunk->thread);\n"
+        "#else\n"
+        "    pthread_join(chunk->thread, 0);\n"
+        "#endif\n"
+        "    chunk->started = 0;\n"
+        "} /* parallel_join() */\n\n");
+
+    fprintf(src_file, "static int parallel_adopt_node(%ls_syntax_node_t *node, void *ib)\n"
+        "{\n"
+        "    node->ib = ib;\n"
+        "    return 0;\n"
+        "} /* parallel_adopt_node() */\n\n", pbuf);
+
+    fprintf(src_file, "/* takes the item the workers parsed at POS, if any, moving its subtrees onto CHILD_STACK */\n"
+        "static int parallel_take(parallel_parse_t *par, int pos, array_t *child_stack, int *end_offset)\n"
+        "{\n"
+        "    parallel_chunk_t *chunk;\n"
+        "    parallel_item_t *item;\n"
+        "    %ls_syntax_node_t **slot;\n"
+        "    int i;\n"
+        "\n"
+        "    /* a chunk is waited for once the parse has reached it */\n"
+        "    while (par->joined < par->num_chunks && par->chunks[par->joined].begin <= pos)\n"
+        "        parallel_join(&par->chunks[par->joined++]);\n"
+        "\n"
+        "    for (; par->cur < par->joined; ++par->cur)\n"
+        "    {\n"
+        "        chunk = par->chunks + par->cur;\n"
+        "\n"
+        "        /* items behind POS were speculation the parse did not follow; parallel_finish() frees them */\n"
+        "        while (chunk->next_item < array_size(&chunk->items))\n"
+        "        {\n"
+        "            item = (parallel_item_t *) array_item(&chunk->items, chunk->next_item);\n"
+        "            if (item->begin > pos)\n"
+        "                return 0;\n"
+        "\n"
+        "            chunk->next_item++;\n"
+        "            if (item->begin < pos)\n"
+        "                continue;\n"
+        "\n"
+        "            for (i = 0; i < item->num_children; ++i)\n"
+        "            {\n"
+        "                slot = (%ls_syntax_node_t **) array_item(&chunk->children, item->first_child + i);\n"
+        "                %ls_syntax_node_traverse_preorder(*slot, chunk->ib, parallel_adopt_node, 0);\n"
+        "                array_add(child_stack, slot);\n"
+        "                *slot = 0;\n"
+        "            }\n"
+        "\n"
+        "            *end_offset = item->end;\n"
+        "            return 1;\n"
+        "        }\n"
+        "    }\n"
+        "\n"
+        "    return 0;\n"
+        "} /* parallel_take() */\n\n", pbuf, pbuf, pbuf);
+
+    fprintf(src_file, "/* waits for every worker and frees the items the parse did not take */\n"
+        "static void parallel_finish(parallel_parse_t *par)\n"
+        "{\n"
+        "    parallel_chunk_t *chunk;\n"
+        "    %ls_syntax_node_t *node;\n"
+        "    int i, j;\n"
+        "\n"
+        "    for (i = 0; i < par->num_chunks; ++i)\n"
+        "    {\n"
+        "        chunk = par->chunks + i;\n"
+        "        parallel_join(chunk);\n"
+        "\n"
+        "        for (j = 0; j < array_size(&chunk->children); ++j)\n"
+        "        {\n"
+        "            if ((node = *(%ls_syntax_node_t **) array_item(&chunk->children, j)))\n"
+        "                %ls_syntax_node_destroy(node);\n"
+        "        }\n"
+        "\n"
+        "        array_deinit(&chunk->items);\n"
+        "        array_deinit(&chunk->children);\n"
+        "        if (chunk->worker_ib)\n"
+        "            input_buffer_destroy(chunk->worker_ib);\n"
+        "    }\n"
+        "\n"
+        "    free(par->chunks);\n"
+        "} /* parallel_finish() */\n\n", pbuf, pbuf, pbuf);
+} /* print_parallel_workers() */
+
+
+static void print_rule_exp(wchar_t *buf, const rule_exp_t *exp, const array_t *rule_records, const array_t *node_function_names, const array_t *classes, const array_t *spans, const array_t *predictions, const rule_exp_t *stream);
+
+/* an alternative of an ordered choice, behind a check of its FIRST set where it has one */
+static void print_alternative(wchar_t *buf, const rule_exp_t *exp, const array_t *rule_records, const array_t *node_function_names, const array_t *classes, const array_t *spans, const array_t *predictions, const rule_exp_t *stream)
+{
+    const predict_rec_t *rec = find_prediction(predictions, exp);
+    wchar_t num[64];
+
+    if (rec)
+    {
+        swprintf(num, 64, L"PREDICT(first_set_%d, fail_set_%d, ", rec->first_index, rec->fail_index);
+        wcsncat(buf, num, BUF_LEN);
+    }
+
+    print_rule_exp(buf, exp, rule_records, node_function_names, classes, spans, predictions, stream);
+
+    if (rec)
+        wcsncat(buf, L")", BUF_LEN);
+} /* print_alternative() */
+
+static void print_rule_exp(wchar_t *buf, const rule_exp_t *exp, const array_t *rule_records, const array_t *node_function_names, const array_t *classes, const array_t *spans, const array_t *predictions, const rule_exp_t *stream)
+{
+    int i, len;
+    wchar_t num[32];
+    span_rec_t span;
+
+    switch (exp->type)
+    {
+    case RULE_EXP_SEQ:
+        wcsncat(buf, L"SEQ(", BUF_LEN);
+        print_rule_exp(buf, exp->left, rule_records, node_function_names, classes, spans, predictions, stream);
+        wcsncat(buf, L", ", BUF_LEN);
+        print_rule_exp(buf, exp->right, rule_records, node_function_names, classes, spans, predictions, stream);
+        wcsncat(buf, L")", BUF_LEN);
+        break;
+    case RULE_EXP_DISJ:
+        wcsncat(buf, L"DISJ(", BUF_LEN);
+        print_alternative(buf, exp->left, rule_records, node_function_names, classes, spans, predictions, stream);
+        wcsncat(buf, L", ", BUF_LEN);
+        print_alternative(buf, exp->right, rule_records, node_function_names, classes, spans, predictions, stream);
+        wcsncat(buf, L")", BUF_LEN);
+        break;
+    case RULE_EXP_STAR:
+        if (span_body(exp->left, &span))
+        {
+            swprintf(num, 32, L"SPAN_STAR(char_span_%d)", find_span(spans, &span));
+            wcsncat(buf, num, BUF_LEN);
+            break;
+        }
+        wcsncat(buf, exp == stream ? L"STREAM_STAR(" : L"STAR(", BUF_LEN);
+        print_rule_exp(buf, exp->left, rule_records, node_function_names, classes, spans, predictions, stream);
+        wcsncat(buf, L")", BUF_LEN);
+        break;
+    case RULE_EXP_PLUS:
+        if (span_body(exp->left, &span))
+        {
+            swprintf(num, 32, L"SPAN_PLUS(char_span_%d)", find_span(spans, &span));
+            wcsncat(buf, num, BUF_LEN);
+            break;
+        }
+        wcsncat(buf, L"PLUS(", BUF_LEN);
+        print_rule_exp(buf, exp->left, rule_records, node_function_names, classes, spans, predictions, stream);
+        wcsncat(buf, L")", BUF_LEN);
+        break;
+    case RULE_EXP_QUES:
+        wcsncat(buf, L"QUES(", BUF_LEN);
+        print_rule_exp(buf, exp->left, rule_records, node_function_names, classes, spans, predictions, stream);
+        wcsncat(buf, L")", BUF_LEN);
+        break;
+    case RULE_EXP_BANG:
+        wcsncat(buf, L"BANG(", BUF_LEN);
+        print_rule_exp(buf, exp->left, rule_records, node_function_names, classes, spans, predictions, stream);
+        wcsncat(buf, L")", BUF_LEN);
+        break;
+    case RULE_EXP_AMP:
+        wcsncat(buf, L"AMP(", BUF_LEN);
+        print_rule_exp(buf, exp->left, rule_records, node_function_names, classes, spans, predictions, stream);
+        wcsncat(buf, L")", BUF_LEN);
+        break;
+    case RULE_EXP_HIDE:
+        wcsncat(buf, L"HIDE(", BUF_LEN);
+        print_rule_exp(buf, exp->left, rule_records, node_function_names, classes, spans, predictions, stream);
+        wcsncat(buf, L")", BUF_LEN);
+        break;
+    case RULE_EXP_CALL:
+        wcsncat(buf, L"T(", BUF_LEN);
+        len = array_size(rule_records);
+        for (i = 0; i < len; ++i)
+        {
+            rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+            if (wcscmp(rec->rule_name, exp->data.str) == 0)
+            {
+                wcsncat(buf, *(wchar_t **) array_item(node_function_names, i), BUF_LEN);
+            }
+        }
+        wcsncat(buf, L")", BUF_LEN);
+        break;
+    case RULE_EXP_STR:
+        len = (int) wcslen(exp->data.str);
+        if (len == 1)
+        {
+            wcsncat(buf, L"S1('", BUF_LEN);
+            print_byte_escape(buf, exp->data.str[0]);
+            wcsncat(buf, L"')", BUF_LEN);
+        }
+        else
+        {
+            wcsncat(buf, L"S(\"", BUF_LEN);
+            for (i = 0; i < len; ++i)
+                print_byte_escape(buf, exp->data.str[i]);
+            swprintf(num, 32, L"\", %d)", len);
+            wcsncat(buf, num, BUF_LEN);
+        }
+        break;
+    case RULE_EXP_DOT:
+        wcsncat(buf, L"DOT", BUF_LEN);
+        break;
+    case RULE_EXP_CUT:
+        wcsncat(buf, L"CUT", BUF_LEN);
+        break;
+    case RULE_EXP_CLASS:
+        i = find_class(classes, exp->data.str);
+        swprintf(num, 32, L"%ls(char_class_%d)", class_has_wide(exp->data.str) ? L"CW" : L"C", i);
+        wcsncat(buf, num, BUF_LEN);
+        break;
+    }
+} /* print_rule_exp() */
+
+/* the bytecode backend compiles each rule into code for one interpreter instead of a function */
+
+enum vm_op_et
+{
+    VM_RETURN = 0,      /* the rule matched */
+    VM_CHAR,            /* byte: match one byte */
+    VM_STR,             /* string, length: match a literal from vm_strings */
+    VM_CLASS,           /* class: match one byte of a class */
+    VM_CLASSW,          /* class: match one character of a class with members above 255 */
+    VM_ANY,             /* match any character */
+    VM_SPAN_STAR,       /* span: skip bytes of a span */
+    VM_SPAN_PLUS,       /* span: skip at least one byte of a span */
+    VM_CALL,            /* node type: parse a rule, keeping its node */
+    VM_CHOICE,          /* target: open a choice that goes on at target if what follows fails */
+    VM_COMMIT,          /* target: close the innermost choice and jump to target */
+    VM_GROUP,           /* open a choice that fails as a whole if what follows fails */
+    VM_POP,             /* close the innermost group */
+    VM_AMP,             /* start a positive lookahead */
+    VM_AMP_END,         /* end it, going back to where it started */
+    VM_BANG,            /* target: start a negative lookahead, going on at target if it fails */
+    VM_BANG_END,        /* end it by failing */
+    VM_HIDE,            /* start dropping the nodes parsed from here */
+    VM_HIDE_END,        /* drop them */
+    VM_CUT,             /* commit the innermost choice */
+    VM_CUT_NONE,        /* a cut with no choice of its own to commit */
+    VM_PREDICT,         /* first set, fail set: fail unless the next byte is in the first set */
+    VM_STREAM_TAKE,     /* target: start an iteration of the streamed repetition, skipping to target if a worker parsed it */
+    VM_STREAM_EMIT,     /* target: hand over the iteration and loop back to target */
+
+    NUM_VM_OPS
+};
+
+static const char *const vm_op_names[NUM_VM_OPS] =
+{
+    "VM_RETURN", "VM_CHAR", "VM_STR", "VM_CLASS", "VM_CLASSW", "VM_ANY", "VM_SPAN_STAR", "VM_SPAN_PLUS",
+    "VM_CALL", "VM_CHOICE", "VM_COMMIT", "VM_GROUP", "VM_POP", "VM_AMP", "VM_AMP_END", "VM_BANG",
+    "VM_BANG_END", "VM_HIDE", "VM_HIDE_END", "VM_CUT", "VM_CUT_NONE", "VM_PREDICT", "VM_STREAM_TAKE",
+    "VM_STREAM_EMIT"
+};
+
+
+typedef struct _vm_compiler_t
+{
+    array_t code;               /* int */
+    array_t strings;            /* const wchar_t *, the literals of two or more characters */
+
+    const array_t *rule_records;
+    const array_t *classes;
+    const array_t *spans;
+    const array_t *predictions;
+    const rule_exp_t *stream;
+
+    int depth;                  /* frames open at the current instruction */
+    int max_depth;
+}
+vm_compiler_t;
+
+
+static int vm_emit(vm_compiler_t *vc, int op)
+{
+    array_add(&vc->code, &op);
+    return array_size(&vc->code) - 1;
+} /* vm_emit() */
+
+
+/* emits OP with a jump target to be patched; returns where the target goes */
+static int vm_emit_jump(vm_compiler_t *vc, int op, int target)
+{
+    vm_emit(vc, op);
+    return vm_emit(vc, target);
+} /* vm_emit_jump() */
+
+
+static void vm_patch(vm_compiler_t *vc, int at)
+{
+    *(int *) array_item(&vc->code, at) = array_size(&vc->code);
+} /* vm_patch() */
+
+
+static void vm_open(vm_compiler_t *vc)
+{
+    if (++vc->depth > vc->max_depth)
+        vc->max_depth = vc->depth;
+} /* vm_open() */
+
+
+static void vm_compile_exp(vm_compiler_t *vc, const rule_exp_t *exp, int cut_frame);
+
+static void vm_compile_alternative(vm_compiler_t *vc, const rule_exp_t *exp, int cut_frame)
+{
+    const predict_rec_t *rec = find_prediction(vc->predictions, exp);
+
+    if (rec)
+    {
+        vm_emit(vc, VM_PREDICT);
+        vm_emit(vc, rec->first_index);
+        vm_emit(vc, rec->fail_index);
+    }
+
+    vm_compile_exp(vc, exp, cut_frame);
+} /* vm_compile_alternative() */
+
+
+/* a repetition: each iteration opens a choice that ends the loop when the iteration fails */
+static void vm_compile_loop(vm_compiler_t *vc, const rule_exp_t *body)
+{
+    int loop = array_size(&vc->code), end;
+
+    end = vm_emit_jump(vc, VM_CHOICE, 0);
+    vm_open(vc);
+    vm_compile_exp(vc, body, 1);
+    vm_emit_jump(vc, VM_COMMIT, loop);
+    vc->depth--;
+    vm_patch(vc, end);
+} /* vm_compile_loop() */
+
+
+/**
+ * Compiles EXP the way print_rule_exp() expands it.  CUT_FRAME is set when the innermost construct
+ * around EXP that has a cut variable of its own is a choice that a cut can still commit.
+ */
+static void vm_compile_exp(vm_compiler_t *vc, const rule_exp_t *exp, int cut_frame)
+{
+    span_rec_t span;
+    int i, at, loop, end;
+
+    switch (exp->type)
+    {
+    case RULE_EXP_SEQ:
+        vm_compile_exp(vc, exp->left, cut_frame);
+        vm_compile_exp(vc, exp->right, cut_frame);
+        break;
+    case RULE_EXP_DISJ:
+        /* the last alternative runs with the choice already closed */
+        at = vm_emit_jump(vc, VM_CHOICE, 0);
+        vm_open(vc);
+        vm_compile_alternative(vc, exp->left, 1);
+        end = vm_emit_jump(vc, VM_COMMIT, 0);
+        vc->depth--;
+        vm_patch(vc, at);
+        vm_compile_alternative(vc, exp->right, 0);
+        vm_patch(vc, end);
+        break;
+    case RULE_EXP_STAR:
+        if (span_body(exp->left, &span))
+        {
+            vm_emit(vc, VM_SPAN_STAR);
+            vm_emit(vc, find_span(vc->spans, &span));
+        }
+        else if (exp == vc->stream)
+        {
+            loop = array_size(&vc->code);
+            at = vm_emit_jump(vc, VM_STREAM_TAKE, 0);
+            end = vm_emit_jump(vc, VM_CHOICE, 0);
+            vm_open(vc);
+            vm_compile_exp(vc, exp->left, 1);
+            i = vm_emit_jump(vc, VM_COMMIT, 0);
+            vc->depth--;
+            vm_patch(vc, at);
+            vm_patch(vc, i);
+            vm_emit_jump(vc, VM_STREAM_EMIT, loop);
+            vm_patch(vc, end);
+        }
+        else
+        {
+            vm_compile_loop(vc, exp->left);
+        }
+        break;
+    case RULE_EXP_PLUS:
+        if (span_body(exp->left, &span))
+        {
+            vm_emit(vc, VM_SPAN_PLUS);
+            vm_emit(vc, find_span(vc->spans, &span));
+            break;
+        }
+
+        /* the first iteration must match */
+        vm_emit(vc, VM_GROUP);
+        vm_open(vc);
+        vm_compile_exp(vc, exp->left, 1);
+        vm_emit(vc, VM_POP);
+        vc->depth--;
+        vm_compile_loop(vc, exp->left);
+        break;
+    case RULE_EXP_QUES:
+        end = vm_emit_jump(vc, VM_CHOICE, 0);
+        vm_open(vc);
+        vm_compile_exp(vc, exp->left, 1);
+        at = vm_emit_jump(vc, VM_COMMIT, 0);
+        vc->depth--;
+        vm_patch(vc, end);
+        vm_patch(vc, at);
+        break;
+    case RULE_EXP_BANG:
+        at = vm_emit_jump(vc, VM_BANG, 0);
+        vm_open(vc);
+        vm_compile_exp(vc, exp->left, 0);
+        vm_emit(vc, VM_BANG_END);
+        vc->depth--;
+        vm_patch(vc, at);
+        break;
+    case RULE_EXP_AMP:
+        vm_emit(vc, VM_AMP);
+        vm_open(vc);
+        vm_compile_exp(vc, exp->left, 0);
+        vm_emit(vc, VM_AMP_END);
+        vc->depth--;
+        break;
+    case RULE_EXP_HIDE:
+        vm_emit(vc, VM_HIDE);
+        vm_open(vc);
+        vm_compile_exp(vc, exp->left, cut_frame);
+        vm_emit(vc, VM_HIDE_END);
+        vc->depth--;
+        break;
+    case RULE_EXP_CALL:
+        vm_emit(vc, VM_CALL);
+        vm_emit(vc, find_rule(vc->rule_records, exp->data.str) + 1);
+        break;
+    case RULE_EXP_STR:
+        if (wcslen(exp->data.str) == 1)
+        {
+            vm_emit(vc, VM_CHAR);
+            vm_emit(vc, exp->data.str[0] & 0xff);
+            break;
+        }
+
+        for (i = 0; i < array_size(&vc->strings); ++i)
+        {
+            if (wcscmp(*(const wchar_t **) array_item(&vc->strings, i), exp->data.str) == 0)
+                break;
+        }
+        if (i == array_size(&vc->strings))
+            array_add(&vc->strings, (void *) &exp->data.str);
+
+        vm_emit(vc, VM_STR);
+        vm_emit(vc, i);
+        vm_emit(vc, (int) wcslen(exp->data.str));
+        break;
+    case RULE_EXP_DOT:
+        vm_emit(vc, VM_ANY);
+        break;
+    case RULE_EXP_CUT:
+        vm_emit(vc, cut_frame ? VM_CUT : VM_CUT_NONE);
+        break;
+    case RULE_EXP_CLASS:
+        vm_emit(vc, class_has_wide(exp->data.str) ? VM_CLASSW : VM_CLASS);
+        vm_emit(vc, find_class(vc->classes, exp->data.str));
+        break;
+    }
+} /* vm_compile_exp() */
+
+
+/* prints a table of pointers NAME to the tables FORMAT names, or a null entry if there are none */
+static void print_vm_table(FILE *src_file, const char *type, const char *name, const char *format, int num)
+{
+    char entry[64];
+    int i;
+
+    fprintf(src_file, "static %s const %s[] = {", type, name);
+    for (i = 0; i < num; ++i)
+    {
+        snprintf(entry, 64, format, i);
+        fprintf(src_file, "%s %s", i ? "," : "", entry);
+    }
+    fprintf(src_file, "%s };\n", num ? "" : " 0");
+} /* print_vm_table() */
+
+
+/** Prints the rules as bytecode, the interpreter that runs it and the rule functions the parse entry points call. */
+static void print_vm_rules(const wchar_t *pbuf, const wchar_t *ubuf, FILE *src_file, const array_t *rule_records,
+                           const array_t *node_type_labels, const array_t *node_function_names,
+                           const array_t *classes, const array_t *spans, int num_spans, const array_t *predictions,
+                           int num_first_sets, int num_fail_sets, const rule_exp_t *stream)
+{
+    vm_compiler_t vc;
+    array_t entries;            /* int, where each rule's code starts */
+    wchar_t buf[BUF_LEN];
+    int i, j, len, max_value = 0, item_entry = -1, any_wide = 0, num_tokens = 0, num_leaders = 0;
+
+    vc.rule_records = rule_records;
+    vc.classes = classes;
+    vc.spans = spans;
+    vc.predictions = predictions;
+    vc.stream = stream;
+    vc.depth = vc.max_depth = 0;
+    array_init(&vc.code, sizeof(int), 0);
+    array_init(&vc.strings, sizeof(const wchar_t *), 0);
+    array_init(&entries, sizeof(int), 0);
+
+    len = array_size(rule_records);
+    for (i = 0; i < len; ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+
+        j = array_size(&vc.code);
+        array_add(&entries, &j);
+        num_leaders += rec->left_recursion == RULE_LR_LEADER;
+
+        /* vm_rule() hands token rules to the scanner */
+        if (rec->token)
+            num_tokens++;
+        else
+            vm_compile_exp(&vc, rec->rule_spec, 0);
+        vm_emit(&vc, VM_RETURN);
+    }
+
+    /* one iteration of the streamed repetition on its own, for the parallel workers */
+    if (stream)
+    {
+        item_entry = vm_emit(&vc, VM_GROUP);
+        vm_open(&vc);
+        vm_compile_exp(&vc, stream->left, 1);
+        vm_emit(&vc, VM_POP);
+        vc.depth--;
+        vm_emit(&vc, VM_RETURN);
+    }
+
+    for (i = 0; i < array_size(&vc.code); ++i)
+    {
+        if (*(int *) array_item(&vc.code, i) > max_value)
+            max_value = *(int *) array_item(&vc.code, i);
+    }
+
+    for (i = 0; i < array_size(classes); ++i)
+        any_wide |= class_has_wide(*(const wchar_t **) array_item(classes, i));
+
+    fprintf(src_file, "/* bytecode */\n\n");
+
+    fprintf(src_file, "enum vm_op_et\n{\n");
+    for (i = 0; i < NUM_VM_OPS; ++i)
+        fprintf(src_file, "    %s%s\n", vm_op_names[i], i < NUM_VM_OPS - 1 ? "," : "");
+    fprintf(src_file, "};\n\n");
+
+    /* 16 bits an instruction word unless the code or an operand needs more */
+    fprintf(src_file, "typedef %s vm_code_t;\n\n", max_value < 65536 ? "unsigned short" : "int");
+
+    fprintf(src_file, "static const vm_code_t vm_code[] =\n{");
+    for (i = 0; i < len; ++i)
+    {
+        int begin = *(int *) array_item(&entries, i);
+        int end = i + 1 < len ? *(int *) array_item(&entries, i + 1) : (item_entry >= 0 ? item_entry : array_size(&vc.code));
+
+        fprintf(src_file, "%s\n    /* %ls */\n   ", i ? "," : "", *(wchar_t **) array_item(node_type_labels, i + 1));
+        for (j = begin; j < end; ++j)
+            fprintf(src_file, "%s %d", j > begin ? "," : "", *(int *) array_item(&vc.code, j));
+    }
+    if (item_entry >= 0)
+    {
+        fprintf(src_file, ",\n    /* one iteration of the streamed repetition */\n   ");
+        for (j = item_entry; j < array_size(&vc.code); ++j)
+            fprintf(src_file, "%s %d", j > item_entry ? "," : "", *(int *) array_item(&vc.code, j));
+    }
+    fprintf(src_file, "\n};\n\n");
+
+    fprintf(src_file, "/* where each node type's rule starts in vm_code */\n");
+    fprintf(src_file, "static const int vm_rule_entry[] = { 0");
+    for (i = 0; i < len; ++i)
+        fprintf(src_file, ", %d", *(int *) array_item(&entries, i));
+    fprintf(src_file, " };\n\n");
+
+    if (num_tokens)
+    {
+        fprintf(src_file, "/* node types whose rules the scanner matches */\n");
+        fprintf(src_file, "static const char token_rule[] = { 0");
+        for (i = 0; i < len; ++i)
+            fprintf(src_file, ", %d", (*(rule_rec_t **) array_item(rule_records, i))->token);
+        fprintf(src_file, " };\n\n");
+    }
+
+    if (num_leaders)
+    {
+        fprintf(src_file, "/* node types whose rules are left-recursive, and grow seeds */\n");
+        fprintf(src_file, "static const char grow_rule[] = { 0");
+        for (i = 0; i < len; ++i)
+            fprintf(src_file, ", %d", (*(rule_rec_t **) array_item(rule_records, i))->left_recursion == RULE_LR_LEADER);
+        fprintf(src_file, " };\n\n");
+    }
+
+    if (item_entry >= 0)
+        fprintf(src_file, "#define VM_ITEM_ENTRY %d\n\n", item_entry);
+
+    fprintf(src_file, "static const char *const vm_strings[] = {");
+    for (i = 0; i < array_size(&vc.strings); ++i)
+    {
+        const wchar_t *str = *(const wchar_t **) array_item(&vc.strings, i);
+
+        buf[0] = 0;
+        for (j = 0; str[j]; ++j)
+            print_byte_escape(buf, str[j]);
+        fprintf(src_file, "%s \"%ls\"", i ? "," : "", buf);
+    }
+    fprintf(src_file, "%s };\n", array_size(&vc.strings) ? "" : " 0");
+
+    print_vm_table(src_file, "const char_class_t *", "vm_classes", "&char_class_%d", array_size(classes));
+    print_vm_table(src_file, "const char_span_t *", "vm_spans", "&char_span_%d", array_size(spans));
+    print_vm_table(src_file, "const char_class_t *", "vm_first_sets", "&first_set_%d", num_first_sets);
+    print_vm_table(src_file, "const unsigned char *", "vm_fail_sets", "fail_set_%d", num_fail_sets);
+    fprintf(src_file, "\n");
+
+    fprintf(src_file, "/* the deepest nesting of choices, lookaheads and hides in any one rule */\n");
+    fprintf(src_file, "#define VM_MAX_FRAMES %d\n\n", vc.max_depth > 0 ? vc.max_depth : 1);
+
+    fprintf(src_file, "/* interpreter */\n\n");
+
+    fprintf(src_file, "/* a choice point, lookahead or hide open in the rule being run */\n"
+        "typedef struct _vm_frame_t\n"
+        "{\n"
+        "    int kind;                  /* the instruction that opened it */\n"
+        "    int pos;                   /* where it started */\n"
+        "    int stack;                 /* how many children there were then */\n"
+        "    int alt;                   /* where to go on if what it guards fails */\n"
+        "    int open;                  /* counted in map->open_choices, so not yet cut */\n"
+        "}\n"
+        "vm_frame_t;\n\n");
+
+    fprintf(src_file, "static int vm_rule(int type, input_buffer_t *ib, int start_offset, int *end_offset, %ls_syntax_node_t **node, memo_map_t *map, error_list_t *errs);\n\n", pbuf);
+
+    fprintf(src_file, "#if defined(__GNUC__)\n"
+        "#define VM_COMPUTED_GOTO\n"
+        "#define VM_NEXT goto *vm_labels[vm_code[pc]]\n"
+        "#define VM_CASE(op) vm_##op:\n"
+        "#else\n"
+        "#define VM_NEXT goto vm_dispatch\n"
+        "#define VM_CASE(op) case op:\n"
+        "#endif\n\n");
+
+    fprintf(src_file, "/* runs the code at PC, putting the nodes it parses on CHILDREN; the frames of choices that */\n"
+        "/* can still be backtracked to live on an explicit stack, and rules are called recursively */\n"
+        "static int vm_run(int pc, input_buffer_t *ib, int start_offset, int *end_offset, array_t *children, memo_map_t *map, error_list_t *errs)\n"
+        "{\n"
+        "    vm_frame_t frames[VM_MAX_FRAMES], *f;\n"
+        "    int pos = start_offset, top = 0, stream_stack = 0, end, len;\n"
+        "    %ls_syntax_node_t *child;\n"
+        "\n"
+        "#ifdef VM_COMPUTED_GOTO\n"
+        "    static const void *const vm_labels[] =\n"
+        "    {\n", pbuf);
+    for (i = 0; i < NUM_VM_OPS; ++i)
+        fprintf(src_file, "        &&vm_%s%s\n", vm_op_names[i], i < NUM_VM_OPS - 1 ? "," : "");
+    fprintf(src_file, "    };\n"
+        "#endif\n"
+        "\n"
+        "    (void) stream_stack;\n"
+        "    (void) child;\n"
+        "    VM_NEXT;\n"
+        "\n"
+        "#ifndef VM_COMPUTED_GOTO\n"
+        "vm_dispatch:\n"
+        "    switch (vm_code[pc])\n"
+        "    {\n"
+        "#endif\n"
+        "\n"
+        "    VM_CASE(VM_RETURN)\n"
+        "        *end_offset = pos;\n"
+        "        return 1;\n"
+        "\n"
+        "    VM_CASE(VM_CHAR)\n"
+        "        if (!input_buffer_has(ib, pos + 1) || (unsigned char) *input_buffer_at(ib, pos) != vm_code[pc + 1])\n"
+        "            goto vm_fail;\n"
+        "        pos++;\n"
+        "        pc += 2;\n"
+        "        VM_NEXT;\n"
+        "\n"
+        "    VM_CASE(VM_STR)\n"
+        "        len = vm_code[pc + 2];\n"
+        "        if (!input_buffer_has(ib, pos + len) || memcmp(input_buffer_at(ib, pos), vm_strings[vm_code[pc + 1]], len) != 0)\n"
+        "            goto vm_fail;\n"
+        "        pos += len;\n"
+        "        pc += 3;\n"
+        "        VM_NEXT;\n"
+        "\n"
+        "    VM_CASE(VM_CLASS)\n"
+        "        if (!input_buffer_has(ib, pos + 1) || !CHAR_CLASS_HAS_BYTE(vm_classes[vm_code[pc + 1]], *input_buffer_at(ib, pos)))\n"
+        "            goto vm_fail;\n"
+        "        pos++;\n"
+        "        pc += 2;\n"
+        "        VM_NEXT;\n"
+        "\n"
+        "    VM_CASE(VM_CLASSW)\n");
+    if (any_wide)
+        fprintf(src_file, "        input_buffer_setpos(ib, pos);\n"
+            "        if (!char_class_match(vm_classes[vm_code[pc + 1]], input_buffer_read_char(ib)))\n"
+            "            goto vm_fail;\n"
+            "        pos = input_buffer_getpos(ib);\n"
+            "        pc += 2;\n"
+            "        VM_NEXT;\n"
+            "\n");
+    else
+        fprintf(src_file, "        goto vm_fail;\n"
+            "\n");
+    fprintf(src_file, "    VM_CASE(VM_ANY)\n"
+        "        input_buffer_setpos(ib, pos);\n"
+        "        if (input_buffer_read_char(ib) == WEOF)\n"
+        "            goto vm_fail;\n"
+        "        pos = input_buffer_getpos(ib);\n"
+        "        pc++;\n"
+        "        VM_NEXT;\n"
+        "\n");
+    if (num_spans)
+        fprintf(src_file, "    VM_CASE(VM_SPAN_STAR)\n"
+            "        pos = input_buffer_span(ib, pos, vm_spans[vm_code[pc + 1]]);\n"
+            "        pc += 2;\n"
+            "        VM_NEXT;\n"
+            "\n"
+            "    VM_CASE(VM_SPAN_PLUS)\n"
+            "        if ((end = input_buffer_span(ib, pos, vm_spans[vm_code[pc + 1]])) == pos)\n"
+            "            goto vm_fail;\n"
+            "        pos = end;\n"
+            "        pc += 2;\n"
+            "        VM_NEXT;\n"
+            "\n");
+    else
+        fprintf(src_file, "    VM_CASE(VM_SPAN_STAR)\n"
+            "    VM_CASE(VM_SPAN_PLUS)\n"
+            "        goto vm_fail;\n"
+            "\n");
+    fprintf(src_file, "    VM_CASE(VM_CALL)\n"
+        "        child = 0;\n"
+        "        if (!vm_rule(vm_code[pc + 1], ib, pos, &end, &child, map, errs))\n"
+        "            goto vm_fail;\n"
+        "        if (child)\n"
+        "            array_add(children, &child);\n"
+        "        pos = end;\n"
+        "        pc += 2;\n"
+        "        VM_NEXT;\n"
+        "\n"
+        "    VM_CASE(VM_CHOICE)\n"
+        "    VM_CASE(VM_BANG)\n"
+        "        f = &frames[top++];\n"
+        "        f->kind = vm_code[pc];\n"
+        "        f->pos = pos;\n"
+        "        f->stack = children->num;\n"
+        "        f->alt = vm_code[pc + 1];\n"
+        "        f->open = 1;\n"
+        "        map->open_choices++;\n"
+        "        if (f->kind == VM_BANG)\n"
+        "            errs->lookaheads++;\n"
+        "        pc += 2;\n"
+        "        VM_NEXT;\n"
+        "\n"
+        "    VM_CASE(VM_COMMIT)\n"
+        "        if (frames[--top].open)\n"
+        "            map->open_choices--;\n"
+        "        pc = vm_code[pc + 1];\n"
+        "        VM_NEXT;\n"
+        "\n"
+        "    VM_CASE(VM_GROUP)\n"
+        "    VM_CASE(VM_AMP)\n"
+        "    VM_CASE(VM_HIDE)\n"
+        "        f = &frames[top++];\n"
+        "        f->kind = vm_code[pc];\n"
+        "        f->pos = pos;\n"
+        "        f->stack = children->num;\n"
+        "        f->open = f->kind != VM_HIDE;\n"
+        "        if (f->open)\n"
+        "            map->open_choices++;\n"
+        "        pc++;\n"
+        "        VM_NEXT;\n"
+        "\n"
+        "    VM_CASE(VM_POP)\n"
+        "        if (frames[--top].open)\n"
+        "            map->open_choices--;\n"
+        "        pc++;\n"
+        "        VM_NEXT;\n"
+        "\n"
+        "    VM_CASE(VM_AMP_END)\n"
+        "        pos = frames[--top].pos;\n"
+        "        map->open_choices--;\n"
+        "        pc++;\n"
+        "        VM_NEXT;\n"
+        "\n"
+        "    VM_CASE(VM_BANG_END)\n"
+        "        f = &frames[--top];\n"
+        "        map->open_choices--;\n"
+        "        errs->lookaheads--;\n"
+        "        delete_children(children, f->stack);\n"
+        "        goto vm_fail;\n"
+        "\n"
+        "    VM_CASE(VM_HIDE_END)\n"
+        "        delete_children(children, frames[--top].stack);\n"
+        "        pc++;\n"
+        "        VM_NEXT;\n"
+        "\n"
+        "    VM_CASE(VM_CUT)\n"
+        "        for (f = &frames[top - 1]; f->kind == VM_HIDE; --f)\n"
+        "            ;\n"
+        "        if (f->open)\n"
+        "        {\n"
+        "            f->open = 0;\n"
+        "            map->open_choices--;\n"
+        "        }\n"
+        "        if (!map->open_choices)\n"
+        "            memo_map_commit(map, pos);\n"
+        "        pc++;\n"
+        "        VM_NEXT;\n"
+        "\n"
+        "    VM_CASE(VM_CUT_NONE)\n"
+        "        if (!map->open_choices)\n"
+        "            memo_map_commit(map, pos);\n"
+        "        pc++;\n"
+        "        VM_NEXT;\n"
+        "\n"
+        "    VM_CASE(VM_PREDICT)\n"
+        "        if (input_buffer_has(ib, pos + 1) && CHAR_CLASS_HAS_BYTE(vm_first_sets[vm_code[pc + 1]], *input_buffer_at(ib, pos)))\n"
+        "        {\n"
+        "            pc += 3;\n"
+        "            VM_NEXT;\n"
+        "        }\n"
+        "        else\n"
+        "        {\n"
+        "            const unsigned char *fails = vm_fail_sets[vm_code[pc + 2]];\n"
+        "            int wish = map->parser->wish_node;\n"
+        "\n"
+        "            record_failures(errs, fails, pos);\n"
+        "            if (wish > 0 && wish < %ls_NUM_NODE_TYPES && (fails[wish >> 3] >> (wish & 7)) & 1)\n"
+        "                dump_errors(errs);\n"
+        "            goto vm_fail;\n"
+        "        }\n"
+        "\n", ubuf);
+    if (stream)
+        fprintf(src_file, "    VM_CASE(VM_STREAM_TAKE)\n"
+            "        stream_stack = children->num;\n"
+            "        if (map->parallel && parallel_take(map->parallel, pos, children, &end))\n"
+            "        {\n"
+            "            pos = end;\n"
+            "            pc = vm_code[pc + 1];\n"
+            "            VM_NEXT;\n"
+            "        }\n"
+            "        pc += 2;\n"
+            "        VM_NEXT;\n"
+            "\n"
+            "    VM_CASE(VM_STREAM_EMIT)\n"
+            "        if (map->stream && !map->open_choices && !stream_children(ib, map, children, stream_stack, pos))\n"
+            "            goto vm_fail;\n"
+            "        pc = vm_code[pc + 1];\n"
+            "        VM_NEXT;\n"
+            "\n");
+    else
+        fprintf(src_file, "    VM_CASE(VM_STREAM_TAKE)\n"
+            "    VM_CASE(VM_STREAM_EMIT)\n"
+            "        goto vm_fail;\n"
+            "\n");
+    fprintf(src_file, "#ifndef VM_COMPUTED_GOTO\n"
+        "    }\n"
+        "#endif\n"
+        "\n"
+        "vm_fail:\n"
+        "    /* back to the innermost choice still open, or out of a negative lookahead */\n"
+        "    while (top > 0)\n"
+        "    {\n"
+        "        f = &frames[--top];\n"
+        "        if (!f->open)\n"
+        "            continue;\n"
+        "\n"
+        "        map->open_choices--;\n"
+        "        if (f->kind == VM_BANG)\n"
+        "            errs->lookaheads--;\n"
+        "        else if (f->kind != VM_CHOICE)\n"
+        "            continue;\n"
+        "\n"
+        "        pos = f->pos;\n"
+        "        delete_children(children, f->stack);\n"
+        "        pc = f->alt;\n"
+        "        VM_NEXT;\n"
+        "    }\n"
+        "\n"
+        "    return 0;\n"
+        "} /* vm_run() */\n\n");
+
+    fprintf(src_file, "/* parses the rule for node type TYPE once, building its node or recording its failure */\n"
+        "static int vm_parse(int type, input_buffer_t *ib, int start_offset, int *end_offset, %ls_syntax_node_t **node, memo_map_t *map, error_list_t *errs)\n"
+        "{\n"
+        "    int res, end = start_offset;\n"
+        "    array_t child_stack;\n"
+        "\n"
+        "    array_init(&child_stack, sizeof(%ls_syntax_node_t *), 0);\n"
+        "\n"
+        "    if ((res = vm_run(vm_rule_entry[type], ib, start_offset, &end, &child_stack, map, errs)))\n"
+        "    {\n"
+        "        int i, len = array_size(&child_stack);\n"
+        "\n"
+        "        *end_offset = end;\n"
+        "        *node = arena_node_create(map->arena, type, start_offset, end, map->node_ib);\n"
+        "        PARSE_STAT(map, nodes);\n"
+        "        (*node)->child = arena_child_array(map->arena, len);\n"
+        "        for (i = 0; i < len; ++i)\n"
+        "            (*node)->child[i] = *(%ls_syntax_node_t **) array_item(&child_stack, i);\n"
+        "        (*node)->children = len;\n"
+        "        delete_children(&child_stack, len);\n"
+        "        array_deinit(&child_stack);\n"
+        "        if (map->parser->dispatch[type] != NULL)\n"
+        "            map->parser->dispatch[type](*node, map->parser->data);\n"
+        "    }\n"
+        "    else\n"
+        "    {\n"
+        "        record_failure(errs, type, start_offset);\n"
+        "        PARSE_STAT(map, failures);\n"
+        "        if (map->parser->wish_node == type)\n"
+        "            dump_errors(errs);\n"
+        "        *node = 0;\n"
+        "        delete_children(&child_stack, 0);\n"
+        "        array_deinit(&child_stack);\n"
+        "    }\n"
+        "\n"
+        "    return res;\n"
+        "} /* vm_parse() */\n\n", pbuf, pbuf, pbuf);
+
+    if (num_leaders)
+        fprintf(src_file, "/* grows the seed of the left-recursive rule for node type TYPE, as PEG_GROW does */\n"
+            "static int vm_grow(int type, input_buffer_t *ib, int start_offset, int *end_offset, %ls_syntax_node_t **node, memo_map_t *map, error_list_t *errs)\n"
+            "{\n"
+            "    int res, end = start_offset;\n"
+            "    %ls_syntax_node_t *seed;\n"
+            "    grow_frame_t frame;\n"
+            "\n"
+            "    if (seed_memoized(map, type, start_offset, node, end_offset))\n"
+            "    {\n"
+            "        if (!*node)\n"
+            "            record_failure(errs, type, start_offset);\n"
+            "        return *node != 0;\n"
+            "    }\n"
+            "\n"
+            "    grow_begin(map, &frame, type, start_offset);\n"
+            "    do\n"
+            "        res = vm_parse(type, ib, start_offset, &end, &seed, map, errs);\n"
+            "    while (grow_step(map, &frame, res, end, seed));\n"
+            "    return grow_end(map, &frame, end_offset, node);\n"
+            "} /* vm_grow() */\n\n", pbuf, pbuf);
+
+    fprintf(src_file, "/* parses the rule for node type TYPE, like a function PEG_PARSE would make */\n"
+        "#ifdef %ls_PROFILE\n"
+        "static int vm_rule_body(int type, input_buffer_t *ib, int start_offset, int *end_offset, %ls_syntax_node_t **node, memo_map_t *map, error_list_t *errs)\n"
+        "#else\n"
+        "static int vm_rule(int type, input_buffer_t *ib, int start_offset, int *end_offset, %ls_syntax_node_t **node, memo_map_t *map, error_list_t *errs)\n"
+        "#endif\n"
+        "{\n"
+        "    int res;\n"
+        "\n", ubuf, pbuf, pbuf);
+
+    if (num_tokens)
+        fprintf(src_file, "    if (token_rule[type])\n"
+            "        return scan_token(ib, type, start_offset, end_offset, node, map, errs);\n"
+            "\n");
+
+    fprintf(src_file, "    if (memo_rule[type] && is_memoized(map, type, start_offset, node, end_offset))\n"
+        "    {\n"
+        "        if (!*node)\n"
+        "            record_failure(errs, type, start_offset);\n"
+        "        return *node != 0;\n"
+        "    }\n"
+        "\n");
+
+    if (num_leaders)
+        fprintf(src_file, "    if (grow_rule[type])\n"
+            "        return vm_grow(type, ib, start_offset, end_offset, node, map, errs);\n"
+            "\n");
+
+    fprintf(src_file, "    res = vm_parse(type, ib, start_offset, end_offset, node, map, errs);\n"
+        "\n"
+        "    if (memo_rule[type])\n"
+        "        memoize(map, type, start_offset, res ? *end_offset : start_offset, *node);\n"
+        "\n"
+        "    return res;\n"
+        "} /* vm_rule() */\n\n");
+
+    /* the profile wraps it in a function that counts and times the calls of each rule */
+    fprintf(src_file, "#ifdef %ls_PROFILE\n"
+        "static int vm_rule(int type, input_buffer_t *ib, int start_offset, int *end_offset, %ls_syntax_node_t **node, memo_map_t *map, error_list_t *errs)\n"
+        "{\n"
+        "    profile_frame_t frame;\n"
+        "\n"
+        "    profile_enter(map, &frame, start_offset);\n"
+        "    return profile_leave(map, &frame, type, vm_rule_body(type, ib, start_offset, end_offset, node, map, errs), end_offset);\n"
+        "}\n"
+        "#endif\n\n", ubuf, pbuf);
+
+    /* only the start rule is called by name */
+    fprintf(src_file, "static int %ls(input_buffer_t *ib, int start_offset, int *end_offset, %ls_syntax_node_t **node, memo_map_t *map, error_list_t *errs)\n"
+        "{\n"
+        "    return vm_rule(%ls, ib, start_offset, end_offset, node, map, errs);\n"
+        "}\n\n",
+        *(wchar_t **) array_item(node_function_names, 0), pbuf, *(wchar_t **) array_item(node_type_labels, 1));
+
+    if (stream)
+        fprintf(src_file, "static int parse_stream_item(input_buffer_t *ib, int start_offset, int *end_offset, array_t *children, memo_map_t *map, error_list_t *errs)\n"
+            "{\n"
+            "    int orig_stack_size = children->num;\n"
+            "\n"
+            "    if (vm_run(VM_ITEM_ENTRY, ib, start_offset, end_offset, children, map, errs))\n"
+            "        return 1;\n"
+            "\n"
+            "    delete_children(children, orig_stack_size);\n"
+            "    return 0;\n"
+            "} /* parse_stream_item() */\n\n");
+
+    array_deinit(&vc.code);
+    array_deinit(&vc.strings);
+    array_deinit(&entries);
+} /* print_vm_rules() */
+
+/* prints NUM values, PER_LINE to a line, as a table of the smallest type that holds them */
+static void print_scan_table(FILE *src_file, const char *name, const int *values, int num, int per_line)
+{
+    int i, max_value = 0;
+
+    for (i = 0; i < num; ++i)
+    {
+        if (values[i] > max_value)
+            max_value = values[i];
+    }
+
+    fprintf(src_file, "static const %s %s[] =\n{", max_value < 256 ? "unsigned char" : max_value < 65536 ? "unsigned short" : "int", name);
+    for (i = 0; i < num; ++i)
+        fprintf(src_file, "%s%s%d", i ? "," : "", i % per_line ? " " : "\n    ", values[i]);
+    fprintf(src_file, "\n};\n\n");
+} /* print_scan_table() */
+
+
+/** Prints the scanner's tables and scan_token(), which the functions of the token rules call. */
+static void print_scanner(const wchar_t *pbuf, FILE *src_file, const scanner_t *scanner)
+{
+    int byte_class[256];
+    int i;
+
+    for (i = 0; i < 256; ++i)
+        byte_class[i] = scanner->byte_class[i];
+
+    fprintf(src_file, "/* the scanner: a DFA over classes of bytes that matches every token rule at once */\n\n");
+    fprintf(src_file, "#define SCAN_NUM_TOKENS %d\n", scanner->num_tokens);
+    fprintf(src_file, "#define SCAN_NUM_CLASSES %d\n\n", scanner->num_classes);
+
+    print_scan_table(src_file, "scan_token_type", scanner->token_types, scanner->num_tokens, 16);
+    print_scan_table(src_file, "scan_byte_class", byte_class, 256, 16);
+    fprintf(src_file, "/* a line per state; state 0 is dead, state 1 the start */\n");
+    print_scan_table(src_file, "scan_next", scanner->next, scanner->num_states * scanner->num_classes, scanner->num_classes);
+    fprintf(src_file, "/* the tokens, as indices into scan_token_type, that reaching each state matches */\n");
+    print_scan_table(src_file, "scan_accept_begin", scanner->accept_begin, scanner->num_states + 1, 16);
+    print_scan_table(src_file, "scan_accepts", scanner->accepts, scanner->num_accepts, 16);
+
+    fprintf(src_file, "static int memo_map_scanned(memo_map_t *map, int pos)\n"
+        "{\n"
+        "    int bit = pos - map->scanned_base;\n"
+        "\n"
+        "    return bit >= 0 && bit < map->scanned_len * 8 && (map->scanned[bit >> 3] >> (bit & 7)) & 1;\n"
+        "} /* memo_map_scanned() */\n\n");
+
+    fprintf(src_file, "static void memo_map_set_scanned(memo_map_t *map, int pos)\n"
+        "{\n"
+        "    int bit = pos - map->scanned_base, len;\n"
+        "\n"
+        "    assert(bit >= 0);\n"
+        "\n"
+        "    if (bit >= map->scanned_len * 8)\n"
+        "    {\n"
+        "        for (len = map->scanned_len ? map->scanned_len * 2 : 256; bit >= len * 8; len *= 2)\n"
+        "            ;\n"
+        "        map->scanned = (unsigned char *) realloc(map->scanned, len);\n"
+        "        memset(map->scanned + map->scanned_len, 0, len - map->scanned_len);\n"
+        "        map->scanned_len = len;\n"
+        "    }\n"
+        "\n"
+        "    map->scanned[bit >> 3] |= (unsigned char) (1 << (bit & 7));\n"
+        "} /* memo_map_set_scanned() */\n\n");
+
+    fprintf(src_file, "/* runs the scanner from START_OFFSET as far as any token can match, and memoizes the longest */\n"
+        "/* match of each token there, without its node, and notes that it has run there */\n"
+        "static void scan(input_buffer_t *ib, int start_offset, memo_map_t *map)\n"
+        "{\n"
+        "    int end[SCAN_NUM_TOKENS];\n"
+        "    int i, state = 1, pos = start_offset;\n"
+        "\n"
+        "    for (i = 0; i < SCAN_NUM_TOKENS; ++i)\n"
+        "        end[i] = -1;\n"
+        "\n"
+        "    while (input_buffer_has(ib, pos + 1)\n"
+        "        && (state = scan_next[state * SCAN_NUM_CLASSES + scan_byte_class[(unsigned char) *input_buffer_at(ib, pos)]]))\n"
+        "    {\n"
+        "        ++pos;\n"
+        "        for (i = scan_accept_begin[state]; i < scan_accept_begin[state + 1]; ++i)\n"
+        "            end[scan_accepts[i]] = pos;\n"
+        "    }\n"
+        "\n"
+        "    for (i = 0; i < SCAN_NUM_TOKENS; ++i)\n"
+        "    {\n"
+        "        if (end[i] >= 0)\n"
+        "            memoize(map, scan_token_type[i], start_offset, end[i], NULL);\n"
+        "    }\n"
+        "\n"
+        "    memo_map_set_scanned(map, start_offset);\n"
+        "} /* scan() */\n\n");
+
+    fprintf(src_file, "/* matches the token rule for node type TYPE, like a function PEG_PARSE would make; the first token */\n"
+        "/* asked for at an offset scans there, the rest find their matches memoized, and a token's leaf */\n"
+        "/* node is built when it is first asked for */\n"
+        "static int scan_token(input_buffer_t *ib, int type, int start_offset, int *end_offset, %ls_syntax_node_t **node, memo_map_t *map, error_list_t *errs)\n"
+        "{\n"
+        "    memo_rec_t *rec = memo_map_find_slot(map->records, map->cap, type, start_offset);\n"
+        "\n"
+        "    if (!rec->type && !memo_map_scanned(map, start_offset))\n"
+        "    {\n"
+        "        scan(ib, start_offset, map);\n"
+        "        rec = memo_map_find_slot(map->records, map->cap, type, start_offset);\n"
+        "    }\n"
+        "\n"
+        "    if (!rec->type)\n"
+        "    {\n"
+        "        record_failure(errs, type, start_offset);\n"
+        "        PARSE_STAT(map, failures);\n"
+        "        if (map->parser->wish_node == type)\n"
+        "            dump_errors(errs);\n"
+        "        *node = 0;\n"
+        "        return 0;\n"
+        "    }\n"
+        "\n"
+        "    if (!rec->parse_tree)\n"
+        "    {\n"
+        "        rec->parse_tree = arena_node_create(map->arena, type, start_offset, rec->end_offset, map->node_ib);\n"
+        "        PARSE_STAT(map, nodes);\n"
+        "        rec->parse_tree->child = arena_child_array(map->arena, 0);\n"
+        "        if (map->parser->dispatch[type] != NULL)\n"
+        "            map->parser->dispatch[type](rec->parse_tree, map->parser->data);\n"
+        "    }\n"
+        "\n"
+        "    *node = syntax_node_retain(rec->parse_tree);\n"
+        "    *end_offset = rec->end_offset;\n"
+        "    return 1;\n"
+        "} /* scan_token() */\n\n", pbuf);
+
+    fprintf(src_file, "#define PEG_TOKEN(FUNCTION, NODE_TYPE)                                                                        \\\n"
+        "RULE_FUNCTION(FUNCTION, NODE_TYPE)                                                                          \\\n"
+        "{                                                                                                           \\\n"
+        "    return scan_token(ib, NODE_TYPE, start_offset, end_offset, node, map, errs);                            \\\n"
+        "}\n\n");
+} /* print_scanner() */
+
+
+/** Prints the functions that grow the seeds of left-recursive rules. */
+static void print_seed_growing(const wchar_t *pbuf, FILE *src_file, const array_t *rule_records)
+{
+    int i;
+
+    fprintf(src_file, "/* left recursion: the memo record of a left-recursive rule holds its seed, the longest match */\n"
+        "/* found so far.  The seed starts as a failure, so the call back into the rule fails and only */\n"
+        "/* the alternatives without one can match.  The rule is then parsed again on each new seed, */\n"
+        "/* until a pass matches no further than the one before.  A cycle can hold more than one such */\n"
+        "/* rule, as in L <- P '.x' / 'x' with P <- P '(n)' / L.  The first of them is the head, and a */\n"
+        "/* seed the others grow inside one of its passes holds for that pass only */\n\n");
+
+    fprintf(src_file, "/* per node type: for a left-recursive rule, the node type of the head of its cycle */\n");
+    fprintf(src_file, "static const int grow_head[] = { 0");
+    for (i = 0; i < array_size(rule_records); ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+        fprintf(src_file, ", %d", rec->left_recursion == RULE_LR_LEADER ? rec->lr_head + 1 : 0);
+    }
+    fprintf(src_file, " };\n\n");
+
+    fprintf(src_file, "/* the pass that a seed of TYPE grown at START_OFFSET now holds for: the current one of the */\n"
+        "/* innermost rule of its cycle growing there, or 0 for any */\n"
+        "static int grow_pass(const memo_map_t *map, int type, int start_offset)\n"
+        "{\n"
+        "    const grow_frame_t *frame;\n"
+        "\n"
+        "    for (frame = map->growing; frame; frame = frame->outer)\n"
+        "    {\n"
+        "        if (frame->start_offset == start_offset && grow_head[frame->type] == grow_head[type])\n"
+        "            return frame->pass;\n"
+        "    }\n"
+        "\n"
+        "    return 0;\n"
+        "} /* grow_pass() */\n\n");
+
+    fprintf(src_file, "/* is_memoized() for a left-recursive rule, passing over a seed grown for an earlier pass */\n"
+        "static int seed_memoized(memo_map_t *map, int type, int start_offset, %ls_syntax_node_t **res, int *end_offset)\n"
+        "{\n"
+        "    memo_rec_t *rec = memo_map_find_slot(map->records, map->cap, type, start_offset);\n"
+        "\n"
+        "    if (rec->type && rec->pass > 0 && rec->pass != grow_pass(map, type, start_offset))\n"
+        "        return 0;\n"
+        "\n"
+        "    return is_memoized(map, type, start_offset, res, end_offset);\n"
+        "} /* seed_memoized() */\n\n", pbuf);
+
+    fprintf(src_file, "static void grow_begin(memo_map_t *map, grow_frame_t *frame, int type, int start_offset)\n"
+        "{\n"
+        "    memoize(map, type, start_offset, start_offset, 0);\n"
+        "    memo_map_find_slot(map->records, map->cap, type, start_offset)->pass = -1;\n"
+        "\n"
+        "    frame->type = type;\n"
+        "    frame->start_offset = start_offset;\n"
+        "    frame->pass = ++map->passes;\n"
+        "    frame->outer = map->growing;\n"
+        "    map->growing = frame;\n"
+        "\n"
+        "    /* every pass starts at START_OFFSET, so no cut may commit beyond it until the last */\n"
+        "    map->open_choices++;\n"
+        "} /* grow_begin() */\n\n");
+
+    fprintf(src_file, "/* takes the result of a pass; returns whether it grew the seed, so that another pass is due */\n"
+        "static int grow_step(memo_map_t *map, grow_frame_t *frame, int res, int end_offset, %ls_syntax_node_t *node)\n"
+        "{\n"
+        "    memo_rec_t *rec = memo_map_find_slot(map->records, map->cap, frame->type, frame->start_offset);\n"
+        "    int grown = res && (!rec->parse_tree || end_offset > rec->end_offset);\n"
+        "\n"
+        "    if (grown)\n"
+        "    {\n"
+        "        memoize(map, frame->type, frame->start_offset, end_offset, node);\n"
+        "        memo_map_find_slot(map->records, map->cap, frame->type, frame->start_offset)->pass = -1;\n"
+        "        frame->pass = ++map->passes;\n"
+        "    }\n"
+        "\n"
+        "    /* the record holds the new seed, and a pass that did not grow it is thrown away */\n"
+        "    if (node)\n"
+        "        %ls_syntax_node_destroy(node);\n"
+        "\n"
+        "    return grown;\n"
+        "} /* grow_step() */\n\n", pbuf, pbuf);
+
+    fprintf(src_file, "static int grow_end(memo_map_t *map, grow_frame_t *frame, int *end_offset, %ls_syntax_node_t **node)\n"
+        "{\n"
+        "    memo_rec_t *rec;\n"
+        "\n"
+        "    map->growing = frame->outer;\n"
+        "    map->open_choices--;\n"
+        "\n"
+        "    rec = memo_map_find_slot(map->records, map->cap, frame->type, frame->start_offset);\n"
+        "    rec->pass = grow_pass(map, frame->type, frame->start_offset);\n"
+        "\n"
+        "    *node = syntax_node_retain(rec->parse_tree);\n"
+        "    *end_offset = rec->end_offset;\n"
+        "    return *node != 0;\n"
+        "} /* grow_end() */\n\n", pbuf);
+} /* print_seed_growing() */
+
+static void print_function_bodies(const wchar_t *prefix, FILE *src_file, const array_t *rule_records, const array_t *node_type_labels, const array_t *node_function_names, int backend, int optimise)
+{
+    wchar_t pbuf[128], ubuf[128];
+    wchar_t buf[BUF_LEN];
+    array_t classes, spans, predictions, first_sets, fail_sets;
+    const rule_exp_t *stream;
+    first_info_t first_info;
+    span_rec_t line_span;
+    scanner_t scanner;
+    int i, len, num_spans, line_span_index, num_leaders = 0;
+
+    swprintf(pbuf, 128, L"%ls", prefix);
+    to_lower(pbuf);
+    swprintf(ubuf, 128, L"%ls", prefix);
+    to_upper(ubuf);
+
+    array_init(&classes, sizeof(wchar_t *), 0);
+    array_init(&spans, sizeof(span_rec_t), 0);
+
+    /* the scanner matches the token rules, so nothing else looks into them */
+    len = array_size(rule_records);
+    for (i = 0; i < len; ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+
+        if (!rec->token)
+        {
+            collect_classes(&classes, rec->rule_spec);
+            collect_spans(&spans, rec->rule_spec);
+        }
+    }
+
+    /* the line index scans for line endings with a span of everything else */
+    num_spans = array_size(&spans);
+    line_span.set = L"\n\r";
+    line_span.negate = 1;
+    if ((line_span_index = find_span(&spans, &line_span)) < 0)
+    {
+        line_span_index = array_size(&spans);
+        array_add(&spans, &line_span);
+    }
+
+    /* FIRST-set prediction, which -O0 turns off along with the rewrites */
+    first_info_init(&first_info, rule_records);
+    array_init(&predictions, sizeof(predict_rec_t), 0);
+    array_init(&first_sets, 32, 0);
+    array_init(&fail_sets, first_info.fail_len, 0);
+    for (i = 0; optimise && i < len; ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+
+        if (!rec->token)
+            collect_predictions(&first_info, rec->rule_spec, &predictions, &first_sets, &fail_sets);
+    }
+
+    print_class_tables(src_file, &classes);
+    print_prediction_tables(src_file, &first_sets, &fail_sets);
+    if (array_size(&predictions) || backend == BACKEND_VM)
+        print_record_failures(src_file);
+    print_span_tables(src_file, &spans);
+    if (num_spans)
+        print_span_reader(src_file);
+    print_line_index(pbuf, src_file, line_span_index);
+
+    /* memoization */
+    fprintf(src_file, "/* rules whose results are memoized; the others are parsed again if re-invoked at the same offset */\n\n");
+    fprintf(src_file, "static const char memo_rule[] = { 0");
+    for (i = 0; i < len; ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+
+        /* left-recursive rules keep their seeds in the memo themselves */
+        fprintf(src_file, ", %d", rec->memoized && rec->left_recursion != RULE_LR_LEADER);
+        num_leaders += rec->left_recursion == RULE_LR_LEADER;
+    }
+    fprintf(src_file, " };\n\n");
+
+    if (num_leaders)
+        print_seed_growing(pbuf, src_file, rule_records);
+
+    /* error messages */
+    fprintf(src_file, "/* what each rule is called in syntax errors */\n\n");
+    fprintf(src_file, "static const wchar_t *const rule_names[] = { 0");
+    for (i = 0; i < len; ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+        fprintf(src_file, ",\n    L\"%ls\"", (rec->rule_desc && rec->rule_desc[0]) ? rec->rule_desc : *(wchar_t **) array_item(node_function_names, i));
+    }
+    fprintf(src_file, "\n};\n\n");
+
+    fprintf(src_file, "/* builds \"syntax error: expected A, B or C\" from the rules that failed at the farthest offset */\n"
+        "static wchar_t *format_failure(const error_list_t *errs)\n"
+        "{\n"
+        "    const wchar_t *names[%ls_NUM_NODE_TYPES];\n"
+        "    wchar_t *str;\n"
+        "    size_t len = 32;\n"
+        "    int type, i, num = 0;\n"
+        "\n"
+        "    for (type = 1; type < %ls_NUM_NODE_TYPES; ++type)\n"
+        "    {\n"
+        "        if (!((errs->expected[type >> 3] >> (type & 7)) & 1))\n"
+        "            continue;\n"
+        "\n"
+        "        /* rules can share a description; name each one once */\n"
+        "        for (i = 0; i < num && wcscmp(names[i], rule_names[type]); ++i)\n"
+        "            ;\n"
+        "        if (i == num)\n"
+        "        {\n"
+        "            names[num++] = rule_names[type];\n"
+        "            len += wcslen(rule_names[type]) + 4;\n"
+        "        }\n"
+        "    }\n"
+        "\n"
+        "    str = (wchar_t *) calloc(len, sizeof(wchar_t));\n"
+        "    wcscpy(str, L\"syntax error: expected \");\n"
+        "    for (i = 0; i < num; ++i)\n"
+        "    {\n"
+        "        if (i)\n"
+        "            wcscat(str, i == num - 1 ? L\" or \" : L\", \");\n"
+        "        wcscat(str, names[i]);\n"
+        "    }\n"
+        "\n"
+        "    return str;\n"
+        "} /* format_failure() */\n\n", ubuf, ubuf);
+
+    fprintf(src_file, "static void format_errors(error_list_t *errs)\n"
+        "{\n"
+        "    %ls_error_rec_t er;\n"
+        "\n"
+        "    if (errs->formatted || errs->fail_pos < 0)\n"
+        "        return;\n"
+        "\n"
+        "    er.pos = errs->fail_pos;\n"
+        "    er.str = format_failure(errs);\n"
+        "    array_add(&errs->errors, &er);\n"
+        "    errs->formatted = 1;\n"
+        "} /* format_errors() */\n\n", pbuf);
+
+    fprintf(src_file, "int %ls_num_errors(void *error_list)\n"
+        "{\n"
+        "    format_errors((error_list_t *) error_list);\n"
+        "    return array_size(&((error_list_t *) error_list)->errors);\n"
+        "}\n\n", pbuf);
+
+    fprintf(src_file, "%ls_error_rec_t *%ls_get_error(void *error_list, int index)\n"
+        "{\n"
+        "    format_errors((error_list_t *) error_list);\n"
+        "    return (%ls_error_rec_t *) array_item(&((error_list_t *) error_list)->errors, index);\n"
+        "}\n\n", pbuf, pbuf, pbuf);
+
+    fprintf(src_file, "int %ls_parse_stats(void *error_list, %ls_parse_stats_t *stats)\n"
+        "{\n"
+        "#ifdef %ls_STATS\n"
+        "    *stats = ((error_list_t *) error_list)->stats;\n"
+        "    return 1;\n"
+        "#else\n"
+        "    (void) error_list;\n"
+        "    memset(stats, 0, sizeof(%ls_parse_stats_t));\n"
+        "    return 0;\n"
+        "#endif\n"
+        "}\n\n", pbuf, pbuf, ubuf, pbuf);
+
+    fprintf(src_file, "int %ls_profile(void *error_list, %ls_rule_profile_t *rules)\n"
+        "{\n"
+        "#ifdef %ls_PROFILE\n"
+        "    memcpy(rules, ((error_list_t *) error_list)->profile, sizeof(((error_list_t *) error_list)->profile));\n"
+        "    return 1;\n"
+        "#else\n"
+        "    (void) error_list;\n"
+        "    memset(rules, 0, %ls_NUM_NODE_TYPES * sizeof(%ls_rule_profile_t));\n"
+        "    return 0;\n"
+        "#endif\n"
+        "}\n\n", pbuf, pbuf, ubuf, ubuf, pbuf);
+
+    fprintf(src_file, "static int compare_self_cycles(const void *a, const void *b)\n"
+        "{\n"
+        "    long long diff = (*(const %ls_rule_profile_t **) b)->self_cycles - (*(const %ls_rule_profile_t **) a)->self_cycles;\n"
+        "    return diff > 0 ? 1 : diff < 0 ? -1 : 0;\n"
+        "} /* compare_self_cycles() */\n\n", pbuf, pbuf);
+
+    fprintf(src_file, "void %ls_profile_report(void *error_list, FILE *out)\n"
+        "{\n"
+        "    %ls_rule_profile_t rules[%ls_NUM_NODE_TYPES], *order[%ls_NUM_NODE_TYPES];\n"
+        "    long long total = 0;\n"
+        "    int i, num = 0;\n"
+        "\n"
+        "    if (!%ls_profile(error_list, rules))\n"
+        "    {\n"
+        "        fprintf(out, \"no profile; compile the parser with %ls_PROFILE defined\\n\");\n"
+        "        return;\n"
+        "    }\n"
+        "\n"
+        "    for (i = 1; i < %ls_NUM_NODE_TYPES; ++i)\n"
+        "    {\n"
+        "        total += rules[i].self_cycles;\n"
+        "        if (rules[i].calls)\n"
+        "            order[num++] = &rules[i];\n"
+        "    }\n"
+        "    qsort(order, num, sizeof(order[0]), compare_self_cycles);\n"
+        "\n"
+        "    fprintf(out, \"%%-28s %%6s %%14s %%12s %%12s %%12s %%12s %%12s %%12s %%14s %%14s\\n\", \"rule\", \"self\", \"self cycles\",\n"
+        "        \"calls\", \"memo hits\", \"memo misses\", \"successes\", \"failures\", \"consumed\", \"backtracked\", \"cycles\");\n"
+        "    for (i = 0; i < num; ++i)\n"
+        "    {\n"
+        "        const %ls_rule_profile_t *r = order[i];\n"
+        "\n"
+        "        fprintf(out, \"%%-28s %%5.1f%%%% %%14lld %%12lld %%12lld %%12lld %%12lld %%12lld %%12lld %%14lld %%14lld\\n\", %ls_node_names[r - rules],\n"
+        "            total ? 100.0 * r->self_cycles / total : 0.0, r->self_cycles, r->calls, r->memo_hits, r->memo_misses,\n"
+        "            r->successes, r->failures, r->consumed, r->backtracked, r->cycles);\n"
+        "    }\n"
+        "} /* profile_report() */\n\n", pbuf, pbuf, ubuf, ubuf, pbuf, ubuf, ubuf, pbuf, pbuf);
+
+    fprintf(src_file, "/*Debug dump of errors to stdout*/\n"
+        "static void dump_errors(error_list_t *errs){\n"
+        "wchar_t *str;\n"
+        "\n"
+        "if (errs->fail_pos < 0) return;\n"
+        "str = format_failure(errs);\n"
+        "printf(\"WishError %%d %%ls\\n\",errs->fail_pos,str);\n"
+        "free(str);\n"
+        "}\n\n");
+
+    scanner_build(rule_records, &scanner);
+    if (scanner.num_tokens)
+        print_scanner(pbuf, src_file, &scanner);
+    scanner_deinit(&scanner);
+
+    /* streaming */
+    stream = find_stream_star(rule_records);
+    fprintf(src_file, "/* set if the start rule has a top-level repetition whose subtrees can be streamed */\n\n");
+    fprintf(src_file, "static const int stream_top_level = %d;\n\n", stream != 0);
+    if (stream)
+        print_parallel_workers(pbuf, src_file);
+
+    if (backend == BACKEND_VM)
+        print_vm_rules(pbuf, ubuf, src_file, rule_records, node_type_labels, node_function_names, &classes, &spans, num_spans,
+                       &predictions, array_size(&first_sets), array_size(&fail_sets), stream);
+    else
+    {
+        fprintf(src_file, "/* parsing functions */\n\n");
+
+        for (i = 0; i < len; ++i)
+        {
+            rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+
+            if (rec->token)
+            {
+                fprintf(src_file, "PEG_TOKEN(%ls, %ls)\n\n",
+                    *(wchar_t **) array_item(node_function_names, i),
+                    *(wchar_t **) array_item(node_type_labels, i+1));
+                continue;
+            }
+
+            buf[0] = 0;
+            print_rule_exp(buf, rec->rule_spec, rule_records, node_function_names, &classes, &spans, &predictions, stream);
+            fprintf(src_file, "PEG_PARSE(%ls%s, %ls, %ls)\n\n", 
+                *(wchar_t **) array_item(node_function_names, i),
+                rec->left_recursion == RULE_LR_LEADER ? "_seed" : "",
+                *(wchar_t **) array_item(node_type_labels, i+1),
+                buf);
+
+            if (rec->left_recursion == RULE_LR_LEADER)
+                fprintf(src_file, "PEG_GROW(%ls, %ls)\n\n",
+                    *(wchar_t **) array_item(node_function_names, i),
+                    *(wchar_t **) array_item(node_type_labels, i+1));
+        }
+
+        if (stream)
+        {
+            buf[0] = 0;
+            print_rule_exp(buf, stream->left, rule_records, node_function_names, &classes, &spans, &predictions, stream);
+            fprintf(src_file, "PEG_ITEM(parse_stream_item, %ls)\n\n", buf);
+        }
+    }
+
+    array_deinit(&classes);
+    array_deinit(&spans);
+    array_deinit(&predictions);
+    array_deinit(&first_sets);
+    array_deinit(&fail_sets);
+    first_info_deinit(&first_info);
+} /* print_function_bodies() */
+
+/** Prints the parser context functions and the worker pool behind _parse_many(). */
+static void print_parser_contexts(const wchar_t *prefix, FILE *src_file)
+{
+    wchar_t buf[BUF_LEN];
+
+    swprintf(buf, BUF_LEN, L"%ls", prefix);
+    to_lower(buf);
+
+    fprintf(src_file, "/* parser contexts */\n\n");
+
+    fprintf(src_file, "%ls_parser_t *%ls_parser_create(void)\n"
+        "{\n"
+        "    %ls_parser_t *parser = (%ls_parser_t *) malloc(sizeof(%ls_parser_t));\n"
+        "    parser_init(parser);\n"
+        "    return parser;\n"
+        "} /* parser_create() */\n\n", buf, buf, buf, buf, buf);
+
+    fprintf(src_file, "void %ls_parser_destroy(%ls_parser_t *parser)\n"
+        "{\n"
+        "    free(parser);\n"
+        "} /* parser_destroy() */\n\n", buf, buf);
+
+    fprintf(src_file, "int %ls_parser_parse(%ls_parser_t *parser, char *fname, %ls_syntax_node_t **parse_tree, void **input_buf, void **error_list)\n"
+        "{\n"
+        "    assert(parser);\n"
+        "\n"
+        "    if (parser->use_mmap)\n"
+        "        return parse_mapped(parser, fname, parser->arena, parse_tree, input_buf, error_list);\n"
+        "    else\n"
+        "        return parse_file(parser, fname, parser->arena, parse_tree, input_buf, error_list);\n"
+        "}\n\n", buf, buf, buf);
+
+    fprintf(src_file, "int %ls_parser_parse_mem(%ls_parser_t *parser, const char *data, size_t len, %ls_syntax_node_t **parse_tree, void **input_buf, void **error_list)\n"
+        "{\n"
+        "    assert(parser);\n"
+        "    return parse_mem(parser, data, len, parser->arena, parse_tree, input_buf, error_list);\n"
+        "}\n\n", buf, buf, buf);
+
+    fprintf(src_file, "/* worker pool for _parse_many() */\n\n");
+
+    fprintf(src_file, "typedef struct _parse_pool_t\n"
+        "{\n"
+        "    const %ls_parser_t *parser;  /* copied by each worker */\n"
+        "    %ls_parse_job_t *jobs;\n"
+        "    int num_jobs;\n"
+        "    volatile long next;        /* the next job to hand out */\n"
+        "    volatile long parsed;      /* jobs that parsed */\n"
+        "}\n"
+        "parse_pool_t;\n\n", buf, buf);
+
+    fprintf(src_file, "static long parse_pool_add(volatile long *value, long n)\n"
+        "{\n"
+        "#ifdef WIN32\n"
+        "    return InterlockedExchangeAdd(value, n);\n"
+        "#else\n"
+        "    return __sync_fetch_and_add(value, n);\n"
+        "#endif\n"
+        "} /* parse_pool_add() */\n\n");
+
+    fprintf(src_file, "static void parse_pool_work(parse_pool_t *pool)\n"
+        "{\n"
+        "    %ls_parser_t parser = *pool->parser;\n"
+        "    %ls_parse_job_t *job;\n"
+        "    long i, parsed = 0;\n"
+        "\n"
+        "    /* an arena cannot be shared between threads, and each tree must be freeable on its own */\n"
+        "    parser.arena = 0;\n"
+        "\n"
+        "    while ((i = parse_pool_add(&pool->next, 1)) < pool->num_jobs)\n"
+        "    {\n"
+        "        job = pool->jobs + i;\n"
+        "        job->parse_tree = 0;\n"
+        "        job->input_buffer = 0;\n"
+        "        job->error_list = 0;\n"
+        "\n"
+        "        if (!job->fname)\n"
+        "            job->res = parse_mem(&parser, job->data, job->len, 0, &job->parse_tree, &job->input_buffer, &job->error_list);\n"
+        "        else if (parser.use_mmap)\n"
+        "            job->res = parse_mapped(&parser, job->fname, 0, &job->parse_tree, &job->input_buffer, &job->error_list);\n"
+        "        else\n"
+        "            job->res = parse_file(&parser, job->fname, 0, &job->parse_tree, &job->input_buffer, &job->error_list);\n"
+        "\n"
+        "        parsed += job->res;\n"
+        "    }\n"
+        "\n"
+        "    parse_pool_add(&pool->parsed, parsed);\n"
+        "} /* parse_pool_work() */\n\n", buf, buf);
+
+    fprintf(src_file, "#ifdef WIN32\n"
+        "static DWORD WINAPI parse_pool_thread(LPVOID pool)\n"
+        "{\n"
+        "    parse_pool_work((parse_pool_t *) pool);\n"
+        "    return 0;\n"
+        "} /* parse_pool_thread() */\n"
+        "#else\n"
+        "static void *parse_pool_thread(void *pool)\n"
+        "{\n"
+        "    parse_pool_work((parse_pool_t *) pool);\n"
+        "    return 0;\n"
+        "} /* parse_pool_thread() */\n"
+        "#endif\n\n");
+
+    fprintf(src_file, "static int parse_pool_processors(void)\n"
+        "{\n"
+        "#ifdef WIN32\n"
+        "    SYSTEM_INFO info;\n"
+        "    GetSystemInfo(&info);\n"
+        "    return (int) info.dwNumberOfProcessors;\n"
+        "#else\n"
+        "    long n = sysconf(_SC_NPROCESSORS_ONLN);\n"
+        "    return n > 0 ? (int) n : 1;\n"
+        "#endif\n"
+        "} /* parse_pool_processors() */\n\n");
+
+    fprintf(src_file, "int %ls_parse_many(const %ls_parser_t *parser, %ls_parse_job_t *jobs, int num_jobs, int num_threads)\n"
+        "{\n"
+        "    parse_pool_t pool;\n"
+        "    %ls_parser_t defaults;\n"
+        "    int i, started = 0;\n"
+        "#ifdef WIN32\n"
+        "    HANDLE *threads;\n"
+        "#else\n"
+        "    pthread_t *threads;\n"
+        "#endif\n"
+        "\n"
+        "    if (!parser)\n"
+        "    {\n"
+        "        parser_init(&defaults);\n"
+        "        parser = &defaults;\n"
+        "    }\n"
+        "\n"
+        "    if (num_threads <= 0)\n"
+        "        num_threads = parse_pool_processors();\n"
+        "    if (num_threads > num_jobs)\n"
+        "        num_threads = num_jobs;\n"
+        "\n"
+        "    pool.parser = parser;\n"
+        "    pool.jobs = jobs;\n"
+        "    pool.num_jobs = num_jobs;\n"
+        "    pool.next = 0;\n"
+        "    pool.parsed = 0;\n"
+        "\n"
+        "    /* the calling thread is one of the workers, and does everything if no thread can be started */\n"
+        "    threads = num_threads > 1 ? malloc((num_threads - 1) * sizeof(*threads)) : 0;\n"
+        "\n"
+        "    for (i = 1; i < num_threads; ++i)\n"
+        "    {\n"
+        "#ifdef WIN32\n"
+        "        if ((threads[started] = CreateThread(0, 0, parse_pool_thread, &pool, 0, 0)) != 0)\n"
+        "            ++started;\n"
+        "#else\n"
+        "        if (pthread_create(&threads[started], 0, parse_pool_thread, &pool) == 0)\n"
+        "            ++started;\n"
+        "#endif\n"
+        "    }\n"
+        "\n"
+        "    parse_pool_work(&pool);\n"
+        "\n"
+        "    for (i = 0; i < started; ++i)\n"
+        "    {\n"
+        "#ifdef WIN32\n"
+        "        WaitForSingleObject(threads[i], INFINITE);\n"
+        "        CloseHandle(threads[i]);\n"
+        "#else\n"
+        "        pthread_join(threads[i], 0);\n"
+        "#endif\n"
+        "    }\n"
+        "\n"
+        "    free(threads);\n"
+        "    return (int) pool.parsed;\n"
+        "} /* parse_many() */\n\n", buf, buf, buf, buf);
+} /* print_parser_contexts() */
+
+/** Prints _parser_parse_parallel(), which splits the start rule's top-level repetition between threads. */
+static void print_parallel_parse(const wchar_t *prefix, FILE *src_file, const array_t *rule_records)
+{
+    wchar_t buf[BUF_LEN];
+
+    swprintf(buf, BUF_LEN, L"%ls", prefix);
+    to_lower(buf);
+
+    fprintf(src_file, "/* parallel parse */\n\n");
+
+    if (!find_stream_star(rule_records))
+    {
+        fprintf(src_file, "int %ls_parser_parse_parallel(const %ls_parser_t *parser, char *fname, int num_threads, %ls_syntax_node_t **parse_tree, void **input_buf, void **error_list)\n"
+            "{\n"
+            "    %ls_parser_t defaults;\n"
+            "    input_buffer_t *ib;\n"
+            "\n"
+            "    /* the start rule has no top-level repetition to split */\n"
+            "    (void) num_threads;\n"
+            "\n"
+            "    if (!parser)\n"
+            "    {\n"
+            "        parser_init(&defaults);\n"
+            "        parser = &defaults;\n"
+            "    }\n"
+            "\n"
+            "    if (!(ib = input_buffer_create_mapped(fname)))\n"
+            "        return 0;\n"
+            "\n"
+            "    *input_buf = ib;\n"
+            "    return parse_input_buffer(parser, ib, 0, parse_tree, error_list, 0, 0, 0);\n"
+            "} /* parser_parse_parallel() */\n\n", buf, buf, buf, buf);
+        return;
+    }
+
+    fprintf(src_file, "/* smaller inputs are not worth a thread */\n"
+        "#define PARALLEL_MIN_CHUNK 65536\n\n");
+
+    fprintf(src_file, "int %ls_parser_parse_parallel(const %ls_parser_t *parser, char *fname, int num_threads, %ls_syntax_node_t **parse_tree, void **input_buf, void **error_list)\n"
+        "{\n"
+        "    %ls_parser_t defaults;\n"
+        "    input_buffer_t *ib;\n"
+        "    parallel_parse_t par;\n"
+        "    parallel_chunk_t *chunk;\n"
+        "    int i, len, begin, res;\n"
+        "\n"
+        "    if (!parser)\n"
+        "    {\n"
+        "        parser_init(&defaults);\n"
+        "        parser = &defaults;\n"
+        "    }\n"
+        "\n"
+        "    if (!(ib = input_buffer_create_mapped(fname)))\n"
+        "        return 0;\n"
+        "    *input_buf = ib;\n"
+        "\n"
+        "    len = ib->bytes_read;\n"
+        "    if (num_threads <= 0)\n"
+        "        num_threads = parse_pool_processors();\n"
+        "    if (num_threads > len / PARALLEL_MIN_CHUNK)\n"
+        "        num_threads = len / PARALLEL_MIN_CHUNK;\n"
+        "    if (num_threads < 2)\n"
+        "        return parse_input_buffer(parser, ib, 0, parse_tree, error_list, 0, 0, 0);\n"
+        "\n"
+        "    /* the calling thread parses from the start; each worker starts at the first unindented line */\n"
+        "    /* past an even split, and parses until it has passed the next worker's start */\n"
+        "    par.chunks = (parallel_chunk_t *) calloc(num_threads - 1, sizeof(parallel_chunk_t));\n"
+        "    par.num_chunks = par.joined = par.cur = 0;\n"
+        "\n"
+        "    for (i = 1, begin = 0; i < num_threads; ++i)\n"
+        "    {\n"
+        "        int pos = parallel_next_line(ib, (int) ((double) len * i / num_threads), len);\n"
+        "\n"
+        "        if (pos <= begin || pos >= len)\n"
+        "            continue;\n"
+        "\n"
+        "        chunk = par.chunks + par.num_chunks++;\n"
+        "        chunk->begin = begin = pos;\n"
+        "        chunk->end = len;\n"
+        "        if (par.num_chunks > 1)\n"
+        "            chunk[-1].end = pos;\n"
+        "\n"
+        "        array_init(&chunk->items, sizeof(parallel_item_t), 0);\n"
+        "        array_init(&chunk->children, sizeof(%ls_syntax_node_t *), 0);\n"
+        "        chunk->parser = parser;\n"
+        "        chunk->ib = ib;\n"
+        "    }\n"
+        "\n"
+        "    for (i = 0; i < par.num_chunks; ++i)\n"
+        "        parallel_start(par.chunks + i);\n"
+        "\n"
+        "    res = parse_input_buffer(parser, ib, 0, parse_tree, error_list, 0, 0, &par);\n"
+        "    parallel_finish(&par);\n"
+        "\n"
+        "    /* the errors of a failed parse are the ones the sequential parse reports */\n"
+        "    if (!res)\n"
+        "    {\n"
+        "        %ls_destroy_error_list(*error_list);\n"
+        "        res = parse_input_buffer(parser, ib, 0, parse_tree, error_list, 0, 0, 0);\n"
+        "    }\n"
+        "\n"
+        "    return res;\n"
+        "} /* parser_parse_parallel() */\n\n", buf, buf, buf, buf, buf, buf);
+} /* print_parallel_parse() */
+
+/** Prints the flat tree functions, which need the line index and the parse entry points. */
+static void print_flat_tree(const wchar_t *prefix, FILE *src_file)
+{
+    wchar_t buf[BUF_LEN];
+
+    swprintf(buf, BUF_LEN, L"%ls", prefix);
+    to_lower(buf);
+
+    fprintf(src_file, "/* flat syntax trees */\n\n");
+
+    fprintf(src_file, "%ls_flat_tree_t *%ls_flat_tree_create(void)\n"
+        "{\n"
+        "    return (%ls_flat_tree_t *) calloc(1, sizeof(%ls_flat_tree_t));\n"
+        "} /* flat_tree_create() */\n\n", buf, buf, buf, buf);
+
+    fprintf(src_file, "void %ls_flat_tree_destroy(%ls_flat_tree_t *tree)\n"
+        "{\n"
+        "    if (!tree)\n"
+        "        return;\n"
+        "\n"
+        "    free(tree->nodes);\n"
+        "    free(tree);\n"
+        "} /* flat_tree_destroy() */\n\n", buf, buf);
+
+    fprintf(src_file, "static int flat_tree_add(%ls_flat_tree_t *tree, %ls_syntax_node_t *node)\n"
+        "{\n"
+        "    %ls_flat_node_t *flat;\n"
+        "\n"
+        "    if (tree->num_nodes == tree->cap)\n"
+        "    {\n"
+        "        tree->cap = tree->cap ? tree->cap * 2 : 256;\n"
+        "        tree->nodes = (%ls_flat_node_t *) realloc(tree->nodes, tree->cap * sizeof(%ls_flat_node_t));\n"
+        "    }\n"
+        "\n"
+        "    flat = tree->nodes + tree->num_nodes;\n"
+        "    flat->type = node->type;\n"
+        "    flat->begin = node->begin;\n"
+        "    flat->end = node->end;\n"
+        "    flat->first_child = -1;\n"
+        "    flat->next_sibling = -1;\n"
+        "\n"
+        "    return tree->num_nodes++;\n"
+        "} /* flat_tree_add() */\n\n", buf, buf, buf, buf, buf);
+
+    fprintf(src_file, "typedef struct _flatten_frame_t\n"
+        "{\n"
+        "    %ls_syntax_node_t *node;\n"
+        "    int index;                 /* where node went in the flat tree */\n"
+        "    int next;                  /* next child of node to copy */\n"
+        "    int last;                  /* flat index of the last child copied, or -1 */\n"
+        "}\n"
+        "flatten_frame_t;\n\n", buf);
+
+    fprintf(src_file, "void %ls_flatten(%ls_flat_tree_t *tree, %ls_syntax_node_t *root)\n"
+        "{\n"
+        "    array_t stack;\n"
+        "    flatten_frame_t frame, *top;\n"
+        "\n"
+        "    assert(tree);\n"
+        "\n"
+        "    tree->num_nodes = 0;\n"
+        "    tree->ib = root ? root->ib : 0;\n"
+        "\n"
+        "    if (!root)\n"
+        "        return;\n"
+        "\n"
+        "    /* the stack holds the path from the root, so nodes are copied in pre-order without recursing */\n"
+        "    array_init(&stack, sizeof(flatten_frame_t), 0);\n"
+        "    frame.node = root;\n"
+        "    frame.index = flat_tree_add(tree, root);\n"
+        "    frame.next = 0;\n"
+        "    frame.last = -1;\n"
+        "    array_add(&stack, &frame);\n"
+        "\n"
+        "    while (array_size(&stack))\n"
+        "    {\n"
+        "        top = (flatten_frame_t *) array_item(&stack, array_size(&stack) - 1);\n"
+        "\n"
+        "        if (top->next < top->node->children)\n"
+        "        {\n"
+        "            frame.node = top->node->child[top->next++];\n"
+        "            frame.index = flat_tree_add(tree, frame.node);\n"
+        "            frame.next = 0;\n"
+        "            frame.last = -1;\n"
+        "\n"
+        "            if (top->last < 0)\n"
+        "                tree->nodes[top->index].first_child = frame.index;\n"
+        "            else\n"
+        "                tree->nodes[top->last].next_sibling = frame.index;\n"
+        "\n"
+        "            top->last = frame.index;\n"
+        "            array_add(&stack, &frame);\n"
+        "        }\n"
+        "        else\n"
+        "        {\n"
+        "            stack.num--;\n"
+        "        }\n"
+        "    }\n"
+        "\n"
+        "    array_deinit(&stack);\n"
+        "} /* flatten() */\n\n", buf, buf, buf);
+
+    fprintf(src_file, "int %ls_flat_children(const %ls_flat_tree_t *tree, int node)\n"
+        "{\n"
+        "    int n = 0, cur;\n"
+        "\n"
+        "    for (cur = tree->nodes[node].first_child; cur >= 0; cur = tree->nodes[cur].next_sibling)\n"
+        "        ++n;\n"
+        "\n"
+        "    return n;\n"
+        "} /* flat_children() */\n\n", buf, buf);
+
+    fprintf(src_file, "int %ls_flat_child(const %ls_flat_tree_t *tree, int node, int idx)\n"
+        "{\n"
+        "    int cur;\n"
+        "\n"
+        "    for (cur = tree->nodes[node].first_child; cur >= 0 && idx > 0; cur = tree->nodes[cur].next_sibling)\n"
+        "        --idx;\n"
+        "\n"
+        "    return idx < 0 ? -1 : cur;\n"
+        "} /* flat_child() */\n\n", buf, buf);
+
+    fprintf(src_file, "int %ls_flat_first_line(const %ls_flat_tree_t *tree, int node)\n"
+        "{\n"
+        "    return input_buffer_line((input_buffer_t *) tree->ib, tree->nodes[node].begin);\n"
+        "}\n\n", buf, buf);
+
+    fprintf(src_file, "int %ls_flat_last_line(const %ls_flat_tree_t *tree, int node)\n"
+        "{\n"
+        "    const %ls_flat_node_t *flat = tree->nodes + node;\n"
+        "    return input_buffer_line((input_buffer_t *) tree->ib, flat->begin < flat->end ? flat->end - 1 : flat->begin);\n"
+        "}\n\n", buf, buf, buf);
+
+    fprintf(src_file, "wchar_t *%ls_flat_get_wstr(const %ls_flat_tree_t *tree, int node)\n"
+        "{\n"
+        "    array_t str;\n"
+        "    wchar_t *res;\n"
+        "\n"
+        "    array_init(&str, sizeof(wchar_t), 0);\n"
+        "    input_buffer_read_wstring((input_buffer_t *) tree->ib, tree->nodes[node].begin, tree->nodes[node].end, &str);\n"
+        "    res = wcs_dup(str.data);\n"
+        "    array_deinit(&str);\n"
+        "    return res;\n"
+        "}\n\n", buf, buf);
+
+    fprintf(src_file, "char *%ls_flat_get_str(const %ls_flat_tree_t *tree, int node)\n"
+        "{\n"
+        "    array_t str;\n"
+        "    char *res;\n"
+        "\n"
+        "    array_init(&str, sizeof(char), 0);\n"
+        "    input_buffer_read_string((input_buffer_t *) tree->ib, tree->nodes[node].begin, tree->nodes[node].end, &str);\n"
+        "    res = str_dup(str.data);\n"
+        "    array_deinit(&str);\n"
+        "    return res;\n"
+        "}\n\n", buf, buf);
+
+    fprintf(src_file, "void %ls_flat_traverse_preorder(const %ls_flat_tree_t *tree, int root, void *data, %ls_flat_process_ft entry_func, %ls_flat_process_ft exit_func)\n"
+        "{\n"
+        "    array_t stack;\n"
+        "    int node = root;\n"
+        "\n"
+        "    if (root < 0 || root >= tree->num_nodes)\n"
+        "        return;\n"
+        "\n"
+        "    /* nodes are visited in array order; the stack only remembers which parents still need exit_func */\n"
+        "    array_init(&stack, sizeof(int), 0);\n"
+        "\n"
+        "    for (;;)\n"
+        "    {\n"
+        "        if (entry_func == NULL || !entry_func(tree, node, data))\n"
+        "        {\n"
+        "            if (tree->nodes[node].first_child >= 0)\n"
+        "            {\n"
+        "                array_add(&stack, &node);\n"
+        "                node = tree->nodes[node].first_child;\n"
+        "                continue;\n"
+        "            }\n"
+        "\n"
+        "            if (exit_func != NULL)\n"
+        "                exit_func(tree, node, data);\n"
+        "        }\n"
+        "\n"
+        "        while (node != root && tree->nodes[node].next_sibling < 0)\n"
+        "        {\n"
+        "            node = *(int *) array_item(&stack, array_size(&stack) - 1);\n"
+        "            stack.num--;\n"
+        "            if (exit_func != NULL)\n"
+        "                exit_func(tree, node, data);\n"
+        "        }\n"
+        "\n"
+        "        if (node == root)\n"
+        "            break;\n"
+        "\n"
+        "        node = tree->nodes[node].next_sibling;\n"
+        "    }\n"
+        "\n"
+        "    array_deinit(&stack);\n"
+        "} /* flat_traverse_preorder() */\n\n", buf, buf, buf, buf);
+
+    fprintf(src_file, "int %ls_parse_flat(char *fname, %ls_flat_tree_t *tree, void **input_buf, void **error_list)\n"
+        "{\n"
+        "    %ls_arena_t *arena = %ls_arena_create();\n"
+        "    %ls_syntax_node_t *root = 0;\n"
+        "    %ls_parser_t parser;\n"
+        "    int res;\n"
+        "\n"
+        "    assert(tree);\n"
+        "\n"
+        "    /* the pointer tree only lives until it has been copied, so it comes from an arena */\n"
+        "    parser_init(&parser);\n"
+        "    res = parse_file(&parser, fname, arena, &root, input_buf, error_list);\n"
+        "    %ls_flatten(tree, root);\n"
+        "    %ls_arena_destroy(arena);\n"
+        "\n"
+        "    return res;\n"
+        "}\n\n", buf, buf, buf, buf, buf, buf, buf, buf);
+} /* print_flat_tree() */
+
+static void generate_source(const wchar_t *prefix, const char *header_fname, const char *src_fname, FILE *src_file, 
+                            const array_t *rule_records, input_buffer_t *ib, const array_t *line_endings, 
+                            const array_t *node_type_labels, const array_t *node_function_names, int backend, int optimise)
+{
+    wchar_t buf[BUF_LEN], ubuf[BUF_LEN];
+    time_t cur_time;
+
+    /* timestamp */
+    time(&cur_time);
+    fprintf(src_file, "/*\n * generated %s */\n", ctime(&cur_time));
+    fprintf(src_file, "\n");
 
     /* utility code */
     fprintf(src_file, "#include \"%s\"\n\n", header_fname);
-    fprintf(src_file, "#include <assert.h>\n#include <stdlib.h>\n#include <stdio.h>\n\n#include <malloc.h>\n#include <string.h>\n#include <wchar.h>\n\n");
+    fprintf(src_file, "#include <assert.h>\n#include <limits.h>\n#include <stdlib.h>\n#include <stdio.h>\n\n#include <malloc.h>\n#include <string.h>\n#include <wchar.h>\n\n");
+    fprintf(src_file, "#ifndef WIN32\n#include <fcntl.h>\n#include <pthread.h>\n#include <sys/mman.h>\n#include <sys/stat.h>\n#include <unistd.h>\n#else\n#include <windows.h>\n#endif\n\n");
 
     print_utility_source(prefix, src_file, node_type_labels);
 
     /* function prototypes */
-    print_function_prototypes(prefix, src_file, node_function_names);
+    print_function_prototypes(prefix, src_file, node_function_names, backend);
 
     /* macros */
-    print_macros(prefix, src_file);
+    if (backend == BACKEND_C)
+        print_macros(prefix, src_file);
 
     /* functions */
-    print_function_bodies(prefix, src_file, rule_records, node_type_labels, node_function_names);
+    print_function_bodies(prefix, src_file, rule_records, node_type_labels, node_function_names, backend, optimise);
 
     /* main function */
     swprintf(buf, BUF_LEN, L"%ls", prefix);
     to_lower(buf);
+    wcscpy(ubuf, buf);
+    to_upper(ubuf);
 
     fprintf(src_file,"/* _wish_node is a useful last-ditch grammar debugging tool. \n"
 		    "Set it to the node you expected to be recognized but wasn't. Dumps error list to stdout. */\n"
 		     
 		    "int %ls_wish_node = 32000;\n\n",buf);
+
+    fprintf(src_file, "/* a context for the _parse functions that don't take one */\n"
+        "static void parser_init(%ls_parser_t *parser)\n"
+        "{\n"
+        "    memset(parser, 0, sizeof(%ls_parser_t));\n"
+        "    memcpy(parser->dispatch, %ls_dispatch, sizeof(parser->dispatch));\n"
+        "    parser->wish_node = %ls_wish_node;\n"
+        "} /* parser_init() */\n\n", buf, buf, buf, buf);
+
     fprintf(src_file, "/* main function */\n\n");
 
-    fprintf(src_file, "int %ls_parse(char *fname, %ls_syntax_node_t **parse_tree, void **input_buf, void **error_list)\n"
+    fprintf(src_file, "static int parse_input_buffer(const %ls_parser_t *parser, input_buffer_t *ib, %ls_arena_t *arena, %ls_syntax_node_t **parse_tree, void **error_list, %ls_syntax_node_process_ft stream, void *stream_data, parallel_parse_t *parallel)\n"
         "{\n"
-        "    FILE *f;\n"
-        "    input_buffer_t *ib;\n"
         "    int start_offset, end_offset;\n"
-        "    array_t line_endings;\n"
         "    memo_map_t *map;\n"
         "    %ls_syntax_node_t *root = 0;\n"
         "\n"
-        "    f = fopen(fname, \"r\");\n"
-        "    if (!f) return 0;\n"
-        "\n"
-        "    ib = input_buffer_create(fname, f);\n"
-        "    assert(ib);\n"
-        "    *input_buf = ib;\n"
-        "\n"
-        "    map = memo_map_create();\n"
-        "    *error_list = (array_t *) calloc(sizeof(array_t), 1);\n"
-        "    array_init(*error_list, sizeof(%ls_error_rec_t), 0);\n"
+        "    map = memo_map_create(arena);\n"
+        "    *error_list = %ls_create_error_list();\n"
         "\n"
         "    start_offset = input_buffer_getpos(ib);\n"
+        "    map->stream = stream;\n"
+        "    map->stream_data = stream_data;\n"
+        "    map->parser = parser;\n"
+        "    map->node_ib = ib;\n"
+        "    map->parallel = parallel;\n"
+        "\n"
         "    %ls(ib, start_offset, &end_offset, &root, map, *error_list);\n"
+        "#ifdef %ls_STATS\n"
+        "    ((error_list_t *) *error_list)->stats = map->stats;\n"
+        "#endif\n"
+        "#ifdef %ls_PROFILE\n"
+        "    memcpy(((error_list_t *) *error_list)->profile, map->profile, sizeof(map->profile));\n"
+        "#endif\n"
         "    memo_map_destroy(map);\n"
         "\n"
+        "    /* how far a successful parse looked ahead is not an error */\n"
         "    if (root)\n"
+        "        clear_failure((error_list_t *) *error_list);\n"
+        "\n"
+        "    /* a streamed parse has already handed over everything but the start node */\n"
+        "    if (root && stream && !stream_top_level && stream(root, stream_data))\n"
         "    {\n"
-        "        array_init(&line_endings, sizeof(int), 0);\n"
-        "        find_line_endings(&line_endings, ib, root->begin);\n"
-        "        assign_line_numbers(ib, root, &line_endings);\n"
-        "        array_deinit(&line_endings);\n"
+        "        %ls_syntax_node_destroy(root);\n"
+        "        root = 0;\n"
         "    }\n"
         "\n"
         "    *parse_tree = root;\n"
         "    return root != 0;\n"
-        "}\n\n", buf, buf, buf, buf, *(wchar_t **) array_item(node_function_names, 0));
-        
+        "} /* parse_input_buffer() */\n\n", buf, buf, buf, buf, buf, buf, *(wchar_t **) array_item(node_function_names, 0), ubuf, ubuf, buf);
+
+    fprintf(src_file, "static int parse_file(const %ls_parser_t *parser, char *fname, %ls_arena_t *arena, %ls_syntax_node_t **parse_tree, void **input_buf, void **error_list)\n"
+        "{\n"
+        "    FILE *f;\n"
+        "    input_buffer_t *ib;\n"
+        "\n"
+        "    f = fopen(fname, \"r\");\n"
+        "    if (!f) return 0;\n"
+        "\n"
+        "    ib = input_buffer_create(fname, f);\n"
+        "    assert(ib);\n"
+        "    *input_buf = ib;\n"
+        "\n"
+        "    return parse_input_buffer(parser, ib, arena, parse_tree, error_list, 0, 0, 0);\n"
+        "} /* parse_file() */\n\n", buf, buf, buf);
+
+    fprintf(src_file, "static int parse_mapped(const %ls_parser_t *parser, char *fname, %ls_arena_t *arena, %ls_syntax_node_t **parse_tree, void **input_buf, void **error_list)\n"
+        "{\n"
+        "    input_buffer_t *ib;\n"
+        "\n"
+        "    if (!(ib = input_buffer_create_mapped(fname)))\n"
+        "        return 0;\n"
+        "\n"
+        "    *input_buf = ib;\n"
+        "    return parse_input_buffer(parser, ib, arena, parse_tree, error_list, 0, 0, 0);\n"
+        "} /* parse_mapped() */\n\n", buf, buf, buf);
+
+    fprintf(src_file, "static int parse_mem(const %ls_parser_t *parser, const char *data, size_t len, %ls_arena_t *arena, %ls_syntax_node_t **parse_tree, void **input_buf, void **error_list)\n"
+        "{\n"
+        "    input_buffer_t *ib;\n"
+        "\n"
+        "    if (!(ib = input_buffer_create_mem(\"<memory>\", data, len)))\n"
+        "        return 0;\n"
+        "\n"
+        "    *input_buf = ib;\n"
+        "    return parse_input_buffer(parser, ib, arena, parse_tree, error_list, 0, 0, 0);\n"
+        "} /* parse_mem() */\n\n", buf, buf, buf);
+
+    fprintf(src_file, "int %ls_parse(char *fname, %ls_syntax_node_t **parse_tree, void **input_buf, void **error_list)\n"
+        "{\n"
+        "    %ls_parser_t parser;\n"
+        "\n"
+        "    parser_init(&parser);\n"
+        "    return parse_file(&parser, fname, 0, parse_tree, input_buf, error_list);\n"
+        "}\n\n", buf, buf, buf);
+
+    fprintf(src_file, "int %ls_parse_arena(char *fname, %ls_arena_t *arena, %ls_syntax_node_t **parse_tree, void **input_buf, void **error_list)\n"
+        "{\n"
+        "    %ls_parser_t parser;\n"
+        "\n"
+        "    assert(arena);\n"
+        "    parser_init(&parser);\n"
+        "    return parse_file(&parser, fname, arena, parse_tree, input_buf, error_list);\n"
+        "}\n\n", buf, buf, buf, buf);
+
+    fprintf(src_file, "int %ls_parse_mmap(char *fname, %ls_arena_t *arena, %ls_syntax_node_t **parse_tree, void **input_buf, void **error_list)\n"
+        "{\n"
+        "    %ls_parser_t parser;\n"
+        "\n"
+        "    parser_init(&parser);\n"
+        "    return parse_mapped(&parser, fname, arena, parse_tree, input_buf, error_list);\n"
+        "}\n\n", buf, buf, buf, buf);
+
+    fprintf(src_file, "int %ls_parse_mem(const char *data, size_t len, %ls_arena_t *arena, %ls_syntax_node_t **parse_tree, void **input_buf, void **error_list)\n"
+        "{\n"
+        "    %ls_parser_t parser;\n"
+        "\n"
+        "    parser_init(&parser);\n"
+        "    return parse_mem(&parser, data, len, arena, parse_tree, input_buf, error_list);\n"
+        "}\n\n", buf, buf, buf, buf);
+
+    fprintf(src_file, "int %ls_parse_stream(char *fname, %ls_syntax_node_process_ft callback, void *data, void **input_buf, void **error_list)\n"
+        "{\n"
+        "    FILE *f;\n"
+        "    input_buffer_t *ib;\n"
+        "    %ls_syntax_node_t *root;\n"
+        "    %ls_parser_t parser;\n"
+        "    int res;\n"
+        "\n"
+        "    assert(callback);\n"
+        "\n"
+        "    f = fopen(fname, \"r\");\n"
+        "    if (!f) return 0;\n"
+        "\n"
+        "    ib = input_buffer_create(fname, f);\n"
+        "    assert(ib);\n"
+        "    *input_buf = ib;\n"
+        "\n"
+        "    /* heap nodes, so that each subtree is freed as soon as the callback returns */\n"
+        "    parser_init(&parser);\n"
+        "    res = parse_input_buffer(&parser, ib, 0, &root, error_list, callback, data, 0);\n"
+        "    if (root)\n"
+        "        %ls_syntax_node_destroy(root);\n"
+        "\n"
+        "    return res;\n"
+        "}\n\n", buf, buf, buf, buf, buf);
+
+    print_parser_contexts(prefix, src_file);
+    print_parallel_parse(prefix, src_file, rule_records);
+    print_flat_tree(prefix, src_file);
 } /* generate_source() */
 
 /*************************************************/
@@ -1431,7 +5452,7 @@ void generate_c_parser(const wchar_t *prefix,
                        const char *header_fname, FILE *header_file, 
                        const char *src_fname, FILE *src_file, 
                        array_t *rule_records, input_buffer_t *ib, 
-                       array_t *line_endings)
+                       array_t *line_endings, int backend, int optimise)
 {
     array_t node_type_labels;    /* wchar_t * */
     array_t node_function_names; /* wchar_t * */
@@ -1451,7 +5472,7 @@ void generate_c_parser(const wchar_t *prefix,
     generate_header(prefix, header_fname, header_file, &node_type_labels);
 
     /* assemble rule code */
-    generate_source(prefix, header_fname, src_fname, src_file, rule_records, ib, line_endings, &node_type_labels, &node_function_names);
+    generate_source(prefix, header_fname, src_fname, src_file, rule_records, ib, line_endings, &node_type_labels, &node_function_names, backend, optimise);
 
     /* clean up */
     len = array_size(&node_type_labels);
@@ -40,7 +40,14 @@
 extern "C" {
 #endif
 
-    void generate_c_parser(const wchar_t *prefix, const char *header_fname, FILE *header_file, const char *src_fname, FILE *src_file, array_t *rule_records, input_buffer_t *ib, array_t *line_endings);
+    /** How the generated parser runs its rules. */
+    enum parser_backend_et
+    {
+        BACKEND_C  = 0,     /* a C function per rule, built from the parsing macros */
+        BACKEND_VM = 1      /* bytecode run by one interpreter */
+    };
+
+    void generate_c_parser(const wchar_t *prefix, const char *header_fname, FILE *header_file, const char *src_fname, FILE *src_file, array_t *rule_records, input_buffer_t *ib, array_t *line_endings, int backend, int optimise);
 
 #ifdef __cplusplus
 } // extern "C"
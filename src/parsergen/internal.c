@@ -184,6 +184,22 @@ static void collect_rule_name(rule_rec_t *rec, syntax_node_t *node, input_buffer
                 break;
             }
         }
+
+        for (i = 0; i < len; ++i)
+        {
+            syntax_node_t *child = node->children[i];
+            if (child->type == PEG_MEMO_NODE)
+            {
+                wchar_t *str = get_string_without_spacing(child, ib);
+                if (wcscmp(str, L"@token") == 0)
+                    rec->token = 1;
+                else
+                    rec->memo = wcscmp(str, L"@nomemo") == 0 ? RULE_MEMO_OFF : RULE_MEMO_ON;
+                free(str);
+
+                break;
+            }
+        }
     }
 } /* collect_rule_name() */
 
@@ -204,6 +220,7 @@ static rule_exp_t *collect_rule_children(syntax_node_t **children, int exp_type,
         {
             *cur = (rule_exp_t *) calloc(1, sizeof(rule_exp_t));
             (*cur)->type = exp_type;
+            (*cur)->pos = (*child)->begin;
             (*cur)->left = collect_rule_exp(*child, context);
             cur = &(*cur)->right;
         }
@@ -242,6 +259,7 @@ static rule_exp_t *collect_prefix_exp(syntax_node_t **children, rule_context *co
         {
             rule_exp_t *exp = (rule_exp_t *) calloc(1, sizeof(rule_exp_t));
             exp->type = rule_type;
+            exp->pos = pref->begin;
             exp->left = collect_rule_exp(children[1], context);
             return exp;
         }
@@ -284,6 +302,7 @@ static rule_exp_t *collect_suffix_exp(syntax_node_t **children, rule_context *co
         {
             rule_exp_t *exp = (rule_exp_t *) calloc(1, sizeof(rule_exp_t));
             exp->type = rule_type;
+            exp->pos = children[0]->begin;
             exp->left = collect_rule_exp(children[0], context);
             return exp;
         }
@@ -307,6 +326,7 @@ static rule_exp_t *collect_rule_call_exp(syntax_node_t *node, rule_context *cont
     /* initialize exp */
     exp = (rule_exp_t *) calloc(1, sizeof(rule_exp_t));
     exp->type = RULE_EXP_CALL;
+    exp->pos = node->begin;
 
     /* get name */
     exp->data.str = get_string_without_spacing(node, context->ib);
@@ -421,6 +441,7 @@ static rule_exp_t *collect_string_exp(syntax_node_t *node, rule_context *context
     /* initialize exp */
     exp = (rule_exp_t *) calloc(1, sizeof(rule_exp_t));
     exp->type = RULE_EXP_STR;
+    exp->pos = node->begin;
 
     /* get string */
     str = get_string_without_spacing(node, context->ib);
@@ -459,6 +480,7 @@ static rule_exp_t *collect_class_exp(syntax_node_t *node, rule_context *context)
     /* initialize exp */
     exp = (rule_exp_t *) calloc(1, sizeof(rule_exp_t));
     exp->type = RULE_EXP_CLASS;
+    exp->pos = node->begin;
 
     array_init(&cc, sizeof(wchar_t), 0);
 
@@ -556,6 +578,12 @@ static rule_exp_t *collect_term_exp(syntax_node_t **children, rule_context *cont
         case PEG_DOT_NODE:
             res = (rule_exp_t *) calloc(1, sizeof(rule_exp_t));
             res->type = RULE_EXP_DOT;
+            res->pos = node->begin;
+            break;
+        case PEG_CUT_NODE:
+            res = (rule_exp_t *) calloc(1, sizeof(rule_exp_t));
+            res->type = RULE_EXP_CUT;
+            res->pos = node->begin;
             break;
         case PEG_DISJ_NODE:
             res = collect_rule_exp(node, context);
@@ -573,6 +601,7 @@ static rule_exp_t *collect_term_exp(syntax_node_t **children, rule_context *cont
     {
         rule_exp_t *next = (rule_exp_t *) calloc(1, sizeof(rule_exp_t));
         next->type = RULE_EXP_HIDE;
+        next->pos = res->pos;
         next->left = res;
 
         res = next;
@@ -638,7 +667,7 @@ static int collect_rule_data(syntax_node_t *node, void *data)
         /* add to the list of rules */
         array_add(context->rule_records, &rec);
 
-        return 1;
+        return SYNTAX_NODE_SKIP_SUBTREE;
     }
     else
     {
@@ -649,7 +678,7 @@ static int collect_rule_data(syntax_node_t *node, void *data)
 
 /*************************************************/
 
-static void cleanup_rule_exp(rule_exp_t *exp)
+void cleanup_rule_exp(rule_exp_t *exp)
 {
     assert(exp);
 
@@ -670,6 +699,32 @@ static void cleanup_rule_exp(rule_exp_t *exp)
 } /* cleanup_rule_exp() */
 
 
+rule_exp_t *copy_rule_exp(const rule_exp_t *exp)
+{
+    rule_exp_t *copy;
+
+    if (!exp)
+        return 0;
+
+    copy = (rule_exp_t *) calloc(1, sizeof(rule_exp_t));
+    copy->type = exp->type;
+    copy->pos = exp->pos;
+
+    switch (exp->type)
+    {
+    case RULE_EXP_CALL:
+    case RULE_EXP_STR:
+    case RULE_EXP_CLASS:
+        copy->data.str = wcsdup(exp->data.str);
+        break;
+    }
+
+    copy->left = copy_rule_exp(exp->left);
+    copy->right = copy_rule_exp(exp->right);
+    return copy;
+} /* copy_rule_exp() */
+
+
 void cleanup_rule(rule_rec_t *rec)
 {
     assert(rec);
@@ -783,6 +838,9 @@ static void print_rule_exp(rule_exp_t *exp)
     case RULE_EXP_DOT:
         fprintf(stdout, "DOT");
         break;
+    case RULE_EXP_CUT:
+        fprintf(stdout, "CUT");
+        break;
     case RULE_EXP_CLASS:
         fprintf(stdout, "C([%ls])", exp->data.str);
         break;
@@ -831,6 +889,7 @@ void get_internal_representation(syntax_node_t **parsed_spec, input_buffer_t *ib
 
         /* error check */
         resolve_rule_calls(rule_records, &rule_calls, errors);
+        check_token_rules(rule_records, errors);
 
         /* clean up */
         array_deinit(&rule_calls);
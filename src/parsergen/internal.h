@@ -54,14 +54,16 @@ extern "C" {
         RULE_EXP_DOT   = 10,
         RULE_EXP_CLASS = 11,
         RULE_EXP_HIDE  = 12,
+        RULE_EXP_CUT   = 13,
 
-        NUM_RULE_EXP   = 13
+        NUM_RULE_EXP   = 14
     };
 
     typedef struct _rule_exp_t
     {
         int type;
         struct _rule_exp_t *left, *right;
+        int pos;                /* where the expression starts in the grammar file */
 
         union 
         {
@@ -72,6 +74,20 @@ extern "C" {
     }
     rule_exp_t;
 
+    enum rule_memo_et
+    {
+        RULE_MEMO_AUTO = 0,     /* decided by analyse_memoization() */
+        RULE_MEMO_ON   = 1,     /* forced on by @memo */
+        RULE_MEMO_OFF  = 2      /* forced off by @nomemo */
+    };
+
+    enum rule_lr_et
+    {
+        RULE_LR_NONE     = 0,
+        RULE_LR_LEADER   = 1,   /* left-recursive: grows a seed in its memo record */
+        RULE_LR_INVOLVED = 2    /* in the left recursion of a leader, so never memoized */
+    };
+
     /** 
     * Contains data for a rule in a grammar file.
     */
@@ -82,6 +98,12 @@ extern "C" {
         syntax_node_t *node;
 
         rule_exp_t *rule_spec;
+
+        int memo;               /* one of rule_memo_et */
+        int memoized;           /* whether the generated parser memoizes this rule */
+        int token;              /* set by @token: matched by the scanner, as a leaf */
+        int left_recursion;     /* one of rule_lr_et, set by check_grammar() */
+        int lr_head;            /* for a leader: the index of the first leader on its cycle */
     }
     rule_rec_t;
 
@@ -93,6 +115,70 @@ extern "C" {
 
     void cleanup_rule(rule_rec_t *rec);
 
+    void cleanup_rule_exp(rule_exp_t *exp);
+
+    rule_exp_t *copy_rule_exp(const rule_exp_t *exp);
+
+    /*************************************************/
+
+    void analyse_memoization(array_t *rule_records);
+
+    void print_memo_report(array_t *rule_records);
+
+    /**
+    * Reports what would keep a parser for the rules from finishing: repetitions of something
+    * that can match the empty string, left recursion that cannot grow a seed, and rules kept
+    * out of the memo that backtracking re-parses at every level of their recursion.
+    * Alternatives that can never match are reported to WARNINGS, which may be null.  Marks
+    * the rules that grow seeds and the rules in their left recursion.
+    */
+    void check_grammar(array_t *rule_records, array_t *errors, array_t *warnings);
+
+    /*************************************************/
+
+    /** Counts the rewrites optimise_rules() made. */
+    typedef struct _optimise_stats_t
+    {
+        int flattened;          /* nested sequences, choices and hides straightened out */
+        int inlined;            /* calls replaced by the called rule's body */
+        int merged;             /* single-byte alternatives folded into a class */
+        int factored;           /* alternatives whose common first element was pulled out */
+    }
+    optimise_stats_t;
+
+    void optimise_rules(array_t *rule_records, optimise_stats_t *stats);
+
+    void print_optimise_report(const optimise_stats_t *stats);
+
+    /*************************************************/
+
+    /**
+    * The token rules as one DFA over classes of bytes.  Run from an offset, it gives the
+    * longest match of every token rule there at once.
+    */
+    typedef struct _scanner_t
+    {
+        int num_tokens;
+        int *token_types;       /* per token: its node type */
+
+        int num_classes;
+        unsigned char byte_class[256];
+
+        int num_states;         /* state 0 is dead and state 1 the start */
+        int *next;              /* num_states * num_classes: the state after a byte of each class */
+        int *accept_begin;      /* num_states + 1: where each state's tokens start in accepts */
+        int num_accepts;
+        int *accepts;           /* the tokens, as indices into token_types, matched on reaching a state */
+    }
+    scanner_t;
+
+    /** Reports token rules that are recursive, use lookaheads or cuts, or can match nothing. */
+    void check_token_rules(array_t *rule_records, array_t *errors);
+
+    void scanner_build(const array_t *rule_records, scanner_t *scanner);
+
+    void scanner_deinit(scanner_t *scanner);
+
     /*************************************************/
 
 #ifdef __cplusplus
@@ -0,0 +1,545 @@
+/*
+ * Copyright (c) 2006, The Narwhal Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    * Neither the name of the Narwhal Project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <assert.h>
+#include "internal.h"
+
+/*************************************************/
+
+/* the largest rule body, in expression nodes, that is inlined */
+#define INLINE_MAX_SIZE 8
+
+/**
+ * Stores what the rewrites need to know about the rules.
+ * Every rule still builds its node, records its failure and runs its dispatch function, so a call
+ * can only be replaced by the rule's body where none of those can be seen.
+ */
+typedef struct _optimise_context
+{
+    array_t *rule_records;  /* array of rule_rec_t * */
+    int num_rules;
+
+    char *never_fails;      /* the rule succeeds at any offset, so it never records a failure */
+
+    optimise_stats_t *stats;
+}
+optimise_context;
+
+/*************************************************/
+
+static rule_exp_t *exp_create(int type, rule_exp_t *left, rule_exp_t *right)
+{
+    rule_exp_t *exp = (rule_exp_t *) calloc(1, sizeof(rule_exp_t));
+    exp->type = type;
+    exp->left = left;
+    exp->right = right;
+    exp->pos = left ? left->pos : 0;
+    return exp;
+} /* exp_create() */
+
+
+static int rule_index(optimise_context *context, const wchar_t *name)
+{
+    int i;
+
+    for (i = 0; i < context->num_rules; ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(context->rule_records, i);
+        if (wcscmp(rec->rule_name, name) == 0)
+            return i;
+    }
+
+    return -1;
+} /* rule_index() */
+
+
+static int exp_equal(const rule_exp_t *a, const rule_exp_t *b)
+{
+    if (!a || !b)
+        return a == b;
+
+    if (a->type != b->type)
+        return 0;
+
+    switch (a->type)
+    {
+    case RULE_EXP_CALL:
+    case RULE_EXP_STR:
+    case RULE_EXP_CLASS:
+        if (wcscmp(a->data.str, b->data.str) != 0)
+            return 0;
+        break;
+    }
+
+    return exp_equal(a->left, b->left) && exp_equal(a->right, b->right);
+} /* exp_equal() */
+
+
+static int exp_size(const rule_exp_t *exp)
+{
+    return exp ? 1 + exp_size(exp->left) + exp_size(exp->right) : 0;
+} /* exp_size() */
+
+
+/**
+ * Whether EXP has a cut that commits the choice EXP itself is part of, rather than one of its own.
+ * Choices, repetitions and lookaheads keep the cuts inside them, and a rule's cuts stay in the rule.
+ */
+static int exp_has_cut(const rule_exp_t *exp)
+{
+    switch (exp->type)
+    {
+    case RULE_EXP_CUT:
+        return 1;
+    case RULE_EXP_SEQ:
+        return exp_has_cut(exp->left) || exp_has_cut(exp->right);
+    case RULE_EXP_HIDE:
+        return exp_has_cut(exp->left);
+    }
+
+    return 0;
+} /* exp_has_cut() */
+
+
+static int exp_never_fails(optimise_context *context, const rule_exp_t *exp)
+{
+    int i;
+
+    switch (exp->type)
+    {
+    case RULE_EXP_SEQ:
+        return exp_never_fails(context, exp->left) && exp_never_fails(context, exp->right);
+    case RULE_EXP_DISJ:
+        return exp_never_fails(context, exp->left) || exp_never_fails(context, exp->right);
+    case RULE_EXP_STAR:
+    case RULE_EXP_QUES:
+        /* a cut followed by a failure fails the repetition */
+        return !exp_has_cut(exp->left);
+    case RULE_EXP_AMP:
+    case RULE_EXP_HIDE:
+        return exp_never_fails(context, exp->left);
+    case RULE_EXP_CALL:
+        i = rule_index(context, exp->data.str);
+        return i >= 0 && context->never_fails[i];
+    case RULE_EXP_STR:
+        return exp->data.str[0] == 0;
+    case RULE_EXP_CUT:
+        return 1;
+    }
+
+    return 0;
+} /* exp_never_fails() */
+
+/*************************************************/
+
+/**
+ * Rewrites sequences and choices nested on the left, as parentheses leave them, into the
+ * right-nested chains the other rewrites and the generator walk.  A choice is only moved when
+ * it has no cut that would commit it alone, and nested hides collapse into one.
+ */
+static void flatten_exp(optimise_context *context, rule_exp_t *exp)
+{
+    rule_exp_t *inner;
+
+    if (!exp)
+        return;
+
+    while ((exp->type == RULE_EXP_SEQ || exp->type == RULE_EXP_DISJ) && exp->left->type == exp->type
+        && (exp->type == RULE_EXP_SEQ || (!exp_has_cut(exp->left->left) && !exp_has_cut(exp->left->right))))
+    {
+        /* (A B) C becomes A (B C), reusing the inner node */
+        inner = exp->left;
+        exp->left = inner->left;
+        inner->left = inner->right;
+        inner->right = exp->right;
+        exp->right = inner;
+        context->stats->flattened++;
+    }
+
+    while (exp->type == RULE_EXP_HIDE && exp->left->type == RULE_EXP_HIDE)
+    {
+        inner = exp->left;
+        exp->left = inner->left;
+        free(inner);
+        context->stats->flattened++;
+    }
+
+    flatten_exp(context, exp->left);
+    flatten_exp(context, exp->right);
+} /* flatten_exp() */
+
+/*************************************************/
+
+/**
+ * Replaces calls whose node and failure nobody sees with a copy of the called rule's body.
+ * Under a hide the node is thrown away, so rules that never fail qualify; under a negative
+ * lookahead failures are not recorded either, so any small rule does.  The copy is not
+ * looked into again, so recursive rules stay finite.
+ */
+static void inline_exp(optimise_context *context, rule_exp_t *exp, int hidden, int lookahead)
+{
+    const rule_rec_t *target;
+    rule_exp_t *copy;
+    int i;
+
+    if (!exp)
+        return;
+
+    switch (exp->type)
+    {
+    case RULE_EXP_HIDE:
+        hidden = 1;
+        break;
+    case RULE_EXP_BANG:
+        hidden = lookahead = 1;
+        break;
+    case RULE_EXP_CALL:
+        if (!hidden || (i = rule_index(context, exp->data.str)) < 0)
+            return;
+
+        target = *(rule_rec_t **) array_item(context->rule_records, i);
+
+        /* token rules are left to the scanner, and left recursion to the rules that grow seeds */
+        if (!target->rule_spec || target->token || target->left_recursion || exp_size(target->rule_spec) > INLINE_MAX_SIZE
+            || exp_has_cut(target->rule_spec))
+            return;
+        if (!lookahead && !context->never_fails[i])
+            return;
+
+        copy = copy_rule_exp(target->rule_spec);
+        free(exp->data.str);
+        *exp = *copy;
+        free(copy);
+
+        context->stats->inlined++;
+        return;
+    }
+
+    inline_exp(context, exp->left, hidden, lookahead);
+    inline_exp(context, exp->right, hidden, lookahead);
+} /* inline_exp() */
+
+/*************************************************/
+
+static int single_byte(const rule_exp_t *exp)
+{
+    const wchar_t *ch;
+
+    if (exp->type == RULE_EXP_STR && wcslen(exp->data.str) != 1)
+        return 0;
+    if (exp->type != RULE_EXP_STR && exp->type != RULE_EXP_CLASS)
+        return 0;
+
+    /* wider classes are matched on decoded characters rather than bytes */
+    for (ch = exp->data.str; *ch; ++ch)
+        if (*ch > 255)
+            return 0;
+
+    return 1;
+} /* single_byte() */
+
+
+static void add_class_members(array_t *members, const wchar_t *str)
+{
+    int i, len;
+
+    for (; *str; ++str)
+    {
+        len = array_size(members);
+        for (i = 0; i < len && *(wchar_t *) array_item(members, i) != *str; ++i)
+            ;
+
+        if (i == len)
+            array_add(members, (void *) str);
+    }
+} /* add_class_members() */
+
+
+/* moves the alternatives of the choice EXP into ALTS, releasing the choice nodes */
+static void split_choice(rule_exp_t *exp, array_t *alts)
+{
+    rule_exp_t *next;
+
+    while (exp->type == RULE_EXP_DISJ)
+    {
+        array_add(alts, &exp->left);
+        next = exp->right;
+        free(exp);
+        exp = next;
+    }
+
+    array_add(alts, &exp);
+} /* split_choice() */
+
+
+/* chains ALTS back into a choice; a single alternative stands alone */
+static rule_exp_t *join_choice(array_t *alts)
+{
+    int i = array_size(alts) - 1;
+    rule_exp_t *exp = *(rule_exp_t **) array_item(alts, i);
+
+    while (--i >= 0)
+        exp = exp_create(RULE_EXP_DISJ, *(rule_exp_t **) array_item(alts, i), exp);
+
+    return exp;
+} /* join_choice() */
+
+
+/**
+ * Merges neighbouring alternatives that each match one byte from a set into one class.
+ * Since each consumes exactly one byte, trying them in turn matches what the union matches.
+ */
+static void merge_exp(optimise_context *context, rule_exp_t **slot)
+{
+    rule_exp_t *exp = *slot, *alt, *prev;
+    array_t alts, merged, members;
+    wchar_t zero = 0;
+    int i, len;
+
+    if (!exp)
+        return;
+
+    if (exp->type != RULE_EXP_DISJ)
+    {
+        merge_exp(context, &exp->left);
+        merge_exp(context, &exp->right);
+        return;
+    }
+
+    array_init(&alts, sizeof(rule_exp_t *), 0);
+    array_init(&merged, sizeof(rule_exp_t *), 0);
+    split_choice(exp, &alts);
+
+    len = array_size(&alts);
+    for (i = 0; i < len; ++i)
+    {
+        alt = *(rule_exp_t **) array_item(&alts, i);
+        prev = array_size(&merged) ? *(rule_exp_t **) array_item(&merged, array_size(&merged) - 1) : 0;
+
+        if (prev && single_byte(prev) && single_byte(alt))
+        {
+            array_init(&members, sizeof(wchar_t), 0);
+            add_class_members(&members, prev->data.str);
+            add_class_members(&members, alt->data.str);
+            array_add(&members, &zero);
+
+            free(prev->data.str);
+            prev->type = RULE_EXP_CLASS;
+            prev->data.str = wcsdup((wchar_t *) members.data);
+            array_deinit(&members);
+
+            cleanup_rule_exp(alt);
+            context->stats->merged++;
+            continue;
+        }
+
+        merge_exp(context, &alt);
+        array_add(&merged, &alt);
+    }
+
+    *slot = join_choice(&merged);
+
+    array_deinit(&alts);
+    array_deinit(&merged);
+} /* merge_exp() */
+
+/*************************************************/
+
+static rule_exp_t *exp_head(rule_exp_t *exp)
+{
+    return exp->type == RULE_EXP_SEQ ? exp->left : exp;
+} /* exp_head() */
+
+
+/**
+ * Pulls the element that neighbouring alternatives start with out of them, so that it is
+ * parsed once:  A B / A C / D becomes A (B / C) / D, and A B / A becomes A B?.  Parsing is
+ * deterministic, so reparsing A could only have found the same match and failures again.  An
+ * alternative after one that is all prefix could never be reached, and is dropped.
+ * Alternatives with a cut are left alone, since the cut would then commit the inner choice.
+ */
+static void factor_exp(optimise_context *context, rule_exp_t **slot)
+{
+    rule_exp_t *exp = *slot, *alt, *head, *inner;
+    array_t alts, factored, rests;
+    int i, j, m, len, optional;
+
+    if (!exp)
+        return;
+
+    if (exp->type != RULE_EXP_DISJ)
+    {
+        factor_exp(context, &exp->left);
+        factor_exp(context, &exp->right);
+        return;
+    }
+
+    array_init(&alts, sizeof(rule_exp_t *), 0);
+    array_init(&factored, sizeof(rule_exp_t *), 0);
+    split_choice(exp, &alts);
+
+    len = array_size(&alts);
+    for (i = 0; i < len; ++i)
+        factor_exp(context, (rule_exp_t **) array_item(&alts, i));
+
+    for (i = 0; i < len; i = j)
+    {
+        alt = *(rule_exp_t **) array_item(&alts, i);
+        head = exp_head(alt);
+
+        for (j = i + 1; j < len && !exp_has_cut(alt); ++j)
+        {
+            rule_exp_t *next = *(rule_exp_t **) array_item(&alts, j);
+
+            if (exp_has_cut(next) || !exp_equal(head, exp_head(next)))
+                break;
+        }
+
+        if (j == i + 1)
+        {
+            array_add(&factored, &alt);
+            continue;
+        }
+
+        /* the rests of alternatives i to j-1, up to the first that is empty */
+        array_init(&rests, sizeof(rule_exp_t *), 0);
+        optional = 0;
+
+        for (m = i; m < j; ++m)
+        {
+            rule_exp_t *cur = *(rule_exp_t **) array_item(&alts, m), *rest = 0;
+
+            if (cur->type == RULE_EXP_SEQ)
+            {
+                rest = cur->right;
+                if (m > i)
+                    cleanup_rule_exp(cur->left);
+                free(cur);
+            }
+            else if (m > i)
+            {
+                cleanup_rule_exp(cur);
+            }
+
+            if (optional)
+            {
+                if (rest)
+                    cleanup_rule_exp(rest);
+            }
+            else if (rest)
+            {
+                array_add(&rests, &rest);
+            }
+            else
+            {
+                optional = 1;
+            }
+        }
+
+        if (array_size(&rests))
+        {
+            inner = join_choice(&rests);
+            factor_exp(context, &inner);
+
+            if (optional)
+                inner = exp_create(RULE_EXP_QUES, inner, 0);
+
+            head = exp_create(RULE_EXP_SEQ, head, inner);
+        }
+
+        array_add(&factored, &head);
+        array_deinit(&rests);
+        context->stats->factored += j - i - 1;
+    }
+
+    *slot = join_choice(&factored);
+
+    array_deinit(&alts);
+    array_deinit(&factored);
+} /* factor_exp() */
+
+/*************************************************/
+
+void optimise_rules(array_t *rule_records, optimise_stats_t *stats)
+{
+    optimise_context context;
+    int i, changed;
+
+    memset(stats, 0, sizeof(optimise_stats_t));
+
+    context.rule_records = rule_records;
+    context.num_rules = array_size(rule_records);
+    context.never_fails = (char *) calloc(context.num_rules + 1, 1);
+    context.stats = stats;
+
+    /* rules that cannot fail, to a fixed point */
+    do
+    {
+        changed = 0;
+
+        for (i = 0; i < context.num_rules; ++i)
+        {
+            rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+
+            if (rec->rule_spec && !context.never_fails[i] && exp_never_fails(&context, rec->rule_spec))
+                changed = context.never_fails[i] = 1;
+        }
+    }
+    while (changed);
+
+    for (i = 0; i < context.num_rules; ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+
+        if (!rec->rule_spec)
+            continue;
+
+        flatten_exp(&context, rec->rule_spec);
+        inline_exp(&context, rec->rule_spec, 0, 0);
+        flatten_exp(&context, rec->rule_spec);
+        merge_exp(&context, &rec->rule_spec);
+        factor_exp(&context, &rec->rule_spec);
+        merge_exp(&context, &rec->rule_spec);
+    }
+
+    free(context.never_fails);
+} /* optimise_rules() */
+
+
+void print_optimise_report(const optimise_stats_t *stats)
+{
+    fprintf(stdout, "optimised rules: %d flattened, %d inlined, %d merged, %d factored\n",
+        stats->flattened, stats->inlined, stats->merged, stats->factored);
+} /* print_optimise_report() */
@@ -44,82 +44,6 @@
 #include <wchar.h>
 #include <errno.h>
 
-/** \name Syntax Node Functions */
-/*@{*/
-
-syntax_node_t *syntax_node_create(const int type, const int begin, const int end)
-{
-    syntax_node_t *res = (syntax_node_t *) calloc(1, sizeof(syntax_node_t));
-    res->type  = type;
-    res->begin = begin;
-    res->end   = end;
-    res->first_line = -1;
-    res->last_line  = -1;
-    res->children = 0;
-    return res;
-} /* syntax_node_create() */
-
-syntax_node_t *syntax_node_copy(const syntax_node_t *node)
-{
-    syntax_node_t *copy = 0, **cur;
-    int i, len;
-
-    if (node)
-    {
-        copy = syntax_node_create(node->type, node->begin, node->end);
-        copy->begin = node->begin;
-        copy->end = node->end;
-        copy->first_line = node->first_line;
-        copy->last_line = node->last_line;
-
-        len = 0;
-        if (node->children)
-            for (cur = node->children; *cur; ++cur)
-                ++len;
-
-        if (len)
-        {
-            copy->children = (syntax_node_t **) calloc(len+1, sizeof(syntax_node_t *));
-
-            for (i = 0; i < len; ++i)
-                copy->children[i] = syntax_node_copy(node->children[i]);
-        }
-    }
-
-    return copy;
-} /* syntax_node_copy() */
-
-void syntax_node_destroy(syntax_node_t *node)
-{
-    syntax_node_t **cur;
-
-    assert(node);
-
-    if (node->children)
-        for (cur = node->children; *cur; ++cur)
-            syntax_node_destroy(*cur);
-
-    free(node);
-} /* syntax_node_destroy() */
-
-
-void syntax_node_traverse_inorder(syntax_node_t *root, void *data, syntax_node_process_ft process)
-{
-    if (root)
-    {
-        syntax_node_t **cur;
-
-        if (process(root, data))
-            return;
-
-        if (root->children)
-            for (cur = root->children; *cur; ++cur)
-                syntax_node_traverse_inorder(*cur, data, process);
-    }
-} /* syntax_node_traverse_inorder() */
-
-/*@}*/
-
 /*************************************************/
 
 /* \name Utilities for assigning line numbers to syntax tree nodes. */
@@ -155,27 +79,7 @@ static void assign_line_numbers(input_buffer_t *ib, syntax_node_t *node, array_t
 /** \name Error handling functions. */
 /*@{*/
 
-void add_error(array_t *errs, const int pos, const wchar_t *str)
-{
-    error_rec rec;
-    rec.pos = pos;
-    rec.str = wcsdup(str);
-
-    array_add(errs, &rec);
-} /* add_error() */
-
-void delete_errors(array_t *errors, const int start_index)
-{
-    int i, len = array_size(errors);
-    for (i = start_index; i < len; ++i)
-    {
-        error_rec *rec = (error_rec *) array_item(errors, i);
-        free(rec->str);
-    }
-    errors->num = start_index;
-} /* add_error() */
-
-static void print_errors(array_t *errors, int num, input_buffer_t *ib, array_t *lines)
+static void print_errors(array_t *errors, int num, const char *kind, input_buffer_t *ib, array_t *lines)
 {
     int i, len = array_size(errors);
     len = num < len ? num : len;
@@ -188,9 +92,9 @@ static void print_errors(array_t *errors, int num, input_buffer_t *ib, array_t *
         wchar_t ch;
 
 #ifdef WIN32
-        fprintf(stderr, "%s(%d) : error: %ls\n", ib->name, line, rec->str);
+        fprintf(stderr, "%s(%d) : %s: %ls\n", ib->name, line, kind, rec->str);
 #else
-        fprintf(stderr, "%s:%d: error: %ls\n", ib->name, line, rec->str);
+        fprintf(stderr, "%s:%d: %s: %ls\n", ib->name, line, kind, rec->str);
 #endif
         fprintf(stderr, ">>> ");
 
@@ -232,6 +136,10 @@ typedef struct _peg_options
     char *input_fname;
     char *output_prefix;
     char *output_base;
+
+    int dump_rules;     /* -d: print the rules before optimisation as well as after */
+    int optimise;       /* cleared by -O0 */
+    int backend;        /* BACKEND_VM with -vm */
 }
 peg_options;
 
@@ -247,6 +155,22 @@ static void get_options(int argc, char **argv, peg_options *ops)
 {
     char buf[FNAME_BUF_SIZE];
 
+    ops->dump_rules = 0;
+    ops->optimise = 1;
+    ops->backend = BACKEND_C;
+
+    for (; argc > 2 && argv[1][0] == '-'; --argc, ++argv)
+    {
+        if (strcmp(argv[1], "-d") == 0)
+            ops->dump_rules = 1;
+        else if (strcmp(argv[1], "-O0") == 0)
+            ops->optimise = 0;
+        else if (strcmp(argv[1], "-vm") == 0)
+            ops->backend = BACKEND_VM;
+        else
+            break;
+    }
+
     if (argc == 2)
     {
         size_t len = strlen(argv[1]);
@@ -289,7 +213,7 @@ static void get_options(int argc, char **argv, peg_options *ops)
         }
     }
 
-    fprintf(stderr, "usage: parsergen peg_source_file.peg\n");
+    fprintf(stderr, "usage: parsergen [-d] [-O0] [-vm] peg_source_file.peg\n");
     exit(1);
 } /* get_options() */
 
@@ -319,7 +243,8 @@ int main(int argc, char **argv)
     peg_options ops;
     FILE *input_file = 0;
     input_buffer_t *ib;
-    array_t errors, line_endings, rule_records;
+    array_t errors, warnings, line_endings, rule_records;
+    optimise_stats_t stats;
     syntax_node_t *parsed_spec;
     int i, len, res = 0;
     wchar_t buf[BUF_LEN];
@@ -336,6 +261,7 @@ int main(int argc, char **argv)
     /* parse specification file */
     ib = input_buffer_create(ops.input_fname, input_file);
     array_init(&errors, sizeof(error_rec), 0);
+    array_init(&warnings, sizeof(error_rec), 0);
     array_init(&line_endings, sizeof(int), 0);
 
     parsed_spec = parse_peg_spec(ib, &errors);
@@ -343,7 +269,7 @@ int main(int argc, char **argv)
 
     if (!parsed_spec)
     {
-        print_errors(&errors, 1, ib, &line_endings);
+        print_errors(&errors, 1, "error", ib, &line_endings);
         res = 1;
         goto cleanup_parse;
     }
@@ -357,12 +283,39 @@ int main(int argc, char **argv)
 
     if (array_size(&errors))
     {
-        print_errors(&errors, 1, ib, &line_endings);
+        print_errors(&errors, 1, "error", ib, &line_endings);
         res = 1;
         goto cleanup_rules;
     }
 
+    /* refuse grammars whose parser would never finish */
+    check_grammar(&rule_records, &errors, &warnings);
+    print_errors(&warnings, array_size(&warnings), "warning", ib, &line_endings);
+
+    if (array_size(&errors))
+    {
+        print_errors(&errors, array_size(&errors), "error", ib, &line_endings);
+        res = 1;
+        goto cleanup_rules;
+    }
+
+    /* rewrite the rules before deciding what to memoize, since factoring removes re-invocations */
+    if (ops.dump_rules)
+    {
+        fprintf(stdout, "rules before optimisation:\n");
+        print_rules(&rule_records);
+        fprintf(stdout, "rules after optimisation:\n");
+    }
+
+    if (ops.optimise)
+        optimise_rules(&rule_records, &stats);
+
+    analyse_memoization(&rule_records);
+
     print_rules(&rule_records);
+    if (ops.optimise)
+        print_optimise_report(&stats);
+    print_memo_report(&rule_records);
 
     /* generate C parser */
     if (1)
@@ -389,7 +342,7 @@ int main(int argc, char **argv)
         }
 
         swprintf(buf, BUF_LEN, L"%hs", ops.output_prefix);
-        generate_c_parser(buf, header_fname, header_file, src_fname, src_file, &rule_records, ib, &line_endings);
+        generate_c_parser(buf, header_fname, header_file, src_fname, src_file, &rule_records, ib, &line_endings, ops.backend, ops.optimise);
 
         /* clean up */
 cleanup_outputs:
@@ -413,6 +366,8 @@ cleanup_parse:
     
     delete_errors(&errors, 0);
     array_deinit(&errors);
+    delete_errors(&warnings, 0);
+    array_deinit(&warnings);
 
     if (parsed_spec)
         syntax_node_destroy(parsed_spec);
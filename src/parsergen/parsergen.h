@@ -48,6 +48,7 @@ extern "C" {
         int end;                /**< The input position after the last character of the match.   */
         int first_line;         /**< The line on which the match begins.                         */
         int last_line;          /**< The line on which the match ends.                           */
+        int refs;               /**< Reference count; memoized subtrees are shared between parents. */
         struct _syntax_node_t **children; /**< Null-terminated array of child nodes.               */
     }
     syntax_node_t;
@@ -58,14 +59,23 @@ extern "C" {
     /** Make a deep copy of a syntax node tree. */
     syntax_node_t *syntax_node_copy(const syntax_node_t *node);
 
-    /** Deallocate a syntax node tree. */
+    /** Release a reference to a syntax node tree, deallocating it when no references remain. */
     void syntax_node_destroy(syntax_node_t *node);
 
     /** A function type for a function that processes a single node. */
     typedef int (*syntax_node_process_ft)(syntax_node_t *node, void *data);
 
-    /** Traverse a syntax node tree in infix order, processing each node with the given function. 
-     *  If the function returns non-null for a given node, the traversal stops.
+    /** Returned by a process function to skip the node's children. */
+#define SYNTAX_NODE_SKIP_SUBTREE 1
+
+    /** Traverse a syntax node tree, calling entry_func on each node before its children and exit_func after them.
+     *  Either function may be null.  If entry_func returns SYNTAX_NODE_SKIP_SUBTREE, the node's children and
+     *  its exit_func are skipped.  The walk uses an explicit stack, so the depth of the tree is not limited.
+     */
+    void syntax_node_traverse_preorder(syntax_node_t *root, void *data, syntax_node_process_ft entry_func, syntax_node_process_ft exit_func);
+
+    /** Traverse a syntax node tree in prefix order, processing each node with the given function. 
+     *  If the function returns SYNTAX_NODE_SKIP_SUBTREE for a given node, its children are skipped.
      */
     void syntax_node_traverse_inorder(syntax_node_t *root, void *data, syntax_node_process_ft process);
 
@@ -36,6 +36,7 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <malloc.h>
+#include <string.h>
 #include <wchar.h>
 #include <stdio.h>
 
@@ -47,36 +48,53 @@
  */
 typedef struct _memo_rec_t
 {
+    int type;                   /**< Node type of the record; zero marks an empty slot. */
     int start_offset, end_offset;
     syntax_node_t *parse_tree;
 }
 memo_rec_t;
 
 /**
- * Records memoizations for all node types.
+ * Records memoizations for all node types, in an open-addressed hash table keyed by (type, start_offset).
  */
 typedef struct _memo_map_t
 {
-    array_t records[PEG_NUM_NODE_TYPES]; /* a array_t of memo_rec_t structures */
+    unsigned int num, cap;      /**< Number of records, and table size (always a power of two). */
+    memo_rec_t *records;
+    peg_parse_stats_t stats;
 }
 memo_map_t;
 
+#define MEMO_MAP_INITIAL_SIZE 1024
+
 /************************/
 
+/**
+ * Hashes a (type, position) key.
+ */
+static unsigned int memo_hash(int type, int start_offset)
+{
+    unsigned int h = (unsigned int) start_offset * PEG_NUM_NODE_TYPES + (unsigned int) type;
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+
+    return h;
+} /* memo_hash() */
+
 /**
  * Creates a memoization map.
  */
 static memo_map_t *memo_map_create()
 {
-    int i;
     memo_map_t *map;
     
     map = (memo_map_t *) calloc(1, sizeof(memo_map_t));
-
-    for (i = 0; i < PEG_NUM_NODE_TYPES; ++i)
-    {
-        array_init(&map->records[i], sizeof(memo_rec_t), 0);
-    }
+    map->cap = MEMO_MAP_INITIAL_SIZE;
+    map->records = (memo_rec_t *) calloc(map->cap, sizeof(memo_rec_t));
 
     return map;
 } /* memo_map_create() */
@@ -86,76 +104,198 @@ static memo_map_t *memo_map_create()
  */
 static void memo_map_destroy(memo_map_t *map)
 {
-    int i;
+    unsigned int i;
 
     assert(map);
 
-    for (i = 0; i < PEG_NUM_NODE_TYPES; ++i)
+    for (i = 0; i < map->cap; ++i)
     {
-        int j, count = array_size(&map->records[i]);
-        for (j = 0; j < count; ++j)
-        {
-            memo_rec_t *mr = (memo_rec_t *) array_item(&map->records[i], j);
-
-            if (mr->parse_tree)
-                syntax_node_destroy(mr->parse_tree);
-        }
+        memo_rec_t *mr = &map->records[i];
 
-        array_deinit(&map->records[i]);
+        if (mr->type && mr->parse_tree)
+            syntax_node_destroy(mr->parse_tree);
     }
 
+    free(map->records);
     free(map);
 } /* memo_map_destroy() */
 
 /**
- * Returns true (and returns a copy of the memoized node) if there is a memoized value for the node type at the current position.
+ * Returns the slot holding the record for the key, or the empty slot where it belongs.
+ */
+static memo_rec_t *memo_map_find_slot(memo_rec_t *records, unsigned int cap, int type, int start_offset)
+{
+    unsigned int mask = cap - 1;
+    unsigned int i = memo_hash(type, start_offset) & mask;
+
+    while (records[i].type && (records[i].type != type || records[i].start_offset != start_offset))
+        i = (i + 1) & mask;
+
+    return &records[i];
+} /* memo_map_find_slot() */
+
+/**
+ * Doubles the size of the table and re-inserts the records.
+ */
+static void memo_map_grow(memo_map_t *map)
+{
+    unsigned int i, old_cap = map->cap;
+    memo_rec_t *old_records = map->records;
+
+    map->cap = old_cap * 2;
+    map->records = (memo_rec_t *) calloc(map->cap, sizeof(memo_rec_t));
+
+    for (i = 0; i < old_cap; ++i)
+    {
+        if (old_records[i].type)
+            *memo_map_find_slot(map->records, map->cap, old_records[i].type, old_records[i].start_offset) = old_records[i];
+    }
+
+    free(old_records);
+} /* memo_map_grow() */
+
+/**
+ * Adds a reference to a (possibly null) syntax node.
+ */
+static syntax_node_t *syntax_node_retain(syntax_node_t *node)
+{
+    if (node)
+        node->refs++;
+
+    return node;
+} /* syntax_node_retain() */
+
+/**
+ * Returns true (and returns a shared reference to the memoized node) if there is a memoized value for the node type at the current position.
  */
 static int is_memoized(memo_map_t *map, int type, int start_offset, syntax_node_t **res, int *end_offset)
 {
-    int i, len;
-    array_t *da;
+    memo_rec_t *rec;
 
     assert(map);
-    assert(type < PEG_NUM_NODE_TYPES);
+    assert(type > 0 && type < PEG_NUM_NODE_TYPES);
 
-    da = &map->records[type];
-    len = array_size(da);
+    map->stats.memo_lookups++;
+    rec = memo_map_find_slot(map->records, map->cap, type, start_offset);
 
-    for (i = 0; i < len; ++i)
+    if (rec->type)
     {
-        memo_rec_t *rec = (memo_rec_t *) array_item(da, i);
-
-        if (rec->start_offset == start_offset)
-        {
-            *res = syntax_node_copy(rec->parse_tree);
-            *end_offset = rec->end_offset;
-            return 1;
-        }
+        map->stats.memo_hits++;
+        *res = syntax_node_retain(rec->parse_tree);
+        *end_offset = rec->end_offset;
+        return 1;
     }
 
     return 0;
 } /* is_memoized() */
 
 /**
- * Copies the tree and records it in the memoization map.
- * \todo Sort these so find_memo_rec() can use a binary search.
+ * Records a reference to the tree in the memoization map, replacing any previous record for the same key.
  */
 static void memoize(memo_map_t *map, int type, int start_offset, int end_offset, syntax_node_t *node)
 {
-    memo_rec_t rec;
+    memo_rec_t *rec;
 
     assert(map);
-    assert(type < PEG_NUM_NODE_TYPES);
+    assert(type > 0 && type < PEG_NUM_NODE_TYPES);
 
-    rec.start_offset = start_offset;
-    rec.end_offset = end_offset;
-    rec.parse_tree = syntax_node_copy(node);
+    /* keep the load factor at or below one half */
+    if ((map->num + 1) * 2 > map->cap)
+        memo_map_grow(map);
+
+    rec = memo_map_find_slot(map->records, map->cap, type, start_offset);
+
+    if (rec->type)
+    {
+        if (rec->parse_tree)
+            syntax_node_destroy(rec->parse_tree);
+    }
+    else
+    {
+        map->num++;
+        map->stats.memo_records++;
+    }
 
-    array_add(&map->records[type], &rec);
+    rec->type = type;
+    rec->start_offset = start_offset;
+    rec->end_offset = end_offset;
+    rec->parse_tree = syntax_node_retain(node);
 } /* memoize() */
 
 /*@}*/
 
+/** \name Syntax errors */
+/*@{*/
+
+/**
+ * The farthest offset at which a rule failed, and the rules that failed there.
+ * Only this is tracked during the parse; the message is built if the parse fails.
+ */
+typedef struct _failure_t
+{
+    int pos;                    /**< Farthest failure offset; -1 if no rule has failed. */
+    int lookaheads;             /**< Negative lookaheads being parsed, whose failures are expected. */
+    const wchar_t *expected[PEG_NUM_NODE_TYPES]; /**< Names of the rules that failed at pos, by node type. */
+}
+failure_t;
+
+/**
+ * Notes that a rule failed at an offset; failures short of the farthest one are forgotten.
+ */
+static void record_failure(failure_t *failure, int type, const wchar_t *name, int pos)
+{
+    if (pos < failure->pos || failure->lookaheads)
+        return;
+
+    if (pos > failure->pos)
+    {
+        failure->pos = pos;
+        memset(failure->expected, 0, sizeof(failure->expected));
+    }
+
+    failure->expected[type] = name;
+} /* record_failure() */
+
+/**
+ * Adds "syntax error: expected A, B or C" for the farthest failure to the error list.
+ */
+static void add_failure_error(array_t *errors, const failure_t *failure)
+{
+    const wchar_t *names[PEG_NUM_NODE_TYPES];
+    wchar_t *str;
+    size_t len = 32;
+    int type, i, num = 0;
+
+    for (type = 1; type < PEG_NUM_NODE_TYPES; ++type)
+    {
+        if (!failure->expected[type])
+            continue;
+
+        /* several rules share a name; give each name once */
+        for (i = 0; i < num && wcscmp(names[i], failure->expected[type]); ++i)
+            ;
+        if (i == num)
+        {
+            names[num++] = failure->expected[type];
+            len += wcslen(names[i]) + 4;
+        }
+    }
+
+    str = (wchar_t *) calloc(len, sizeof(wchar_t));
+    wcscpy(str, L"syntax error: expected ");
+    for (i = 0; i < num; ++i)
+    {
+        if (i)
+            wcscat(str, i == num - 1 ? L" or " : L", ");
+        wcscat(str, names[i]);
+    }
+
+    add_error(errors, failure->pos, str);
+    free(str);
+} /* add_failure_error() */
+
+/*@}*/
+
 static void delete_children(array_t *children, int start_index)
 {
     int i, len;
@@ -225,7 +365,6 @@ static void print_debug_indent(int indent, char *prefix, char *what, char *suffi
                                             \
     if (!res)                               \
     {                                       \
-        delete_errors(error_stack, 0);      \
         cur_start_pos = orig_start_pos;     \
                                             \
         B;                                  \
@@ -253,8 +392,6 @@ static void print_debug_indent(int indent, char *prefix, char *what, char *suffi
     while(res);                             \
     res = 1;                                \
                                             \
-    delete_errors(error_stack, 0);          \
-                                            \
     EXIT_DEBUG(star);                       \
 }
 
@@ -262,7 +399,6 @@ static void print_debug_indent(int indent, char *prefix, char *what, char *suffi
 {                                           \
     int orig_stack_size = child_stack.num;  \
     int count = 0;                          \
-    int error_stack_size = error_stack->num; \
                                             \
     ENTER_DEBUG(plus);                      \
                                             \
@@ -279,9 +415,7 @@ static void print_debug_indent(int indent, char *prefix, char *what, char *suffi
     while (res);                            \
     res = count > 0;                        \
                                             \
-    if (res)                                \
-        delete_errors(error_stack, error_stack_size); \
-    else                                    \
+    if (!res)                               \
         delete_children(&child_stack, orig_stack_size); \
                                             \
     EXIT_DEBUG(plus);                       \
@@ -289,7 +423,6 @@ static void print_debug_indent(int indent, char *prefix, char *what, char *suffi
 
 #define QUES(A)                             \
 {                                           \
-    int error_stack_size = error_stack->num; \
     ENTER_DEBUG(ques);                      \
                                             \
     A;                                      \
@@ -298,7 +431,6 @@ static void print_debug_indent(int indent, char *prefix, char *what, char *suffi
         cur_start_pos = cur_end_pos;        \
                                             \
     res = 1;                                \
-    delete_errors(error_stack, error_stack_size); \
     EXIT_DEBUG(ques);                       \
 }
 
@@ -306,18 +438,18 @@ static void print_debug_indent(int indent, char *prefix, char *what, char *suffi
 {                                           \
     int orig_start_pos = cur_start_pos;     \
     int orig_stack_size = child_stack.num;  \
-    int orig_error_size = error_stack->num; \
                                             \
     ENTER_DEBUG(bang);                      \
                                             \
+    failure->lookaheads++;                  \
     A;                                      \
+    failure->lookaheads--;                  \
                                             \
     res = !res;                             \
                                             \
     cur_start_pos = cur_end_pos = orig_start_pos; \
                                             \
     delete_children(&child_stack, orig_stack_size); \
-    delete_errors(error_stack, orig_error_size); \
                                             \
     EXIT_DEBUG(bang);                       \
 }
@@ -353,7 +485,7 @@ static void print_debug_indent(int indent, char *prefix, char *what, char *suffi
 {                                                                   \
     syntax_node_t *child = 0;                                         \
     ENTER_DEBUG(func);                                              \
-    if ((res = func(ib, cur_start_pos, &cur_end_pos, &child, map, error_stack))) \
+    if ((res = func(ib, cur_start_pos, &cur_end_pos, &child, map, failure))) \
     {                                                               \
         if (child)                                                  \
             array_add(&child_stack, &child);                        \
@@ -411,7 +543,7 @@ static void print_debug_indent(int indent, char *prefix, char *what, char *suffi
 }
 
 #define PEG_PARSE(FUNCTION, NODE_TYPE, NODE_NAME, EXP)                                                                 \
-static int FUNCTION(input_buffer_t *ib, int start_offset, int *end_offset, syntax_node_t **node, memo_map_t *map, array_t *error_stack) \
+static int FUNCTION(input_buffer_t *ib, int start_offset, int *end_offset, syntax_node_t **node, memo_map_t *map, failure_t *failure) \
 {                                                                                                           \
     int res = 0;                                                                                            \
     int cur_start_pos = start_offset, cur_end_pos = start_offset;                                           \
@@ -420,7 +552,11 @@ static int FUNCTION(input_buffer_t *ib, int start_offset, int *end_offset, synta
     array_init(&child_stack, sizeof(syntax_node_t *), 0);                                                     \
                                                                                                             \
     if (is_memoized(map, NODE_TYPE, start_offset, node, end_offset))                                        \
+    {                                                                                                       \
+        if (!*node)                                                                                         \
+            record_failure(failure, NODE_TYPE, NODE_NAME, start_offset);                                    \
         return *node != 0;                                                                                  \
+    }                                                                                                       \
                                                                                                             \
     EXP;                                                                                                    \
                                                                                                             \
@@ -429,6 +565,7 @@ static int FUNCTION(input_buffer_t *ib, int start_offset, int *end_offset, synta
         int i, len;                                                                                         \
         *end_offset = cur_end_pos;                                                                          \
         *node = syntax_node_create(NODE_TYPE, start_offset, cur_end_pos);                                   \
+        map->stats.nodes++;                                                                                 \
         len = array_size(&child_stack);                                                                     \
         (*node)->children = (syntax_node_t **) calloc(len+1, sizeof(syntax_node_t *));                          \
                                                                                                             \
@@ -443,11 +580,8 @@ static int FUNCTION(input_buffer_t *ib, int start_offset, int *end_offset, synta
     }                                                                                                       \
     else                                                                                                    \
     {                                                                                                       \
-        int len = (int) wcslen(NODE_NAME) + 64;                                                             \
-        wchar_t *buf = (wchar_t *) calloc(len, sizeof(wchar_t));                                            \
-        swprintf(buf, len, L"syntax error: expected %ls", NODE_NAME);                                        \
-        add_error(error_stack, start_offset, buf);                                                          \
-        free(buf);                                                                                          \
+        record_failure(failure, NODE_TYPE, NODE_NAME, start_offset);                                        \
+        map->stats.failures++;                                                                              \
         *node = 0;                                                                                          \
         delete_children(&child_stack, 0);                                                                   \
         array_deinit(&child_stack);                                                                         \
@@ -458,7 +592,7 @@ static int FUNCTION(input_buffer_t *ib, int start_offset, int *end_offset, synta
     return res;                                                                                             \
 }
 
-#define PEG_FUNC(F) static int F(input_buffer_t *ib, int start_offset, int *end_offset, syntax_node_t **node, memo_map_t *map, array_t *error_stack)
+#define PEG_FUNC(F) static int F(input_buffer_t *ib, int start_offset, int *end_offset, syntax_node_t **node, memo_map_t *map, failure_t *failure)
 
 /*************************************************/
 
@@ -490,6 +624,8 @@ PEG_FUNC(parse_peg_space);
 PEG_FUNC(parse_peg_eol);
 PEG_FUNC(parse_peg_eof);
 PEG_FUNC(parse_peg_hide);
+PEG_FUNC(parse_peg_memo);
+PEG_FUNC(parse_peg_cut);
 
 /*************************************************/
 
@@ -501,8 +637,9 @@ PEG_PARSE(parse_peg_grammar,        PEG_GRAMMAR_NODE,               L"PEG gramma
 
 PEG_PARSE(parse_peg_rule,           PEG_RULE_NODE,                  L"PEG rule",                SEQ(T(parse_peg_identifier),
                                                                                                     SEQ(QUES(T(parse_peg_literal)),
-                                                                                                        SEQ(T(parse_peg_left_arrow),
-                                                                                                            T(parse_peg_disjunction)))));
+                                                                                                        SEQ(QUES(T(parse_peg_memo)),
+                                                                                                            SEQ(T(parse_peg_left_arrow),
+                                                                                                                T(parse_peg_disjunction))))));
 
 PEG_PARSE(parse_peg_disjunction,    PEG_DISJ_NODE,                  L"expression",              SEQ(T(parse_peg_conjunction), STAR(SEQ(T(parse_peg_slash), T(parse_peg_conjunction)))));
 
@@ -517,13 +654,15 @@ PEG_PARSE(parse_peg_suffix_exp,     PEG_SUFFIX_EXP_NODE,            L"term",
 
 PEG_PARSE(parse_peg_term, PEG_TERM_NODE, L"term", DISJ(SEQ(T(parse_peg_identifier), 
                                                            BANG(SEQ(QUES(T(parse_peg_literal)), 
-                                                                    T(parse_peg_left_arrow)))),
+                                                                    SEQ(QUES(T(parse_peg_memo)),
+                                                                        T(parse_peg_left_arrow))))),
                                                        DISJ(SEQ(T(parse_peg_open), 
                                                                 SEQ(T(parse_peg_disjunction), 
                                                                     T(parse_peg_close))),
                                                             DISJ(T(parse_peg_literal),
                                                                  DISJ(T(parse_peg_class), 
-                                                                      T(parse_peg_dot))))));
+                                                                      DISJ(T(parse_peg_dot),
+                                                                           T(parse_peg_cut)))))));
 
 /* lexicon */
 
@@ -547,6 +686,7 @@ PEG_PARSE(parse_peg_plus,       PEG_PLUS_NODE,          L"'+'", SEQ(S(L"+"), T(p
 PEG_PARSE(parse_peg_open,       PEG_OPEN_NODE,          L"'('", SEQ(S(L"("), T(parse_peg_spacing)));
 PEG_PARSE(parse_peg_close,      PEG_CLOSE_NODE,         L"')'", SEQ(S(L")"), T(parse_peg_spacing)));
 PEG_PARSE(parse_peg_dot,        PEG_DOT_NODE,           L"'.'", SEQ(S(L"."), T(parse_peg_spacing)));
+PEG_PARSE(parse_peg_cut,        PEG_CUT_NODE,           L"'^'", SEQ(S(L"^"), T(parse_peg_spacing)));
 
 PEG_PARSE(parse_peg_spacing,    PEG_SPACING_NODE,       L"whitespace", STAR(DISJ(T(parse_peg_space), T(parse_peg_comment))));
 PEG_PARSE(parse_peg_comment,    PEG_COMMENT_NODE,       L"comment", SEQ(S(L"#"), SEQ(STAR(SEQ(BANG(T(parse_peg_eol)), DOT)), T(parse_peg_eol))));
@@ -557,21 +697,38 @@ PEG_PARSE(parse_peg_eof, PEG_EOF_NODE, L"end-of-file", BANG(DOT));
 
 PEG_PARSE(parse_peg_hide, PEG_HIDE_NODE, L"~", SEQ(S(L"~"), T(parse_peg_spacing)));
 
+/* rule attribute forcing memoization of the rule on or off */
+PEG_PARSE(parse_peg_memo, PEG_MEMO_NODE, L"rule attribute", SEQ(S(L"@"), SEQ(DISJ(S(L"memo"), DISJ(S(L"nomemo"), S(L"token"))), T(parse_peg_spacing))));
+
 /*************************************************/
 
 syntax_node_t *parse_peg_spec(input_buffer_t *ib, array_t *errors)
+{
+    return parse_peg_spec_stats(ib, errors, NULL);
+} /* parse_peg_spec() */
+
+syntax_node_t *parse_peg_spec_stats(input_buffer_t *ib, array_t *errors, peg_parse_stats_t *stats)
 {
     int start_offset, end_offset;
     memo_map_t *map = memo_map_create();
     syntax_node_t *grammar = 0;
+    failure_t failure;
+
+    memset(&failure, 0, sizeof(failure));
+    failure.pos = -1;
 
     start_offset = input_buffer_getpos(ib);
-    parse_peg_grammar(ib, start_offset, &end_offset, &grammar, map, errors);
-    
+    parse_peg_grammar(ib, start_offset, &end_offset, &grammar, map, &failure);
+
+    if (stats)
+        *stats = map->stats;
     memo_map_destroy(map);
 
+    if (!grammar && failure.pos >= 0)
+        add_failure_error(errors, &failure);
+
     return grammar;
-} /* parse_peg_spec() */
+} /* parse_peg_spec_stats() */
 
 /*************************************************/
 
@@ -722,6 +879,15 @@ void syntax_node_print(input_buffer_t *ib, syntax_node_t *node, int indent)
     case PEG_EOF_NODE:
         fprintf(out, "EOF");
 
+        break;
+    case PEG_CUT_NODE:
+        fprintf(out, "cut");
+
+        break;
+    case PEG_MEMO_NODE:
+        input_buffer_read_string(ib, node->begin, node->end, &str);
+        fprintf(out, "memo: %ls", (wchar_t *) str.data);
+
         break;
     case PEG_SUCCEED_BLOCK_NODE:
         input_buffer_read_string(ib, node->begin, node->end, &str);
@@ -128,12 +128,28 @@ extern "C" {
         PEG_EOF_NODE        = 29,
         PEG_SUCCEED_BLOCK_NODE = 30,
         PEG_HIDE_NODE       = 31,
-        PEG_NUM_NODE_TYPES  = 32
+        PEG_MEMO_NODE       = 32,
+        PEG_CUT_NODE        = 33,
+        PEG_NUM_NODE_TYPES  = 34
     };
 
+    /** Counters of one parse, for benchmarking the parser. */
+    typedef struct _peg_parse_stats_t
+    {
+        long long memo_lookups;     /**< Rule calls that looked for a memoized result. */
+        long long memo_hits;        /**< Lookups that found one. */
+        long long memo_records;     /**< Records added to the memo map, which keeps them all. */
+        long long nodes;            /**< Nodes built, including those backtracking dropped. */
+        long long failures;         /**< Rule calls that failed. */
+    }
+    peg_parse_stats_t;
+
     /** This is the main parsing function. */
     syntax_node_t *parse_peg_spec(input_buffer_t *ib, array_t *errors);
 
+    /** Parses as parse_peg_spec() does, and fills in the counters of the parse. */
+    syntax_node_t *parse_peg_spec_stats(input_buffer_t *ib, array_t *errors, peg_parse_stats_t *stats);
+
     void syntax_node_print(input_buffer_t *ib, syntax_node_t *node, int indent);
 
 #ifdef __cplusplus
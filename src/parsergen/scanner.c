@@ -0,0 +1,728 @@
+/*
+ * Copyright (c) 2006, The Narwhal Project 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    * Neither the name of the Narwhal Project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */ 
+
+/** \file scanner.c
+ *
+ * Builds the rules marked @token into one DFA.  Each token rule becomes a fragment of an NFA
+ * the usual way, the fragments are joined at a common start, and subset construction gives a
+ * DFA whose states know which tokens have matched so far.  Bytes that no token tells apart
+ * share a class, so the transition table has a column per class rather than per byte.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include "internal.h"
+
+/*************************************************/
+
+/**
+ * A state of the NFA.  It either moves to OUT on a byte in BYTES, or makes up to two
+ * moves that consume nothing.  The state a token rule ends in records the token.
+ */
+typedef struct _nfa_state_t
+{
+    int out, out2;          /* the following states, or -1 */
+    int token;              /* the token matched on reaching this state, or -1 */
+    int has_bytes;          /* OUT is taken on a byte in BYTES rather than for free */
+    unsigned char bytes[32];
+}
+nfa_state_t;
+
+/**
+ * Where a token rule can go two ways: the alternatives of a choice, or another iteration of
+ * a repetition against leaving it.  Each way runs from a state to the state it ends in.
+ */
+typedef struct _fork_t
+{
+    int first, first_end;
+    int second, second_end; /* second_end is -1 for the end of the token */
+    int repeats;            /* the first way is another iteration */
+}
+fork_t;
+
+/**
+ * Stores the NFA while the token rules are built into it.
+ */
+typedef struct _scan_context
+{
+    const array_t *rule_records;  /* array of rule_rec_t * */
+    int num_rules;
+
+    array_t states;         /* array of nfa_state_t */
+    char *visiting;         /* rules being built, so that recursion is caught */
+    array_t forks;          /* array of fork_t, for the token rule being built */
+
+    const rule_rec_t *token;    /* the token rule being built */
+    array_t *errors;        /* where rules that cannot be scanned are reported, if anywhere */
+    int failed;
+}
+scan_context;
+
+/*************************************************/
+
+static int rule_index(scan_context *context, const wchar_t *name)
+{
+    int i;
+
+    for (i = 0; i < context->num_rules; ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(context->rule_records, i);
+        if (wcscmp(rec->rule_name, name) == 0)
+            return i;
+    }
+
+    return -1;
+} /* rule_index() */
+
+
+static nfa_state_t *state_at(scan_context *context, int i)
+{
+    return (nfa_state_t *) array_item(&context->states, i);
+} /* state_at() */
+
+
+static int new_state(scan_context *context)
+{
+    nfa_state_t state;
+
+    memset(&state, 0, sizeof(nfa_state_t));
+    state.out = state.out2 = state.token = -1;
+    array_add(&context->states, &state);
+
+    return array_size(&context->states) - 1;
+} /* new_state() */
+
+
+static void add_move(scan_context *context, int from, int to)
+{
+    nfa_state_t *state = state_at(context, from);
+
+    if (state->out < 0)
+        state->out = to;
+    else
+        state->out2 = to;
+} /* add_move() */
+
+
+/* turns FROM into a state that moves on a byte in BITS; returns the state it moves to */
+static int add_byte_move(scan_context *context, int from, const unsigned char bits[32])
+{
+    int to = new_state(context);
+    nfa_state_t *state = state_at(context, from);
+
+    state->has_bytes = 1;
+    memcpy(state->bytes, bits, 32);
+    state->out = to;
+
+    return to;
+} /* add_byte_move() */
+
+
+/* adds STATE and the states it reaches without consuming input to SET, not going on from STOP */
+static void add_closure(scan_context *context, unsigned char *set, int state, int stop)
+{
+    nfa_state_t *s;
+
+    if ((set[state >> 3] >> (state & 7)) & 1)
+        return;
+
+    set[state >> 3] |= (unsigned char) (1 << (state & 7));
+
+    s = state_at(context, state);
+    if (s->has_bytes || state == stop)
+        return;
+
+    if (s->out >= 0)
+        add_closure(context, set, s->out, stop);
+    if (s->out2 >= 0)
+        add_closure(context, set, s->out2, stop);
+} /* add_closure() */
+
+
+static int find_or_add_set(array_t *sets, const unsigned char *set)
+{
+    int i;
+
+    for (i = 0; i < array_size(sets); ++i)
+    {
+        if (memcmp(array_item(sets, i), set, sets->data_size) == 0)
+            return i;
+    }
+
+    array_add(sets, (void *) set);
+    return i;
+} /* find_or_add_set() */
+
+
+static void report(scan_context *context, const wchar_t *msg)
+{
+    int len;
+    wchar_t *buf;
+
+    /* one error a token rule is enough */
+    if (context->failed)
+        return;
+    context->failed = 1;
+
+    if (!context->errors)
+        return;
+
+    len = (int) (wcslen(msg) + wcslen(context->token->rule_name) + 32);
+    buf = (wchar_t *) calloc(len + 1, sizeof(wchar_t));
+    swprintf(buf, len, msg, context->token->rule_name);
+    add_error(context->errors, context->token->node->begin, buf);
+    free(buf);
+} /* report() */
+
+/*************************************************/
+
+/* the byte a grammar character stands for, or -1 above 255; bytes may be read sign-extended */
+static int char_byte(wchar_t ch)
+{
+    if (ch < 0 && ch >= -128)
+        return ch & 0xff;
+
+    return ch >= 0 && ch < 256 ? (int) ch : -1;
+} /* char_byte() */
+
+
+static int class_bytes(const wchar_t *str, unsigned char bits[32])
+{
+    int byte;
+
+    memset(bits, 0, 32);
+
+    for (; *str; ++str)
+    {
+        if ((byte = char_byte(*str)) < 0)
+            return 0;
+        bits[byte >> 3] |= (unsigned char) (1 << (byte & 7));
+    }
+
+    return 1;
+} /* class_bytes() */
+
+
+/* if EXP always matches exactly one byte, sets BITS to the bytes it can match */
+static int exp_byte_set(scan_context *context, const rule_exp_t *exp, unsigned char bits[32])
+{
+    unsigned char other[32];
+    int i, res;
+
+    switch (exp->type)
+    {
+    case RULE_EXP_STR:
+        if (wcslen(exp->data.str) != 1 || (i = char_byte(exp->data.str[0])) < 0)
+            return 0;
+        memset(bits, 0, 32);
+        bits[i >> 3] |= (unsigned char) (1 << (i & 7));
+        return 1;
+    case RULE_EXP_CLASS:
+        return class_bytes(exp->data.str, bits);
+    case RULE_EXP_DOT:
+        memset(bits, 0xff, 32);
+        return 1;
+    case RULE_EXP_DISJ:
+        if (!exp_byte_set(context, exp->left, bits) || !exp_byte_set(context, exp->right, other))
+            return 0;
+        for (i = 0; i < 32; ++i)
+            bits[i] |= other[i];
+        return 1;
+    case RULE_EXP_HIDE:
+        return exp_byte_set(context, exp->left, bits);
+    case RULE_EXP_CALL:
+        if ((i = rule_index(context, exp->data.str)) < 0 || context->visiting[i])
+            return 0;
+        context->visiting[i] = 1;
+        res = exp_byte_set(context, (*(rule_rec_t **) array_item(context->rule_records, i))->rule_spec, bits);
+        context->visiting[i] = 0;
+        return res;
+    }
+
+    return 0;
+} /* exp_byte_set() */
+
+
+/**
+ * Builds EXP into the NFA starting at FROM, a state with no moves yet, and returns the
+ * state it ends in, which has none either; -1 if EXP cannot be scanned.  Called rules are
+ * built in place, and matches are the longest the expression has, as in a regular expression.
+ * Each choice and repetition is added to the forks, for build_token() to check.
+ */
+static int build_exp(scan_context *context, const rule_exp_t *exp, int from)
+{
+    const rule_exp_t *next;
+    unsigned char bits[32];
+    fork_t fork;
+    int i, body, body2, end, end2;
+
+    if (from < 0)
+        return -1;
+
+    switch (exp->type)
+    {
+    case RULE_EXP_SEQ:
+        if (exp->left->type != RULE_EXP_BANG)
+            return build_exp(context, exp->right, build_exp(context, exp->left, from));
+
+        /* !c . is a byte outside c */
+        next = exp->right->type == RULE_EXP_SEQ ? exp->right->left : exp->right;
+        if (next->type != RULE_EXP_DOT || !exp_byte_set(context, exp->left->left, bits))
+        {
+            report(context, L"token rule '%ls' has a lookahead other than !c . for a byte outside c");
+            return -1;
+        }
+
+        for (i = 0; i < 32; ++i)
+            bits[i] = (unsigned char) ~bits[i];
+        end = add_byte_move(context, from, bits);
+
+        return exp->right->type == RULE_EXP_SEQ ? build_exp(context, exp->right->right, end) : end;
+    case RULE_EXP_DISJ:
+        body = new_state(context);
+        add_move(context, from, body);
+        end = build_exp(context, exp->left, body);
+
+        body2 = new_state(context);
+        add_move(context, from, body2);
+        end2 = build_exp(context, exp->right, body2);
+
+        if (end < 0 || end2 < 0)
+            return -1;
+
+        fork.first = body;
+        fork.first_end = end;
+        fork.second = body2;
+        fork.second_end = end2;
+        fork.repeats = 0;
+        array_add(&context->forks, &fork);
+
+        body = new_state(context);
+        add_move(context, end, body);
+        add_move(context, end2, body);
+        return body;
+    case RULE_EXP_STAR:
+    case RULE_EXP_QUES:
+        body = new_state(context);
+        end = new_state(context);
+        add_move(context, from, body);
+        add_move(context, from, end);
+
+        if ((end2 = build_exp(context, exp->left, body)) < 0)
+            return -1;
+
+        fork.first = body;
+        fork.first_end = end2;
+        fork.second = end;
+        fork.second_end = -1;
+        fork.repeats = 1;
+        array_add(&context->forks, &fork);
+
+        add_move(context, end2, exp->type == RULE_EXP_STAR ? from : end);
+        return end;
+    case RULE_EXP_PLUS:
+        body = new_state(context);
+        add_move(context, from, body);
+
+        if ((end = build_exp(context, exp->left, body)) < 0)
+            return -1;
+
+        end2 = new_state(context);
+        add_move(context, end, body);
+        add_move(context, end, end2);
+
+        fork.first = body;
+        fork.first_end = end;
+        fork.second = end2;
+        fork.second_end = -1;
+        fork.repeats = 1;
+        array_add(&context->forks, &fork);
+        return end2;
+    case RULE_EXP_HIDE:
+        return build_exp(context, exp->left, from);
+    case RULE_EXP_CALL:
+        /* unknown rules have been reported already */
+        if ((i = rule_index(context, exp->data.str)) < 0)
+        {
+            context->failed = 1;
+            return -1;
+        }
+        if (context->visiting[i])
+        {
+            report(context, L"token rule '%ls' is recursive");
+            return -1;
+        }
+
+        context->visiting[i] = 1;
+        end = build_exp(context, (*(rule_rec_t **) array_item(context->rule_records, i))->rule_spec, from);
+        context->visiting[i] = 0;
+        return end;
+    case RULE_EXP_STR:
+        for (i = 0, end = from; exp->data.str[i]; ++i)
+        {
+            int byte = char_byte(exp->data.str[i]);
+
+            if (byte < 0)
+            {
+                report(context, L"token rule '%ls' matches a character above 255");
+                return -1;
+            }
+
+            memset(bits, 0, 32);
+            bits[byte >> 3] |= (unsigned char) (1 << (byte & 7));
+            end = add_byte_move(context, end, bits);
+        }
+        return end;
+    case RULE_EXP_CLASS:
+        if (!class_bytes(exp->data.str, bits))
+        {
+            report(context, L"token rule '%ls' matches a character above 255");
+            return -1;
+        }
+        return add_byte_move(context, from, bits);
+    case RULE_EXP_DOT:
+        memset(bits, 0xff, 32);
+        return add_byte_move(context, from, bits);
+    }
+
+    report(context, L"token rule '%ls' has a lookahead or a cut, which the scanner cannot match");
+    return -1;
+} /* build_exp() */
+
+
+/* adds to TARGET the states that the states of SET from LO on move to on BYTE, not going on from STOP */
+static int step(scan_context *context, const unsigned char *set, unsigned char *target, int byte, int stop, int lo)
+{
+    int j, moved = 0;
+
+    for (j = lo; j < array_size(&context->states); ++j)
+    {
+        nfa_state_t *s = state_at(context, j);
+
+        if ((set[j >> 3] >> (j & 7)) & 1 && s->has_bytes && (s->bytes[byte >> 3] >> (byte & 7)) & 1)
+        {
+            add_closure(context, target, s->out, stop);
+            moved = 1;
+        }
+    }
+
+    return moved;
+} /* step() */
+
+
+/**
+ * Whether a match of one way of FORK can be the start of a match of the other, the token's
+ * states beginning at START and ending at END.  If not, no more than one way can match at
+ * any offset, so ordered choice and greedy repetition take the way the longest match does.
+ * For a repetition only ways that read a byte count, since leaving it at the end of the
+ * token is what the longest match does too.  Runs both ways side by side, as pairs of
+ * state sets with a last byte telling whether anything has been read.
+ */
+static int fork_overlaps(scan_context *context, const fork_t *fork, int start, int end)
+{
+    array_t pairs;
+    unsigned char *pair, *next;
+    int second_end = fork->second_end < 0 ? end : fork->second_end;
+    int i, byte, found = 0, set_len = array_size(&context->states) / 8 + 1;
+
+    pair = (unsigned char *) calloc(2 * set_len + 1, 1);
+    next = (unsigned char *) calloc(2 * set_len + 1, 1);
+    array_init(&pairs, 2 * set_len + 1, 0);
+
+    add_closure(context, pair, fork->first, fork->first_end);
+    add_closure(context, pair + set_len, fork->second, second_end);
+    array_add(&pairs, pair);
+
+    for (i = 0; !found && i < array_size(&pairs); ++i)
+    {
+        memcpy(pair, array_item(&pairs, i), 2 * set_len + 1);
+
+        /* the states of each way all lead to its end, so one way ending while the other goes on is enough */
+        if ((pair[2 * set_len] || !fork->repeats) && ((pair[fork->first_end >> 3] >> (fork->first_end & 7)) & 1 ||
+            (pair[set_len + (second_end >> 3)] >> (second_end & 7)) & 1))
+            found = 1;
+
+        for (byte = 0; !found && byte < 256; ++byte)
+        {
+            memset(next, 0, 2 * set_len + 1);
+            next[2 * set_len] = 1;
+
+            if (step(context, pair, next, byte, fork->first_end, start) &&
+                step(context, pair + set_len, next + set_len, byte, second_end, start))
+                find_or_add_set(&pairs, next);
+        }
+    }
+
+    free(pair);
+    free(next);
+    array_deinit(&pairs);
+
+    return found;
+} /* fork_overlaps() */
+
+
+/* builds the rule at INDEX into the NFA as TOKEN; returns its start state, or -1 if it cannot be scanned */
+static int build_token(scan_context *context, int index, int token)
+{
+    unsigned char *set;
+    int i, start, end, nullable;
+
+    context->token = *(rule_rec_t **) array_item(context->rule_records, index);
+    context->failed = 0;
+    array_clear(&context->forks);
+
+    start = new_state(context);
+
+    context->visiting[index] = 1;
+    end = build_exp(context, context->token->rule_spec, start);
+    context->visiting[index] = 0;
+
+    if (end < 0)
+        return -1;
+
+    state_at(context, end)->token = token;
+
+    /* a token that matches nothing would match at every offset */
+    set = (unsigned char *) calloc(array_size(&context->states) / 8 + 1, 1);
+    add_closure(context, set, start, -1);
+    nullable = (set[end >> 3] >> (end & 7)) & 1;
+    free(set);
+
+    if (nullable)
+    {
+        report(context, L"token rule '%ls' can match the empty string");
+        return -1;
+    }
+
+    /* the scanner takes the longest match, which the rule as a parser would not always find */
+    for (i = 0; i < array_size(&context->forks); ++i)
+    {
+        fork_t *fork = (fork_t *) array_item(&context->forks, i);
+
+        if (!fork_overlaps(context, fork, start, end))
+            continue;
+
+        report(context, fork->repeats ?
+            L"token rule '%ls' has a repetition that can go on with what follows it, so its longest match can differ from the greedy one" :
+            L"token rule '%ls' has a choice where a match of one alternative can begin a match of another, so its longest match can differ from the first");
+        return -1;
+    }
+
+    return start;
+} /* build_token() */
+
+
+static void scan_context_init(scan_context *context, const array_t *rule_records, array_t *errors)
+{
+    context->rule_records = rule_records;
+    context->num_rules = array_size(rule_records);
+    array_init(&context->states, sizeof(nfa_state_t), 0);
+    array_init(&context->forks, sizeof(fork_t), 0);
+    context->visiting = (char *) calloc(context->num_rules + 1, 1);
+    context->token = 0;
+    context->errors = errors;
+    context->failed = 0;
+} /* scan_context_init() */
+
+
+static void scan_context_deinit(scan_context *context)
+{
+    array_deinit(&context->states);
+    array_deinit(&context->forks);
+    free(context->visiting);
+} /* scan_context_deinit() */
+
+/*************************************************/
+
+void check_token_rules(array_t *rule_records, array_t *errors)
+{
+    scan_context context;
+    int i;
+
+    scan_context_init(&context, rule_records, errors);
+
+    for (i = 0; i < context.num_rules; ++i)
+    {
+        if ((*(rule_rec_t **) array_item(rule_records, i))->token)
+            build_token(&context, i, 0);
+    }
+
+    scan_context_deinit(&context);
+} /* check_token_rules() */
+
+
+/* gives bytes that every byte set of the NFA either holds both of or neither the same class */
+static void find_byte_classes(scan_context *context, scanner_t *scanner)
+{
+    int split[512];
+    int i, byte, num = 1, num_split;
+
+    memset(scanner->byte_class, 0, 256);
+
+    for (i = 0; i < array_size(&context->states); ++i)
+    {
+        nfa_state_t *state = state_at(context, i);
+
+        if (!state->has_bytes)
+            continue;
+
+        /* the bytes of each class inside the set and those outside it part ways */
+        memset(split, -1, sizeof(split));
+        num_split = 0;
+
+        for (byte = 0; byte < 256; ++byte)
+        {
+            int key = scanner->byte_class[byte] * 2 + ((state->bytes[byte >> 3] >> (byte & 7)) & 1);
+
+            if (split[key] < 0)
+                split[key] = num_split++;
+            scanner->byte_class[byte] = (unsigned char) split[key];
+        }
+
+        num = num_split;
+    }
+
+    scanner->num_classes = num;
+} /* find_byte_classes() */
+
+
+void scanner_build(const array_t *rule_records, scanner_t *scanner)
+{
+    scan_context context;
+    array_t sets, next, accept_begin, accepts;
+    unsigned char *set, *target;
+    int representative[256];
+    int i, j, num_states, set_len, state, byte;
+
+    memset(scanner, 0, sizeof(scanner_t));
+    scan_context_init(&context, rule_records, 0);
+
+    scanner->token_types = (int *) calloc(context.num_rules + 1, sizeof(int));
+    array_init(&sets, sizeof(int), 0);
+
+    /* the start states go in SETS for now */
+    for (i = 0; i < context.num_rules; ++i)
+    {
+        if (!(*(rule_rec_t **) array_item(rule_records, i))->token || (state = build_token(&context, i, scanner->num_tokens)) < 0)
+            continue;
+
+        array_add(&sets, &state);
+        scanner->token_types[scanner->num_tokens++] = i + 1;
+    }
+
+    if (!scanner->num_tokens)
+    {
+        array_deinit(&sets);
+        scan_context_deinit(&context);
+        return;
+    }
+
+    num_states = array_size(&context.states);
+    set_len = num_states / 8 + 1;
+
+    find_byte_classes(&context, scanner);
+    for (byte = 255; byte >= 0; --byte)
+        representative[scanner->byte_class[byte]] = byte;
+
+    /* state 0 is the empty set, which is dead; state 1 starts every token at once */
+    set = (unsigned char *) calloc(set_len, 1);
+    target = (unsigned char *) calloc(set_len, 1);
+
+    for (i = 0; i < array_size(&sets); ++i)
+        add_closure(&context, set, *(int *) array_item(&sets, i), -1);
+
+    array_deinit(&sets);
+    array_init(&sets, set_len, 0);
+    memset(target, 0, set_len);
+    array_add(&sets, target);
+    array_add(&sets, set);
+
+    array_init(&next, sizeof(int), 0);
+    array_init(&accept_begin, sizeof(int), 0);
+    array_init(&accepts, sizeof(int), 0);
+
+    for (state = 0; state < array_size(&sets); ++state)
+    {
+        memcpy(set, array_item(&sets, state), set_len);
+
+        for (i = 0; i < scanner->num_classes; ++i)
+        {
+            byte = representative[i];
+            memset(target, 0, set_len);
+
+            for (j = 0; j < num_states; ++j)
+            {
+                nfa_state_t *s = state_at(&context, j);
+
+                if ((set[j >> 3] >> (j & 7)) & 1 && s->has_bytes && (s->bytes[byte >> 3] >> (byte & 7)) & 1)
+                    add_closure(&context, target, s->out, -1);
+            }
+
+            j = find_or_add_set(&sets, target);
+            array_add(&next, &j);
+        }
+
+        j = array_size(&accepts);
+        array_add(&accept_begin, &j);
+
+        for (j = 0; j < num_states; ++j)
+        {
+            if ((set[j >> 3] >> (j & 7)) & 1 && state_at(&context, j)->token >= 0)
+                array_add(&accepts, &state_at(&context, j)->token);
+        }
+    }
+
+    j = array_size(&accepts);
+    array_add(&accept_begin, &j);
+
+    /* the tables keep the arrays' storage */
+    scanner->num_states = array_size(&sets);
+    scanner->next = (int *) next.data;
+    scanner->accept_begin = (int *) accept_begin.data;
+    scanner->num_accepts = array_size(&accepts);
+    scanner->accepts = (int *) accepts.data;
+
+    free(set);
+    free(target);
+    array_deinit(&sets);
+    scan_context_deinit(&context);
+} /* scanner_build() */
+
+
+void scanner_deinit(scanner_t *scanner)
+{
+    free(scanner->token_types);
+    free(scanner->next);
+    free(scanner->accept_begin);
+    free(scanner->accepts);
+} /* scanner_deinit() */
@@ -0,0 +1,233 @@
+
+/*
+ * Copyright (c) 2006, The Narwhal Project 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    * Neither the name of the Narwhal Project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "parsergen.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <wchar.h>
+
+/** \file syntax_node.c
+ *
+ * The syntax tree and error record functions declared in parsergen.h, shared by parsergen
+ * and the runtime grammar loader.
+ */
+
+/** \name Syntax Node Functions */
+/*@{*/
+
+syntax_node_t *syntax_node_create(const int type, const int begin, const int end)
+{
+    syntax_node_t *res = (syntax_node_t *) calloc(1, sizeof(syntax_node_t));
+    res->type  = type;
+    res->begin = begin;
+    res->end   = end;
+    res->first_line = -1;
+    res->last_line  = -1;
+    res->refs = 1;
+    res->children = 0;
+    return res;
+} /* syntax_node_create() */
+
+static syntax_node_t *syntax_node_copy_one(const syntax_node_t *node)
+{
+    syntax_node_t *copy = syntax_node_create(node->type, node->begin, node->end);
+
+    copy->first_line = node->first_line;
+    copy->last_line = node->last_line;
+
+    return copy;
+} /* syntax_node_copy_one() */
+
+syntax_node_t *syntax_node_copy(const syntax_node_t *node)
+{
+    const syntax_node_t *src;
+    syntax_node_t *copy, *dest;
+    array_t work; /* pairs of (original, copy) whose children are still to be copied */
+    int i, len;
+
+    if (!node)
+        return 0;
+
+    array_init(&work, sizeof(void *), 0);
+    copy = syntax_node_copy_one(node);
+    array_add(&work, &node);
+    array_add(&work, &copy);
+
+    while (array_size(&work))
+    {
+        len = array_size(&work);
+        dest = *(syntax_node_t **) array_item(&work, len-1);
+        src = *(const syntax_node_t **) array_item(&work, len-2);
+        array_resize(&work, len-2);
+
+        len = 0;
+        if (src->children)
+            while (src->children[len])
+                ++len;
+
+        if (!len)
+            continue;
+
+        dest->children = (syntax_node_t **) calloc(len+1, sizeof(syntax_node_t *));
+
+        for (i = 0; i < len; ++i)
+        {
+            dest->children[i] = syntax_node_copy_one(src->children[i]);
+            array_add(&work, &src->children[i]);
+            array_add(&work, &dest->children[i]);
+        }
+    }
+
+    array_deinit(&work);
+    return copy;
+} /* syntax_node_copy() */
+
+void syntax_node_destroy(syntax_node_t *node)
+{
+    syntax_node_t **cur;
+    array_t work; /* nodes with no references left whose children have not been released */
+
+    assert(node);
+    assert(node->refs > 0);
+
+    if (--node->refs > 0)
+        return;
+
+    array_init(&work, sizeof(syntax_node_t *), 0);
+    array_add(&work, &node);
+
+    while (array_size(&work))
+    {
+        node = *(syntax_node_t **) array_item(&work, array_size(&work)-1);
+        array_resize(&work, array_size(&work)-1);
+
+        if (node->children)
+        {
+            for (cur = node->children; *cur; ++cur)
+            {
+                assert((*cur)->refs > 0);
+
+                if (--(*cur)->refs == 0)
+                    array_add(&work, cur);
+            }
+
+            free(node->children);
+        }
+
+        free(node);
+    }
+
+    array_deinit(&work);
+} /* syntax_node_destroy() */
+
+
+typedef struct _traverse_frame
+{
+    syntax_node_t *node;
+    syntax_node_t **next;   /* the next child to visit; null or pointing at null when done */
+}
+traverse_frame;
+
+void syntax_node_traverse_preorder(syntax_node_t *root, void *data, syntax_node_process_ft entry_func, syntax_node_process_ft exit_func)
+{
+    array_t stack; /* the path from the root to the current node */
+    traverse_frame frame, *top;
+
+    if (!root)
+        return;
+    if (entry_func && entry_func(root, data))
+        return;
+
+    array_init(&stack, sizeof(traverse_frame), 0);
+    frame.node = root;
+    frame.next = root->children;
+    array_add(&stack, &frame);
+
+    while (array_size(&stack))
+    {
+        top = (traverse_frame *) array_item(&stack, array_size(&stack)-1);
+
+        if (top->next && *top->next)
+        {
+            frame.node = *top->next++;
+            frame.next = frame.node->children;
+
+            if (entry_func && entry_func(frame.node, data))
+                continue;
+
+            array_add(&stack, &frame);
+        }
+        else
+        {
+            frame = *top;
+            array_resize(&stack, array_size(&stack)-1);
+
+            if (exit_func)
+                exit_func(frame.node, data);
+        }
+    }
+
+    array_deinit(&stack);
+} /* syntax_node_traverse_preorder() */
+
+void syntax_node_traverse_inorder(syntax_node_t *root, void *data, syntax_node_process_ft process)
+{
+    syntax_node_traverse_preorder(root, data, process, 0);
+} /* syntax_node_traverse_inorder() */
+
+/*@}*/
+
+/** \name Error handling functions. */
+/*@{*/
+
+void add_error(array_t *errs, const int pos, const wchar_t *str)
+{
+    error_rec rec;
+    rec.pos = pos;
+    rec.str = wcsdup(str);
+
+    array_add(errs, &rec);
+} /* add_error() */
+
+void delete_errors(array_t *errors, const int start_index)
+{
+    int i, len = array_size(errors);
+    for (i = start_index; i < len; ++i)
+    {
+        error_rec *rec = (error_rec *) array_item(errors, i);
+        free(rec->str);
+    }
+    errors->num = start_index;
+} /* add_error() */
+
+/*@}*/
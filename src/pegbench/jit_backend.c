@@ -0,0 +1,207 @@
+/** \file jit_backend.c
+ *
+ * Compares a parser compiled by pegjit at runtime with the one parsergen generates ahead of
+ * time from the same grammar.  kscope.peg is loaded with pegjit_load(), timing the load, and a
+ * large synthetic kscope source is parsed with each parser, checking that the trees have the
+ * same nodes.  The best throughput of several runs is reported.
+ *
+ * Usage: jit_backend [mb] [repeats] [grammar] [scratch_file]
+ */
+
+#include "kscope.h"
+#include "pegjit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_MB 2
+#define DEFAULT_REPEATS 3
+
+/** A block of kscope source covering the constructs in kscope.peg; %d makes the names unique. */
+static const char *s_block =
+    "# block %d\n"
+    "def binary : 1 (x y) y;\n"
+    "def fib%d(x)\n"
+    "  if (x < 3) then\n"
+    "    1\n"
+    "  else\n"
+    "    fib%d(x-1)+fib%d(x-2);\n"
+    "def fibi%d(x)\n"
+    "  var a = 1, b = 1, c in\n"
+    "  (for i = 3, i < x in\n"
+    "     c = a + b :\n"
+    "     a = b :\n"
+    "     b = c) :\n"
+    "  b;\n"
+    "extern printd%d(x);\n"
+    "fibi%d(10);\n"
+    "def fod%d(a b) a*a + 2*a*b + b*b;\n";
+
+static long write_source(const char *fname, long num_bytes)
+{
+    FILE *f;
+    long written = 0;
+    int i = 0;
+
+    if (!(f = fopen(fname, "w")))
+        return -1;
+
+    while (written < num_bytes)
+    {
+        written += fprintf(f, s_block, i, i, i, i, i, i, i, i);
+        ++i;
+    }
+
+    fclose(f);
+    return written;
+} /* write_source() */
+
+static double now(void)
+{
+#ifdef WIN32
+    return (double) clock() / CLOCKS_PER_SEC;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+} /* now() */
+
+/* the two parsers */
+
+static pegjit_grammar_t *s_grammar;
+
+static int count_node(kscope_syntax_node_t *node, void *data)
+{
+    (void) node;
+    ++*(long *) data;
+    return 0;
+} /* count_node() */
+
+static int count_jit_node(pegjit_syntax_node_t *node, void *data)
+{
+    (void) node;
+    ++*(long *) data;
+    return 0;
+} /* count_jit_node() */
+
+/** Parses FNAME with the generated parser; returns 1 and the number of nodes if it parsed. */
+static int parse_aot(char *fname, long *nodes)
+{
+    kscope_syntax_node_t *root = 0;
+    void *ib = 0, *error_list = 0;
+    int ok;
+
+    *nodes = 0;
+    if ((ok = kscope_parse(fname, &root, &ib, &error_list)))
+    {
+        kscope_syntax_node_traverse_preorder(root, nodes, count_node, NULL);
+        kscope_syntax_node_destroy(root);
+    }
+
+    if (error_list)
+        kscope_destroy_error_list(error_list);
+    if (ib)
+        kscope_destroy_input_buffer(ib);
+
+    return ok;
+} /* parse_aot() */
+
+static int parse_jit(char *fname, long *nodes)
+{
+    pegjit_syntax_node_t *root = 0;
+    void *ib = 0, *error_list = 0;
+    int ok;
+
+    *nodes = 0;
+    if ((ok = pegjit_parse(s_grammar, fname, &root, &ib, &error_list)))
+    {
+        pegjit_syntax_node_traverse_preorder(root, nodes, count_jit_node, NULL);
+        pegjit_syntax_node_destroy(root);
+    }
+
+    if (error_list)
+        pegjit_destroy_error_list(error_list);
+    if (ib)
+        pegjit_destroy_input_buffer(ib);
+
+    return ok;
+} /* parse_jit() */
+
+typedef int (*parse_ft)(char *fname, long *nodes);
+
+/** Runs PARSE REPEATS times, keeping the best time; returns the nodes, or -1. */
+static long bench(const char *label, parse_ft parse, char *fname, long bytes, int repeats)
+{
+    double start, secs, best = -1;
+    long nodes = -1;
+    int i;
+
+    for (i = 0; i < repeats; ++i)
+    {
+        start = now();
+        if (!parse(fname, &nodes))
+            return -1;
+        secs = now() - start;
+
+        if (best < 0 || secs < best)
+            best = secs;
+    }
+
+    printf("%-8s %10.3f %10.1f\n", label, best, bytes / best / (1024 * 1024));
+    return nodes;
+} /* bench() */
+
+int main(int argc, char **argv)
+{
+    long mb = DEFAULT_MB, bytes, aot_nodes, jit_nodes;
+    int repeats = DEFAULT_REPEATS;
+    char *grammar = "kscope.peg", *fname = "jit_backend.ks";
+    wchar_t *error = 0;
+    double start;
+
+    if (argc > 1)
+        mb = atol(argv[1]);
+    if (argc > 2)
+        repeats = atoi(argv[2]);
+    if (argc > 3)
+        grammar = argv[3];
+    if (argc > 4)
+        fname = argv[4];
+
+    start = now();
+    if (!(s_grammar = pegjit_load(grammar, NULL, &error)))
+    {
+        fprintf(stderr, "%ls\n", error);
+        free(error);
+        return 1;
+    }
+    printf("%s loaded and compiled in %.3f s\n", grammar, now() - start);
+
+    if ((bytes = write_source(fname, mb * 1024 * 1024)) < 0)
+    {
+        fprintf(stderr, "unable to write %s\n", fname);
+        pegjit_destroy(s_grammar);
+        return 1;
+    }
+
+    printf("%ld bytes, best of %d\n", bytes, repeats);
+    printf("%-8s %10s %10s\n", "parser", "parse (s)", "MB/s");
+
+    aot_nodes = bench("aot", parse_aot, fname, bytes, repeats);
+    jit_nodes = bench("jit", parse_jit, fname, bytes, repeats);
+
+    pegjit_destroy(s_grammar);
+    remove(fname);
+
+    if (aot_nodes < 0 || aot_nodes != jit_nodes)
+    {
+        fprintf(stderr, "the parsers disagree: %ld nodes ahead of time, %ld from the jit\n", aot_nodes, jit_nodes);
+        return 1;
+    }
+
+    printf("%ld nodes from each\n", aot_nodes);
+    return 0;
+}
@@ -0,0 +1,121 @@
+/** \file kscope_scaling.c
+ *
+ * Measures how the parse time of the parsergen-generated kscope parser grows with the size
+ * of the input.  Synthetic kscope sources are written for a series of doubling sizes, and
+ * each one is parsed and timed.  With constant-time memoization the time per kilobyte should
+ * stay roughly flat as the input grows.
+ *
+ * Usage: kscope_scaling [max_kb] [scratch_file]
+ */
+
+#include "kscope.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_MIN_KB 16
+#define DEFAULT_MAX_KB 128
+
+/** A block of kscope source covering the constructs in kscope.peg; %d makes the names unique. */
+static const char *s_block =
+    "# block %d\n"
+    "def binary : 1 (x y) y;\n"
+    "def fib%d(x)\n"
+    "  if (x < 3) then\n"
+    "    1\n"
+    "  else\n"
+    "    fib%d(x-1)+fib%d(x-2);\n"
+    "def fibi%d(x)\n"
+    "  var a = 1, b = 1, c in\n"
+    "  (for i = 3, i < x in\n"
+    "     c = a + b :\n"
+    "     a = b :\n"
+    "     b = c) :\n"
+    "  b;\n"
+    "extern printd%d(x);\n"
+    "fibi%d(10);\n"
+    "def fod%d(a b) a*a + 2*a*b + b*b;\n";
+
+static long write_source(const char *fname, long num_bytes)
+{
+    FILE *f;
+    long written = 0;
+    int i = 0;
+
+    if (!(f = fopen(fname, "w")))
+        return -1;
+
+    while (written < num_bytes)
+    {
+        written += fprintf(f, s_block, i, i, i, i, i, i, i, i);
+        ++i;
+    }
+
+    fclose(f);
+    return written;
+} /* write_source() */
+
+static int count_node(kscope_syntax_node_t *node, void *data)
+{
+    (void) node;
+    ++*(long *) data;
+    return 0;
+} /* count_node() */
+
+static double seconds_since(clock_t start)
+{
+    return (double) (clock() - start) / CLOCKS_PER_SEC;
+} /* seconds_since() */
+
+int main(int argc, char **argv)
+{
+    long kb, max_kb = DEFAULT_MAX_KB;
+    const char *fname = "kscope_scaling.ks";
+    double prev_rate = 0;
+
+    if (argc > 1)
+        max_kb = atol(argv[1]);
+    if (argc > 2)
+        fname = argv[2];
+
+    printf("%10s %10s %12s %12s %10s\n", "bytes", "nodes", "parse (s)", "us/KB", "growth");
+
+    for (kb = DEFAULT_MIN_KB; kb <= max_kb; kb *= 2)
+    {
+        kscope_syntax_node_t *root = 0;
+        void *ib = 0, *error_list = 0;
+        long bytes, nodes = 0;
+        double secs, rate;
+        clock_t start;
+
+        if ((bytes = write_source(fname, kb * 1024)) < 0)
+        {
+            fprintf(stderr, "unable to write %s\n", fname);
+            return 1;
+        }
+
+        start = clock();
+        if (!kscope_parse((char *) fname, &root, &ib, &error_list))
+        {
+            fprintf(stderr, "parse of %ld bytes failed\n", bytes);
+            return 1;
+        }
+        secs = seconds_since(start);
+
+        kscope_syntax_node_traverse_preorder(root, &nodes, count_node, NULL);
+        rate = secs * 1e6 / (bytes / 1024.0);
+
+        /* growth is the change in time per kilobyte; about 1.0 means linear scaling */
+        printf("%10ld %10ld %12.4f %12.2f %10.2f\n", bytes, nodes, secs, rate, prev_rate > 0 ? rate / prev_rate : 1.0);
+        prev_rate = rate;
+
+        kscope_syntax_node_destroy(root);
+        kscope_destroy_error_list(error_list);
+        kscope_destroy_input_buffer(ib);
+    }
+
+    remove(fname);
+    return 0;
+}
@@ -0,0 +1,175 @@
+/** \file parallel_parse.c
+ *
+ * Measures how _parser_parse_parallel() of the generated kscope parser scales with the number
+ * of threads.  One large synthetic kscope source is written and parsed sequentially, then in
+ * parallel with a doubling number of threads, checking each time that the tree has the same
+ * nodes as the sequential one.  The speedup can only approach the number of cores, so no more
+ * threads are tried than there are processors online.
+ *
+ * Usage: parallel_parse [mb] [max_threads] [scratch_file]
+ */
+
+#include "kscope.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define DEFAULT_MB 4
+#define DEFAULT_MAX_THREADS 16
+
+/** A block of kscope source covering the constructs in kscope.peg; %d makes the names unique. */
+static const char *s_block =
+    "# block %d\n"
+    "def binary : 1 (x y) y;\n"
+    "def fib%d(x)\n"
+    "  if (x < 3) then\n"
+    "    1\n"
+    "  else\n"
+    "    fib%d(x-1)+fib%d(x-2);\n"
+    "def fibi%d(x)\n"
+    "  var a = 1, b = 1, c in\n"
+    "  (for i = 3, i < x in\n"
+    "     c = a + b :\n"
+    "     a = b :\n"
+    "     b = c) :\n"
+    "  b;\n"
+    "extern printd%d(x);\n"
+    "fibi%d(10);\n"
+    "def fod%d(a b) a*a + 2*a*b + b*b;\n";
+
+static long write_source(const char *fname, long num_bytes)
+{
+    FILE *f;
+    long written = 0;
+    int i = 0;
+
+    if (!(f = fopen(fname, "w")))
+        return -1;
+
+    while (written < num_bytes)
+    {
+        written += fprintf(f, s_block, i, i, i, i, i, i, i, i);
+        ++i;
+    }
+
+    fclose(f);
+    return written;
+} /* write_source() */
+
+static int count_node(kscope_syntax_node_t *node, void *data)
+{
+    (void) node;
+    ++*(long *) data;
+    return 0;
+} /* count_node() */
+
+/** Wall-clock time, since clock() adds up the time of every thread on POSIX. */
+static double now(void)
+{
+#ifdef WIN32
+    return (double) clock() / CLOCKS_PER_SEC;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+} /* now() */
+
+static int online_processors(void)
+{
+#ifdef WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int) info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int) n : 1;
+#endif
+} /* online_processors() */
+
+/** Parses FNAME with NUM_THREADS, or sequentially if it is zero; returns the seconds taken, or -1. */
+static double time_parse(char *fname, int num_threads, long *nodes)
+{
+    kscope_syntax_node_t *root = 0;
+    void *ib = 0, *error_list = 0;
+    double start, secs;
+    int ok;
+
+    start = now();
+    if (num_threads)
+        ok = kscope_parser_parse_parallel(NULL, fname, num_threads, &root, &ib, &error_list);
+    else
+        ok = kscope_parse_mmap(fname, NULL, &root, &ib, &error_list);
+    secs = now() - start;
+
+    *nodes = 0;
+    if (ok)
+    {
+        kscope_syntax_node_traverse_preorder(root, nodes, count_node, NULL);
+        kscope_syntax_node_destroy(root);
+    }
+
+    if (error_list)
+        kscope_destroy_error_list(error_list);
+    if (ib)
+        kscope_destroy_input_buffer(ib);
+
+    return ok ? secs : -1;
+} /* time_parse() */
+
+int main(int argc, char **argv)
+{
+    long mb = DEFAULT_MB, bytes, seq_nodes, nodes;
+    int threads, max_threads = DEFAULT_MAX_THREADS;
+    char *fname = "parallel_parse.ks";
+    double seq_secs, secs;
+
+    if (argc > 1)
+        mb = atol(argv[1]);
+    if (argc > 2)
+        max_threads = atoi(argv[2]);
+    if (argc > 3)
+        fname = argv[3];
+
+    /* more threads than processors only take turns on them */
+    if (max_threads > online_processors())
+        max_threads = online_processors();
+
+    if ((bytes = write_source(fname, mb * 1024 * 1024)) < 0)
+    {
+        fprintf(stderr, "unable to write %s\n", fname);
+        return 1;
+    }
+
+    if ((seq_secs = time_parse(fname, 0, &seq_nodes)) < 0)
+    {
+        fprintf(stderr, "parse of %ld bytes failed\n", bytes);
+        return 1;
+    }
+
+    printf("%ld bytes, %ld nodes\n", bytes, seq_nodes);
+    printf("%10s %12s %10s\n", "threads", "parse (s)", "speedup");
+    printf("%10s %12.3f %10.2f\n", "seq", seq_secs, 1.0);
+
+    for (threads = 1; threads <= max_threads; threads *= 2)
+    {
+        if ((secs = time_parse(fname, threads, &nodes)) < 0 || nodes != seq_nodes)
+        {
+            fprintf(stderr, "parallel parse with %d threads differs from the sequential one\n", threads);
+            return 1;
+        }
+
+        printf("%10d %12.3f %10.2f\n", threads, secs, seq_secs / secs);
+    }
+
+    remove(fname);
+    return 0;
+}
@@ -0,0 +1,409 @@
+/** \file parser_diff.c
+ *
+ * Checks that the ways of building the kscope parser give the same results.  Each input is
+ * parsed with the parser parsergen generates, with one generated with -O0 (no rewrites and no
+ * FIRST-set prediction), with one generated with -vm, and with pegjit loading kscope.peg.  The
+ * trees must have the same nodes in the same order, and the same errors must be reported.
+ * The inputs are the sample files given, a synthetic source covering the constructs in
+ * kscope.peg, and that source cut off at a few places inside a block, which leaves a tail
+ * that only UNKNOWN matches.
+ *
+ * The same is done on a few short inputs for predict.peg, a small grammar with an alternative
+ * that can fail before any rule in it does.  Prediction must leave such an alternative alone.
+ *
+ * Usage: parser_diff kscope_grammar predict_grammar scratch_file [sample ...]
+ */
+
+#include "kscope.h"
+#include "kscope_o0.h"
+#include "kscope_vm.h"
+#include "predict.h"
+#include "predict_o0.h"
+#include "predict_vm.h"
+#include "pegjit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#define SYNTHETIC_BYTES 65536
+#define NUM_CUTS 4
+
+/** A block of kscope source covering the constructs in kscope.peg; %d makes the names unique. */
+static const char *s_block =
+    "# block %d\n"
+    "def binary : 1 (x y) y;\n"
+    "def fib%d(x)\n"
+    "  if (x < 3) then\n"
+    "    1\n"
+    "  else\n"
+    "    fib%d(x-1)+fib%d(x-2);\n"
+    "def fibi%d(x)\n"
+    "  var a = 1, b = 1, c in\n"
+    "  (for i = 3, i < x in\n"
+    "     c = a + b :\n"
+    "     a = b :\n"
+    "     b = c) :\n"
+    "  b;\n"
+    "extern printd%d(x);\n"
+    "fibi%d(10);\n"
+    "def fod%d(a b) a*a + 2*a*b + b*b;\n";
+
+/** Writes whole blocks until NUM_BYTES are written, or only the first CUT bytes of them if CUT is not negative. */
+static long write_source(const char *fname, long num_bytes, long cut)
+{
+    char block[1024];
+    FILE *f;
+    long written = 0;
+    int i = 0, len;
+
+    if (!(f = fopen(fname, "w")))
+        return -1;
+
+    while (written < num_bytes)
+    {
+        len = snprintf(block, sizeof(block), s_block, i, i, i, i, i, i, i, i);
+        if (cut >= 0 && written + len > cut)
+            len = (int) (cut - written);
+
+        fwrite(block, 1, len, f);
+        written += len;
+        ++i;
+
+        if (cut >= 0 && written >= cut)
+            break;
+    }
+
+    fclose(f);
+    return written;
+} /* write_source() */
+
+/* what a parse gave: whether it parsed, its nodes in pre-order, and its errors */
+
+typedef struct _result_t
+{
+    int ok;
+    long *nodes;                /* type, begin, end and number of children of each node */
+    int num_nodes, cap;
+    int num_errors;
+    int *error_pos;
+    wchar_t **error_str;
+}
+result_t;
+
+static void result_add_node(result_t *res, int type, int begin, int end, int children)
+{
+    if (res->num_nodes == res->cap)
+    {
+        res->cap = res->cap ? res->cap * 2 : 1024;
+        res->nodes = (long *) realloc(res->nodes, res->cap * 4 * sizeof(long));
+    }
+
+    res->nodes[res->num_nodes * 4] = type;
+    res->nodes[res->num_nodes * 4 + 1] = begin;
+    res->nodes[res->num_nodes * 4 + 2] = end;
+    res->nodes[res->num_nodes * 4 + 3] = children;
+    res->num_nodes++;
+} /* result_add_node() */
+
+static void result_set_errors(result_t *res, int num_errors)
+{
+    res->num_errors = num_errors;
+    res->error_pos = (int *) calloc(num_errors + 1, sizeof(int));
+    res->error_str = (wchar_t **) calloc(num_errors + 1, sizeof(wchar_t *));
+} /* result_set_errors() */
+
+static void result_deinit(result_t *res)
+{
+    int i;
+
+    for (i = 0; i < res->num_errors; ++i)
+        free(res->error_str[i]);
+
+    free(res->nodes);
+    free(res->error_pos);
+    free(res->error_str);
+    memset(res, 0, sizeof(result_t));
+} /* result_deinit() */
+
+static wchar_t *wcs_copy(const wchar_t *str)
+{
+    wchar_t *res = (wchar_t *) malloc((wcslen(str) + 1) * sizeof(wchar_t));
+
+    wcscpy(res, str);
+    return res;
+} /* wcs_copy() */
+
+/* the four parsers; each generated one has its own prefix, so the functions are stamped out per prefix */
+
+static pegjit_grammar_t *s_grammar;
+
+#define PARSE_FUNCTION(NAME, PREFIX)                                                                \
+static int NAME##_add_node(PREFIX##_syntax_node_t *node, void *data)                                \
+{                                                                                                   \
+    result_add_node((result_t *) data, node->type, node->begin, node->end, node->children);         \
+    return 0;                                                                                       \
+}                                                                                                   \
+                                                                                                    \
+static void NAME(char *fname, result_t *res)                                                        \
+{                                                                                                   \
+    PREFIX##_syntax_node_t *root = 0;                                                               \
+    void *ib = 0, *error_list = 0;                                                                  \
+    int i;                                                                                          \
+                                                                                                    \
+    if ((res->ok = PREFIX##_parse(fname, &root, &ib, &error_list)))                                 \
+    {                                                                                               \
+        PREFIX##_syntax_node_traverse_preorder(root, res, NAME##_add_node, NULL);                   \
+        PREFIX##_syntax_node_destroy(root);                                                         \
+    }                                                                                               \
+                                                                                                    \
+    if (error_list)                                                                                 \
+    {                                                                                               \
+        result_set_errors(res, PREFIX##_num_errors(error_list));                                    \
+        for (i = 0; i < res->num_errors; ++i)                                                       \
+        {                                                                                           \
+            res->error_pos[i] = PREFIX##_get_error(error_list, i)->pos;                             \
+            res->error_str[i] = wcs_copy(PREFIX##_get_error(error_list, i)->str);                   \
+        }                                                                                           \
+        PREFIX##_destroy_error_list(error_list);                                                    \
+    }                                                                                               \
+                                                                                                    \
+    if (ib)                                                                                         \
+        PREFIX##_destroy_input_buffer(ib);                                                          \
+}
+
+PARSE_FUNCTION(parse_c, kscope)
+PARSE_FUNCTION(parse_o0, kscope_o0)
+PARSE_FUNCTION(parse_vm, kscope_vm)
+PARSE_FUNCTION(parse_predict_c, predict)
+PARSE_FUNCTION(parse_predict_o0, predict_o0)
+PARSE_FUNCTION(parse_predict_vm, predict_vm)
+
+static int add_jit_node(pegjit_syntax_node_t *node, void *data)
+{
+    result_add_node((result_t *) data, node->type, node->begin, node->end, node->children);
+    return 0;
+} /* add_jit_node() */
+
+static void parse_jit(char *fname, result_t *res)
+{
+    pegjit_syntax_node_t *root = 0;
+    void *ib = 0, *error_list = 0;
+    int i;
+
+    if ((res->ok = pegjit_parse(s_grammar, fname, &root, &ib, &error_list)))
+    {
+        pegjit_syntax_node_traverse_preorder(root, res, add_jit_node, NULL);
+        pegjit_syntax_node_destroy(root);
+    }
+
+    if (error_list)
+    {
+        result_set_errors(res, pegjit_num_errors(error_list));
+        for (i = 0; i < res->num_errors; ++i)
+        {
+            res->error_pos[i] = pegjit_get_error(error_list, i)->pos;
+            res->error_str[i] = wcs_copy(pegjit_get_error(error_list, i)->str);
+        }
+        pegjit_destroy_error_list(error_list);
+    }
+
+    if (ib)
+        pegjit_destroy_input_buffer(ib);
+} /* parse_jit() */
+
+/* one grammar's generated, -O0 and -vm parsers; pegjit parses with s_grammar */
+typedef struct _parser_set_t
+{
+    void (*parse_c)(char *fname, result_t *res);
+    void (*parse_o0)(char *fname, result_t *res);
+    void (*parse_vm)(char *fname, result_t *res);
+}
+parser_set_t;
+
+static const parser_set_t s_kscope = { parse_c, parse_o0, parse_vm };
+static const parser_set_t s_predict = { parse_predict_c, parse_predict_o0, parse_predict_vm };
+
+/** Reports the first difference between the generated parser's result and another's; returns 1 if there is one. */
+static int report_difference(const char *fname, const char *label, const result_t *expected, const result_t *res)
+{
+    int i, j;
+
+    if (res->ok != expected->ok)
+    {
+        printf("%s: %s %s, the generated parser %s\n", fname, label, res->ok ? "parses" : "fails",
+            expected->ok ? "parses" : "fails");
+        return 1;
+    }
+
+    for (i = 0; i < res->num_nodes && i < expected->num_nodes; ++i)
+    {
+        for (j = 0; j < 4 && res->nodes[i * 4 + j] == expected->nodes[i * 4 + j]; ++j)
+            ;
+
+        if (j < 4)
+        {
+            printf("%s: node %d is type %ld [%ld, %ld) with %ld children from %s, type %ld [%ld, %ld) with %ld from the generated parser\n",
+                fname, i, res->nodes[i * 4], res->nodes[i * 4 + 1], res->nodes[i * 4 + 2], res->nodes[i * 4 + 3], label,
+                expected->nodes[i * 4], expected->nodes[i * 4 + 1], expected->nodes[i * 4 + 2], expected->nodes[i * 4 + 3]);
+            return 1;
+        }
+    }
+
+    if (res->num_nodes != expected->num_nodes)
+    {
+        printf("%s: %d nodes from %s, %d from the generated parser\n", fname, res->num_nodes, label, expected->num_nodes);
+        return 1;
+    }
+
+    for (i = 0; i < res->num_errors && i < expected->num_errors; ++i)
+    {
+        if (res->error_pos[i] != expected->error_pos[i] || wcscmp(res->error_str[i], expected->error_str[i]))
+        {
+            printf("%s: error %d is \"%ls\" at %d from %s, \"%ls\" at %d from the generated parser\n", fname, i,
+                res->error_str[i], res->error_pos[i], label, expected->error_str[i], expected->error_pos[i]);
+            return 1;
+        }
+    }
+
+    if (res->num_errors != expected->num_errors)
+    {
+        printf("%s: %d errors from %s, %d from the generated parser\n", fname, res->num_errors, label, expected->num_errors);
+        return 1;
+    }
+
+    return 0;
+} /* report_difference() */
+
+/** Parses FNAME with each parser of SET and pegjit; returns the number that differ from the generated one. */
+static int check_input(char *fname, const parser_set_t *set)
+{
+    result_t expected, res;
+    int differ = 0;
+
+    memset(&expected, 0, sizeof(result_t));
+    memset(&res, 0, sizeof(result_t));
+
+    set->parse_c(fname, &expected);
+
+    set->parse_o0(fname, &res);
+    differ += report_difference(fname, "-O0", &expected, &res);
+    result_deinit(&res);
+
+    set->parse_vm(fname, &res);
+    differ += report_difference(fname, "-vm", &expected, &res);
+    result_deinit(&res);
+
+    parse_jit(fname, &res);
+    differ += report_difference(fname, "pegjit", &expected, &res);
+    result_deinit(&res);
+
+    printf("%-24s %-6s %8d nodes %4d errors%s\n", fname, expected.ok ? "parses" : "fails",
+        expected.num_nodes, expected.num_errors, differ ? "  DIFFERS" : "");
+
+    result_deinit(&expected);
+    return differ;
+} /* check_input() */
+
+/** Writes STR to FNAME and checks the predict grammar's parsers on it; returns the number that differ. */
+static int check_string(char *fname, const char *str)
+{
+    FILE *f;
+
+    if (!(f = fopen(fname, "w")))
+    {
+        fprintf(stderr, "unable to write %s\n", fname);
+        return 1;
+    }
+
+    fputs(str, f);
+    fclose(f);
+    return check_input(fname, &s_predict);
+} /* check_string() */
+
+static pegjit_grammar_t *load_grammar(const char *fname, int num_node_types)
+{
+    pegjit_grammar_t *grammar;
+    wchar_t *error = 0;
+
+    if (!(grammar = pegjit_load(fname, NULL, &error)))
+    {
+        fprintf(stderr, "%ls\n", error);
+        free(error);
+        return NULL;
+    }
+
+    if (pegjit_num_node_types(grammar) != num_node_types)
+    {
+        fprintf(stderr, "%s: the parsers number the node types differently\n", fname);
+        pegjit_destroy(grammar);
+        return NULL;
+    }
+
+    return grammar;
+} /* load_grammar() */
+
+int main(int argc, char **argv)
+{
+    /* inputs on which R0's alternative [ac]+ 'cb' R0 fails before calling R0, and some on which it gets further */
+    static const char *predict_inputs[] = { "c", "", "a", "b", "ab", "cc", "acb", "accb", "cacb" };
+    char *scratch;
+    long bytes;
+    int i, differ = 0;
+
+    if (argc < 4)
+    {
+        fprintf(stderr, "usage: parser_diff kscope_grammar predict_grammar scratch_file [sample ...]\n");
+        return 1;
+    }
+
+    scratch = argv[3];
+
+    if ((int) KSCOPE_O0_NUM_NODE_TYPES != (int) KSCOPE_NUM_NODE_TYPES || (int) KSCOPE_VM_NUM_NODE_TYPES != (int) KSCOPE_NUM_NODE_TYPES
+        || (int) PREDICT_O0_NUM_NODE_TYPES != (int) PREDICT_NUM_NODE_TYPES || (int) PREDICT_VM_NUM_NODE_TYPES != (int) PREDICT_NUM_NODE_TYPES)
+    {
+        fprintf(stderr, "the parsers number the node types differently\n");
+        return 1;
+    }
+
+    if (!(s_grammar = load_grammar(argv[1], KSCOPE_NUM_NODE_TYPES)))
+        return 1;
+
+    for (i = 4; i < argc; ++i)
+        differ += check_input(argv[i], &s_kscope);
+
+    /* the whole source, then cut off part of the way into a block */
+    if ((bytes = write_source(scratch, SYNTHETIC_BYTES, -1)) < 0)
+    {
+        fprintf(stderr, "unable to write %s\n", scratch);
+        pegjit_destroy(s_grammar);
+        return 1;
+    }
+    differ += check_input(scratch, &s_kscope);
+
+    for (i = 1; i <= NUM_CUTS; ++i)
+    {
+        write_source(scratch, SYNTHETIC_BYTES, bytes * i / (NUM_CUTS + 1) + 7 * i);
+        differ += check_input(scratch, &s_kscope);
+    }
+
+    pegjit_destroy(s_grammar);
+
+    if (!(s_grammar = load_grammar(argv[2], PREDICT_NUM_NODE_TYPES)))
+        return 1;
+
+    for (i = 0; i < (int) (sizeof(predict_inputs) / sizeof(predict_inputs[0])); ++i)
+        differ += check_string(scratch, predict_inputs[i]);
+
+    remove(scratch);
+    pegjit_destroy(s_grammar);
+
+    if (differ)
+    {
+        fprintf(stderr, "%d parses differ from the generated parser's\n", differ);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,484 @@
+/** \file pegbench.c
+ *
+ * Throughput and memory benchmark for parsergen's parsers.  Synthetic kscope sources of each
+ * requested size are parsed with the generated kscope parser, and synthetic grammars with the
+ * bootstrap parser, parse_peg_spec(), that parsergen reads .peg files with.  Each run reports
+ * the best throughput of several parses, the nodes in the tree and the nodes built, the memo
+ * lookups, hits and records, the rule failures and error records, and the peak resident set
+ * size.  The results are printed as a table and written as JSON, so that runs from before and
+ * after a change to the generator can be compared.
+ *
+ * The kscope parser is compiled with KSCOPE_STATS so that it keeps its counters.  Where fork()
+ * is available each run is made in a child process, so that its peak RSS is its own.
+ *
+ * Usage: pegbench [-o results.json] [-s sizes] [-m stream_sizes] [-g grammar_sizes] [-r repeats] [-t scratch_dir]
+ *
+ * Sizes are comma-separated byte counts with an optional K, M or G suffix, up to 1G.  The kscope
+ * parser builds the whole tree for the -s sizes and streams it for the -m sizes; a streamed parse
+ * frees each statement's subtree as it goes, which is what lets the largest inputs fit in memory.
+ */
+
+#include "kscope.h"
+#include "peg_parser.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef WIN32
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#define DEFAULT_SIZES "1K,64K,1M,16M"
+#define DEFAULT_STREAM_SIZES "1M,16M"
+#define DEFAULT_GRAMMAR_SIZES "1K,64K,1M"
+#define DEFAULT_REPEATS 3
+#define MAX_SIZE (1L << 30)
+#define MAX_RUNS 64
+
+/** A block of kscope source covering the constructs in kscope.peg and test.ks; %d makes the names unique. */
+static const char *s_kscope_block =
+    "# block %d\n"
+    "def binary : 1 (x y) y;\n"
+    "def unary - (v) 0-v;\n"
+    "def fib%d(x)\n"
+    "  if (x < 3) then\n"
+    "    1\n"
+    "  else\n"
+    "    fib%d(x-1)+fib%d(x-2);\n"
+    "def fibi%d(x)\n"
+    "  var a = 1, b = 1, c in\n"
+    "  (for i = 3, i < x in\n"
+    "     c = a + b :\n"
+    "     a = b :\n"
+    "     b = c) :\n"
+    "  b;\n"
+    "extern printd%d(x);\n"
+    "fibi%d(10);\n"
+    "def fod%d(a b) a*a + 2.5*a*b + -b*.5;\n";
+
+/** A group of grammar rules using each construct of the .peg syntax; %d makes the names unique. */
+static const char *s_grammar_block =
+    "# group %d\n"
+    "EXPR%d 'expression' @memo <- TERM%d (OPERATOR%d TERM%d)*\n"
+    "TERM%d <- '(' _%d EXPR%d ')' _%d ^\n"
+    "        / NUMBER%d / NAME%d ~_%d / !'#' \"str\\\"ing\\n\" .? _%d\n"
+    "OPERATOR%d @nomemo <- [-+*/] _%d\n"
+    "NUMBER%d <- [0-9]+ ('.' [0-9]*)? _%d\n"
+    "NAME%d <- [a-zA-Z_\\]] [a-zA-Z0-9_]* &.\n"
+    "_%d @token <- ([ \\t\\n] / '#' (!'\\n' .)* '\\n')+\n\n";
+
+typedef struct _result_t
+{
+    int ok;
+    double seconds;            /* best of the repeats */
+    long long nodes;           /* in the parse tree */
+    long long nodes_built;     /* the rest are the counters of the last parse */
+    long long memo_lookups;
+    long long memo_hits;
+    long long memo_records;
+    long long memo_peak;
+    long long failures;
+    long long error_records;
+    long peak_rss_kb;          /* -1 where it cannot be measured */
+}
+result_t;
+
+/** Parses FNAME, filling in the counters of RES and the seconds the parse itself took; returns 1 if it parsed. */
+typedef int (*parse_ft)(char *fname, result_t *res, double *secs);
+
+typedef struct _run_t
+{
+    const char *parser;
+    long bytes;
+    result_t res;
+}
+run_t;
+
+static long parse_size(const char *str)
+{
+    char *end;
+    long size = strtol(str, &end, 10);
+
+    switch (*end)
+    {
+    case 'k': case 'K': size <<= 10; break;
+    case 'm': case 'M': size <<= 20; break;
+    case 'g': case 'G': size <<= 30; break;
+    }
+
+    return size;
+} /* parse_size() */
+
+/** Writes numbered copies of BLOCK to FNAME until there are NUM_BYTES; returns the bytes written. */
+static long write_blocks(const char *fname, const char *block, long num_bytes)
+{
+    FILE *f;
+    long written = 0;
+    int i = 0;
+
+    if (!(f = fopen(fname, "w")))
+        return -1;
+
+    while (written < num_bytes)
+    {
+        /* the blocks use at most 20 numbers; fprintf ignores the extra ones */
+        written += fprintf(f, block, i, i, i, i, i, i, i, i, i, i, i, i, i, i, i, i, i, i, i, i);
+        ++i;
+    }
+
+    fclose(f);
+    return written;
+} /* write_blocks() */
+
+static double now(void)
+{
+#ifdef WIN32
+    return (double) clock() / CLOCKS_PER_SEC;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+} /* now() */
+
+/* the parsers */
+
+static int count_kscope_node(kscope_syntax_node_t *node, void *data)
+{
+    (void) node;
+    ++*(long long *) data;
+    return 0;
+} /* count_kscope_node() */
+
+static void kscope_counters(void *error_list, result_t *res)
+{
+    kscope_parse_stats_t stats;
+
+    kscope_parse_stats(error_list, &stats);
+    res->nodes_built = stats.nodes;
+    res->memo_lookups = stats.memo_lookups;
+    res->memo_hits = stats.memo_hits;
+    res->memo_records = stats.memo_records;
+    res->memo_peak = stats.memo_peak;
+    res->failures = stats.failures;
+    res->error_records = kscope_num_errors(error_list);
+} /* kscope_counters() */
+
+static int parse_kscope(char *fname, result_t *res, double *secs)
+{
+    kscope_syntax_node_t *root = 0;
+    void *ib = 0, *error_list = 0;
+    double start = now();
+    int ok;
+
+    ok = kscope_parse_mmap(fname, NULL, &root, &ib, &error_list);
+    *secs = now() - start;
+
+    res->nodes = 0;
+    if (ok)
+    {
+        kscope_syntax_node_traverse_preorder(root, &res->nodes, count_kscope_node, NULL);
+        kscope_syntax_node_destroy(root);
+    }
+
+    if (error_list)
+    {
+        kscope_counters(error_list, res);
+        kscope_destroy_error_list(error_list);
+    }
+    if (ib)
+        kscope_destroy_input_buffer(ib);
+
+    return ok;
+} /* parse_kscope() */
+
+static int count_kscope_subtree(kscope_syntax_node_t *node, void *data)
+{
+    kscope_syntax_node_traverse_preorder(node, data, count_kscope_node, NULL);
+    return 0;
+} /* count_kscope_subtree() */
+
+/* streams the tree, so the largest inputs fit in memory; the time includes counting the nodes */
+static int parse_kscope_stream(char *fname, result_t *res, double *secs)
+{
+    void *ib = 0, *error_list = 0;
+    double start = now();
+    int ok;
+
+    res->nodes = 0;
+    ok = kscope_parse_stream(fname, count_kscope_subtree, &res->nodes, &ib, &error_list);
+    *secs = now() - start;
+
+    if (error_list)
+    {
+        kscope_counters(error_list, res);
+        kscope_destroy_error_list(error_list);
+    }
+    if (ib)
+        kscope_destroy_input_buffer(ib);
+
+    return ok;
+} /* parse_kscope_stream() */
+
+static int count_peg_node(syntax_node_t *node, void *data)
+{
+    (void) node;
+    ++*(long long *) data;
+    return 0;
+} /* count_peg_node() */
+
+static int parse_grammar(char *fname, result_t *res, double *secs)
+{
+    FILE *f;
+    input_buffer_t *ib;
+    array_t errors;
+    syntax_node_t *grammar;
+    peg_parse_stats_t stats;
+    double start = now();
+
+    if (!(f = fopen(fname, "rb")))
+        return 0;
+
+    ib = input_buffer_create(fname, f);
+    array_init(&errors, sizeof(error_rec), 0);
+    grammar = parse_peg_spec_stats(ib, &errors, &stats);
+    *secs = now() - start;
+
+    res->nodes = 0;
+    if (grammar)
+    {
+        syntax_node_traverse_preorder(grammar, &res->nodes, count_peg_node, NULL);
+        syntax_node_destroy(grammar);
+    }
+
+    res->nodes_built = stats.nodes;
+    res->memo_lookups = stats.memo_lookups;
+    res->memo_hits = stats.memo_hits;
+    res->memo_records = stats.memo_records;
+    res->memo_peak = stats.memo_records; /* the bootstrap parser keeps every record */
+    res->failures = stats.failures;
+    res->error_records = array_size(&errors);
+
+    delete_errors(&errors, 0);
+    array_deinit(&errors);
+    input_buffer_destroy(ib);
+    fclose(f);
+
+    return grammar != 0;
+} /* parse_grammar() */
+
+/* runs */
+
+/** Parses FNAME REPEATS times, keeping the best time and the counters of the last parse. */
+static void bench(parse_ft parse, char *fname, int repeats, result_t *res)
+{
+    double secs;
+    int i;
+
+    res->seconds = -1;
+    for (i = 0; i < repeats; ++i)
+    {
+        if (!(res->ok = parse(fname, res, &secs)))
+            return;
+        if (res->seconds < 0 || secs < res->seconds)
+            res->seconds = secs;
+    }
+} /* bench() */
+
+/** Benchmarks PARSE in a child process where there is fork(), so that the peak RSS is the run's own. */
+static void bench_isolated(parse_ft parse, char *fname, int repeats, result_t *res)
+{
+#ifndef WIN32
+    struct rusage usage;
+    int fds[2], status;
+    pid_t pid;
+
+    memset(res, 0, sizeof(result_t));
+    fflush(stdout);
+
+    if (pipe(fds) == 0)
+    {
+        if ((pid = fork()) == 0)
+        {
+            close(fds[0]);
+            bench(parse, fname, repeats, res);
+            if (write(fds[1], res, sizeof(result_t)) != sizeof(result_t))
+                _exit(1);
+            _exit(0);
+        }
+
+        close(fds[1]);
+        if (pid > 0)
+        {
+            if (read(fds[0], res, sizeof(result_t)) != sizeof(result_t))
+                res->ok = 0;
+            close(fds[0]);
+
+            if (wait4(pid, &status, 0, &usage) == pid)
+            {
+#ifdef __APPLE__
+                res->peak_rss_kb = usage.ru_maxrss / 1024; /* in bytes on Mac OS */
+#else
+                res->peak_rss_kb = usage.ru_maxrss;
+#endif
+            }
+            else
+            {
+                res->peak_rss_kb = -1;
+            }
+            return;
+        }
+        close(fds[0]);
+    }
+#endif
+
+    memset(res, 0, sizeof(result_t));
+    bench(parse, fname, repeats, res);
+    res->peak_rss_kb = -1;
+} /* bench_isolated() */
+
+static double mb_per_s(const run_t *run)
+{
+    return run->res.seconds > 0 ? run->bytes / run->res.seconds / (1024 * 1024) : 0;
+} /* mb_per_s() */
+
+static double hit_rate(const run_t *run)
+{
+    return run->res.memo_lookups ? (double) run->res.memo_hits / run->res.memo_lookups : 0;
+} /* hit_rate() */
+
+static void print_run(const run_t *run)
+{
+    printf("%-13s %11ld %3s %9.1f %11lld %11lld %11lld %6.3f %11lld %11lld %11lld %6lld %10ld\n",
+        run->parser, run->bytes, run->res.ok ? "ok" : "bad", mb_per_s(run), run->res.nodes, run->res.nodes_built,
+        run->res.memo_lookups, hit_rate(run), run->res.memo_records, run->res.memo_peak, run->res.failures,
+        run->res.error_records, run->res.peak_rss_kb);
+} /* print_run() */
+
+static int write_json(const char *fname, const run_t *runs, int num_runs, int repeats)
+{
+    FILE *f;
+    int i;
+
+    if (!(f = fopen(fname, "w")))
+        return 0;
+
+    fprintf(f, "{\n  \"benchmark\": \"pegbench\",\n  \"repeats\": %d,\n  \"runs\": [", repeats);
+
+    for (i = 0; i < num_runs; ++i)
+    {
+        const run_t *run = &runs[i];
+
+        fprintf(f, "%s\n    {\"parser\": \"%s\", \"bytes\": %ld, \"ok\": %s, \"seconds\": %.6f, \"mb_per_s\": %.3f, "
+            "\"nodes\": %lld, \"nodes_built\": %lld, \"memo_lookups\": %lld, \"memo_hits\": %lld, \"memo_hit_rate\": %.4f, "
+            "\"memo_records\": %lld, \"memo_peak\": %lld, \"failures\": %lld, \"error_records\": %lld, \"peak_rss_kb\": %ld}",
+            i ? "," : "", run->parser, run->bytes, run->res.ok ? "true" : "false", run->res.seconds, mb_per_s(run),
+            run->res.nodes, run->res.nodes_built, run->res.memo_lookups, run->res.memo_hits, hit_rate(run),
+            run->res.memo_records, run->res.memo_peak, run->res.failures, run->res.error_records, run->res.peak_rss_kb);
+    }
+
+    fprintf(f, "\n  ]\n}\n");
+    fclose(f);
+    return 1;
+} /* write_json() */
+
+/** Benchmarks PARSE on an input of each size in the comma-separated SIZES, written from BLOCK. */
+static int bench_sizes(const char *parser, parse_ft parse, const char *block, const char *sizes,
+                       char *fname, int repeats, run_t *runs, int num_runs)
+{
+    const char *cur = sizes;
+
+    while (*cur && num_runs < MAX_RUNS)
+    {
+        run_t *run = &runs[num_runs];
+        long size = parse_size(cur);
+
+        if (size <= 0 || size > MAX_SIZE)
+        {
+            fprintf(stderr, "sizes must be from 1 byte to 1G: %s\n", sizes);
+            exit(1);
+        }
+
+        if ((run->bytes = write_blocks(fname, block, size)) < 0)
+        {
+            fprintf(stderr, "unable to write %s\n", fname);
+            exit(1);
+        }
+
+        run->parser = parser;
+        bench_isolated(parse, fname, repeats, &run->res);
+        print_run(run);
+        ++num_runs;
+
+        if (!(cur = strchr(cur, ',')))
+            break;
+        ++cur;
+    }
+
+    remove(fname);
+    return num_runs;
+} /* bench_sizes() */
+
+int main(int argc, char **argv)
+{
+    const char *json_fname = "pegbench.json", *sizes = DEFAULT_SIZES, *stream_sizes = DEFAULT_STREAM_SIZES;
+    const char *grammar_sizes = DEFAULT_GRAMMAR_SIZES;
+    const char *dir = ".";
+    char kscope_fname[1024], grammar_fname[1024];
+    run_t runs[MAX_RUNS];
+    int i, num_runs = 0, repeats = DEFAULT_REPEATS, failed = 0;
+
+    for (i = 1; i + 1 < argc; i += 2)
+    {
+        if (!strcmp(argv[i], "-o"))
+            json_fname = argv[i + 1];
+        else if (!strcmp(argv[i], "-s"))
+            sizes = argv[i + 1];
+        else if (!strcmp(argv[i], "-m"))
+            stream_sizes = argv[i + 1];
+        else if (!strcmp(argv[i], "-g"))
+            grammar_sizes = argv[i + 1];
+        else if (!strcmp(argv[i], "-r"))
+            repeats = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "-t"))
+            dir = argv[i + 1];
+        else
+            break;
+    }
+
+    if (i < argc || repeats < 1)
+    {
+        fprintf(stderr, "usage: pegbench [-o results.json] [-s sizes] [-m stream_sizes] [-g grammar_sizes] [-r repeats] [-t scratch_dir]\n");
+        return 1;
+    }
+
+    sprintf(kscope_fname, "%.1000s/pegbench.ks", dir);
+    sprintf(grammar_fname, "%.1000s/pegbench.peg", dir);
+
+    printf("best of %d; counters from the last parse; RSS in KB\n", repeats);
+    printf("%-13s %11s %3s %9s %11s %11s %11s %6s %11s %11s %11s %6s %10s\n", "parser", "bytes", "", "MB/s", "nodes",
+        "built", "memo looks", "hits", "memo recs", "memo peak", "failures", "errors", "peak RSS");
+
+    num_runs = bench_sizes("kscope", parse_kscope, s_kscope_block, sizes, kscope_fname, repeats, runs, num_runs);
+    num_runs = bench_sizes("kscope_stream", parse_kscope_stream, s_kscope_block, stream_sizes, kscope_fname, repeats, runs, num_runs);
+    num_runs = bench_sizes("peg", parse_grammar, s_grammar_block, grammar_sizes, grammar_fname, repeats, runs, num_runs);
+
+    for (i = 0; i < num_runs; ++i)
+        failed |= !runs[i].res.ok;
+
+    if (!write_json(json_fname, runs, num_runs, repeats))
+    {
+        fprintf(stderr, "unable to write %s\n", json_fname);
+        return 1;
+    }
+
+    printf("results written to %s\n", json_fname);
+    return failed;
+}
@@ -0,0 +1,313 @@
+/** \file tree_walk.c
+ *
+ * Times traversal, copy and destroy of large syntax trees built with the generated kscope
+ * node functions, against the recursive versions those functions used to have.  Two shapes
+ * are built: a bushy tree, as a statement list produces, and a left-nested chain, as a long
+ * sum does.  Each shape is built and timed in a process of its own, so that the heap the
+ * first leaves behind does not slow the second, and the recursive versions run in a further
+ * child process, since on the chain they overflow the C stack.
+ *
+ * Usage: tree_walk [num_nodes]
+ */
+
+#include "kscope.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef WIN32
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#define DEFAULT_NUM_NODES 10000000
+#define BUSHY_FANOUT 4
+#define REPEATS 3
+
+static double seconds_since(clock_t start)
+{
+    return (double) (clock() - start) / CLOCKS_PER_SEC;
+} /* seconds_since() */
+
+static void set_children(kscope_syntax_node_t *node, int num)
+{
+    node->child = (kscope_syntax_node_t **) calloc(num + 1, sizeof(kscope_syntax_node_t *));
+    node->children = num;
+} /* set_children() */
+
+/** Builds a complete tree of num_nodes nodes in breadth-first order, BUSHY_FANOUT children to a node. */
+static kscope_syntax_node_t *build_bushy(long num_nodes)
+{
+    kscope_syntax_node_t **nodes = (kscope_syntax_node_t **) calloc(num_nodes, sizeof(kscope_syntax_node_t *));
+    kscope_syntax_node_t *root;
+    long i, j, next = 1;
+
+    for (i = 0; i < num_nodes; ++i)
+        nodes[i] = kscope_syntax_node_create(KSCOPE_EXPR_NODE, (int) i, (int) i + 1, 0);
+
+    for (i = 0; i < num_nodes && next < num_nodes; ++i)
+    {
+        int num = (int) (num_nodes - next < BUSHY_FANOUT ? num_nodes - next : BUSHY_FANOUT);
+
+        set_children(nodes[i], num);
+        for (j = 0; j < num; ++j)
+            nodes[i]->child[j] = nodes[next++];
+    }
+
+    root = nodes[0];
+    free(nodes);
+    return root;
+} /* build_bushy() */
+
+/** Builds ADDEXPR <- ADDEXPR ADDOP MULEXPR / MULEXPR nested num_nodes / 3 deep, as 1+1+...+1 parses. */
+static kscope_syntax_node_t *build_chain(long num_nodes)
+{
+    kscope_syntax_node_t *cur, *prev = 0;
+    long i;
+
+    for (i = 0; i + 3 <= num_nodes; i += 3)
+    {
+        cur = kscope_syntax_node_create(KSCOPE_ADDEXPR_NODE, 0, (int) i + 3, 0);
+
+        if (prev)
+        {
+            set_children(cur, 3);
+            cur->child[0] = prev;
+            cur->child[1] = kscope_syntax_node_create(KSCOPE_ADDOP_NODE, (int) i + 1, (int) i + 2, 0);
+            cur->child[2] = kscope_syntax_node_create(KSCOPE_MULEXPR_NODE, (int) i + 2, (int) i + 3, 0);
+        }
+        else
+        {
+            set_children(cur, 1);
+            cur->child[0] = kscope_syntax_node_create(KSCOPE_MULEXPR_NODE, 0, 3, 0);
+        }
+
+        prev = cur;
+    }
+
+    return prev;
+} /* build_chain() */
+
+/* the recursive implementations the generated code replaced */
+
+static void recursive_traverse(kscope_syntax_node_t *root, void *data, kscope_syntax_node_process_ft entry_func, kscope_syntax_node_process_ft exit_func)
+{
+    kscope_syntax_node_t **cur;
+
+    if (entry_func && entry_func(root, data))
+        return;
+
+    if (root->child)
+        for (cur = root->child; *cur; ++cur)
+            recursive_traverse(*cur, data, entry_func, exit_func);
+
+    if (exit_func)
+        exit_func(root, data);
+} /* recursive_traverse() */
+
+static kscope_syntax_node_t *recursive_copy(kscope_syntax_node_t *node)
+{
+    kscope_syntax_node_t *copy = kscope_syntax_node_create(node->type, node->begin, node->end, node->ib);
+    int i;
+
+    copy->first_line = node->first_line;
+    copy->last_line = node->last_line;
+
+    if (node->children)
+    {
+        set_children(copy, node->children);
+        for (i = 0; i < node->children; ++i)
+            copy->child[i] = recursive_copy(node->child[i]);
+    }
+
+    return copy;
+} /* recursive_copy() */
+
+static void recursive_destroy(kscope_syntax_node_t *node)
+{
+    kscope_syntax_node_t **cur;
+
+    if (--node->refs > 0)
+        return;
+
+    if (node->child)
+    {
+        for (cur = node->child; *cur; ++cur)
+            recursive_destroy(*cur);
+        free(node->child);
+    }
+
+    free(node);
+} /* recursive_destroy() */
+
+static int count_enter(kscope_syntax_node_t *node, void *data)
+{
+    (void) node;
+    ++*(long *) data;
+    return 0;
+} /* count_enter() */
+
+static int count_exit(kscope_syntax_node_t *node, void *data)
+{
+    (void) node;
+    --*(long *) data;
+    return 0;
+} /* count_exit() */
+
+/* read through volatile pointers, so that the compiler cannot specialise the recursive */
+/* traverse for these callbacks and inline them, which it cannot do for the generated one */
+static kscope_syntax_node_process_ft volatile enter_callback = count_enter, exit_callback = count_exit;
+
+typedef struct _timings_t
+{
+    double traverse, copy, destroy;
+}
+timings_t;
+
+static void keep_best(double *best, double secs)
+{
+    if (*best < 0 || secs < *best)
+        *best = secs;
+} /* keep_best() */
+
+static void time_iterative(kscope_syntax_node_t *root, timings_t *best)
+{
+    kscope_syntax_node_t *copy;
+    long count = 0;
+    clock_t start;
+
+    start = clock();
+    kscope_syntax_node_traverse_preorder(root, &count, enter_callback, exit_callback);
+    keep_best(&best->traverse, seconds_since(start));
+
+    start = clock();
+    copy = kscope_syntax_node_copy(root);
+    keep_best(&best->copy, seconds_since(start));
+
+    start = clock();
+    kscope_syntax_node_destroy(copy);
+    keep_best(&best->destroy, seconds_since(start));
+} /* time_iterative() */
+
+static void time_recursive(kscope_syntax_node_t *root, timings_t *best)
+{
+    kscope_syntax_node_t *copy;
+    long count = 0;
+    clock_t start;
+
+    start = clock();
+    recursive_traverse(root, &count, enter_callback, exit_callback);
+    keep_best(&best->traverse, seconds_since(start));
+
+    start = clock();
+    copy = recursive_copy(root);
+    keep_best(&best->copy, seconds_since(start));
+
+    start = clock();
+    recursive_destroy(copy);
+    keep_best(&best->destroy, seconds_since(start));
+} /* time_recursive() */
+
+static void print_timings(const char *label, const timings_t *t)
+{
+    printf("  %-10s %10.3f %10.3f %10.3f\n", label, t->traverse, t->copy, t->destroy);
+} /* print_timings() */
+
+/** Runs the recursive versions in a child process, so that a stack overflow can be reported. */
+static void bench_recursive(kscope_syntax_node_t *root)
+{
+#ifndef WIN32
+    timings_t recursive = { -1, -1, -1 };
+    int i, status;
+    pid_t pid;
+
+    fflush(stdout);
+
+    if ((pid = fork()) == 0)
+    {
+        /* the child's first copy pays for copying the parent's heap pages */
+        recursive_destroy(recursive_copy(root));
+
+        for (i = 0; i < REPEATS; ++i)
+            time_recursive(root, &recursive);
+
+        print_timings("recursive", &recursive);
+        fflush(stdout);
+        _exit(0);
+    }
+
+    if (pid < 0 || waitpid(pid, &status, 0) != pid)
+        printf("  %-10s could not run\n", "recursive");
+    else if (WIFSIGNALED(status))
+        printf("  %-10s killed by signal %d (stack overflow)\n", "recursive", WTERMSIG(status));
+#else
+    printf("  %-10s not run\n", "recursive");
+#endif
+} /* bench_recursive() */
+
+static void bench_shape(const char *shape, kscope_syntax_node_t *root)
+{
+    timings_t iterative = { -1, -1, -1 };
+    long count = 0;
+    int i;
+
+    kscope_syntax_node_traverse_preorder(root, &count, count_enter, NULL);
+    printf("%-7s %10ld nodes\n", shape, count);
+
+    /* fault in the heap a copy needs, so neither version pays for it */
+    kscope_syntax_node_destroy(kscope_syntax_node_copy(root));
+
+    /* best of several, since one copy of the tree fills the caches many times over */
+    for (i = 0; i < REPEATS; ++i)
+        time_iterative(root, &iterative);
+
+    print_timings("iterative", &iterative);
+    bench_recursive(root);
+} /* bench_shape() */
+
+/** Builds, times and destroys one shape, in a child process where fork() is available. */
+static void run_shape(const char *shape, kscope_syntax_node_t *(*build)(long), long num_nodes)
+{
+    kscope_syntax_node_t *root;
+#ifndef WIN32
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+
+    if ((pid = fork()) != 0)
+    {
+        if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status))
+            printf("%-7s could not run\n", shape);
+        return;
+    }
+#endif
+
+    root = build(num_nodes);
+    bench_shape(shape, root);
+    kscope_syntax_node_destroy(root);
+
+#ifndef WIN32
+    fflush(stdout);
+    _exit(0);
+#endif
+} /* run_shape() */
+
+int main(int argc, char **argv)
+{
+    long num_nodes = DEFAULT_NUM_NODES;
+
+    if (argc > 1)
+        num_nodes = atol(argv[1]);
+    if (num_nodes < 3)
+        num_nodes = 3;
+
+    printf("%-12s %10s %10s %10s  (seconds)\n", "", "traverse", "copy", "destroy");
+
+    run_shape("bushy", build_bushy, num_nodes);
+    run_shape("chain", build_chain, num_nodes);
+
+    return 0;
+}
@@ -0,0 +1,315 @@
+/** \file vm_backend.c
+ *
+ * Compares the two parsergen backends on the kscope grammar: kscope.c is generated as C
+ * functions, kscope_vm.c from the same grammar with -vm as bytecode for one interpreter.  A
+ * large synthetic kscope source is parsed with each, checking that the trees have the same
+ * nodes, and the best throughput of several runs is reported together with the instructions
+ * and L1 instruction cache misses of a run where the kernel lets them be counted.
+ *
+ * Usage: vm_backend [mb] [repeats] [scratch_file]
+ */
+
+#include "kscope.h"
+#include "kscope_vm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define DEFAULT_MB 2
+#define DEFAULT_REPEATS 3
+
+/** A block of kscope source covering the constructs in kscope.peg; %d makes the names unique. */
+static const char *s_block =
+    "# block %d\n"
+    "def binary : 1 (x y) y;\n"
+    "def fib%d(x)\n"
+    "  if (x < 3) then\n"
+    "    1\n"
+    "  else\n"
+    "    fib%d(x-1)+fib%d(x-2);\n"
+    "def fibi%d(x)\n"
+    "  var a = 1, b = 1, c in\n"
+    "  (for i = 3, i < x in\n"
+    "     c = a + b :\n"
+    "     a = b :\n"
+    "     b = c) :\n"
+    "  b;\n"
+    "extern printd%d(x);\n"
+    "fibi%d(10);\n"
+    "def fod%d(a b) a*a + 2*a*b + b*b;\n";
+
+static long write_source(const char *fname, long num_bytes)
+{
+    FILE *f;
+    long written = 0;
+    int i = 0;
+
+    if (!(f = fopen(fname, "w")))
+        return -1;
+
+    while (written < num_bytes)
+    {
+        written += fprintf(f, s_block, i, i, i, i, i, i, i, i);
+        ++i;
+    }
+
+    fclose(f);
+    return written;
+} /* write_source() */
+
+static double now(void)
+{
+#ifdef WIN32
+    return (double) clock() / CLOCKS_PER_SEC;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+} /* now() */
+
+/* hardware counters */
+
+enum counter_et
+{
+    COUNT_INSTRUCTIONS = 0,
+    COUNT_ICACHE_MISSES = 1,
+
+    NUM_COUNTERS = 2
+};
+
+typedef struct _counters_t
+{
+    int fd[NUM_COUNTERS];       /* -1 where the counter could not be opened */
+    long long value[NUM_COUNTERS];
+}
+counters_t;
+
+static void counters_open(counters_t *c)
+{
+    int i;
+
+#ifdef __linux__
+    struct perf_event_attr attr;
+
+    for (i = 0; i < NUM_COUNTERS; ++i)
+    {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        if (i == COUNT_INSTRUCTIONS)
+        {
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        }
+        else
+        {
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1I | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        }
+
+        c->fd[i] = (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#else
+    for (i = 0; i < NUM_COUNTERS; ++i)
+        c->fd[i] = -1;
+#endif
+} /* counters_open() */
+
+static void counters_start(counters_t *c)
+{
+    int i;
+
+    for (i = 0; i < NUM_COUNTERS; ++i)
+    {
+        c->value[i] = -1;
+#ifdef __linux__
+        if (c->fd[i] >= 0)
+        {
+            ioctl(c->fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(c->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+} /* counters_start() */
+
+static void counters_stop(counters_t *c)
+{
+#ifdef __linux__
+    int i;
+
+    for (i = 0; i < NUM_COUNTERS; ++i)
+    {
+        if (c->fd[i] < 0)
+            continue;
+
+        ioctl(c->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(c->fd[i], &c->value[i], sizeof(long long)) != sizeof(long long))
+            c->value[i] = -1;
+    }
+#endif
+} /* counters_stop() */
+
+static void counters_close(counters_t *c)
+{
+#ifdef __linux__
+    int i;
+
+    for (i = 0; i < NUM_COUNTERS; ++i)
+    {
+        if (c->fd[i] >= 0)
+            close(c->fd[i]);
+    }
+#endif
+} /* counters_close() */
+
+static void print_count(long long value)
+{
+    if (value < 0)
+        printf(" %14s", "n/a");
+    else
+        printf(" %14lld", value);
+} /* print_count() */
+
+/* the two parsers */
+
+static int count_node(kscope_syntax_node_t *node, void *data)
+{
+    (void) node;
+    ++*(long *) data;
+    return 0;
+} /* count_node() */
+
+static int count_vm_node(kscope_vm_syntax_node_t *node, void *data)
+{
+    (void) node;
+    ++*(long *) data;
+    return 0;
+} /* count_vm_node() */
+
+/** Parses FNAME with the C backend; returns 1 and the number of nodes if it parsed. */
+static int parse_c(char *fname, long *nodes)
+{
+    kscope_syntax_node_t *root = 0;
+    void *ib = 0, *error_list = 0;
+    int ok;
+
+    *nodes = 0;
+    if ((ok = kscope_parse_mmap(fname, NULL, &root, &ib, &error_list)))
+    {
+        kscope_syntax_node_traverse_preorder(root, nodes, count_node, NULL);
+        kscope_syntax_node_destroy(root);
+    }
+
+    if (error_list)
+        kscope_destroy_error_list(error_list);
+    if (ib)
+        kscope_destroy_input_buffer(ib);
+
+    return ok;
+} /* parse_c() */
+
+static int parse_vm(char *fname, long *nodes)
+{
+    kscope_vm_syntax_node_t *root = 0;
+    void *ib = 0, *error_list = 0;
+    int ok;
+
+    *nodes = 0;
+    if ((ok = kscope_vm_parse_mmap(fname, NULL, &root, &ib, &error_list)))
+    {
+        kscope_vm_syntax_node_traverse_preorder(root, nodes, count_vm_node, NULL);
+        kscope_vm_syntax_node_destroy(root);
+    }
+
+    if (error_list)
+        kscope_vm_destroy_error_list(error_list);
+    if (ib)
+        kscope_vm_destroy_input_buffer(ib);
+
+    return ok;
+} /* parse_vm() */
+
+typedef int (*parse_ft)(char *fname, long *nodes);
+
+/** Runs PARSE REPEATS times, keeping the best time and the counters of the last run; returns the nodes, or -1. */
+static long bench(const char *label, parse_ft parse, char *fname, long bytes, int repeats, counters_t *c)
+{
+    double start, secs, best = -1;
+    long nodes = -1;
+    int i;
+
+    for (i = 0; i < repeats; ++i)
+    {
+        counters_start(c);
+        start = now();
+        if (!parse(fname, &nodes))
+            return -1;
+        secs = now() - start;
+        counters_stop(c);
+
+        if (best < 0 || secs < best)
+            best = secs;
+    }
+
+    printf("%-8s %10.3f %10.1f", label, best, bytes / best / (1024 * 1024));
+    print_count(c->value[COUNT_INSTRUCTIONS]);
+    print_count(c->value[COUNT_ICACHE_MISSES]);
+    printf("\n");
+
+    return nodes;
+} /* bench() */
+
+int main(int argc, char **argv)
+{
+    long mb = DEFAULT_MB, bytes, c_nodes, vm_nodes;
+    int repeats = DEFAULT_REPEATS;
+    char *fname = "vm_backend.ks";
+    counters_t counters;
+
+    if (argc > 1)
+        mb = atol(argv[1]);
+    if (argc > 2)
+        repeats = atoi(argv[2]);
+    if (argc > 3)
+        fname = argv[3];
+
+    if ((bytes = write_source(fname, mb * 1024 * 1024)) < 0)
+    {
+        fprintf(stderr, "unable to write %s\n", fname);
+        return 1;
+    }
+
+    counters_open(&counters);
+
+    printf("%ld bytes, best of %d\n", bytes, repeats);
+    printf("%-8s %10s %10s %14s %14s\n", "backend", "parse (s)", "MB/s", "instructions", "L1i misses");
+
+    c_nodes = bench("c", parse_c, fname, bytes, repeats, &counters);
+    vm_nodes = bench("vm", parse_vm, fname, bytes, repeats, &counters);
+
+    counters_close(&counters);
+    remove(fname);
+
+    if (c_nodes < 0 || c_nodes != vm_nodes)
+    {
+        fprintf(stderr, "the backends disagree: %ld nodes from c, %ld from vm\n", c_nodes, vm_nodes);
+        return 1;
+    }
+
+    printf("%ld nodes from each\n", c_nodes);
+    return 0;
+}
@@ -0,0 +1,869 @@
+
+/*
+ * Copyright (c) 2006, The Narwhal Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    * Neither the name of the Narwhal Project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/** \file lower.c
+ *
+ * Lowers the rule IR to LLVM IR, one function per rule, and compiles it with ORC's LLJIT.  The
+ * code does what the parsing macros of a generated parser do: bytes are matched inline, and
+ * building nodes, memoizing and recording failures are left to the runtime functions in
+ * pegjit.c, which the code calls through their addresses.
+ */
+
+#include "pegjit_internal.h"
+#include "internal.h"
+
+#include <llvm-c/Analysis.h>
+#include <llvm-c/Core.h>
+#include <llvm-c/Error.h>
+#include <llvm-c/LLJIT.h>
+#include <llvm-c/Orc.h>
+#include <llvm-c/Target.h>
+#include <llvm-c/Transforms/PassManagerBuilder.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#define START_SYMBOL "pegjit_start"
+
+typedef struct _lower_t
+{
+    LLVMContextRef ctx;
+    LLVMModuleRef mod;
+    LLVMBuilderRef b;
+    LLVMBuilderRef alloca_b;    /* adds variables to the entry block of the current rule */
+
+    LLVMTypeRef i1, i8, i32, i64, i8p, i32p, nodepp, run_type, runp;
+    LLVMTypeRef rule_type, enter_type, grow_type, leave_type, push_type, truncate_type;
+    LLVMValueRef enter_fn, grow_fn, leave_fn, push_fn, truncate_fn, token_fn;
+
+    const array_t *rule_records;
+    LLVMValueRef *rules;        /* per rule: its function */
+    LLVMValueRef *seeds;        /* per rule: the body a left-recursive rule grows its seed with */
+    array_t classes;            /* class_rec_t */
+
+    /* the rule being lowered */
+    LLVMValueRef fn, run, buf, len, pos, end_tmp, node_tmp;
+}
+lower_t;
+
+typedef struct _class_rec_t
+{
+    const wchar_t *str;
+    LLVMValueRef table;         /* [256 x i8]: 1 for the members */
+}
+class_rec_t;
+
+
+static int find_rule(const array_t *rule_records, const wchar_t *rule_name)
+{
+    int i;
+
+    for (i = 0; i < array_size(rule_records); ++i)
+    {
+        if (wcscmp((*(rule_rec_t **) array_item(rule_records, i))->rule_name, rule_name) == 0)
+            return i;
+    }
+
+    return -1;
+} /* find_rule() */
+
+
+/* whether a cut in EXP commits the construct around EXP; the constructs with a cut of their own stop it */
+static int exp_cuts(const rule_exp_t *exp)
+{
+    switch (exp->type)
+    {
+    case RULE_EXP_CUT:
+        return 1;
+    case RULE_EXP_SEQ:
+        return exp_cuts(exp->left) || exp_cuts(exp->right);
+    case RULE_EXP_HIDE:
+        return exp_cuts(exp->left);
+    }
+
+    return 0;
+} /* exp_cuts() */
+
+
+static LLVMValueRef const_i32(lower_t *l, int value)
+{
+    return LLVMConstInt(l->i32, (unsigned long long) (long long) value, 1);
+}
+
+/* a runtime function, called through its address */
+static LLVMValueRef runtime_fn(lower_t *l, LLVMTypeRef type, void (*addr)(void))
+{
+    LLVMValueRef value = LLVMConstInt(l->i64, (unsigned long long) (uintptr_t) addr, 0);
+    return LLVMConstIntToPtr(value, LLVMPointerType(type, 0));
+}
+
+static LLVMValueRef new_var(lower_t *l, LLVMTypeRef type, const char *name)
+{
+    return LLVMBuildAlloca(l->alloca_b, type, name);
+}
+
+static LLVMBasicBlockRef new_block(lower_t *l, const char *name)
+{
+    return LLVMAppendBasicBlockInContext(l->ctx, l->fn, name);
+}
+
+static LLVMValueRef load_pos(lower_t *l)
+{
+    return LLVMBuildLoad2(l->b, l->i32, l->pos, "pos");
+}
+
+static void store_pos(lower_t *l, LLVMValueRef pos)
+{
+    LLVMBuildStore(l->b, pos, l->pos);
+}
+
+/* the fields of pegjit_run_t the compiled rules use in place */
+enum run_field_et
+{
+    RUN_NUM_CHILDREN = 0,
+    RUN_LOOKAHEADS   = 1,
+    RUN_OPEN_CHOICES = 2,
+    RUN_COMMIT_POS   = 3,
+
+    NUM_RUN_FIELDS   = 4
+};
+
+static LLVMValueRef run_field(lower_t *l, int index)
+{
+    return LLVMBuildStructGEP2(l->b, l->run_type, l->run, index, "");
+}
+
+static LLVMValueRef load_mark(lower_t *l)
+{
+    return LLVMBuildLoad2(l->b, l->i32, run_field(l, RUN_NUM_CHILDREN), "mark");
+}
+
+static void add_to_field(lower_t *l, int index, int delta)
+{
+    LLVMValueRef field = run_field(l, index);
+    LLVMValueRef value = LLVMBuildLoad2(l->b, l->i32, field, "");
+
+    LLVMBuildStore(l->b, LLVMBuildAdd(l->b, value, const_i32(l, delta), ""), field);
+} /* add_to_field() */
+
+/* a choice point counts itself open until it is left or cut, as in the generated parsers */
+static void open_choice(lower_t *l, LLVMValueRef cut)
+{
+    add_to_field(l, RUN_OPEN_CHOICES, 1);
+    if (cut)
+        LLVMBuildStore(l->b, LLVMConstInt(l->i1, 0, 0), cut);
+} /* open_choice() */
+
+static void close_choice(lower_t *l, LLVMValueRef cut)
+{
+    LLVMBasicBlockRef close, done;
+
+    if (!cut)
+    {
+        add_to_field(l, RUN_OPEN_CHOICES, -1);
+        return;
+    }
+
+    close = new_block(l, "close");
+    done = new_block(l, "closed");
+    LLVMBuildCondBr(l->b, LLVMBuildLoad2(l->b, l->i1, cut, ""), done, close);
+
+    LLVMPositionBuilderAtEnd(l->b, close);
+    add_to_field(l, RUN_OPEN_CHOICES, -1);
+    LLVMBuildBr(l->b, done);
+
+    LLVMPositionBuilderAtEnd(l->b, done);
+} /* close_choice() */
+
+/* drops the children above MARK; the runtime is only called when there are some */
+static void truncate_children(lower_t *l, LLVMValueRef mark)
+{
+    LLVMBasicBlockRef drop = new_block(l, "drop"), done = new_block(l, "dropped");
+    LLVMValueRef args[2];
+
+    LLVMBuildCondBr(l->b, LLVMBuildICmp(l->b, LLVMIntSGT, load_mark(l), mark, ""), drop, done);
+
+    LLVMPositionBuilderAtEnd(l->b, drop);
+    args[0] = l->run;
+    args[1] = mark;
+    LLVMBuildCall2(l->b, l->truncate_type, l->truncate_fn, args, 2, "");
+    LLVMBuildBr(l->b, done);
+
+    LLVMPositionBuilderAtEnd(l->b, done);
+} /* truncate_children() */
+
+/* branches to FAIL unless COND, going on in a new block */
+static void fail_unless(lower_t *l, LLVMValueRef cond, LLVMBasicBlockRef fail)
+{
+    LLVMBasicBlockRef next = new_block(l, "");
+
+    LLVMBuildCondBr(l->b, cond, next, fail);
+    LLVMPositionBuilderAtEnd(l->b, next);
+} /* fail_unless() */
+
+/* fails unless COUNT more bytes are left at POS */
+static void need_bytes(lower_t *l, LLVMValueRef pos, int count, LLVMBasicBlockRef fail)
+{
+    LLVMValueRef avail = LLVMBuildSub(l->b, l->len, pos, "");
+    fail_unless(l, LLVMBuildICmp(l->b, LLVMIntSGE, avail, const_i32(l, count), ""), fail);
+}
+
+static LLVMValueRef load_byte(lower_t *l, LLVMValueRef pos)
+{
+    LLVMValueRef idx = LLVMBuildSExt(l->b, pos, l->i64, "");
+    LLVMValueRef addr = LLVMBuildGEP2(l->b, l->i8, l->buf, &idx, 1, "");
+    return LLVMBuildLoad2(l->b, l->i8, addr, "byte");
+}
+
+static LLVMValueRef class_table(lower_t *l, const wchar_t *str)
+{
+    class_rec_t rec;
+    LLVMValueRef bytes[256];
+    const wchar_t *cur;
+    int i;
+
+    for (i = 0; i < array_size(&l->classes); ++i)
+    {
+        class_rec_t *cur = (class_rec_t *) array_item(&l->classes, i);
+        if (wcscmp(cur->str, str) == 0)
+            return cur->table;
+    }
+
+    for (i = 0; i < 256; ++i)
+        bytes[i] = LLVMConstInt(l->i8, 0, 0);
+
+    /* members read from the grammar as sign-extended bytes still denote those bytes; the input */
+    /* is bytes, so members above 255 never match */
+    for (cur = str; *cur; ++cur)
+    {
+        wchar_t ch = *cur;
+
+        if (ch < 0 && ch >= -128)
+            ch &= 0xff;
+        if (ch >= 0 && ch < 256)
+            bytes[ch] = LLVMConstInt(l->i8, 1, 0);
+    }
+
+    rec.str = str;
+    rec.table = LLVMAddGlobal(l->mod, LLVMArrayType(l->i8, 256), "class");
+    LLVMSetInitializer(rec.table, LLVMConstArray(l->i8, bytes, 256));
+    LLVMSetGlobalConstant(rec.table, 1);
+    LLVMSetLinkage(rec.table, LLVMPrivateLinkage);
+    LLVMSetUnnamedAddress(rec.table, LLVMGlobalUnnamedAddr);
+    array_add(&l->classes, &rec);
+
+    return rec.table;
+} /* class_table() */
+
+static void lower_exp(lower_t *l, const rule_exp_t *exp, LLVMValueRef cut, LLVMBasicBlockRef fail);
+
+/* fails if CUT was set by the choice that just failed */
+static void fail_if_cut(lower_t *l, LLVMValueRef cut, LLVMBasicBlockRef fail)
+{
+    if (cut)
+        fail_unless(l, LLVMBuildNot(l->b, LLVMBuildLoad2(l->b, l->i1, cut, ""), ""), fail);
+} /* fail_if_cut() */
+
+/* the iterations of a repetition after the first; an iteration that fails is undone, and fails */
+/* the repetition if it was cut */
+static void lower_loop(lower_t *l, const rule_exp_t *body, LLVMBasicBlockRef fail)
+{
+    LLVMBasicBlockRef head = new_block(l, "iter"), iter_fail = new_block(l, "iter_fail"), done;
+    LLVMValueRef cut = exp_cuts(body) ? new_var(l, l->i1, "cut") : 0;
+    LLVMValueRef start, mark;
+
+    LLVMBuildBr(l->b, head);
+    LLVMPositionBuilderAtEnd(l->b, head);
+    start = load_pos(l);
+    mark = load_mark(l);
+    open_choice(l, cut);
+
+    lower_exp(l, body, cut, iter_fail);
+    close_choice(l, cut);
+    LLVMBuildBr(l->b, head);
+
+    LLVMPositionBuilderAtEnd(l->b, iter_fail);
+    close_choice(l, cut);
+    truncate_children(l, mark);
+    store_pos(l, start);
+    fail_if_cut(l, cut, fail);
+
+    done = new_block(l, "iter_done");
+    LLVMBuildBr(l->b, done);
+    LLVMPositionBuilderAtEnd(l->b, done);
+} /* lower_loop() */
+
+/* commits to the innermost choice; with no choice left open anywhere, nothing before the */
+/* current offset will be parsed again, and its memo records can be evicted */
+static void lower_cut(lower_t *l, LLVMValueRef cut)
+{
+    LLVMBasicBlockRef commit = new_block(l, "commit"), done = new_block(l, "committed");
+    LLVMValueRef pos, field;
+
+    if (cut)
+    {
+        close_choice(l, cut);
+        LLVMBuildStore(l->b, LLVMConstInt(l->i1, 1, 0), cut);
+    }
+
+    field = LLVMBuildLoad2(l->b, l->i32, run_field(l, RUN_OPEN_CHOICES), "");
+    pos = load_pos(l);
+    LLVMBuildCondBr(l->b, LLVMBuildICmp(l->b, LLVMIntEQ, field, const_i32(l, 0), ""), commit, done);
+
+    LLVMPositionBuilderAtEnd(l->b, commit);
+    field = run_field(l, RUN_COMMIT_POS);
+    LLVMBuildStore(l->b, LLVMBuildSelect(l->b, LLVMBuildICmp(l->b, LLVMIntSGT, pos, LLVMBuildLoad2(l->b, l->i32, field, ""), ""),
+                                         pos, LLVMBuildLoad2(l->b, l->i32, field, ""), ""), field);
+    LLVMBuildBr(l->b, done);
+
+    LLVMPositionBuilderAtEnd(l->b, done);
+} /* lower_cut() */
+
+/**
+ * Emits EXP at the builder's position: a match goes on from where the builder is left, with the
+ * offset after the match in l->pos, and a failure branches to FAIL.  CUT is the flag a cut in EXP
+ * sets, or null if nothing around EXP can still be committed.
+ */
+static void lower_exp(lower_t *l, const rule_exp_t *exp, LLVMValueRef cut, LLVMBasicBlockRef fail)
+{
+    LLVMBasicBlockRef alt_fail, done;
+    LLVMValueRef pos, mark, inner_cut, args[6];
+    int i, len;
+
+    switch (exp->type)
+    {
+    case RULE_EXP_SEQ:
+        lower_exp(l, exp->left, cut, fail);
+        lower_exp(l, exp->right, cut, fail);
+        break;
+    case RULE_EXP_DISJ:
+        /* the last alternative runs with the choice already closed */
+        alt_fail = new_block(l, "alt_fail");
+        done = new_block(l, "alt_done");
+        inner_cut = exp_cuts(exp->left) ? new_var(l, l->i1, "cut") : 0;
+        pos = load_pos(l);
+        mark = load_mark(l);
+        open_choice(l, inner_cut);
+
+        lower_exp(l, exp->left, inner_cut, alt_fail);
+        close_choice(l, inner_cut);
+        LLVMBuildBr(l->b, done);
+
+        LLVMPositionBuilderAtEnd(l->b, alt_fail);
+        close_choice(l, inner_cut);
+        truncate_children(l, mark);
+        fail_if_cut(l, inner_cut, fail);
+        store_pos(l, pos);
+        lower_exp(l, exp->right, 0, fail);
+        LLVMBuildBr(l->b, done);
+
+        LLVMPositionBuilderAtEnd(l->b, done);
+        break;
+    case RULE_EXP_STAR:
+        lower_loop(l, exp->left, fail);
+        break;
+    case RULE_EXP_PLUS:
+        /* the first iteration must match, cut or not */
+        alt_fail = new_block(l, "first_fail");
+        inner_cut = exp_cuts(exp->left) ? new_var(l, l->i1, "cut") : 0;
+        open_choice(l, inner_cut);
+
+        lower_exp(l, exp->left, inner_cut, alt_fail);
+        close_choice(l, inner_cut);
+        done = new_block(l, "first_done");
+        LLVMBuildBr(l->b, done);
+
+        LLVMPositionBuilderAtEnd(l->b, alt_fail);
+        close_choice(l, inner_cut);
+        LLVMBuildBr(l->b, fail);
+
+        LLVMPositionBuilderAtEnd(l->b, done);
+        lower_loop(l, exp->left, fail);
+        break;
+    case RULE_EXP_QUES:
+        alt_fail = new_block(l, "opt_fail");
+        done = new_block(l, "opt_done");
+        inner_cut = exp_cuts(exp->left) ? new_var(l, l->i1, "cut") : 0;
+        pos = load_pos(l);
+        mark = load_mark(l);
+        open_choice(l, inner_cut);
+
+        lower_exp(l, exp->left, inner_cut, alt_fail);
+        close_choice(l, inner_cut);
+        LLVMBuildBr(l->b, done);
+
+        LLVMPositionBuilderAtEnd(l->b, alt_fail);
+        close_choice(l, inner_cut);
+        truncate_children(l, mark);
+        store_pos(l, pos);
+        fail_if_cut(l, inner_cut, fail);
+        LLVMBuildBr(l->b, done);
+
+        LLVMPositionBuilderAtEnd(l->b, done);
+        break;
+    case RULE_EXP_BANG:
+        /* what fails inside is hoped to fail, and is not a syntax error */
+        alt_fail = new_block(l, "not_fail");
+        pos = load_pos(l);
+        mark = load_mark(l);
+        open_choice(l, 0);
+        add_to_field(l, RUN_LOOKAHEADS, 1);
+
+        lower_exp(l, exp->left, 0, alt_fail);
+        add_to_field(l, RUN_LOOKAHEADS, -1);
+        close_choice(l, 0);
+        truncate_children(l, mark);
+        store_pos(l, pos);
+        LLVMBuildBr(l->b, fail);
+
+        LLVMPositionBuilderAtEnd(l->b, alt_fail);
+        add_to_field(l, RUN_LOOKAHEADS, -1);
+        close_choice(l, 0);
+        truncate_children(l, mark);
+        store_pos(l, pos);
+        break;
+    case RULE_EXP_AMP:
+        /* the nodes parsed by a positive lookahead are kept, as they are by AMP() */
+        alt_fail = new_block(l, "and_fail");
+        pos = load_pos(l);
+        open_choice(l, 0);
+
+        lower_exp(l, exp->left, 0, alt_fail);
+        close_choice(l, 0);
+        store_pos(l, pos);
+        done = new_block(l, "and_done");
+        LLVMBuildBr(l->b, done);
+
+        LLVMPositionBuilderAtEnd(l->b, alt_fail);
+        close_choice(l, 0);
+        LLVMBuildBr(l->b, fail);
+
+        LLVMPositionBuilderAtEnd(l->b, done);
+        break;
+    case RULE_EXP_HIDE:
+        mark = load_mark(l);
+        lower_exp(l, exp->left, cut, fail);
+        truncate_children(l, mark);
+        break;
+    case RULE_EXP_CALL:
+        i = find_rule(l->rule_records, exp->data.str);
+        args[0] = l->run;
+        args[1] = l->buf;
+        args[2] = l->len;
+        args[3] = load_pos(l);
+        args[4] = l->end_tmp;
+        args[5] = l->node_tmp;
+        fail_unless(l, LLVMBuildICmp(l->b, LLVMIntNE, LLVMBuildCall2(l->b, l->rule_type, l->rules[i], args, 6, ""), const_i32(l, 0), ""), fail);
+
+        args[1] = LLVMBuildLoad2(l->b, LLVMGetElementType(l->nodepp), l->node_tmp, "child");
+        LLVMBuildCall2(l->b, l->push_type, l->push_fn, args, 2, "");
+        store_pos(l, LLVMBuildLoad2(l->b, l->i32, l->end_tmp, "end"));
+        break;
+    case RULE_EXP_STR:
+        len = (int) wcslen(exp->data.str);
+        pos = load_pos(l);
+        need_bytes(l, pos, len, fail);
+        for (i = 0; i < len; ++i)
+        {
+            LLVMValueRef byte = load_byte(l, LLVMBuildAdd(l->b, pos, const_i32(l, i), ""));
+            LLVMValueRef ch = LLVMConstInt(l->i8, (unsigned int) exp->data.str[i] & 0xff, 0);
+            fail_unless(l, LLVMBuildICmp(l->b, LLVMIntEQ, byte, ch, ""), fail);
+        }
+        store_pos(l, LLVMBuildAdd(l->b, pos, const_i32(l, len), ""));
+        break;
+    case RULE_EXP_DOT:
+        pos = load_pos(l);
+        need_bytes(l, pos, 1, fail);
+        store_pos(l, LLVMBuildAdd(l->b, pos, const_i32(l, 1), ""));
+        break;
+    case RULE_EXP_CLASS:
+        pos = load_pos(l);
+        need_bytes(l, pos, 1, fail);
+        {
+            LLVMValueRef idx[2], member;
+
+            idx[0] = LLVMConstInt(l->i64, 0, 0);
+            idx[1] = LLVMBuildZExt(l->b, load_byte(l, pos), l->i64, "");
+            member = LLVMBuildGEP2(l->b, LLVMArrayType(l->i8, 256), class_table(l, exp->data.str), idx, 2, "");
+            member = LLVMBuildLoad2(l->b, l->i8, member, "member");
+            fail_unless(l, LLVMBuildICmp(l->b, LLVMIntNE, member, LLVMConstInt(l->i8, 0, 0), ""), fail);
+        }
+        store_pos(l, LLVMBuildAdd(l->b, pos, const_i32(l, 1), ""));
+        break;
+    case RULE_EXP_CUT:
+        lower_cut(l, cut);
+        break;
+    }
+} /* lower_exp() */
+
+
+/** Emits the function of left-recursive rule INDEX, shaped like PEG_GROW(): the runtime parses its seed. */
+static void lower_grow(lower_t *l, int index)
+{
+    LLVMValueRef fn = l->rules[index], args[8];
+
+    LLVMPositionBuilderAtEnd(l->b, LLVMAppendBasicBlockInContext(l->ctx, fn, "grow"));
+    args[0] = LLVMGetParam(fn, 0);
+    args[1] = LLVMGetParam(fn, 1);
+    args[2] = LLVMGetParam(fn, 2);
+    args[3] = const_i32(l, index + 1);
+    args[4] = LLVMGetParam(fn, 3);
+    args[5] = LLVMGetParam(fn, 4);
+    args[6] = LLVMGetParam(fn, 5);
+    args[7] = l->seeds[index];
+    LLVMBuildRet(l->b, LLVMBuildCall2(l->b, l->grow_type, l->grow_fn, args, 8, "grow"));
+} /* lower_grow() */
+
+/** Emits the function of rule INDEX, shaped like PEG_PARSE(). */
+static void lower_rule(lower_t *l, int index)
+{
+    const rule_rec_t *rec = *(rule_rec_t **) array_item(l->rule_records, index);
+    LLVMBasicBlockRef entry, start, body, fail;
+    LLVMValueRef start_pos, node, end, mark, res, args[7];
+    int type = index + 1;
+
+    l->fn = l->rules[index];
+    if (rec->left_recursion == RULE_LR_LEADER)
+    {
+        /* the rest is the seed's body, which the grow loop parses without its memo record */
+        lower_grow(l, index);
+        l->fn = l->seeds[index];
+    }
+    l->run = LLVMGetParam(l->fn, 0);
+    l->buf = LLVMGetParam(l->fn, 1);
+    l->len = LLVMGetParam(l->fn, 2);
+    start_pos = LLVMGetParam(l->fn, 3);
+    end = LLVMGetParam(l->fn, 4);
+    node = LLVMGetParam(l->fn, 5);
+
+    /* the scanner matches token rules */
+    if (rec->token)
+    {
+        LLVMPositionBuilderAtEnd(l->b, new_block(l, "token"));
+        args[0] = l->run;
+        args[1] = const_i32(l, type);
+        args[2] = start_pos;
+        args[3] = end;
+        args[4] = node;
+        LLVMBuildRet(l->b, LLVMBuildCall2(l->b, l->enter_type, l->token_fn, args, 5, "token"));
+        return;
+    }
+
+    entry = new_block(l, "entry");
+    start = new_block(l, "start");
+    LLVMPositionBuilderAtEnd(l->alloca_b, entry);
+    l->pos = new_var(l, l->i32, "pos");
+    l->end_tmp = new_var(l, l->i32, "end_tmp");
+    l->node_tmp = new_var(l, LLVMGetElementType(l->nodepp), "node_tmp");
+
+    LLVMPositionBuilderAtEnd(l->b, start);
+    mark = load_mark(l);
+
+    if (rec->memoized && rec->left_recursion != RULE_LR_LEADER)
+    {
+        LLVMBasicBlockRef hit = new_block(l, "memo_hit");
+
+        body = new_block(l, "body");
+        args[0] = l->run;
+        args[1] = const_i32(l, type);
+        args[2] = start_pos;
+        args[3] = end;
+        args[4] = node;
+        res = LLVMBuildCall2(l->b, l->enter_type, l->enter_fn, args, 5, "memo");
+        LLVMBuildCondBr(l->b, LLVMBuildICmp(l->b, LLVMIntSLT, res, const_i32(l, 0), ""), body, hit);
+
+        LLVMPositionBuilderAtEnd(l->b, hit);
+        LLVMBuildRet(l->b, res);
+
+        LLVMPositionBuilderAtEnd(l->b, body);
+    }
+
+    fail = new_block(l, "fail");
+    store_pos(l, start_pos);
+    lower_exp(l, rec->rule_spec, 0, fail);
+
+    res = load_pos(l);
+    LLVMBuildStore(l->b, res, end);
+    args[0] = l->run;
+    args[1] = const_i32(l, type);
+    args[2] = start_pos;
+    args[3] = res;
+    args[4] = mark;
+    args[5] = const_i32(l, 1);
+    args[6] = node;
+    LLVMBuildCall2(l->b, l->leave_type, l->leave_fn, args, 7, "");
+    LLVMBuildRet(l->b, const_i32(l, 1));
+
+    LLVMPositionBuilderAtEnd(l->b, fail);
+    args[3] = start_pos;
+    args[5] = const_i32(l, 0);
+    LLVMBuildCall2(l->b, l->leave_type, l->leave_fn, args, 7, "");
+    LLVMBuildRet(l->b, const_i32(l, 0));
+
+    /* the variables are all in place now */
+    LLVMPositionBuilderAtEnd(l->alloca_b, entry);
+    LLVMBuildBr(l->alloca_b, start);
+} /* lower_rule() */
+
+
+static void lower_init(lower_t *l, LLVMContextRef ctx, const array_t *rule_records)
+{
+    LLVMTypeRef fields[NUM_RUN_FIELDS], params[8];
+    int i, len = array_size(rule_records);
+
+    memset(l, 0, sizeof(*l));
+    l->ctx = ctx;
+    l->mod = LLVMModuleCreateWithNameInContext("pegjit", ctx);
+    l->b = LLVMCreateBuilderInContext(ctx);
+    l->alloca_b = LLVMCreateBuilderInContext(ctx);
+    l->rule_records = rule_records;
+    array_init(&l->classes, sizeof(class_rec_t), 0);
+
+    l->i1 = LLVMInt1TypeInContext(ctx);
+    l->i8 = LLVMInt8TypeInContext(ctx);
+    l->i32 = LLVMInt32TypeInContext(ctx);
+    l->i64 = LLVMInt64TypeInContext(ctx);
+    l->i8p = LLVMPointerType(l->i8, 0);
+    l->i32p = LLVMPointerType(l->i32, 0);
+    l->nodepp = LLVMPointerType(l->i8p, 0);
+
+    /* the head of pegjit_run_t; the rest is only touched by the runtime */
+    for (i = 0; i < NUM_RUN_FIELDS; ++i)
+        fields[i] = l->i32;
+    l->run_type = LLVMStructCreateNamed(ctx, "pegjit_run_t");
+    LLVMStructSetBody(l->run_type, fields, NUM_RUN_FIELDS, 0);
+    l->runp = LLVMPointerType(l->run_type, 0);
+
+    params[0] = l->runp;
+    params[1] = l->i8p;
+    params[2] = l->i32;
+    params[3] = l->i32;
+    params[4] = l->i32p;
+    params[5] = l->nodepp;
+    l->rule_type = LLVMFunctionType(l->i32, params, 6, 0);
+
+    params[1] = l->i32;
+    params[2] = l->i32;
+    params[3] = l->i32p;
+    params[4] = l->nodepp;
+    l->enter_type = LLVMFunctionType(l->i32, params, 5, 0);
+
+    params[1] = l->i8p;
+    params[2] = l->i32;
+    params[3] = l->i32;
+    params[4] = l->i32;
+    params[5] = l->i32p;
+    params[6] = l->nodepp;
+    params[7] = LLVMPointerType(l->rule_type, 0);
+    l->grow_type = LLVMFunctionType(l->i32, params, 8, 0);
+
+    params[1] = l->i32;
+    params[2] = l->i32;
+    params[3] = l->i32;
+    params[4] = l->i32;
+    params[5] = l->i32;
+    params[6] = l->nodepp;
+    l->leave_type = LLVMFunctionType(l->i32, params, 7, 0);
+
+    params[1] = l->i8p;
+    l->push_type = LLVMFunctionType(LLVMVoidTypeInContext(ctx), params, 2, 0);
+
+    params[1] = l->i32;
+    l->truncate_type = LLVMFunctionType(LLVMVoidTypeInContext(ctx), params, 2, 0);
+
+    l->enter_fn = runtime_fn(l, l->enter_type, (void (*)(void)) pegjit_rt_enter);
+    l->grow_fn = runtime_fn(l, l->grow_type, (void (*)(void)) pegjit_rt_grow);
+    l->leave_fn = runtime_fn(l, l->leave_type, (void (*)(void)) pegjit_rt_leave);
+    l->push_fn = runtime_fn(l, l->push_type, (void (*)(void)) pegjit_rt_push);
+    l->truncate_fn = runtime_fn(l, l->truncate_type, (void (*)(void)) pegjit_rt_truncate);
+    l->token_fn = runtime_fn(l, l->enter_type, (void (*)(void)) pegjit_rt_token);
+
+    /* only the start rule is called from outside, so the others can be inlined and dropped */
+    l->rules = (LLVMValueRef *) calloc(len, sizeof(LLVMValueRef));
+    l->seeds = (LLVMValueRef *) calloc(len, sizeof(LLVMValueRef));
+    for (i = 0; i < len; ++i)
+    {
+        l->rules[i] = LLVMAddFunction(l->mod, i ? "rule" : START_SYMBOL, l->rule_type);
+        if (i)
+            LLVMSetLinkage(l->rules[i], LLVMInternalLinkage);
+
+        if ((*(rule_rec_t **) array_item(rule_records, i))->left_recursion == RULE_LR_LEADER)
+        {
+            l->seeds[i] = LLVMAddFunction(l->mod, "seed", l->rule_type);
+            LLVMSetLinkage(l->seeds[i], LLVMInternalLinkage);
+        }
+    }
+} /* lower_init() */
+
+
+static void lower_deinit(lower_t *l)
+{
+    LLVMDisposeBuilder(l->b);
+    LLVMDisposeBuilder(l->alloca_b);
+    array_deinit(&l->classes);
+    free(l->rules);
+    free(l->seeds);
+} /* lower_deinit() */
+
+
+static void optimise_module(LLVMModuleRef mod, int opt_level)
+{
+    LLVMPassManagerBuilderRef pmb = LLVMPassManagerBuilderCreate();
+    LLVMPassManagerRef fpm = LLVMCreateFunctionPassManagerForModule(mod);
+    LLVMPassManagerRef mpm = LLVMCreatePassManager();
+    LLVMValueRef fn;
+
+    LLVMPassManagerBuilderSetOptLevel(pmb, (unsigned int) opt_level);
+    if (opt_level > 1)
+        LLVMPassManagerBuilderUseInlinerWithThreshold(pmb, opt_level > 2 ? 275 : 225);
+    LLVMPassManagerBuilderPopulateFunctionPassManager(pmb, fpm);
+    LLVMPassManagerBuilderPopulateModulePassManager(pmb, mpm);
+
+    LLVMInitializeFunctionPassManager(fpm);
+    for (fn = LLVMGetFirstFunction(mod); fn; fn = LLVMGetNextFunction(fn))
+        LLVMRunFunctionPassManager(fpm, fn);
+    LLVMFinalizeFunctionPassManager(fpm);
+    LLVMRunPassManager(mpm, mod);
+
+    LLVMDisposePassManager(fpm);
+    LLVMDisposePassManager(mpm);
+    LLVMPassManagerBuilderDispose(pmb);
+} /* optimise_module() */
+
+
+static void set_message(wchar_t **error, const char *what, const char *msg)
+{
+    size_t len;
+
+    if (!error)
+        return;
+
+    len = strlen(what) + strlen(msg) + 8;
+    *error = (wchar_t *) calloc(len, sizeof(wchar_t));
+    swprintf(*error, len, L"%hs: %hs", what, msg);
+} /* set_message() */
+
+/* consumes ERR */
+static void set_llvm_error(wchar_t **error, const char *what, LLVMErrorRef err)
+{
+    char *msg = LLVMGetErrorMessage(err);
+
+    set_message(error, what, msg);
+    LLVMDisposeErrorMessage(msg);
+} /* set_llvm_error() */
+
+
+int pegjit_compile(pegjit_grammar_t *grammar, array_t *rule_records, const pegjit_options_t *options, wchar_t **error)
+{
+    LLVMOrcLLJITRef jit;
+    LLVMOrcThreadSafeContextRef tsc;
+    LLVMOrcThreadSafeModuleRef tsm;
+    LLVMOrcJITTargetAddress addr;
+    LLVMErrorRef err;
+    lower_t l;
+    char *msg = 0;
+    int i;
+
+    LLVMInitializeNativeTarget();
+    LLVMInitializeNativeAsmPrinter();
+
+    if ((err = LLVMOrcCreateLLJIT(&jit, 0)))
+    {
+        set_llvm_error(error, "unable to create the JIT", err);
+        return 0;
+    }
+
+    tsc = LLVMOrcCreateNewThreadSafeContext();
+    lower_init(&l, LLVMOrcThreadSafeContextGetContext(tsc), rule_records);
+    LLVMSetTarget(l.mod, LLVMOrcLLJITGetTripleString(jit));
+    LLVMSetDataLayout(l.mod, LLVMOrcLLJITGetDataLayoutStr(jit));
+
+    for (i = 0; i < array_size(rule_records); ++i)
+        lower_rule(&l, i);
+    lower_deinit(&l);
+
+    if (LLVMVerifyModule(l.mod, LLVMReturnStatusAction, &msg))
+    {
+        set_message(error, "the lowered grammar is broken", msg);
+        LLVMDisposeMessage(msg);
+        LLVMDisposeModule(l.mod);
+        LLVMOrcDisposeThreadSafeContext(tsc);
+        LLVMOrcDisposeLLJIT(jit);
+        return 0;
+    }
+    LLVMDisposeMessage(msg);
+
+    if (options->opt_level > 0)
+        optimise_module(l.mod, options->opt_level);
+    if (options->dump_ir)
+    {
+        msg = LLVMPrintModuleToString(l.mod);
+        fputs(msg, stderr);
+        LLVMDisposeMessage(msg);
+    }
+
+    /* the module keeps the context alive */
+    tsm = LLVMOrcCreateNewThreadSafeModule(l.mod, tsc);
+    LLVMOrcDisposeThreadSafeContext(tsc);
+
+    if ((err = LLVMOrcLLJITAddLLVMIRModule(jit, LLVMOrcLLJITGetMainJITDylib(jit), tsm)))
+    {
+        LLVMOrcDisposeThreadSafeModule(tsm);
+        LLVMOrcDisposeLLJIT(jit);
+        set_llvm_error(error, "unable to add the lowered grammar", err);
+        return 0;
+    }
+
+    if ((err = LLVMOrcLLJITLookup(jit, &addr, START_SYMBOL)))
+    {
+        LLVMOrcDisposeLLJIT(jit);
+        set_llvm_error(error, "unable to compile the grammar", err);
+        return 0;
+    }
+
+    grammar->start = (pegjit_rule_ft) (uintptr_t) addr;
+    grammar->jit = jit;
+    return 1;
+} /* pegjit_compile() */
+
+
+void pegjit_release(void *jit)
+{
+    LLVMErrorRef err = LLVMOrcDisposeLLJIT((LLVMOrcLLJITRef) jit);
+
+    if (err)
+        LLVMConsumeError(err);
+} /* pegjit_release() */
@@ -0,0 +1,1050 @@
+
+/*
+ * Copyright (c) 2006, The Narwhal Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    * Neither the name of the Narwhal Project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/** \file pegjit.c
+ *
+ * Loading grammars at runtime, and everything a compiled grammar calls while it parses: the
+ * syntax tree, the child stack, the memo table, the error list and the input.
+ */
+
+#include "pegjit_internal.h"
+#include "parsergen.h"
+#include "peg_parser.h"
+#include "internal.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#define MEMO_INITIAL_CAP 1024
+#define CHILDREN_INITIAL_CAP 64
+
+/** \name Syntax Node Functions */
+/*@{*/
+
+pegjit_syntax_node_t *pegjit_syntax_node_create(int type, int begin, int end, void *ib)
+{
+    pegjit_syntax_node_t *res = (pegjit_syntax_node_t *) calloc(1, sizeof(pegjit_syntax_node_t));
+    res->type  = type;
+    res->begin = begin;
+    res->end   = end;
+    res->first_line = -1;
+    res->last_line  = -1;
+    res->refs = 1;
+    res->ib = ib;
+    return res;
+} /* pegjit_syntax_node_create() */
+
+static pegjit_syntax_node_t *syntax_node_copy_one(pegjit_syntax_node_t *node)
+{
+    pegjit_syntax_node_t *copy = pegjit_syntax_node_create(node->type, node->begin, node->end, node->ib);
+
+    copy->first_line = node->first_line;
+    copy->last_line = node->last_line;
+    return copy;
+} /* syntax_node_copy_one() */
+
+pegjit_syntax_node_t *pegjit_syntax_node_copy(pegjit_syntax_node_t *node)
+{
+    pegjit_syntax_node_t *copy = 0, *src, *dest, **slot;
+    void **work;
+    int i, len, num = 0, cap = 64;
+
+    if (!node)
+        return 0;
+
+    /* pairs of (original, where its copy goes) */
+    work = (void **) malloc(cap * sizeof(void *));
+    work[num++] = node;
+    work[num++] = &copy;
+
+    while (num)
+    {
+        slot = (pegjit_syntax_node_t **) work[--num];
+        src = (pegjit_syntax_node_t *) work[--num];
+        *slot = dest = syntax_node_copy_one(src);
+
+        len = src->children;
+        dest->children = len;
+        if (!len)
+            continue;
+
+        dest->child = (pegjit_syntax_node_t **) calloc(len + 1, sizeof(pegjit_syntax_node_t *));
+        if (num + 2 * len > cap)
+        {
+            while (num + 2 * len > cap)
+                cap *= 2;
+            work = (void **) realloc(work, cap * sizeof(void *));
+        }
+
+        for (i = len - 1; i >= 0; --i)
+        {
+            work[num++] = src->child[i];
+            work[num++] = &dest->child[i];
+        }
+    }
+
+    free(work);
+    return copy;
+} /* pegjit_syntax_node_copy() */
+
+void pegjit_syntax_node_destroy(pegjit_syntax_node_t *node)
+{
+    pegjit_syntax_node_t **cur, **work;
+    int num = 0, cap = 64;
+
+    assert(node);
+
+    if (--node->refs > 0)
+        return;
+
+    /* nodes whose last reference has gone, but whose children have not been released yet */
+    work = (pegjit_syntax_node_t **) malloc(cap * sizeof(pegjit_syntax_node_t *));
+    work[num++] = node;
+
+    while (num)
+    {
+        node = work[--num];
+
+        if (node->child)
+        {
+            if (num + node->children > cap)
+            {
+                while (num + node->children > cap)
+                    cap *= 2;
+                work = (pegjit_syntax_node_t **) realloc(work, cap * sizeof(pegjit_syntax_node_t *));
+            }
+
+            for (cur = node->child + node->children - 1; cur >= node->child; --cur)
+                if (--(*cur)->refs == 0)
+                    work[num++] = *cur;
+
+            free(node->child);
+        }
+
+        free(node);
+    }
+
+    free(work);
+} /* pegjit_syntax_node_destroy() */
+
+int pegjit_syntax_node_children(pegjit_syntax_node_t *node)
+{
+    return node->children;
+}
+
+pegjit_syntax_node_t *pegjit_syntax_node_child(pegjit_syntax_node_t *node, int idx)
+{
+    return idx >= 0 && idx < node->children ? node->child[idx] : 0;
+}
+
+typedef struct _traverse_frame_t
+{
+    pegjit_syntax_node_t *node;
+    pegjit_syntax_node_t **next;  /* next child to visit; null or pointing at null when done */
+}
+traverse_frame_t;
+
+void pegjit_syntax_node_traverse_preorder(pegjit_syntax_node_t *root, void *data, pegjit_syntax_node_process_ft entry_func, pegjit_syntax_node_process_ft exit_func)
+{
+    traverse_frame_t *stack, *top;
+    int num = 0, cap = 64;
+
+    if (!root)
+        return;
+    if (entry_func != NULL && entry_func(root, data))
+        return;
+
+    /* the path from the root to the current node */
+    stack = (traverse_frame_t *) malloc(cap * sizeof(traverse_frame_t));
+    stack[num].node = root;
+    stack[num++].next = root->child;
+
+    while (num)
+    {
+        top = stack + num - 1;
+
+        if (top->next && *top->next)
+        {
+            pegjit_syntax_node_t *child = *top->next++;
+
+            if (entry_func != NULL && entry_func(child, data))
+                continue;
+
+            if (num == cap)
+                stack = (traverse_frame_t *) realloc(stack, (cap *= 2) * sizeof(traverse_frame_t));
+            stack[num].node = child;
+            stack[num++].next = child->child;
+        }
+        else
+        {
+            --num;
+            if (exit_func != NULL)
+                exit_func(top->node, data);
+        }
+    }
+
+    free(stack);
+} /* pegjit_syntax_node_traverse_preorder() */
+
+/*@}*/
+
+/** \name Input Functions */
+/*@{*/
+
+static pegjit_input_t *input_create(const char *name, const char *data, int len, int owned)
+{
+    pegjit_input_t *input = (pegjit_input_t *) calloc(1, sizeof(pegjit_input_t));
+
+    input->name = strdup(name);
+    input->data = data;
+    input->len = len;
+    input->owned = owned;
+    array_init(&input->line_ends, sizeof(int), 0);
+    return input;
+} /* input_create() */
+
+/** Reads FNAME whole; returns null if it cannot be read. */
+static pegjit_input_t *input_read(const char *fname)
+{
+    FILE *f;
+    char *data = 0;
+    long len = 0, cap = 0;
+    size_t got;
+
+    if (!(f = fopen(fname, "r")))
+        return 0;
+
+    /* text mode may shrink the file as it reads, so read until it runs out */
+    do
+    {
+        if (len == cap)
+            data = (char *) realloc(data, (cap = cap ? cap * 2 : 65536) + 1);
+        got = fread(data + len, 1, cap - len, f);
+        len += (long) got;
+    }
+    while (got);
+
+    fclose(f);
+    return input_create(fname, data, (int) len, 1);
+} /* input_read() */
+
+void pegjit_destroy_input_buffer(void *ib)
+{
+    pegjit_input_t *input = (pegjit_input_t *) ib;
+
+    if (!input)
+        return;
+
+    if (input->owned)
+        free((char *) input->data);
+    free(input->name);
+    array_deinit(&input->line_ends);
+    free(input);
+} /* pegjit_destroy_input_buffer() */
+
+/* a line ends after \n, \r, or \r\n */
+static int input_line(pegjit_input_t *input, int pos)
+{
+    const int *ends;
+    int lo = 0, hi, scan = input->line_scan_pos;
+
+    for (; scan <= pos && scan < input->len; ++scan)
+    {
+        char ch = input->data[scan];
+
+        if (ch != '\n' && ch != '\r')
+            continue;
+
+        if (ch == '\r' && scan + 1 < input->len && input->data[scan + 1] == '\n')
+            ++scan;
+        hi = scan + 1;
+        array_add(&input->line_ends, &hi);
+    }
+    input->line_scan_pos = scan;
+
+    ends = (const int *) input->line_ends.data;
+    hi = array_size(&input->line_ends);
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+
+        if (ends[mid] <= pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo + 1;
+} /* input_line() */
+
+int pegjit_syntax_node_first_line(pegjit_syntax_node_t *node)
+{
+    if (node->first_line < 0)
+        node->first_line = input_line((pegjit_input_t *) node->ib, node->begin);
+
+    return node->first_line;
+}
+
+int pegjit_syntax_node_last_line(pegjit_syntax_node_t *node)
+{
+    if (node->last_line < 0)
+        node->last_line = input_line((pegjit_input_t *) node->ib, node->begin < node->end ? node->end - 1 : node->begin);
+
+    return node->last_line;
+}
+
+wchar_t *pegjit_get_wstr(pegjit_syntax_node_t *node)
+{
+    pegjit_input_t *input = (pegjit_input_t *) node->ib;
+    int i, len = node->end - node->begin;
+    wchar_t *res = (wchar_t *) calloc(len + 1, sizeof(wchar_t));
+
+    for (i = 0; i < len; ++i)
+        res[i] = (unsigned char) input->data[node->begin + i];
+    return res;
+}
+
+char *pegjit_get_str(pegjit_syntax_node_t *node)
+{
+    pegjit_input_t *input = (pegjit_input_t *) node->ib;
+    int len = node->end - node->begin;
+    char *res = (char *) malloc(len + 1);
+
+    memcpy(res, input->data + node->begin, len);
+    res[len] = 0;
+    return res;
+}
+
+/*@}*/
+
+/** \name Error Functions */
+/*@{*/
+
+static pegjit_errors_t *errors_create(const pegjit_grammar_t *grammar)
+{
+    pegjit_errors_t *errs = (pegjit_errors_t *) calloc(1, sizeof(pegjit_errors_t));
+
+    errs->fail_pos = -1;
+    errs->expected_len = (grammar->num_types + 7) / 8;
+    errs->expected = (unsigned char *) calloc(errs->expected_len, 1);
+    errs->rule_names = (const wchar_t *const *) grammar->descs;
+    errs->num_types = grammar->num_types;
+    array_init(&errs->errors, sizeof(pegjit_error_rec_t), 0);
+    return errs;
+} /* errors_create() */
+
+void pegjit_destroy_error_list(void *error_list)
+{
+    pegjit_errors_t *errs = (pegjit_errors_t *) error_list;
+    int i;
+
+    if (!errs)
+        return;
+
+    for (i = 0; i < array_size(&errs->errors); ++i)
+        free(((pegjit_error_rec_t *) array_item(&errs->errors, i))->str);
+    array_deinit(&errs->errors);
+    free(errs->expected);
+    free(errs);
+} /* pegjit_destroy_error_list() */
+
+void pegjit_add_error(void *error_list, int pos, wchar_t *str)
+{
+    pegjit_error_rec_t er;
+
+    er.pos = pos;
+    er.str = wcsdup(str);
+    array_add(&((pegjit_errors_t *) error_list)->errors, &er);
+} /* pegjit_add_error() */
+
+static void record_failure(pegjit_run_t *run, int type, int pos)
+{
+    pegjit_errors_t *errs = run->errs;
+
+    if (pos < errs->fail_pos || run->lookaheads)
+        return;
+
+    if (pos > errs->fail_pos)
+    {
+        errs->fail_pos = pos;
+        memset(errs->expected, 0, errs->expected_len);
+    }
+
+    errs->expected[type >> 3] |= (unsigned char) (1 << (type & 7));
+} /* record_failure() */
+
+/* builds "syntax error: expected A, B or C" from the rules that failed at the farthest offset */
+static wchar_t *format_failure(const pegjit_errors_t *errs)
+{
+    const wchar_t **names = (const wchar_t **) malloc(errs->num_types * sizeof(wchar_t *));
+    wchar_t *str;
+    size_t len = 32;
+    int type, i, num = 0;
+
+    for (type = 1; type < errs->num_types; ++type)
+    {
+        if (!((errs->expected[type >> 3] >> (type & 7)) & 1))
+            continue;
+
+        /* rules can share a description; name each one once */
+        for (i = 0; i < num && wcscmp(names[i], errs->rule_names[type]); ++i)
+            ;
+        if (i == num)
+        {
+            names[num++] = errs->rule_names[type];
+            len += wcslen(errs->rule_names[type]) + 4;
+        }
+    }
+
+    str = (wchar_t *) calloc(len, sizeof(wchar_t));
+    wcscpy(str, L"syntax error: expected ");
+    for (i = 0; i < num; ++i)
+    {
+        if (i)
+            wcscat(str, i == num - 1 ? L" or " : L", ");
+        wcscat(str, names[i]);
+    }
+
+    free(names);
+    return str;
+} /* format_failure() */
+
+static void format_errors(pegjit_errors_t *errs)
+{
+    pegjit_error_rec_t er;
+
+    if (errs->formatted || errs->fail_pos < 0)
+        return;
+
+    er.pos = errs->fail_pos;
+    er.str = format_failure(errs);
+    array_add(&errs->errors, &er);
+    errs->formatted = 1;
+} /* format_errors() */
+
+int pegjit_num_errors(void *error_list)
+{
+    format_errors((pegjit_errors_t *) error_list);
+    return array_size(&((pegjit_errors_t *) error_list)->errors);
+}
+
+pegjit_error_rec_t *pegjit_get_error(void *error_list, int index)
+{
+    format_errors((pegjit_errors_t *) error_list);
+    return (pegjit_error_rec_t *) array_item(&((pegjit_errors_t *) error_list)->errors, index);
+}
+
+/*@}*/
+
+/** \name Runtime Functions
+ * What the compiled rules call around the matching they do inline.
+ */
+/*@{*/
+
+static pegjit_memo_t *memo_find(pegjit_run_t *run, int type, int pos)
+{
+    unsigned int mask = run->memo_cap - 1;
+    unsigned int i = ((unsigned int) pos * 0x9e3779b1u ^ (unsigned int) type * 0x85ebca77u) & mask;
+
+    while (run->memo[i].type && (run->memo[i].type != type || run->memo[i].pos != pos))
+        i = (i + 1) & mask;
+
+    return &run->memo[i];
+} /* memo_find() */
+
+/* drops the records before the commit offset, which nothing will look up again */
+static void memo_rehash(pegjit_run_t *run, int new_cap)
+{
+    pegjit_memo_t *old = run->memo;
+    int i, old_cap = run->memo_cap;
+
+    run->memo_cap = new_cap;
+    run->memo = (pegjit_memo_t *) calloc(run->memo_cap, sizeof(pegjit_memo_t));
+
+    for (i = 0; i < old_cap; ++i)
+    {
+        if (!old[i].type)
+            continue;
+
+        if (old[i].pos < run->commit_pos)
+        {
+            if (old[i].node)
+                pegjit_syntax_node_destroy(old[i].node);
+            run->memo_used--;
+        }
+        else
+        {
+            *memo_find(run, old[i].type, old[i].pos) = old[i];
+        }
+    }
+
+    run->evict_pos = run->commit_pos;
+    free(old);
+
+    /* the scanner will not run behind the commit offset either */
+    if ((i = (run->commit_pos - run->scanned_base) >> 3) > 0)
+    {
+        if (i < run->scanned_len)
+        {
+            memmove(run->scanned, run->scanned + i, run->scanned_len - i);
+            memset(run->scanned + run->scanned_len - i, 0, i);
+        }
+        else if (run->scanned)
+        {
+            memset(run->scanned, 0, run->scanned_len);
+        }
+        run->scanned_base += i * 8;
+    }
+} /* memo_rehash() */
+
+static void memoize(pegjit_run_t *run, int type, int pos, int end, pegjit_syntax_node_t *node)
+{
+    pegjit_memo_t *m;
+
+    /* keep the table at most half full, evicting committed records before growing */
+    if (2 * (run->memo_used + 1) > run->memo_cap)
+    {
+        if (run->commit_pos > run->evict_pos)
+            memo_rehash(run, run->memo_cap);
+        if (run->memo_used * 4 > run->memo_cap)
+            memo_rehash(run, run->memo_cap * 2);
+    }
+
+    m = memo_find(run, type, pos);
+    if (m->type)
+        return;
+
+    m->type = type;
+    m->pos = pos;
+    m->end = end;
+    m->pass = 0;
+    m->node = node;
+    if (node)
+        node->refs++;
+    run->memo_used++;
+} /* memoize() */
+
+/** Looks up a memoized rule: returns 1 or 0 for a remembered match or failure, -1 if it must be parsed. */
+int pegjit_rt_enter(pegjit_run_t *run, int type, int pos, int *end, pegjit_syntax_node_t **node)
+{
+    pegjit_memo_t *m = memo_find(run, type, pos);
+
+    if (!m->type)
+        return -1;
+
+    if (!m->node)
+    {
+        record_failure(run, type, pos);
+        *node = 0;
+        return 0;
+    }
+
+    m->node->refs++;
+    *node = m->node;
+    *end = m->end;
+    return 1;
+} /* pegjit_rt_enter() */
+
+/* the pass that a seed of TYPE grown at POS now holds for: the current one of the innermost rule of its cycle growing there, or 0 for any */
+static int grow_pass(const pegjit_run_t *run, int type, int pos)
+{
+    const int *head = run->grammar->grow_head;
+    const pegjit_grow_t *frame;
+
+    for (frame = run->growing; frame; frame = frame->outer)
+    {
+        if (frame->pos == pos && head[frame->type] == head[type])
+            return frame->pass;
+    }
+
+    return 0;
+} /* grow_pass() */
+
+/**
+ * Matches a left-recursive rule, as PEG_GROW() does.  SEED is the rule's body, parsed again on
+ * each new seed in the rule's memo record until a pass matches no further than the one before.
+ * Another rule of the cycle growing at POS makes the seed good for its current pass only.
+ */
+int pegjit_rt_grow(pegjit_run_t *run, const char *buf, int len, int type, int pos, int *end, pegjit_syntax_node_t **node, pegjit_rule_ft seed)
+{
+    pegjit_syntax_node_t *grown;
+    pegjit_memo_t *m = memo_find(run, type, pos);
+    pegjit_grow_t frame;
+    int grown_end, res;
+
+    /* a seed grown for an earlier pass is grown again */
+    if (m->type && m->pass > 0 && m->pass != grow_pass(run, type, pos))
+    {
+        if (m->node)
+            pegjit_syntax_node_destroy(m->node);
+        m->end = pos;
+        m->node = 0;
+        m->pass = -1;
+    }
+    else if ((res = pegjit_rt_enter(run, type, pos, end, node)) >= 0)
+    {
+        return res;
+    }
+    else
+    {
+        /* the seed starts as a failure, so only the alternatives that do not call back match */
+        memoize(run, type, pos, pos, 0);
+        memo_find(run, type, pos)->pass = -1;
+    }
+
+    frame.type = type;
+    frame.pos = pos;
+    frame.pass = ++run->passes;
+    frame.outer = run->growing;
+    run->growing = &frame;
+
+    /* every pass starts at POS, so no cut may commit beyond it until the last */
+    run->open_choices++;
+    while (seed(run, buf, len, pos, &grown_end, &grown))
+    {
+        m = memo_find(run, type, pos);
+        if (m->node && grown_end <= m->end)
+        {
+            pegjit_syntax_node_destroy(grown);
+            break;
+        }
+
+        /* the record takes over the reference to the longer match */
+        if (m->node)
+            pegjit_syntax_node_destroy(m->node);
+        m->end = grown_end;
+        m->node = grown;
+        frame.pass = ++run->passes;
+    }
+    run->open_choices--;
+    run->growing = frame.outer;
+
+    m = memo_find(run, type, pos);
+    m->pass = grow_pass(run, type, pos);
+    *node = m->node;
+    if (!m->node)
+        return 0;
+
+    m->node->refs++;
+    *end = m->end;
+    return 1;
+} /* pegjit_rt_grow() */
+
+/** Finishes a rule: builds its node from the children above MARK, or records its failure. */
+int pegjit_rt_leave(pegjit_run_t *run, int type, int start, int end, int mark, int ok, pegjit_syntax_node_t **node)
+{
+    const pegjit_grammar_t *grammar = run->grammar;
+    pegjit_syntax_node_t *res = 0;
+
+    if (ok)
+    {
+        int len = run->num_children - mark;
+
+        res = pegjit_syntax_node_create(type, start, end, run->input);
+        res->children = len;
+        if (len)
+        {
+            res->child = (pegjit_syntax_node_t **) malloc((len + 1) * sizeof(pegjit_syntax_node_t *));
+            memcpy(res->child, run->children + mark, len * sizeof(pegjit_syntax_node_t *));
+            res->child[len] = 0;
+        }
+        run->num_children = mark;
+
+        if (grammar->dispatch[type] != NULL)
+            grammar->dispatch[type](res, grammar->dispatch_data[type]);
+    }
+    else
+    {
+        pegjit_rt_truncate(run, mark);
+        record_failure(run, type, start);
+    }
+
+    if (grammar->memoized[type])
+        memoize(run, type, start, ok ? end : start, res);
+
+    *node = res;
+    return ok;
+} /* pegjit_rt_leave() */
+
+void pegjit_rt_push(pegjit_run_t *run, pegjit_syntax_node_t *node)
+{
+    if (run->num_children == run->children_cap)
+    {
+        run->children_cap *= 2;
+        run->children = (pegjit_syntax_node_t **) realloc(run->children, run->children_cap * sizeof(pegjit_syntax_node_t *));
+    }
+
+    run->children[run->num_children++] = node;
+} /* pegjit_rt_push() */
+
+/** Backtracks the child stack to MARK, releasing the subtrees above it. */
+void pegjit_rt_truncate(pegjit_run_t *run, int mark)
+{
+    while (run->num_children > mark)
+        pegjit_syntax_node_destroy(run->children[--run->num_children]);
+} /* pegjit_rt_truncate() */
+
+static int scanned(pegjit_run_t *run, int pos)
+{
+    int bit = pos - run->scanned_base;
+
+    return bit >= 0 && bit < run->scanned_len * 8 && (run->scanned[bit >> 3] >> (bit & 7)) & 1;
+} /* scanned() */
+
+static void set_scanned(pegjit_run_t *run, int pos)
+{
+    int bit = pos - run->scanned_base, len;
+
+    assert(bit >= 0);
+
+    if (bit >= run->scanned_len * 8)
+    {
+        for (len = run->scanned_len ? run->scanned_len * 2 : 256; bit >= len * 8; len *= 2)
+            ;
+        run->scanned = (unsigned char *) realloc(run->scanned, len);
+        memset(run->scanned + run->scanned_len, 0, len - run->scanned_len);
+        run->scanned_len = len;
+    }
+
+    run->scanned[bit >> 3] |= (unsigned char) (1 << (bit & 7));
+} /* set_scanned() */
+
+/* runs the scanner from POS and memoizes the longest match of each token there, without its node */
+static void scan(pegjit_run_t *run, int pos)
+{
+    const scanner_t *scanner = &run->grammar->scanner;
+    const unsigned char *data = (const unsigned char *) run->input->data;
+    int i, state = 1, start = pos;
+
+    for (i = 0; i < scanner->num_tokens; ++i)
+        run->scan_end[i] = -1;
+
+    while (pos < run->input->len && (state = scanner->next[state * scanner->num_classes + scanner->byte_class[data[pos]]]))
+    {
+        ++pos;
+        for (i = scanner->accept_begin[state]; i < scanner->accept_begin[state + 1]; ++i)
+            run->scan_end[scanner->accepts[i]] = pos;
+    }
+
+    for (i = 0; i < scanner->num_tokens; ++i)
+    {
+        if (run->scan_end[i] >= 0)
+            memoize(run, scanner->token_types[i], start, run->scan_end[i], 0);
+    }
+
+    set_scanned(run, start);
+} /* scan() */
+
+/** Matches a token rule; the first token asked for at an offset scans there, and the rest find their matches memoized. */
+int pegjit_rt_token(pegjit_run_t *run, int type, int pos, int *end, pegjit_syntax_node_t **node)
+{
+    const pegjit_grammar_t *grammar = run->grammar;
+    pegjit_memo_t *m = memo_find(run, type, pos);
+
+    if (!m->type && !scanned(run, pos))
+    {
+        scan(run, pos);
+        m = memo_find(run, type, pos);
+    }
+
+    if (!m->type)
+    {
+        record_failure(run, type, pos);
+        *node = 0;
+        return 0;
+    }
+
+    /* the leaf is built when first asked for */
+    if (!m->node)
+    {
+        m->node = pegjit_syntax_node_create(type, pos, m->end, run->input);
+        if (grammar->dispatch[type] != NULL)
+            grammar->dispatch[type](m->node, grammar->dispatch_data[type]);
+    }
+
+    m->node->refs++;
+    *node = m->node;
+    *end = m->end;
+    return 1;
+} /* pegjit_rt_token() */
+
+/*@}*/
+
+/** \name Grammar Functions */
+/*@{*/
+
+void pegjit_default_options(pegjit_options_t *options)
+{
+    options->optimise = 1;
+    options->opt_level = 2;
+    options->dump_ir = 0;
+} /* pegjit_default_options() */
+
+static void set_error(wchar_t **error, const wchar_t *format, const char *name, int line, const wchar_t *msg)
+{
+    size_t len;
+
+    if (!error)
+        return;
+
+    len = wcslen(format) + strlen(name) + (msg ? wcslen(msg) : 0) + 32;
+    *error = (wchar_t *) calloc(len, sizeof(wchar_t));
+    swprintf(*error, len, format, name, line, msg);
+} /* set_error() */
+
+static pegjit_grammar_t *grammar_create(array_t *rule_records)
+{
+    pegjit_grammar_t *grammar = (pegjit_grammar_t *) calloc(1, sizeof(pegjit_grammar_t));
+    int i, len = array_size(rule_records);
+
+    grammar->num_types = len + 1;
+    grammar->names = (wchar_t **) calloc(len + 1, sizeof(wchar_t *));
+    grammar->descs = (wchar_t **) calloc(len + 1, sizeof(wchar_t *));
+    grammar->memoized = (char *) calloc(len + 1, 1);
+    grammar->grow_head = (int *) calloc(len + 1, sizeof(int));
+    grammar->dispatch = (pegjit_syntax_node_process_ft *) calloc(len + 1, sizeof(pegjit_syntax_node_process_ft));
+    grammar->dispatch_data = (void **) calloc(len + 1, sizeof(void *));
+
+    for (i = 0; i < len; ++i)
+    {
+        rule_rec_t *rec = *(rule_rec_t **) array_item(rule_records, i);
+
+        grammar->names[i + 1] = wcsdup(rec->rule_name);
+        grammar->descs[i + 1] = wcsdup(rec->rule_desc && rec->rule_desc[0] ? rec->rule_desc : rec->rule_name);
+        grammar->memoized[i + 1] = (char) (rec->memoized && rec->left_recursion != RULE_LR_LEADER);
+        grammar->grow_head[i + 1] = rec->left_recursion == RULE_LR_LEADER ? rec->lr_head + 1 : 0;
+    }
+
+    scanner_build(rule_records, &grammar->scanner);
+
+    return grammar;
+} /* grammar_create() */
+
+pegjit_grammar_t *pegjit_load(const char *fname, const pegjit_options_t *options, wchar_t **error)
+{
+    pegjit_options_t defaults;
+    pegjit_grammar_t *grammar = 0;
+    FILE *input_file;
+    input_buffer_t *ib;
+    array_t errors, line_endings, rule_records;
+    optimise_stats_t stats;
+    syntax_node_t *parsed_spec;
+    int i;
+
+    if (!options)
+    {
+        pegjit_default_options(&defaults);
+        options = &defaults;
+    }
+
+    if (!(input_file = fopen(fname, "r")))
+    {
+        set_error(error, L"%hs: error: unable to open the grammar", fname, 0, 0);
+        return 0;
+    }
+
+    /* the same front end as parsergen */
+    ib = input_buffer_create(fname, input_file);
+    array_init(&errors, sizeof(error_rec), 0);
+    array_init(&line_endings, sizeof(int), 0);
+    array_init(&rule_records, sizeof(rule_rec_t *), 0);
+
+    parsed_spec = parse_peg_spec(ib, &errors);
+    input_buffer_find_line_endings(&line_endings, ib, parsed_spec ? parsed_spec->begin : 0);
+
+    if (parsed_spec)
+        get_internal_representation(&parsed_spec, ib, &rule_records, &line_endings, &errors);
+    if (parsed_spec && !array_size(&errors))
+        check_grammar(&rule_records, &errors, 0);
+
+    if (array_size(&errors) || !array_size(&rule_records))
+    {
+        error_rec *rec = array_size(&errors) ? (error_rec *) array_item(&errors, 0) : 0;
+
+        set_error(error, L"%hs:%d: error: %ls", fname, rec ? input_buffer_find_line(rec->pos, &line_endings) : 0,
+                  rec ? rec->str : L"no rules");
+        goto cleanup;
+    }
+
+    if (options->optimise)
+        optimise_rules(&rule_records, &stats);
+    analyse_memoization(&rule_records);
+
+    grammar = grammar_create(&rule_records);
+    if (!pegjit_compile(grammar, &rule_records, options, error))
+    {
+        pegjit_destroy(grammar);
+        grammar = 0;
+    }
+
+cleanup:
+    for (i = 0; i < array_size(&rule_records); ++i)
+        cleanup_rule(*(rule_rec_t **) array_item(&rule_records, i));
+    array_deinit(&rule_records);
+    array_deinit(&line_endings);
+    delete_errors(&errors, 0);
+    array_deinit(&errors);
+    if (parsed_spec)
+        syntax_node_destroy(parsed_spec);
+    input_buffer_destroy(ib);
+    fclose(input_file);
+
+    return grammar;
+} /* pegjit_load() */
+
+void pegjit_destroy(pegjit_grammar_t *grammar)
+{
+    int i;
+
+    if (!grammar)
+        return;
+
+    if (grammar->jit)
+        pegjit_release(grammar->jit);
+
+    for (i = 0; i < grammar->num_types; ++i)
+    {
+        free(grammar->names[i]);
+        free(grammar->descs[i]);
+    }
+    free(grammar->names);
+    free(grammar->descs);
+    free(grammar->memoized);
+    free(grammar->grow_head);
+    scanner_deinit(&grammar->scanner);
+    free(grammar->dispatch);
+    free(grammar->dispatch_data);
+    free(grammar);
+} /* pegjit_destroy() */
+
+int pegjit_num_node_types(const pegjit_grammar_t *grammar)
+{
+    return grammar->num_types;
+}
+
+const wchar_t *pegjit_node_name(const pegjit_grammar_t *grammar, int type)
+{
+    return type > 0 && type < grammar->num_types ? grammar->names[type] : L"NULL";
+}
+
+int pegjit_node_type(const pegjit_grammar_t *grammar, const wchar_t *rule_name)
+{
+    int type;
+
+    for (type = 1; type < grammar->num_types; ++type)
+    {
+        if (wcscmp(grammar->names[type], rule_name) == 0)
+            return type;
+    }
+
+    return 0;
+} /* pegjit_node_type() */
+
+void pegjit_set_dispatch(pegjit_grammar_t *grammar, int type, pegjit_syntax_node_process_ft func, void *data)
+{
+    if (type <= 0 || type >= grammar->num_types)
+        return;
+
+    grammar->dispatch[type] = func;
+    grammar->dispatch_data[type] = data;
+} /* pegjit_set_dispatch() */
+
+/*@}*/
+
+/** \name Parse Functions */
+/*@{*/
+
+static int parse_input(pegjit_grammar_t *grammar, pegjit_input_t *input, pegjit_syntax_node_t **parse_tree, void **error_list)
+{
+    pegjit_run_t run;
+    pegjit_syntax_node_t *root = 0;
+    int i, end;
+
+    memset(&run, 0, sizeof(run));
+    run.grammar = grammar;
+    run.input = input;
+    run.errs = errors_create(grammar);
+    run.children_cap = CHILDREN_INITIAL_CAP;
+    run.children = (pegjit_syntax_node_t **) malloc(run.children_cap * sizeof(pegjit_syntax_node_t *));
+    run.memo_cap = MEMO_INITIAL_CAP;
+    run.memo = (pegjit_memo_t *) calloc(run.memo_cap, sizeof(pegjit_memo_t));
+    run.scan_end = (int *) malloc((grammar->scanner.num_tokens + 1) * sizeof(int));
+
+    grammar->start(&run, input->data, input->len, 0, &end, &root);
+
+    /* the memo table holds a reference to each subtree it remembers */
+    for (i = 0; i < run.memo_cap; ++i)
+    {
+        if (run.memo[i].node)
+            pegjit_syntax_node_destroy(run.memo[i].node);
+    }
+    free(run.memo);
+    free(run.children);
+    free(run.scan_end);
+    free(run.scanned);
+
+    /* how far a successful parse looked ahead is not an error */
+    if (root)
+        run.errs->fail_pos = -1;
+
+    *parse_tree = root;
+    *error_list = run.errs;
+    return root != 0;
+} /* parse_input() */
+
+int pegjit_parse(pegjit_grammar_t *grammar, char *fname, pegjit_syntax_node_t **parse_tree, void **input_buffer, void **error_list)
+{
+    pegjit_input_t *input;
+
+    *parse_tree = 0;
+    *input_buffer = 0;
+    *error_list = 0;
+    if (!(input = input_read(fname)))
+        return 0;
+
+    *input_buffer = input;
+    return parse_input(grammar, input, parse_tree, error_list);
+} /* pegjit_parse() */
+
+int pegjit_parse_mem(pegjit_grammar_t *grammar, const char *data, size_t len, pegjit_syntax_node_t **parse_tree, void **input_buffer, void **error_list)
+{
+    pegjit_input_t *input = input_create("<memory>", data, (int) len, 0);
+
+    *input_buffer = input;
+    return parse_input(grammar, input, parse_tree, error_list);
+} /* pegjit_parse_mem() */
+
+/*@}*/
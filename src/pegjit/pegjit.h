@@ -0,0 +1,137 @@
+#ifndef PEGJIT_H
+#define PEGJIT_H
+
+/*
+ * Copyright (c) 2006, The Narwhal Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    * Neither the name of the Narwhal Project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** \file pegjit.h
+ *
+ * Loads a .peg grammar at runtime and compiles its rules to native code with LLVM, so that a
+ * program can parse with a grammar it was not built with.  The trees, traversal and error
+ * functions are those of a parser generated by parsergen, with the prefix pegjit; node types
+ * are numbered as parsergen numbers them, from 1 for the first rule, and the names come from
+ * the grammar instead of an enum.
+ */
+
+#include <stddef.h>
+#include <wchar.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* nodes in the abstract syntax tree */
+
+typedef struct _pegjit_syntax_node_t
+{
+    int type;                  /* type of node; the rule's index in the grammar, plus one        */
+    int begin;                 /* input position before the first character of the match  */
+    int end;                   /* input position after the last character of the match    */
+    int first_line;            /* line on which the match begins; -1 until asked for      */
+    int last_line;             /* line on which the match ends; -1 until asked for        */
+    int children;              /* number of children */
+    int refs;                  /* reference count; memoized subtrees are shared, not copied */
+    struct _pegjit_syntax_node_t **child; /* null-terminated array of child nodes */
+    void *data;
+    void *ib;                  /* input buffer the node was parsed from */
+}
+pegjit_syntax_node_t;
+
+extern pegjit_syntax_node_t *pegjit_syntax_node_create(int type, int begin, int end, void *ib);
+extern pegjit_syntax_node_t *pegjit_syntax_node_copy(pegjit_syntax_node_t *node);
+extern void pegjit_syntax_node_destroy(pegjit_syntax_node_t *node); /* releases one reference; frees the tree when none remain */
+extern int pegjit_syntax_node_children(pegjit_syntax_node_t *node);
+extern pegjit_syntax_node_t *pegjit_syntax_node_child(pegjit_syntax_node_t *node, int idx);
+extern int pegjit_syntax_node_first_line(pegjit_syntax_node_t *node); /* the input must not have been destroyed */
+extern int pegjit_syntax_node_last_line(pegjit_syntax_node_t *node);
+
+typedef int (*pegjit_syntax_node_process_ft)(pegjit_syntax_node_t *node, void *data);
+
+#define PEGJIT_SKIP_SUBTREE 1 /* returned by an entry_func to skip the node's children and its exit_func */
+
+extern void pegjit_syntax_node_traverse_preorder(pegjit_syntax_node_t *root, void *data, pegjit_syntax_node_process_ft entry_func, pegjit_syntax_node_process_ft exit_func); /* walks with an explicit stack, so any depth of tree is safe */
+
+/* error handling */
+
+typedef struct _pegjit_error_rec_t
+{
+    int pos;
+    wchar_t *str;
+}
+pegjit_error_rec_t;
+
+extern void pegjit_destroy_error_list(void *error_list);
+extern void pegjit_add_error(void *error_list, int pos, wchar_t *str);
+extern int pegjit_num_errors(void *error_list);
+extern pegjit_error_rec_t *pegjit_get_error(void *error_list, int index);
+
+/* input buffers */
+
+extern wchar_t *pegjit_get_wstr(pegjit_syntax_node_t *node);
+extern char *pegjit_get_str(pegjit_syntax_node_t *node);
+extern void pegjit_destroy_input_buffer(void *ib);
+
+/* grammars */
+
+typedef struct _pegjit_grammar_t pegjit_grammar_t;
+
+/** Options for pegjit_load(). */
+typedef struct _pegjit_options_t
+{
+    int optimise;              /* rewrite the rules as parsergen does unless -O0 is given */
+    int opt_level;             /* LLVM optimisation level, 0 to 3 */
+    int dump_ir;               /* prints the LLVM module to stderr before it is compiled */
+}
+pegjit_options_t;
+
+extern void pegjit_default_options(pegjit_options_t *options);
+
+/** Loads and compiles the grammar in FNAME; on failure returns null and, if ERROR is given, a message to free. */
+extern pegjit_grammar_t *pegjit_load(const char *fname, const pegjit_options_t *options, wchar_t **error);
+extern void pegjit_destroy(pegjit_grammar_t *grammar); /* trees parsed with the grammar stay valid */
+
+extern int pegjit_num_node_types(const pegjit_grammar_t *grammar); /* one more than the number of rules */
+extern const wchar_t *pegjit_node_name(const pegjit_grammar_t *grammar, int type); /* the rule's name */
+extern int pegjit_node_type(const pegjit_grammar_t *grammar, const wchar_t *rule_name); /* 0 if there is no such rule */
+
+/** Calls FUNC with DATA on each node of type TYPE as it is built; null stops calling it. */
+extern void pegjit_set_dispatch(pegjit_grammar_t *grammar, int type, pegjit_syntax_node_process_ft func, void *data);
+
+/* parsing; a grammar can be used by several threads at once if its dispatch table is left alone */
+
+extern int pegjit_parse(pegjit_grammar_t *grammar, char *fname, pegjit_syntax_node_t **parse_tree, void **input_buffer, void **error_list);
+extern int pegjit_parse_mem(pegjit_grammar_t *grammar, const char *data, size_t len, pegjit_syntax_node_t **parse_tree, void **input_buffer, void **error_list); /* parses the caller's buffer in place; it must outlive the input buffer */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef PEGJIT_INTERNAL_H
+#define PEGJIT_INTERNAL_H
+
+
+/*
+ * Copyright (c) 2006, The Narwhal Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *    * Neither the name of the Narwhal Project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/** \file pegjit_internal.h
+ *
+ * What the loader, the runtime and the compiled rules share.
+ */
+
+#include "pegjit.h"
+#include "narwhal_utils.h"
+#include "internal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /** Input held whole in memory, as the compiled rules read it. */
+    typedef struct _pegjit_input_t
+    {
+        char *name;
+        const char *data;
+        int len;
+        int owned;              /* data was read by the loader and is freed with the input */
+        array_t line_ends;      /* int: offset after each line ending, found as lines are asked for */
+        int line_scan_pos;
+    }
+    pegjit_input_t;
+
+    /** An error list, as the generated parsers keep one. */
+    typedef struct _pegjit_errors_t
+    {
+        int fail_pos;           /* farthest offset at which a rule failed; -1 if none has */
+        unsigned char *expected; /* the rules that failed at fail_pos, one bit per node type */
+        int expected_len;
+        const wchar_t *const *rule_names; /* what each rule is called in syntax errors */
+        int num_types;
+        int formatted;          /* set once the failure has been added to errors */
+        array_t errors;         /* pegjit_error_rec_t */
+    }
+    pegjit_errors_t;
+
+    /** A memoized result; type 0 marks an empty slot. */
+    typedef struct _pegjit_memo_t
+    {
+        int type, pos, end;
+        int pass;               /* for a seed: -1 while it grows, else the pass it is good for, or 0 for any */
+        pegjit_syntax_node_t *node; /* null for a failure */
+    }
+    pegjit_memo_t;
+
+    /** A left-recursive rule growing its seed, on the stack of pegjit_rt_grow(). */
+    typedef struct _pegjit_grow_t
+    {
+        int type, pos;
+        int pass;               /* numbers the current pass among all those of the parse */
+        struct _pegjit_grow_t *outer;
+    }
+    pegjit_grow_t;
+
+    /**
+     * The state of one parse.  The compiled rules read and write the first four fields in place, so
+     * they must stay first and stay ints.
+     */
+    typedef struct _pegjit_run_t
+    {
+        int num_children;       /* nodes on the child stack */
+        int lookaheads;         /* negative lookaheads being parsed, whose failures are expected */
+        int open_choices;       /* choice points that can still backtrack */
+        int commit_pos;         /* nothing before this offset will be parsed again */
+
+        pegjit_syntax_node_t **children; /* the subtrees of the rules being parsed, innermost last */
+        int children_cap;
+
+        pegjit_memo_t *memo;    /* open addressing on (type, pos) */
+        int memo_cap, memo_used;
+        int evict_pos;          /* records before this offset have been evicted */
+        pegjit_grow_t *growing; /* the seeds being grown, innermost first */
+        int passes;             /* seed-growing passes begun so far */
+
+        const pegjit_grammar_t *grammar;
+        pegjit_input_t *input;
+        pegjit_errors_t *errs;
+        int *scan_end;          /* per token: where the scanner last matched it */
+        unsigned char *scanned; /* a bit per offset from scanned_base, set where the scanner has run */
+        int scanned_base, scanned_len; /* scanned_base is a multiple of 8, scanned_len counts bytes */
+    }
+    pegjit_run_t;
+
+    /** A compiled rule: parses at POS of BUF, which holds LEN bytes. */
+    typedef int (*pegjit_rule_ft)(pegjit_run_t *run, const char *buf, int len, int pos, int *end, pegjit_syntax_node_t **node);
+
+    struct _pegjit_grammar_t
+    {
+        int num_types;          /* rules plus one; type 0 is no node */
+        wchar_t **names;        /* per type: the rule's name */
+        wchar_t **descs;        /* per type: what syntax errors call the rule */
+        char *memoized;         /* per type: whether the rule's results are memoized */
+        int *grow_head;         /* per type: for a left-recursive rule, the type of the head of its cycle */
+        scanner_t scanner;      /* the DFA for the token rules */
+
+        pegjit_syntax_node_process_ft *dispatch;
+        void **dispatch_data;
+
+        pegjit_rule_ft start;
+        void *jit;              /* the LLVM JIT holding the compiled rules */
+    };
+
+    /*************************************************/
+
+    /* called from the compiled rules */
+
+    int pegjit_rt_enter(pegjit_run_t *run, int type, int pos, int *end, pegjit_syntax_node_t **node);
+
+    int pegjit_rt_grow(pegjit_run_t *run, const char *buf, int len, int type, int pos, int *end, pegjit_syntax_node_t **node, pegjit_rule_ft seed);
+
+    int pegjit_rt_leave(pegjit_run_t *run, int type, int start, int end, int mark, int ok, pegjit_syntax_node_t **node);
+
+    void pegjit_rt_push(pegjit_run_t *run, pegjit_syntax_node_t *node);
+
+    void pegjit_rt_truncate(pegjit_run_t *run, int mark);
+
+    int pegjit_rt_token(pegjit_run_t *run, int type, int pos, int *end, pegjit_syntax_node_t **node);
+
+    /*************************************************/
+
+    /** Compiles the rules into GRAMMAR's start function; on failure returns 0 and sets ERROR. */
+    int pegjit_compile(pegjit_grammar_t *grammar, array_t *rule_records, const pegjit_options_t *options, wchar_t **error);
+
+    void pegjit_release(void *jit);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif